@@ -29,7 +29,10 @@
 #ifndef STM32OTAFLASHER_H
 #define STM32OTAFLASHER_H
 
-extern void                         wifi_connect (char * ssid, char * ssidkey, bool do_disconnect);
+extern void                         wifi_connect (const char * ssid, const char * ssidkey);
 extern void                         wifi_ap (const char * apssid, const char * apssidkey);
+extern void                         wifi_request_connect (void);
+extern void                         wifi_request_ap (void);
+extern String                       wifi_status (void);
 
 #endif // STM32OTAFLASHER_H
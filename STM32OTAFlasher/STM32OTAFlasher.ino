@@ -33,105 +33,220 @@
 #include "http.h"
 #include "stm32flash.h"
 #include "eepromdata.h"
+#include "console.h"
+#include "rfc2217.h"
+#include "arbiter.h"
+#include "conlog.h"
+#include "metrics.h"
+#include "fleet.h"
 
-#define WIFI_STATE_DISCONNECTED   0
+#define WIFI_STATE_DISCONNECTED   0                                         // not started
 #define WIFI_STATE_CONNECTED      1
-#define WIFI_STATE_AP             2
+#define WIFI_STATE_AP             2                                         // AP mode selected by user or button
+#define WIFI_STATE_FAST_CONNECT   3                                         // connecting with cached BSSID and channel
+#define WIFI_STATE_CONNECTING     4                                         // connecting with scan
+#define WIFI_STATE_BACKOFF        5                                         // waiting for next connect attempt
+
+#define WIFI_FAST_CONNECT_MSEC    3000                                      // max. time of connect with cached BSSID and channel, incl. DHCP
+#define WIFI_CONNECT_MSEC         10000                                     // max. time of connect with scan
+#define WIFI_BACKOFF_MIN_MSEC     1000                                      // wait after 1st failed attempt, doubled for each failure
+#define WIFI_BACKOFF_MAX_MSEC     60000
+#define WIFI_AP_FALLBACK_FAILURES 5                                         // start fallback AP after this number of failed attempts
+#define WIFI_REQUEST_DELAY_MSEC   1000                                      // delay of requests from web pages: deliver page first
+
+#define WIFI_REQUEST_NONE         0
+#define WIFI_REQUEST_CONNECT      1
+#define WIFI_REQUEST_AP           2
 
 /*----------------------------------------------------------------------------------------------------------------------------------------
  * global data:
  *----------------------------------------------------------------------------------------------------------------------------------------
  */
 static int                          wifi_state = WIFI_STATE_DISCONNECTED;
+static const char *                 wifi_ssid;
+static const char *                 wifi_ssidkey;
+static unsigned long                wifi_connect_start;                     // begin of connect or link loss
+static unsigned long                wifi_attempt_start;                     // begin of current attempt or backoff
+static unsigned long                wifi_backoff;                           // current backoff time
+static unsigned long                wifi_connect_msec;                      // duration of last connect
+static uint16_t                     wifi_failures;                          // failed attempts since last connect
+static bool                         wifi_fast;                              // last connect used cached BSSID
+static bool                         wifi_fallback_ap;                       // fallback AP active while connecting
+static uint8_t                      wifi_request;                           // pending request of web page
+static unsigned long                wifi_request_time;
 static bool                         serial_swapped = false;
-static WiFiServer                   telnet_server(23);
+static bool                         services_running = false;
+
+static void
+services_start (void)
+{
+    if (! serial_swapped)
+    {
+        Serial.flush ();
+        delay (200);
+        arbiter_uart_begin (arbiter_baud (), ARBITER_DEFAULT_CONFIG);        // switch to 8 bit even parity, swap pins, connect to STM32
+        serial_swapped = true;
+    }
+
+    console_setup ();
+    rfc2217_setup ();
+    http_setup ();
+    conlog_setup ();                                                    // needs LittleFS, mounted by http_setup ()
+    services_running = true;
+}
 
 /*----------------------------------------------------------------------------------------------------------------------------------------
- * telnet_setup () - start telnet server
+ * set IP configuration: static IP if configured, else DHCP
+ * The lease of the last connection is not reused: a static configuration would stop the DHCP client, so the lease would never
+ * be renewed and the server could hand out the address again.
  *----------------------------------------------------------------------------------------------------------------------------------------
  */
 static void
-telnet_setup (void)
+wifi_ip_config (void)
 {
-    telnet_server.begin();
+    if (eeprom_config.static_ip.ip != 0)
+    {
+        WiFi.config(IPAddress(eeprom_config.static_ip.ip), IPAddress(eeprom_config.static_ip.gateway),
+                    IPAddress(eeprom_config.static_ip.netmask), IPAddress(eeprom_config.static_ip.dns));
+    }
+    else
+    {
+        WiFi.config(IPAddress(), IPAddress(), IPAddress());                 // DHCP
+    }
 }
 
 /*----------------------------------------------------------------------------------------------------------------------------------------
- * telnet_loop - telnet server loop
+ * save BSSID and channel of current connection, EEPROM is written only if changed
  *----------------------------------------------------------------------------------------------------------------------------------------
  */
 static void
-telnet_loop (void)
+wifi_save_cache (void)
 {
-    static WiFiClient telnet_client;
-    
-    if (! telnet_client || ! telnet_client.connected())
-    {
-        telnet_client = telnet_server.available();
-    }
+    EEPROM_WIFI_CACHE   cache;
 
-    if (telnet_client && telnet_client.connected())
-    {
-        while (telnet_client.available())
-        {
-            Serial.write (char (telnet_client.read ()));
-        }
+    memset (&cache, 0, sizeof (cache));
+    cache.valid     = 1;
+    memcpy (cache.bssid, WiFi.BSSID(), sizeof (cache.bssid));
+    cache.channel   = WiFi.channel();
 
-        Serial.flush ();
+    eeprom_config.wifi_cache = cache;
+    eeprom_commit ();                                                       // writes flash only if record changed
+}
 
-        while (Serial.available())
-        {
-            telnet_client.write (char (Serial.read()));
-        }
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * start a connect attempt, fast: with cached BSSID and channel, skipping the scan
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+wifi_begin (bool fast)
+{
+    WiFi.disconnect();                                                      // abort previous attempt
+    wifi_ip_config ();
 
-        telnet_client.flush ();
+    if (fast)
+    {
+        WiFi.begin(wifi_ssid, wifi_ssidkey, eeprom_config.wifi_cache.channel, eeprom_config.wifi_cache.bssid);
+        wifi_state = WIFI_STATE_FAST_CONNECT;
     }
-    else      // not connected, flush input queue
+    else
     {
-        while (Serial.available())
-        {
-            Serial.read();
-        }
+        WiFi.begin(wifi_ssid, wifi_ssidkey);
+        wifi_state = WIFI_STATE_CONNECTING;
     }
+
+    wifi_fast           = fast;
+    wifi_attempt_start  = millis ();
 }
 
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * attempt failed: wait with exponential backoff, start fallback AP after WIFI_AP_FALLBACK_FAILURES attempts
+ * The fallback AP runs in AP+STA mode, attempts go on. While the STA scans, the AP may be unreachable.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
 static void
-services_start (void)
+wifi_failed (void)
 {
+    uint16_t    shift;
+
+    metrics_count (METRICS_WIFI_FAILED, 1);
+    wifi_failures++;
+
     if (! serial_swapped)
     {
-        Serial.flush ();
-        delay (200);
-        Serial.end ();                                          // end old serial
-        Serial.begin (115200, SERIAL_8E1);                      // switch to 8 bit even parity, connect to STM32
-        Serial.swap ();                                         // swap UART pins to UART2: GPIO15 is now TX, GPIO13 is now RX
-        serial_swapped = true;
+        Serial.print("WiFi connection to '");
+        Serial.print(wifi_ssid);
+        Serial.println("' not established!");
     }
 
-    telnet_setup ();
-    http_setup ();
+    if (! wifi_fallback_ap && wifi_failures >= WIFI_AP_FALLBACK_FAILURES)
+    {
+        WiFi.mode(WIFI_AP_STA);
+        WiFi.softAP(eeprom_config.ap_ssid, eeprom_config.ap_ssidkey);
+        wifi_fallback_ap = true;
+        services_start ();
+    }
 
+    shift           = wifi_failures - 1 < 6 ? wifi_failures - 1 : 6;
+    wifi_backoff    = WIFI_BACKOFF_MIN_MSEC << shift;
+
+    if (wifi_backoff > WIFI_BACKOFF_MAX_MSEC)
+    {
+        wifi_backoff = WIFI_BACKOFF_MAX_MSEC;
+    }
+
+    wifi_backoff       += random (wifi_backoff / 4);                        // don't let all units of a rack retry at the same time
+    wifi_attempt_start  = millis ();
+    wifi_state          = WIFI_STATE_BACKOFF;
 }
 
 /*----------------------------------------------------------------------------------------------------------------------------------------
- * connect to AP
+ * link is up
  *----------------------------------------------------------------------------------------------------------------------------------------
  */
-void
-wifi_connect (char * ssid, char * ssidkey, bool do_disconnect)
+static void
+wifi_connected (void)
 {
-    int cnt;
-  
-    WiFi.mode(WIFI_STA);
+    wifi_connect_msec = millis () - wifi_connect_start;
+    metrics_observe (METRICS_PHASE_WIFI, wifi_connect_msec);
+    metrics_count (wifi_fast ? METRICS_WIFI_FAST : METRICS_WIFI_SCAN, 1);
+    wifi_save_cache ();
 
-    if (do_disconnect)
+    if (wifi_fallback_ap)
     {
-        WiFi.disconnect();
-        delay(100);
+        WiFi.softAPdisconnect(true);
+        WiFi.mode(WIFI_STA);
+        wifi_fallback_ap = false;
     }
 
-    wifi_state = WIFI_STATE_DISCONNECTED;
-    WiFi.begin(ssid, ssidkey);
+    if (! serial_swapped)
+    {
+        Serial.println("WiFi connection established.");
+        Serial.print("IP address: ");
+        Serial.println(WiFi.localIP());
+    }
+
+    wifi_failures   = 0;
+    wifi_state      = WIFI_STATE_CONNECTED;
+    services_start ();
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * connect to AP, returns at once, see wifi_loop ()
+ * A fast connect with the cached BSSID and channel of the last connection skips the scan, DHCP is still done. If it fails, the
+ * cache is invalidated and a normal connect with scan follows.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+wifi_connect (const char * ssid, const char * ssidkey)
+{
+    wifi_ssid           = ssid;
+    wifi_ssidkey        = ssidkey;
+    wifi_failures       = 0;
+    wifi_fallback_ap    = false;
+    wifi_connect_start  = millis ();
+
+    WiFi.mode(WIFI_STA);
+    WiFi.setAutoReconnect(false);                                           // reconnect is done by wifi_loop ()
 
     if (! serial_swapped)
     {
@@ -140,37 +255,7 @@ wifi_connect (char * ssid, char * ssidkey, bool do_disconnect)
         Serial.println(" ...");
     }
 
-    for (cnt = 0; cnt < 20; cnt++)                                          // check 10 seconds if connected
-    {
-        if (WiFi.status() == WL_CONNECTED)
-        {
-            break;
-        }
-  
-        delay(500);
-    }
-  
-    if (WiFi.status() != WL_CONNECTED)
-    {
-        if (! serial_swapped)
-        {
-            Serial.print("WiFi connection to '");
-            Serial.print(ssid);
-            Serial.println("' not established!");  
-        }
-    }
-    else
-    {
-        if (! serial_swapped)
-        {
-            Serial.println("WiFi connection established.");  
-            Serial.print("IP address: ");
-            Serial.println(WiFi.localIP());
-        }
-
-        services_start ();
-        wifi_state = WIFI_STATE_CONNECTED;
-    }
+    wifi_begin (eeprom_config.wifi_cache.valid);
 }
 
 /*----------------------------------------------------------------------------------------------------------------------------------------
@@ -181,21 +266,18 @@ void
 wifi_ap (const char * apssid, const char * apssidkey)
 {
     WiFi.mode(WIFI_AP);
-  
+
     if (! serial_swapped)
     {
         Serial.println ("disconnecting...");
-        Serial.flush ();
     }
 
     WiFi.disconnect();
-    wifi_state = WIFI_STATE_DISCONNECTED;
-    delay(100);
+    wifi_fallback_ap = false;
 
     if (! serial_swapped)
     {
         Serial.println ("starting ap mode...");
-        Serial.flush ();
     }
 
     WiFi.softAP(apssid, apssidkey);
@@ -203,7 +285,6 @@ wifi_ap (const char * apssid, const char * apssidkey)
     if (! serial_swapped)
     {
         Serial.println ("begin server...");
-        Serial.flush ();
         Serial.print ("AP ");
         Serial.println(apssid);
         Serial.print ("ipaddress ");
@@ -214,6 +295,152 @@ wifi_ap (const char * apssid, const char * apssidkey)
     services_start ();
 }
 
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * requests of web pages: executed after WIFI_REQUEST_DELAY_MSEC, so that the page is delivered before the connection drops
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+wifi_request_connect (void)
+{
+    wifi_request        = WIFI_REQUEST_CONNECT;
+    wifi_request_time   = millis ();
+}
+
+void
+wifi_request_ap (void)
+{
+    wifi_request        = WIFI_REQUEST_AP;
+    wifi_request_time   = millis ();
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * wifi_loop () - connection state machine, never blocks
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+wifi_loop (void)
+{
+    unsigned long   now = millis ();
+    uint8_t         request;
+
+    if (wifi_request != WIFI_REQUEST_NONE && now - wifi_request_time >= WIFI_REQUEST_DELAY_MSEC)
+    {
+        request         = wifi_request;
+        wifi_request    = WIFI_REQUEST_NONE;
+
+        if (request == WIFI_REQUEST_CONNECT)
+        {
+            wifi_connect (eeprom_config.ssid, eeprom_config.ssidkey);
+        }
+        else
+        {
+            wifi_ap (eeprom_config.ap_ssid, eeprom_config.ap_ssidkey);
+        }
+        return;
+    }
+
+    switch (wifi_state)
+    {
+        case WIFI_STATE_FAST_CONNECT:
+        {
+            if (WiFi.status() == WL_CONNECTED)
+            {
+                wifi_connected ();
+            }
+            else if (now - wifi_attempt_start >= WIFI_FAST_CONNECT_MSEC)
+            {
+                metrics_count (METRICS_WIFI_FAST_FAILED, 1);
+                eeprom_config.wifi_cache.valid = 0;                         // not saved, next connect saves new cache
+                wifi_begin (false);
+            }
+            break;
+        }
+        case WIFI_STATE_CONNECTING:
+        {
+            if (WiFi.status() == WL_CONNECTED)
+            {
+                wifi_connected ();
+            }
+            else if (now - wifi_attempt_start >= WIFI_CONNECT_MSEC)
+            {
+                wifi_failed ();
+            }
+            break;
+        }
+        case WIFI_STATE_BACKOFF:
+        {
+            if (now - wifi_attempt_start >= wifi_backoff)
+            {
+                wifi_begin (eeprom_config.wifi_cache.valid);
+            }
+            break;
+        }
+        case WIFI_STATE_CONNECTED:
+        {
+            if (WiFi.status() != WL_CONNECTED)                              // link lost, reconnect at once
+            {
+                metrics_count (METRICS_WIFI_LINK_LOST, 1);
+                wifi_connect_start = now;
+                wifi_begin (eeprom_config.wifi_cache.valid);
+            }
+            break;
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * wifi_status () - connection status as HTML text
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+String
+wifi_status (void)
+{
+    String  status;
+
+    switch (wifi_state)
+    {
+        case WIFI_STATE_CONNECTED:
+        {
+            status = (String) "Connected to " + wifi_ssid + ", IP " + WiFi.localIP().toString() + ", RSSI " + WiFi.RSSI() + " dBm, connect time " +
+                     wifi_connect_msec + " ms" + (wifi_fast ? " (fast)" : "");
+            break;
+        }
+        case WIFI_STATE_AP:
+        {
+            status = (String) "Access point " + WiFi.softAPSSID() + ", IP " + WiFi.softAPIP().toString();
+            break;
+        }
+        case WIFI_STATE_FAST_CONNECT:
+        {
+            status = (String) "Connecting to " + wifi_ssid + " with cached BSSID";
+            break;
+        }
+        case WIFI_STATE_CONNECTING:
+        {
+            status = (String) "Connecting to " + wifi_ssid + ", attempt " + (wifi_failures + 1);
+            break;
+        }
+        case WIFI_STATE_BACKOFF:
+        {
+            status = (String) "Connection to " + wifi_ssid + " failed " + wifi_failures + " times, next attempt in " +
+                     ((wifi_backoff - (millis () - wifi_attempt_start)) / 1000 + 1) + " s";
+            break;
+        }
+        default:
+        {
+            status = "Disconnected";
+            break;
+        }
+    }
+
+    if (wifi_fallback_ap)
+    {
+        status += (String) "<BR>Fallback access point " + WiFi.softAPSSID() + ", IP " + WiFi.softAPIP().toString();
+    }
+
+    return status;
+}
+
 /*----------------------------------------------------------------------------------------------------------------------------------------
  * global setup
  *----------------------------------------------------------------------------------------------------------------------------------------
@@ -224,27 +451,26 @@ setup (void)
     stm32_flash_setup ();
 
     Serial.begin(115200);                                     // use 115200 Baud
-    EEPROM.begin(512);                                        // use 512 bytes as EEPROM
+    EEPROM.begin(EEPROM_SIZE);                                // use 512 bytes as EEPROM
+    WiFi.persistent(false);                                   // credentials are stored in EEPROM, don't write SDK flash sector on each connect
     delay(10);
     Serial.println();
-    delay(500);
     Serial.println ("FIRMWARE 1.0.0");                        // print firmware version
 
     eeprom_read ();
 
 #if 0 // force connect
-    eeprom_flags = 0x00;
-    eeprom_save_flags ();
+    eeprom_config.flags = 0x00;
     eeprom_commit ();
 #endif
 
-    if (eeprom_flags & EEPROM_FLAG_BOOT_AS_AP)
+    if (eeprom_config.flags & EEPROM_FLAG_BOOT_AS_AP)
     {
-        wifi_ap (eeprom_ap_ssid, eeprom_ap_ssidkey);
+        wifi_ap (eeprom_config.ap_ssid, eeprom_config.ap_ssidkey);
     }
     else
     {
-        wifi_connect (eeprom_ssid, eeprom_ssidkey, false);
+        wifi_connect (eeprom_config.ssid, eeprom_config.ssidkey);
     }
 }
 
@@ -255,14 +481,25 @@ setup (void)
 void
 loop() 
 {
-    if (digitalRead(0) == LOW)
+    if (digitalRead(0) == LOW && wifi_state != WIFI_STATE_AP)
     {
         wifi_ap (EEPROM_AP_SSID_CONTENT, EEPROM_AP_SSID_KEY_CONTENT);
     }
 
-    if (wifi_state != WIFI_STATE_DISCONNECTED)
+    wifi_loop ();
+
+    if (services_running)                                                   // go on while reconnecting
     {
         http_loop ();
-        telnet_loop ();
+
+        if (stm32_dump_active ())
+        {
+            stm32_dump_loop ();
+        }
+
+        rfc2217_loop ();
+        console_loop ();                                                    // uses UART only if no other session is active
+        conlog_loop ();
+        fleet_loop ();
     }
 }
@@ -0,0 +1,109 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * arbiter.cpp - ownership of the STM32 UART
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <Arduino.h>
+#include "arbiter.h"
+#include "console.h"
+#include "eepromdata.h"
+
+static uint8_t                      arbiter_current = ARBITER_OWNER_CONSOLE;
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * arbiter_acquire () - start session
+ * Returns false if another session is active
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+bool
+arbiter_acquire (uint8_t owner)
+{
+    if (arbiter_current == owner)
+    {
+        return true;
+    }
+
+    if (arbiter_current != ARBITER_OWNER_CONSOLE)
+    {
+        return false;
+    }
+
+    console_drain ();                                                                   // save pending console output
+    arbiter_current = owner;
+    return true;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * arbiter_release () - end session, UART returns to console
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+arbiter_release (uint8_t owner)
+{
+    if (arbiter_current == owner)
+    {
+        arbiter_current = ARBITER_OWNER_CONSOLE;
+    }
+}
+
+uint8_t
+arbiter_owner (void)
+{
+    return arbiter_current;
+}
+
+const char *
+arbiter_owner_name (void)
+{
+    switch (arbiter_current)
+    {
+        case ARBITER_OWNER_FLASHER: return "flasher";
+        case ARBITER_OWNER_REMOTE:  return "remote serial port";
+        default:                    return "console";
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * arbiter_baud () - configured baud rate of console and flasher
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint32_t
+arbiter_baud (void)
+{
+    return eeprom_config.baud != 0 ? eeprom_config.baud : ARBITER_DEFAULT_BAUD;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * arbiter_uart_begin () - (re)initialize UART, STM32 is connected to the swapped pins
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+arbiter_uart_begin (uint32_t baud, SerialConfig config)
+{
+    Serial.flush ();
+    Serial.end ();
+    Serial.setRxBufferSize (CONSOLE_UART_RX_BUFSIZE);                                   // console bridge reads in bulk
+    Serial.begin (baud, config);
+    Serial.swap ();                                                                     // GPIO15 is now TX, GPIO13 is now RX
+}
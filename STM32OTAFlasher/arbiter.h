@@ -0,0 +1,50 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * arbiter.h - ownership of the STM32 UART
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef ARBITER_H
+#define ARBITER_H
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * The console owns the UART unless a session of the flasher or the remote serial port is active. Sessions are exclusive:
+ * a session can only be started while the console owns the UART. Console output received before a session starts is
+ * saved in the console buffer and sent to the telnet clients afterwards, console input is held back during the session.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define ARBITER_OWNER_CONSOLE       0                                                   // telnet console, default owner
+#define ARBITER_OWNER_FLASHER       1                                                   // STM32 bootloader: flash, verify, read-out
+#define ARBITER_OWNER_REMOTE        2                                                   // RFC 2217 remote serial port
+
+#define ARBITER_DEFAULT_BAUD        115200                                              // UART settings of console and flasher
+#define ARBITER_DEFAULT_CONFIG      SERIAL_8E1
+
+extern bool                         arbiter_acquire (uint8_t owner);
+extern void                         arbiter_release (uint8_t owner);
+extern uint8_t                      arbiter_owner (void);
+extern const char *                 arbiter_owner_name (void);
+extern void                         arbiter_uart_begin (uint32_t baud, SerialConfig config);
+extern uint32_t                     arbiter_baud (void);
+
+#endif // ARBITER_H
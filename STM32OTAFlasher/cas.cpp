@@ -0,0 +1,356 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * cas.cpp - library of images stored as content addressed chunks
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <ESP8266WiFi.h>
+#include <LittleFS.h>
+#include "image.h"
+#include "cas.h"
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * An image is stored as flat binary, split into chunks of IMAGE_CAS_CHUNK_SIZE bytes. Each chunk is saved as IMAGE_CAS_DIR/<id>,
+ * id is the beginning of the SHA-256 of the chunk. The manifest <name>.man lists the chunk ids of an image, see image.h.
+ * Chunks shared by several versions of a firmware are stored only once, empty chunks (all 0xFF) are not stored at all.
+ * Manifests are flashed like any other image file.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define CAS_FLAT_TMP                IMAGE_CAS_DIR "/import.tmp"
+#define CAS_BUFSIZE                 256
+
+static IMAGE_READER                 cas_rd;
+static IMAGE_FLAT                   cas_flat;
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * image data callback for flattening
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+cas_flat_data (void * ctx, uint32_t address, uint8_t * data, uint16_t len)
+{
+    return image_flat_write ((IMAGE_FLAT *) ctx, address, data, len) ? 0 : -1;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * store one chunk of flat binary, computes its id
+ * Returns 1 if chunk was new, 0 if already stored or empty, -1 on error
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+cas_store_chunk (File & flat_fp, uint32_t offset, uint32_t len, br_sha256_context * image_ctx, uint8_t * id)
+{
+    br_sha256_context   ctx;
+    uint8_t             sha256[IMAGE_SHA256_LEN];
+    uint8_t             buf[CAS_BUFSIZE];
+    uint32_t            i;
+    uint32_t            j;
+    uint32_t            n;
+    bool                empty = true;
+
+    br_sha256_init (&ctx);
+    flat_fp.seek (offset);
+
+    for (i = 0; i < len; i += n)
+    {
+        n = len - i < CAS_BUFSIZE ? len - i : CAS_BUFSIZE;
+
+        if (flat_fp.read (buf, n) != n)
+        {
+            return -1;
+        }
+
+        for (j = 0; j < n && empty; j++)
+        {
+            if (buf[j] != 0xFF)
+            {
+                empty = false;
+            }
+        }
+
+        br_sha256_update (&ctx, buf, n);
+        br_sha256_update (image_ctx, buf, n);
+    }
+
+    if (empty)
+    {
+        memset (id, 0, IMAGE_CAS_ID_LEN);
+        return 0;
+    }
+
+    br_sha256_out (&ctx, sha256);
+    memcpy (id, sha256, IMAGE_CAS_ID_LEN);
+
+    String path = image_cas_chunk_path (id);
+
+    if (LittleFS.exists (path))                                                         // deduplicated
+    {
+        return 0;
+    }
+
+    File f = LittleFS.open (path, "w");
+
+    if (! f)
+    {
+        return -1;
+    }
+
+    flat_fp.seek (offset);
+
+    for (i = 0; i < len; i += n)
+    {
+        n = len - i < CAS_BUFSIZE ? len - i : CAS_BUFSIZE;
+
+        if (flat_fp.read (buf, n) != n || f.write (buf, n) != n)
+        {
+            f.close ();
+            LittleFS.remove (path);
+            return -1;
+        }
+
+        yield ();
+    }
+
+    f.close ();
+    return 1;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * cas_store () - store image file in library as <name>.man, the image file itself is left untouched
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+bool
+cas_store (String fname, uint32_t base_address, String & man_fname, String & msg)
+{
+    IMAGE_MANIFEST      man;
+    br_sha256_context   ctx;
+    uint8_t             id[IMAGE_CAS_ID_LEN];
+    uint8_t             format = image_format (fname);
+    uint32_t            offset;
+    uint32_t            len;
+    uint32_t            n_new   = 0;
+    int                 pos;
+    int                 rtc;
+    bool                ok      = true;
+
+    if (format == IMAGE_FORMAT_NONE || (format & IMAGE_FORMAT_MASK) == IMAGE_FORMAT_MANIFEST)
+    {
+        msg = "not an image file";
+        return false;
+    }
+
+    pos         = fname.indexOf ('.');
+    man_fname   = (pos > 0 ? fname.substring (0, pos) : fname) + IMAGE_MANIFEST_SUFFIX;
+
+    if (LittleFS.exists (man_fname))
+    {
+        msg = man_fname + " already exists";
+        return false;
+    }
+
+    if (! image_info_load (fname, &cas_rd.info) ||                                      // need address range for flat binary
+        ((format & IMAGE_FORMAT_MASK) == IMAGE_FORMAT_BIN && cas_rd.info.address_min != base_address))
+    {
+        image_reader_begin (&cas_rd, format, base_address, 0, 0);
+
+        if (image_read_file (fname, &cas_rd) < 0)
+        {
+            msg = cas_rd.errmsg;
+            return false;
+        }
+
+        image_info_save (fname, &cas_rd.info);
+    }
+
+    LittleFS.mkdir (IMAGE_CAS_DIR);
+    image_flat_open (&cas_flat, CAS_FLAT_TMP, cas_rd.info.address_min);
+    image_reader_begin (&cas_rd, format, base_address, cas_flat_data, &cas_flat);
+
+    if (image_read_file (fname, &cas_rd) < 0 || ! image_flat_close (&cas_flat))
+    {
+        msg = (String) "cannot convert image: " + cas_rd.errmsg;
+        LittleFS.remove (CAS_FLAT_TMP);
+        return false;
+    }
+
+    File flat_fp    = LittleFS.open (CAS_FLAT_TMP, "r");
+    File man_fp     = LittleFS.open (man_fname, "w");
+
+    if (! flat_fp || ! man_fp)
+    {
+        msg = "cannot open files";
+        ok = false;
+    }
+    else
+    {
+        memset (&man, 0, sizeof (man));
+        man.magic           = IMAGE_MANIFEST_MAGIC;
+        man.base_address    = cas_rd.info.address_min;
+        man.size            = flat_fp.size ();
+        man.n_chunks        = (man.size + IMAGE_CAS_CHUNK_SIZE - 1) / IMAGE_CAS_CHUNK_SIZE;
+        man_fp.write ((uint8_t *) &man, sizeof (man));                                  // header is rewritten with SHA-256 below
+        br_sha256_init (&ctx);
+
+        for (offset = 0; offset < man.size && ok; offset += len)
+        {
+            len = man.size - offset < IMAGE_CAS_CHUNK_SIZE ? man.size - offset : IMAGE_CAS_CHUNK_SIZE;
+            rtc = cas_store_chunk (flat_fp, offset, len, &ctx, id);
+
+            if (rtc < 0 || man_fp.write (id, IMAGE_CAS_ID_LEN) != IMAGE_CAS_ID_LEN)
+            {
+                msg = "cannot store chunk, filesystem full?";
+                ok = false;
+            }
+            else
+            {
+                n_new += rtc;
+            }
+        }
+
+        br_sha256_out (&ctx, man.sha256);
+        man_fp.seek (0);
+
+        if (ok && man_fp.write ((uint8_t *) &man, sizeof (man)) != sizeof (man))
+        {
+            msg = "cannot write manifest";
+            ok = false;
+        }
+    }
+
+    if (flat_fp)
+    {
+        flat_fp.close ();
+    }
+
+    if (man_fp)
+    {
+        man_fp.close ();
+    }
+
+    LittleFS.remove (CAS_FLAT_TMP);
+
+    if (ok)
+    {
+        msg = (String) "stored " + man_fname + ": " + man.size + " bytes, " + man.n_chunks + " chunks, " + n_new + " new";
+    }
+    else
+    {
+        cas_remove (man_fname);                                                         // remove manifest and new chunks
+    }
+
+    return ok;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * mark chunk ids of manifest fp which are also listed in ids
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+cas_mark_used (File & fp, uint8_t * ids, bool * used, uint32_t n_ids)
+{
+    uint8_t     id[IMAGE_CAS_ID_LEN];
+    uint32_t    i;
+
+    fp.seek (sizeof (IMAGE_MANIFEST));
+
+    while (fp.read (id, IMAGE_CAS_ID_LEN) == IMAGE_CAS_ID_LEN)
+    {
+        for (i = 0; i < n_ids; i++)
+        {
+            if (! used[i] && memcmp (id, ids + i * IMAGE_CAS_ID_LEN, IMAGE_CAS_ID_LEN) == 0)
+            {
+                used[i] = true;
+            }
+        }
+
+        yield ();
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * cas_remove () - remove library image and all chunks no other manifest refers to
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+cas_remove (String man_fname)
+{
+    uint8_t *   ids;
+    bool *      used;
+    uint32_t    n_ids;
+    uint32_t    i;
+
+    File fp = LittleFS.open (man_fname, "r");
+
+    if (! fp)
+    {
+        return;
+    }
+
+    n_ids   = fp.size () > sizeof (IMAGE_MANIFEST) ? (fp.size () - sizeof (IMAGE_MANIFEST)) / IMAGE_CAS_ID_LEN : 0;
+    ids     = (uint8_t *) malloc (n_ids * IMAGE_CAS_ID_LEN + 1);
+    used    = (bool *) calloc (n_ids + 1, sizeof (bool));
+
+    if (ids && used)
+    {
+        fp.seek (sizeof (IMAGE_MANIFEST));
+        n_ids = fp.read (ids, n_ids * IMAGE_CAS_ID_LEN) / IMAGE_CAS_ID_LEN;
+        fp.close ();
+
+        LittleFS.remove (man_fname);
+        image_info_remove (man_fname);
+
+        File dir = LittleFS.open ("/", "r");
+        File entry;
+
+        while ((entry = dir.openNextFile ()))                                           // all other manifests
+        {
+            String name = entry.name ();
+
+            if (! entry.isDirectory () && image_format (name) == IMAGE_FORMAT_MANIFEST)
+            {
+                cas_mark_used (entry, ids, used, n_ids);
+            }
+
+            entry.close ();
+        }
+
+        dir.close ();
+
+        for (i = 0; i < n_ids; i++)
+        {
+            if (! used[i])
+            {
+                LittleFS.remove (image_cas_chunk_path (ids + i * IMAGE_CAS_ID_LEN));   // empty chunks don't exist, no harm
+            }
+        }
+    }
+    else
+    {
+        fp.close ();                                                                    // not enough memory: keep chunks, only remove manifest
+        LittleFS.remove (man_fname);
+        image_info_remove (man_fname);
+    }
+
+    free (ids);
+    free (used);
+}
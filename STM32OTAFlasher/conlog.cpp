@@ -0,0 +1,513 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * conlog.cpp - persistent compressed log of STM32 console output
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "conlog.h"
+#include "hsencoder.h"
+
+CONLOG_STATS                        conlog_stats;
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * current block: collected in RAM, compressed and appended to the newest segment if full or older than CONLOG_FLUSH_MSEC
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint8_t                      conlog_buf[CONLOG_BLOCK_SIZE];
+static uint16_t                     conlog_len;                                         // bytes in conlog_buf
+static uint32_t                     conlog_offset;                                      // log offset of conlog_buf[0]
+static uint32_t                     conlog_uptime;                                      // millis () at arrival of conlog_buf[0]
+static uint8_t                      conlog_comp[CONLOG_BLOCK_SIZE];                     // compressed block
+
+static uint32_t                     conlog_first_seg;                                   // oldest segment, 0: none
+static uint32_t                     conlog_last_seg;                                    // newest segment, 0: none
+static uint32_t                     conlog_start_offset;                                // log offset of 1st byte in oldest segment
+static uint16_t                     conlog_boot_cnt;
+static bool                         conlog_started;
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * state of a read, allocated only while reading
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct
+{
+    HS_DECODER                      hs;
+    uint8_t                         buf[CONLOG_BLOCK_SIZE];                             // decoded block
+    uint16_t                        len;
+} CONLOG_READER;
+
+static String
+conlog_path (uint32_t seg)
+{
+    char    buf[32];
+
+    sprintf (buf, CONLOG_DIR "/%08lu.log", (unsigned long) seg);
+    return (String) buf;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * read and check block header, data must be complete
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static bool
+conlog_read_block (File & f, CONLOG_BLOCK * blk)
+{
+    return f.read ((uint8_t *) blk, sizeof (CONLOG_BLOCK)) == sizeof (CONLOG_BLOCK) &&
+           blk->magic == CONLOG_BLOCK_MAGIC &&
+           blk->raw_len > 0 && blk->raw_len <= CONLOG_BLOCK_SIZE &&
+           blk->data_len > 0 && blk->data_len <= blk->raw_len &&
+           (uint32_t) f.available () >= blk->data_len;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * set conlog_start_offset from 1st block of oldest segment
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+conlog_update_start (void)
+{
+    CONLOG_BLOCK    blk;
+    File            f = LittleFS.open (conlog_path (conlog_first_seg), "r");
+
+    if (f && conlog_read_block (f, &blk))
+    {
+        conlog_start_offset = blk.offset;
+    }
+    else
+    {
+        conlog_start_offset = conlog_offset;
+    }
+
+    f.close ();
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * find end of newest segment: a block truncated by a reset or power loss is cut off
+ * Returns false if the segment contains no valid block.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static bool
+conlog_recover (uint32_t seg)
+{
+    CONLOG_BLOCK    blk;
+    File            f       = LittleFS.open (conlog_path (seg), "r+");
+    uint32_t        valid   = 0;
+    bool            found   = false;
+
+    if (! f)
+    {
+        return false;
+    }
+
+    while (conlog_read_block (f, &blk))
+    {
+        f.seek (blk.data_len, SeekCur);
+        valid           = f.position ();
+        conlog_offset   = blk.offset + blk.raw_len;
+        conlog_boot_cnt = blk.boot;
+        found           = true;
+    }
+
+    if (found && valid < f.size ())
+    {
+        f.truncate (valid);
+    }
+
+    f.close ();
+    return found;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * conlog_setup () - continue existing log, LittleFS must be mounted
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+conlog_setup (void)
+{
+    uint32_t    seg;
+
+    if (conlog_started)
+    {
+        return;
+    }
+
+    LittleFS.mkdir (CONLOG_DIR);
+
+    File dir = LittleFS.open (CONLOG_DIR, "r");
+    File entry;
+
+    while ((entry = dir.openNextFile ()))
+    {
+        seg = strtoul (entry.name (), (char **) 0, 10);
+
+        if (! entry.isDirectory () && seg > 0)
+        {
+            if (conlog_first_seg == 0 || seg < conlog_first_seg)
+            {
+                conlog_first_seg = seg;
+            }
+
+            if (seg > conlog_last_seg)
+            {
+                conlog_last_seg = seg;
+            }
+        }
+
+        entry.close ();
+    }
+
+    dir.close ();
+
+    while (conlog_last_seg > 0 && ! conlog_recover (conlog_last_seg))                  // remove empty or broken segments
+    {
+        LittleFS.remove (conlog_path (conlog_last_seg));
+        conlog_last_seg = conlog_last_seg > conlog_first_seg ? conlog_last_seg - 1 : 0;
+    }
+
+    if (conlog_last_seg == 0)
+    {
+        conlog_first_seg = 0;
+    }
+
+    conlog_update_start ();
+    conlog_boot_cnt++;
+    conlog_started = true;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * conlog_flush () - compress current block and append it to newest segment, start a new segment if full
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+conlog_flush (void)
+{
+    CONLOG_BLOCK        blk;
+    const uint8_t *     data;
+    unsigned long       start;
+    unsigned long       usec;
+    size_t              n;
+    File                f;
+
+    if (conlog_len == 0)
+    {
+        return;
+    }
+
+    start           = micros ();
+    n               = hs_encode (conlog_buf, conlog_len, conlog_comp, conlog_len - 1);   // store raw if not smaller
+    data            = n > 0 ? conlog_comp : conlog_buf;
+
+    blk.magic       = CONLOG_BLOCK_MAGIC;
+    blk.boot        = conlog_boot_cnt;
+    blk.offset      = conlog_offset;
+    blk.uptime      = conlog_uptime;
+    blk.raw_len     = conlog_len;
+    blk.data_len    = n > 0 ? n : conlog_len;
+
+    if (conlog_last_seg == 0)
+    {
+        conlog_first_seg = conlog_last_seg = 1;
+    }
+
+    f = LittleFS.open (conlog_path (conlog_last_seg), "a");
+
+    if (f && f.size () > 0 && f.size () + sizeof (blk) + blk.data_len > CONLOG_SEGMENT_SIZE)
+    {
+        f.close ();
+        conlog_last_seg++;
+        f = LittleFS.open (conlog_path (conlog_last_seg), "a");
+    }
+
+    if (f && f.write ((uint8_t *) &blk, sizeof (blk)) == sizeof (blk) && f.write (data, blk.data_len) == blk.data_len)
+    {
+        conlog_stats.raw_bytes      += blk.raw_len;
+        conlog_stats.stored_bytes   += sizeof (blk) + blk.data_len;
+        conlog_stats.blocks++;
+    }
+    else
+    {
+        conlog_stats.write_errors++;                                                    // block is lost, offsets stay valid
+    }
+
+    f.close ();
+
+    conlog_offset  += conlog_len;
+    conlog_len      = 0;
+
+    if (conlog_last_seg - conlog_first_seg >= CONLOG_MAX_SEGMENTS)
+    {
+        while (conlog_last_seg - conlog_first_seg >= CONLOG_MAX_SEGMENTS)
+        {
+            LittleFS.remove (conlog_path (conlog_first_seg));
+            conlog_first_seg++;
+        }
+
+        conlog_update_start ();
+    }
+
+    usec = micros () - start;
+    conlog_stats.busy_usec += usec;
+
+    if (conlog_stats.max_usec < usec)
+    {
+        conlog_stats.max_usec = usec;
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * conlog_write () - append console output to current block
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+conlog_write (const uint8_t * buf, size_t len)
+{
+    size_t  n;
+
+    if (! conlog_started)
+    {
+        return;
+    }
+
+    while (len > 0)
+    {
+        if (conlog_len == 0)
+        {
+            conlog_uptime = millis ();
+        }
+
+        n = CONLOG_BLOCK_SIZE - conlog_len;
+
+        if (n > len)
+        {
+            n = len;
+        }
+
+        memcpy (conlog_buf + conlog_len, buf, n);
+        conlog_len += n;
+        buf        += n;
+        len        -= n;
+
+        if (conlog_len == CONLOG_BLOCK_SIZE)
+        {
+            conlog_flush ();
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * conlog_loop () - write partial block after CONLOG_FLUSH_MSEC, so slow output is saved in batches
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+conlog_loop (void)
+{
+    if (conlog_len > 0 && millis () - conlog_uptime >= CONLOG_FLUSH_MSEC)
+    {
+        conlog_flush ();
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * log offsets of oldest and next byte, current boot counter
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint32_t
+conlog_start (void)
+{
+    return conlog_start_offset;
+}
+
+uint32_t
+conlog_end (void)
+{
+    return conlog_offset + conlog_len;
+}
+
+uint16_t
+conlog_boot (void)
+{
+    return conlog_boot_cnt;
+}
+
+static int
+conlog_decoder_output (void * ctx, const uint8_t * buf, size_t len)
+{
+    CONLOG_READER * rd = (CONLOG_READER *) ctx;
+
+    if (len > (size_t) (CONLOG_BLOCK_SIZE - rd->len))
+    {
+        return -1;
+    }
+
+    memcpy (rd->buf + rd->len, buf, len);
+    rd->len += len;
+    return 0;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * output part of block at log offset block_offset which lies in [offset, end)
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+conlog_send_slice (const uint8_t * buf, uint32_t block_offset, uint32_t block_len, uint32_t offset, uint32_t end,
+                   IMAGE_OUTPUT_FUNC out_func, void * out_ctx)
+{
+    uint32_t    from    = offset > block_offset ? offset - block_offset : 0;
+    uint32_t    to      = end < block_offset + block_len ? end - block_offset : block_len;
+
+    if (end <= block_offset || from >= to)
+    {
+        return 0;
+    }
+
+    return (out_func) (out_ctx, buf + from, to - from);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * read and decompress block data
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+conlog_decode_block (File & f, CONLOG_BLOCK * blk, CONLOG_READER * rd)
+{
+    uint8_t     buf[128];
+    uint32_t    remaining   = blk->data_len;
+    size_t      n;
+    int         rtc         = 0;
+
+    rd->len = 0;
+
+    if (blk->data_len == blk->raw_len)                                                  // stored uncompressed
+    {
+        rd->len = f.read (rd->buf, blk->raw_len);
+    }
+    else
+    {
+        hs_decoder_init (&rd->hs);
+
+        while (rtc == 0 && remaining > 0)
+        {
+            n = f.read (buf, remaining < sizeof (buf) ? remaining : sizeof (buf));
+
+            if (n == 0)
+            {
+                rtc = -1;
+            }
+            else
+            {
+                rtc = hs_decoder_feed (&rd->hs, buf, n, conlog_decoder_output, rd);
+                remaining -= n;
+            }
+        }
+
+        if (rtc == 0)
+        {
+            rtc = hs_decoder_finish (&rd->hs, conlog_decoder_output, rd);
+        }
+    }
+
+    if (rtc == 0 && rd->len != blk->raw_len)
+    {
+        rtc = -1;
+    }
+
+    return rtc;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * conlog_read () - output decompressed log bytes [offset, offset + len), clipped to [conlog_start (), conlog_end ())
+ * Bytes of lost blocks are skipped. Returns 0 on success, -1 on error.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+int
+conlog_read (uint32_t offset, uint32_t len, IMAGE_OUTPUT_FUNC out_func, void * out_ctx)
+{
+    CONLOG_READER *     rd;
+    CONLOG_BLOCK        blk;
+    uint32_t            end;
+    uint32_t            seg;
+    bool                done    = false;
+    int                 rtc     = 0;
+
+    if (offset < conlog_start ())
+    {
+        offset = conlog_start ();
+    }
+
+    if (offset > conlog_end ())
+    {
+        offset = conlog_end ();
+    }
+
+    if (len > conlog_end () - offset)
+    {
+        len = conlog_end () - offset;
+    }
+
+    end = offset + len;
+
+    if (len > 0 && offset < conlog_offset)                                              // part of it is in LittleFS
+    {
+        rd = new CONLOG_READER;
+
+        for (seg = conlog_first_seg; rtc == 0 && ! done && seg > 0 && seg <= conlog_last_seg; seg++)
+        {
+            File f = LittleFS.open (conlog_path (seg), "r");
+
+            while (rtc == 0 && f && conlog_read_block (f, &blk))
+            {
+                if (blk.offset >= end)
+                {
+                    done = true;
+                    break;
+                }
+
+                if (blk.offset + blk.raw_len <= offset)
+                {
+                    f.seek (blk.data_len, SeekCur);
+                    continue;
+                }
+
+                rtc = conlog_decode_block (f, &blk, rd);
+
+                if (rtc == 0)
+                {
+                    rtc = conlog_send_slice (rd->buf, blk.offset, rd->len, offset, end, out_func, out_ctx);
+                }
+            }
+
+            f.close ();
+        }
+
+        delete rd;
+    }
+
+    if (rtc == 0)
+    {
+        rtc = conlog_send_slice (conlog_buf, conlog_offset, conlog_len, offset, end, out_func, out_ctx);
+    }
+
+    return rtc;
+}
@@ -0,0 +1,80 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * conlog.h - persistent compressed log of STM32 console output
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef CONLOG_H
+#define CONLOG_H
+
+#include "image.h"
+
+#define CONLOG_DIR                  "/log"                                              // segment files <n>.log, n counts up
+#define CONLOG_BLOCK_SIZE           1024                                                // raw bytes per compressed block
+#define CONLOG_SEGMENT_SIZE         32768                                               // max. size of a segment file
+#define CONLOG_MAX_SEGMENTS         8                                                   // oldest segment is removed if exceeded
+#define CONLOG_FLUSH_MSEC           30000                                               // max. age of a partial block in RAM
+#define CONLOG_TAIL_DEFAULT         4096                                                // default length of GET /log
+#define CONLOG_BLOCK_MAGIC          0x4C43                                              // "CL"
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * header of a block in a segment file, followed by data_len bytes: compressed (see hsencoder.h) if data_len < raw_len, else raw.
+ * Offsets count log bytes since creation of the log and continue across reboots.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct __attribute__ ((packed))
+{
+    uint16_t                        magic;                                              // CONLOG_BLOCK_MAGIC
+    uint16_t                        boot;                                               // boot counter, starts with 1
+    uint32_t                        offset;                                             // log offset of 1st byte
+    uint32_t                        uptime;                                             // millis () at arrival of 1st byte
+    uint16_t                        raw_len;
+    uint16_t                        data_len;
+} CONLOG_BLOCK;
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * statistics since boot
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct
+{
+    uint32_t                        raw_bytes;                                          // logged bytes written to LittleFS
+    uint32_t                        stored_bytes;                                       // bytes written incl. block headers
+    uint32_t                        blocks;                                             // written blocks
+    uint32_t                        busy_usec;                                          // time spent compressing and writing
+    uint32_t                        max_usec;                                           // longest block write
+    uint32_t                        write_errors;
+} CONLOG_STATS;
+
+extern CONLOG_STATS                 conlog_stats;
+
+extern void                         conlog_setup (void);
+extern void                         conlog_write (const uint8_t * buf, size_t len);
+extern void                         conlog_loop (void);
+extern void                         conlog_flush (void);
+extern uint32_t                     conlog_start (void);
+extern uint32_t                     conlog_end (void);
+extern uint16_t                     conlog_boot (void);
+extern int                          conlog_read (uint32_t offset, uint32_t len, IMAGE_OUTPUT_FUNC out_func, void * out_ctx);
+
+#endif // CONLOG_H
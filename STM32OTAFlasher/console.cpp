@@ -0,0 +1,386 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * console.cpp - buffered bridge between STM32 UART and telnet clients
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <ESP8266WiFi.h>
+#include <WiFiClient.h>
+#include "console.h"
+#include "arbiter.h"
+#include "conlog.h"
+
+CONSOLE_STATS                       console_stats;
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * clients: all clients get the UART output, only one client (the writer) may send input
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct
+{
+    WiFiClient                      client;
+    uint32_t                        rpos;                                               // next byte of rx_buf to send
+    unsigned long                   time;                                               // arrival of oldest unsent byte
+} CONSOLE_CLIENT;
+
+static WiFiServer                   console_server(CONSOLE_PORT);
+static CONSOLE_CLIENT               console_clients[CONSOLE_MAX_CLIENTS];
+static int                          console_writer = -1;                                // index of writing client, -1: none
+static unsigned long                console_writer_time;                                // last input of writer
+static bool                         console_started;
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * ring buffers, positions count bytes since boot, index = position % size
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint8_t                      rx_buf[CONSOLE_RX_BUFSIZE];                         // UART -> TCP, shared by all clients
+static uint32_t                     rx_wpos;                                            // next byte from UART
+
+static uint8_t                      tx_buf[CONSOLE_TX_BUFSIZE];                         // TCP -> UART
+static uint32_t                     tx_wpos;                                            // next byte from writer
+static uint32_t                     tx_rpos;                                            // next byte to UART
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * console_setup () - start telnet server
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+console_setup (void)
+{
+    if (! console_started)
+    {
+        console_server.begin();
+        console_started = true;
+    }
+}
+
+static bool
+console_connected (CONSOLE_CLIENT * c)
+{
+    return c->client && c->client.connected ();
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * accept new client, drop disconnected clients
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+console_accept (void)
+{
+    CONSOLE_CLIENT *    c;
+    int                 i;
+
+    for (i = 0; i < CONSOLE_MAX_CLIENTS; i++)
+    {
+        c = console_clients + i;
+
+        if (c->client && ! c->client.connected ())
+        {
+            c->client.stop ();
+
+            if (console_writer == i)
+            {
+                console_writer = -1;
+            }
+        }
+    }
+
+    while (console_server.hasClient ())
+    {
+        for (i = 0; i < CONSOLE_MAX_CLIENTS; i++)
+        {
+            if (! console_connected (console_clients + i))
+            {
+                break;
+            }
+        }
+
+        if (i == CONSOLE_MAX_CLIENTS)
+        {
+            console_server.available ().stop ();                                        // too many clients
+            continue;
+        }
+
+        c = console_clients + i;
+        c->client = console_server.available ();
+        c->client.setNoDelay (true);                                                    // segments are coalesced in rx_buf
+        c->rpos = rx_wpos - (rx_wpos < CONSOLE_RX_BUFSIZE ? rx_wpos : CONSOLE_RX_BUFSIZE); // send saved output first
+        c->time = millis ();
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * console_drain () - read UART into rx_buf and the persistent log, bytes not yet sent to slow clients are overwritten
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+console_drain (void)
+{
+    CONSOLE_CLIENT *    c;
+    size_t              n;
+    size_t              idx;
+    int                 i;
+
+    if (Serial.hasOverrun ())
+    {
+        console_stats.uart_overruns++;
+    }
+
+    while ((n = Serial.available ()) > 0)
+    {
+        idx = rx_wpos % CONSOLE_RX_BUFSIZE;
+
+        if (n > CONSOLE_RX_BUFSIZE - idx)                                               // up to end of buffer
+        {
+            n = CONSOLE_RX_BUFSIZE - idx;
+        }
+
+        n = Serial.read ((char *) rx_buf + idx, n);
+        conlog_write (rx_buf + idx, n);
+
+        for (i = 0; i < CONSOLE_MAX_CLIENTS; i++)
+        {
+            c = console_clients + i;
+
+            if (c->rpos == rx_wpos)
+            {
+                c->time = millis ();
+            }
+        }
+
+        rx_wpos += n;
+        console_stats.rx_bytes += n;
+
+        for (i = 0; i < CONSOLE_MAX_CLIENTS; i++)
+        {
+            c = console_clients + i;
+
+            if (console_connected (c) && rx_wpos - c->rpos > CONSOLE_RX_BUFSIZE)
+            {
+                console_stats.rx_dropped += rx_wpos - c->rpos - CONSOLE_RX_BUFSIZE;
+                c->rpos = rx_wpos - CONSOLE_RX_BUFSIZE;
+            }
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * send rx_buf to client without blocking: full segments at once, a partial segment after CONSOLE_COALESCE_MSEC
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+console_tcp_write (CONSOLE_CLIENT * c)
+{
+    size_t      pending;
+    size_t      space;
+    size_t      idx;
+    size_t      n;
+
+    while ((pending = rx_wpos - c->rpos) > 0)
+    {
+        if (pending < CONSOLE_SEGMENT_SIZE && millis () - c->time < CONSOLE_COALESCE_MSEC)
+        {
+            break;
+        }
+
+        idx     = c->rpos % CONSOLE_RX_BUFSIZE;
+        n       = pending < CONSOLE_RX_BUFSIZE - idx ? pending : CONSOLE_RX_BUFSIZE - idx;
+        space   = c->client.availableForWrite ();
+
+        if (n > space)
+        {
+            n = space;
+        }
+
+        if (n == 0)                                                                     // TCP send buffer full, try again later
+        {
+            break;
+        }
+
+        n = c->client.write (rx_buf + idx, n);
+        c->rpos += n;
+        c->time = millis ();
+
+        if (n == 0)
+        {
+            break;
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * read client input: the first client sending input becomes the writer until it disconnects or is idle for
+ * CONSOLE_WRITER_IDLE_MSEC, input of other clients is discarded.
+ * Input of the writer stays in the TCP buffer while tx_buf is full.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+console_tcp_read (int i)
+{
+    CONSOLE_CLIENT *    c = console_clients + i;
+    uint8_t             buf[64];
+    int                 len;
+    size_t              n;
+    size_t              idx;
+    size_t              space;
+
+    if (c->client.available () <= 0)
+    {
+        return;
+    }
+
+    if (console_writer >= 0 && console_writer != i && millis () - console_writer_time >= CONSOLE_WRITER_IDLE_MSEC)
+    {
+        console_writer = -1;
+    }
+
+    if (console_writer < 0)
+    {
+        console_writer = i;
+    }
+
+    if (console_writer != i)
+    {
+        while ((len = c->client.read (buf, sizeof (buf))) > 0)
+        {
+            console_stats.input_rejected += len;
+        }
+        return;
+    }
+
+    console_writer_time = millis ();
+
+    while ((n = c->client.available ()) > 0 && (space = CONSOLE_TX_BUFSIZE - (tx_wpos - tx_rpos)) > 0)
+    {
+        idx = tx_wpos % CONSOLE_TX_BUFSIZE;
+
+        if (n > space)
+        {
+            n = space;
+        }
+
+        if (n > CONSOLE_TX_BUFSIZE - idx)
+        {
+            n = CONSOLE_TX_BUFSIZE - idx;
+        }
+
+        len = c->client.read (tx_buf + idx, n);
+
+        if (len <= 0)
+        {
+            break;
+        }
+
+        tx_wpos += len;
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * write tx_buf to UART without blocking
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+console_uart_write (void)
+{
+    size_t      pending;
+    size_t      idx;
+    size_t      n;
+
+    while ((pending = tx_wpos - tx_rpos) > 0 && (n = Serial.availableForWrite ()) > 0)
+    {
+        idx = tx_rpos % CONSOLE_TX_BUFSIZE;
+
+        if (n > pending)
+        {
+            n = pending;
+        }
+
+        if (n > CONSOLE_TX_BUFSIZE - idx)
+        {
+            n = CONSOLE_TX_BUFSIZE - idx;
+        }
+
+        n = Serial.write (tx_buf + idx, n);
+        tx_rpos += n;
+        console_stats.tx_bytes += n;
+
+        if (n == 0)
+        {
+            break;
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * console_n_clients () - number of connected clients
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+int
+console_n_clients (void)
+{
+    int     n = 0;
+    int     i;
+
+    for (i = 0; i < CONSOLE_MAX_CLIENTS; i++)
+    {
+        if (console_connected (console_clients + i))
+        {
+            n++;
+        }
+    }
+    return n;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * console_loop () - move data between UART and telnet clients
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+console_loop (void)
+{
+    CONSOLE_CLIENT *    c;
+    int                 i;
+
+    console_accept ();
+
+    if (arbiter_owner () == ARBITER_OWNER_CONSOLE)
+    {
+        console_drain ();
+    }
+
+    for (i = 0; i < CONSOLE_MAX_CLIENTS; i++)
+    {
+        c = console_clients + i;
+
+        if (console_connected (c))
+        {
+            console_tcp_write (c);
+            console_tcp_read (i);
+        }
+    }
+
+    if (arbiter_owner () == ARBITER_OWNER_CONSOLE)                                      // input is held back during sessions
+    {
+        console_uart_write ();
+    }
+}
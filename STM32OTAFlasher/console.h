@@ -0,0 +1,59 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * console.h - buffered bridge between STM32 UART and telnet clients
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#define CONSOLE_PORT                23
+#define CONSOLE_MAX_CLIENTS         4                                                   // all get the output, one may write
+#define CONSOLE_WRITER_IDLE_MSEC    10000                                               // writer gives up input after this idle time
+#define CONSOLE_UART_RX_BUFSIZE     2048                                                // UART driver RX buffer, 22 msec at 921600 Bd
+#define CONSOLE_RX_BUFSIZE          4096                                                // UART -> TCP, power of 2, new clients get the saved output
+#define CONSOLE_TX_BUFSIZE          1024                                                // TCP -> UART, power of 2
+#define CONSOLE_SEGMENT_SIZE        1460                                                // send TCP segment as soon as it is full
+#define CONSOLE_COALESCE_MSEC       5                                                   // max. delay of a partial TCP segment
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * statistics since boot
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct
+{
+    uint32_t                        rx_bytes;                                           // UART -> TCP
+    uint32_t                        tx_bytes;                                           // TCP -> UART
+    uint32_t                        rx_dropped;                                         // not sent, client too slow
+    uint32_t                        input_rejected;                                     // input of clients other than the writer
+    uint32_t                        uart_overruns;                                      // UART RX buffer overflows
+} CONSOLE_STATS;
+
+extern CONSOLE_STATS                console_stats;
+
+extern void                         console_setup (void);
+extern void                         console_loop (void);
+extern void                         console_drain (void);
+extern int                          console_n_clients (void);
+
+#endif // CONSOLE_H
@@ -27,239 +27,163 @@
 #include <Arduino.h>
 #include <EEPROM.h>
 #include "eepromdata.h"
+#include "image.h"
 
-#define EEPROM_VERSION_100          "100"                                               // 1.0.0
-#define EEPROM_CURRENT_VERSION      EEPROM_VERSION_100                                  // current eeprom version
+static_assert (sizeof (EEPROM_CONFIG) <= EEPROM_SIZE, "EEPROM_CONFIG too large");
+
+EEPROM_CONFIG                       eeprom_config;
 
 /*----------------------------------------------------------------------------------------------------------------------------------------
- * data stored in EEPROM:
+ * layout of firmware 1.0.x: fields at fixed offsets, validated by magic string and version, only read for migration
  *----------------------------------------------------------------------------------------------------------------------------------------
  */
-#define EEPROM_MAGIC_CONTENT        "3.141593"                                          // exact 8 characters long
-
-#define EEPROM_MAGIC_OFFSET         (0)
-#define EEPROM_VERSION_OFFSET       (EEPROM_MAGIC_OFFSET + EEPROM_MAGIC_LEN)
-#define EEPROM_SSID_OFFSET          (EEPROM_VERSION_OFFSET + EEPROM_VERSION_LEN)
-#define EEPROM_SSID_KEY_OFFSET      (EEPROM_SSID_OFFSET + EEPROM_SSID_LEN)
-#define EEPROM_AP_SSID_OFFSET       (EEPROM_SSID_KEY_OFFSET + EEPROM_SSID_KEY_LEN)
-#define EEPROM_AP_SSID_KEY_OFFSET   (EEPROM_AP_SSID_OFFSET + EEPROM_AP_SSID_LEN)
-#define EEPROM_FLAGS_OFFSET         (EEPROM_AP_SSID_KEY_OFFSET + EEPROM_AP_SSID_KEY_LEN)
+#define EEPROM_V1_MAGIC_CONTENT     "3.141593"                                          // exact 8 characters long
+#define EEPROM_V1_MAGIC_LEN         8
+#define EEPROM_V1_VERSION_LEN       3
+#define EEPROM_V1_WIFI_CACHE_LEN    24                                                  // packed EEPROM_WIFI_CACHE of 1.0.1
+
+#define EEPROM_V1_MAGIC_OFFSET      (0)
+#define EEPROM_V1_VERSION_OFFSET    (EEPROM_V1_MAGIC_OFFSET + EEPROM_V1_MAGIC_LEN)
+#define EEPROM_V1_SSID_OFFSET       (EEPROM_V1_VERSION_OFFSET + EEPROM_V1_VERSION_LEN)
+#define EEPROM_V1_SSID_KEY_OFFSET   (EEPROM_V1_SSID_OFFSET + EEPROM_SSID_LEN)
+#define EEPROM_V1_AP_SSID_OFFSET    (EEPROM_V1_SSID_KEY_OFFSET + EEPROM_SSID_KEY_LEN)
+#define EEPROM_V1_AP_SSID_KEY_OFFSET (EEPROM_V1_AP_SSID_OFFSET + EEPROM_AP_SSID_LEN)
+#define EEPROM_V1_FLAGS_OFFSET      (EEPROM_V1_AP_SSID_KEY_OFFSET + EEPROM_AP_SSID_KEY_LEN)
+#define EEPROM_V1_WIFI_CACHE_OFFSET (EEPROM_V1_FLAGS_OFFSET + 1)                       // 1.0.1 only
+#define EEPROM_V1_STATIC_IP_OFFSET  (EEPROM_V1_WIFI_CACHE_OFFSET + EEPROM_V1_WIFI_CACHE_LEN)
 
 /*----------------------------------------------------------------------------------------------------------------------------------------
- * global data:
+ * CRC32 of stored record, computed with crc32 field = 0
  *----------------------------------------------------------------------------------------------------------------------------------------
  */
-
-static char                         eeprom_magic[EEPROM_MAGIC_LEN + 1];
-static char                         eeprom_version[EEPROM_VERSION_LEN + 1];             // 101 means 1.0.1
-char                                eeprom_ssid[EEPROM_SSID_LEN + 1];
-char                                eeprom_ssidkey[EEPROM_SSID_KEY_LEN + 1];
-char                                eeprom_ap_ssid[EEPROM_AP_SSID_LEN + 1];
-char                                eeprom_ap_ssidkey[EEPROM_AP_SSID_KEY_LEN + 1];
-uint8_t                             eeprom_flags;
-static bool                         eeprom_changed = false;
-
-static void
-eeprom_read_entry (char * target, int offset, int len)
+static uint32_t
+eeprom_crc32 (const uint8_t * data, uint16_t size)
 {
-    int   i;
-
-    for (i = 0; i < len; i++)
-    {
-        target[i] = EEPROM.read(offset + i);
-    }
-}
-
-static uint8_t
-eeprom_read_byte (int offset)
-{
-    uint8_t   value;
-    value = EEPROM.read(offset);
-    return value;
-}
-
-static void
-eeprom_write_entry (char * src, int offset, int len)
-{
-    int   i;
-
-    for (i = 0; i < len; i++)
-    {
-        EEPROM.write(offset + i, src[i]);
-    }
-}
+    uint32_t    zero = 0;
+    uint32_t    crc;
 
-static void
-eeprom_write_byte (uint8_t src, int offset)
-{
-    EEPROM.write(offset, src);
+    crc = image_crc32 (0, data, offsetof (EEPROM_CONFIG, crc32));
+    crc = image_crc32 (crc, (const uint8_t *) &zero, sizeof (zero));
+    return image_crc32 (crc, data + offsetof (EEPROM_CONFIG, baud), size - offsetof (EEPROM_CONFIG, baud));
 }
 
 /*----------------------------------------------------------------------------------------------------------------------------------------
- * save magic - save eeprom magic
- * this function is intentionally static
+ * set default values
  *----------------------------------------------------------------------------------------------------------------------------------------
  */
 static void
-eeprom_save_magic (void)
+eeprom_defaults (void)
 {
-    memcpy (eeprom_magic, EEPROM_MAGIC_CONTENT, EEPROM_MAGIC_LEN);
-    eeprom_write_entry (eeprom_magic, EEPROM_MAGIC_OFFSET, EEPROM_MAGIC_LEN);
-    eeprom_changed = true;
+    memset (&eeprom_config, 0, sizeof (eeprom_config));
+    strcpy (eeprom_config.ap_ssid, EEPROM_AP_SSID_CONTENT);
+    strcpy (eeprom_config.ap_ssidkey, EEPROM_AP_SSID_KEY_CONTENT);
+    eeprom_config.flags = EEPROM_FLAG_BOOT_AS_AP;
 }
 
 /*----------------------------------------------------------------------------------------------------------------------------------------
- * save version
- * this function is intentionally static
+ * migrate layout of firmware 1.0.x, returns false if not found
  *----------------------------------------------------------------------------------------------------------------------------------------
  */
-static void
-eeprom_save_version (void)
+static bool
+eeprom_migrate_v1 (const uint8_t * data)
 {
-    eeprom_write_entry (eeprom_version, EEPROM_VERSION_OFFSET, EEPROM_VERSION_LEN);
-    eeprom_changed = true;
-}
+    char    version[EEPROM_V1_VERSION_LEN + 1];
+    int     n_version;
 
-/*----------------------------------------------------------------------------------------------------------------------------------------
- * save ssid
- *----------------------------------------------------------------------------------------------------------------------------------------
- */
-void
-eeprom_save_ssid (void)
-{
-    eeprom_write_entry (eeprom_ssid, EEPROM_SSID_OFFSET, EEPROM_SSID_LEN);
-    eeprom_changed = true;
-}
+    if (memcmp (data + EEPROM_V1_MAGIC_OFFSET, EEPROM_V1_MAGIC_CONTENT, EEPROM_V1_MAGIC_LEN) != 0)
+    {
+        return false;
+    }
 
-/*----------------------------------------------------------------------------------------------------------------------------------------
- * save ssid key
- *----------------------------------------------------------------------------------------------------------------------------------------
- */
-void
-eeprom_save_ssidkey (void)
-{
-    eeprom_write_entry (eeprom_ssidkey, EEPROM_SSID_KEY_OFFSET, EEPROM_SSID_KEY_LEN);
-    eeprom_changed = true;
-}
+    memcpy (version, data + EEPROM_V1_VERSION_OFFSET, EEPROM_V1_VERSION_LEN);
+    version[EEPROM_V1_VERSION_LEN] = '\0';
+    n_version = atoi (version);
 
-/*----------------------------------------------------------------------------------------------------------------------------------------
- * save AP ssid
- *----------------------------------------------------------------------------------------------------------------------------------------
- */
-void
-eeprom_save_ap_ssid (void)
-{
-    eeprom_write_entry (eeprom_ap_ssid, EEPROM_AP_SSID_OFFSET, EEPROM_AP_SSID_LEN);
-    eeprom_changed = true;
-}
+    if (n_version < 100 || n_version >= 200)                                                            // 1.0.0 to 1.9.9
+    {
+        return false;
+    }
 
-/*----------------------------------------------------------------------------------------------------------------------------------------
- * save AP ssid key
- *----------------------------------------------------------------------------------------------------------------------------------------
- */
-void
-eeprom_save_ap_ssidkey (void)
-{
-    eeprom_write_entry (eeprom_ap_ssidkey, EEPROM_AP_SSID_KEY_OFFSET, EEPROM_AP_SSID_KEY_LEN);
-    eeprom_changed = true;
-}
+    Serial.print ("Migrating EEPROM version ");
+    Serial.println (n_version);
 
-/*----------------------------------------------------------------------------------------------------------------------------------------
- * save flags
- *----------------------------------------------------------------------------------------------------------------------------------------
- */
-void
-eeprom_save_flags (void)
-{
-    eeprom_write_byte (eeprom_flags, EEPROM_FLAGS_OFFSET);
-    eeprom_changed = true;
+    memset (&eeprom_config, 0, sizeof (eeprom_config));
+    memcpy (eeprom_config.ssid, data + EEPROM_V1_SSID_OFFSET, EEPROM_SSID_LEN);
+    memcpy (eeprom_config.ssidkey, data + EEPROM_V1_SSID_KEY_OFFSET, EEPROM_SSID_KEY_LEN);
+    memcpy (eeprom_config.ap_ssid, data + EEPROM_V1_AP_SSID_OFFSET, EEPROM_AP_SSID_LEN);
+    memcpy (eeprom_config.ap_ssidkey, data + EEPROM_V1_AP_SSID_KEY_OFFSET, EEPROM_AP_SSID_KEY_LEN);
+    eeprom_config.flags = data[EEPROM_V1_FLAGS_OFFSET];
+
+    if (n_version >= 101)
+    {
+        memcpy (&eeprom_config.wifi_cache, data + EEPROM_V1_WIFI_CACHE_OFFSET, offsetof (EEPROM_WIFI_CACHE, unused));
+        memcpy (&eeprom_config.static_ip, data + EEPROM_V1_STATIC_IP_OFFSET, sizeof (EEPROM_IP_CONFIG));
+    }
+
+    return true;
 }
 
 /*----------------------------------------------------------------------------------------------------------------------------------------
- * commit EEPROM writes
+ * eeprom_commit () - write record if changed
  *----------------------------------------------------------------------------------------------------------------------------------------
  */
 void
 eeprom_commit (void)
 {
-    if (eeprom_changed)
+    eeprom_config.magic     = EEPROM_CONFIG_MAGIC;
+    eeprom_config.version   = EEPROM_CONFIG_VERSION;
+    eeprom_config.size      = sizeof (EEPROM_CONFIG);
+    eeprom_config.crc32     = eeprom_crc32 ((const uint8_t *) &eeprom_config, sizeof (EEPROM_CONFIG));
+
+    if (memcmp (EEPROM.getConstDataPtr (), &eeprom_config, sizeof (EEPROM_CONFIG)) != 0)
     {
+        memcpy (EEPROM.getDataPtr (), &eeprom_config, sizeof (EEPROM_CONFIG));            // getDataPtr () marks EEPROM as changed
         EEPROM.commit ();
-        eeprom_changed = false;
     }
 }
 
 /*----------------------------------------------------------------------------------------------------------------------------------------
- * write complete EEPROM
- *----------------------------------------------------------------------------------------------------------------------------------------
- */
-static void
-format_eeprom (void)
-{
-    strcpy (eeprom_magic, EEPROM_MAGIC_CONTENT);
-    strcpy (eeprom_version, EEPROM_CURRENT_VERSION);
-    strcpy (eeprom_ssid, "");
-    strcpy (eeprom_ssidkey, "");
-    strcpy (eeprom_ap_ssid, EEPROM_AP_SSID_CONTENT);
-    strcpy (eeprom_ap_ssidkey, EEPROM_AP_SSID_KEY_CONTENT);
-    eeprom_flags = EEPROM_FLAG_BOOT_AS_AP;
-
-    eeprom_save_magic ();
-    eeprom_save_version ();
-    eeprom_save_ssid ();
-    eeprom_save_ssidkey ();
-    eeprom_save_ap_ssid ();
-    eeprom_save_ap_ssidkey ();
-    eeprom_save_flags ();
-    eeprom_commit ();
-}
-
-/*----------------------------------------------------------------------------------------------------------------------------------------
- * read eeprom
+ * eeprom_read () - load record with one block copy, migrate old layout or set defaults if invalid
+ * A record of another size is converted on the next eeprom_commit ().
  *----------------------------------------------------------------------------------------------------------------------------------------
  */
 void
 eeprom_read (void)
 {
-    int n_version;
+    const uint8_t *     data = EEPROM.getConstDataPtr ();
+    EEPROM_CONFIG       hdr;
 
-    eeprom_read_entry (eeprom_magic, EEPROM_MAGIC_OFFSET, EEPROM_MAGIC_LEN);
+    memcpy (&hdr, data, offsetof (EEPROM_CONFIG, baud));
 
-    if (strcmp (eeprom_magic, EEPROM_MAGIC_CONTENT) != 0)
+    if (hdr.magic == EEPROM_CONFIG_MAGIC && hdr.version == EEPROM_CONFIG_VERSION &&
+        hdr.size >= offsetof (EEPROM_CONFIG, baud) && hdr.size <= EEPROM_SIZE &&
+        hdr.crc32 == eeprom_crc32 (data, hdr.size))
     {
-        Serial.println ("Formatting EEPROM...");
-        format_eeprom ();
+        memset (&eeprom_config, 0, sizeof (eeprom_config));                             // fields unknown to older firmware: 0
+        memcpy (&eeprom_config, data, hdr.size < sizeof (eeprom_config) ? hdr.size : sizeof (eeprom_config));
     }
     else
     {
-        eeprom_read_entry (eeprom_version, EEPROM_VERSION_OFFSET, EEPROM_VERSION_LEN);
-
-        n_version = atoi (eeprom_version);
-        Serial.print ("EEPROM version: ");
-        Serial.println (n_version);
-
-        if (n_version >= 100 && n_version < 200)                                                        // 1.0.0 to 1.9.9
+        if (! eeprom_migrate_v1 (data))
         {
-            eeprom_read_entry (eeprom_ssid, EEPROM_SSID_OFFSET, EEPROM_SSID_LEN);
-            eeprom_read_entry (eeprom_ssidkey, EEPROM_SSID_KEY_OFFSET, EEPROM_SSID_KEY_LEN);
-            eeprom_read_entry (eeprom_ap_ssid, EEPROM_AP_SSID_OFFSET, EEPROM_AP_SSID_LEN);
-            eeprom_read_entry (eeprom_ap_ssidkey, EEPROM_AP_SSID_KEY_OFFSET, EEPROM_AP_SSID_KEY_LEN);
-            eeprom_flags = eeprom_read_byte (EEPROM_FLAGS_OFFSET);
+            Serial.println ("Formatting EEPROM...");
+            eeprom_defaults ();
+        }
 
-            Serial.print ("EEPROM ssid: ");
-            Serial.println (eeprom_ssid);
+        eeprom_commit ();
+    }
 
-            Serial.print ("EEPROM ssidkey: ");
-            Serial.println (eeprom_ssidkey);
+    eeprom_config.ssid[EEPROM_SSID_LEN]             = '\0';
+    eeprom_config.ssidkey[EEPROM_SSID_KEY_LEN]      = '\0';
+    eeprom_config.ap_ssid[EEPROM_AP_SSID_LEN]       = '\0';
+    eeprom_config.ap_ssidkey[EEPROM_AP_SSID_KEY_LEN] = '\0';
 
-            Serial.print ("EEPROM AP ssid: ");
-            Serial.println (eeprom_ap_ssid);
+    Serial.print ("EEPROM ssid: ");
+    Serial.println (eeprom_config.ssid);
 
-            Serial.print ("EEPROM AP ssidkey: ");
-            Serial.println (eeprom_ap_ssidkey);
+    Serial.print ("EEPROM AP ssid: ");
+    Serial.println (eeprom_config.ap_ssid);
 
-            Serial.print ("EEPROM flags: ");
-            Serial.println (eeprom_flags);
-        }
-    }
+    Serial.print ("EEPROM flags: ");
+    Serial.println (eeprom_config.flags);
 }
@@ -35,42 +35,117 @@
 #define EEPROM_AP_SSID_KEY_CONTENT  "1234567890"                                        // default AP SSID KEY, min. length is 8!
 
 /*----------------------------------------------------------------------------------------------------------------------------------------
- * Possible flags set in eeprom_flags
+ * Possible flags set in eeprom_config.flags
  *----------------------------------------------------------------------------------------------------------------------------------------
  */
 #define EEPROM_FLAG_BOOT_AS_AP      0x01
 
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * Possible values of eeprom_config.verify and eeprom_config.erase
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define EEPROM_VERIFY_AUTO          0                                                   // GET CHECKSUM if supported, else read back
+#define EEPROM_VERIFY_READBACK      1                                                   // always read back
+
+#define EEPROM_ERASE_AUTO           0                                                   // mass erase, changed pages if incremental
+#define EEPROM_ERASE_PAGES          1                                                   // always erase only changed pages
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * Possible values of eeprom_config.targets[].kind, see target.h
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define EEPROM_TARGET_NONE          0                                                   // not configured, target 0: built-in board
+#define EEPROM_TARGET_UART          1                                                   // swapped hardware UART, optionally via mux
+#define EEPROM_TARGET_SOFT          2                                                   // software serial on rx_pin/tx_pin
+#define EEPROM_TARGET_EMULATED      3                                                   // emulated STM32 for tests, see stm32emu.h
+
 /*----------------------------------------------------------------------------------------------------------------------------------------
  * Lengths of EEPROM values
  *----------------------------------------------------------------------------------------------------------------------------------------
  */
-#define EEPROM_MAGIC_LEN            8
-#define EEPROM_VERSION_LEN          3
+#define EEPROM_SIZE                 512                                                 // size of emulated EEPROM, see EEPROM.begin ()
 #define EEPROM_SSID_LEN             32
 #define EEPROM_SSID_KEY_LEN         64
 #define EEPROM_AP_SSID_LEN          32
 #define EEPROM_AP_SSID_KEY_LEN      64
-#define EEPROM_FLAGS_LEN            1
+#define EEPROM_N_TARGETS            4                                                   // number of target boards
+#define EEPROM_FLEET_URL_LEN        128                                                 // URL of fleet manifest, see fleet.h
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * last successful connection: used for a fast connect without scan, see wifi_connect ()
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct __attribute__ ((packed))
+{
+    uint8_t                         valid;                                              // 0: no cache, normal connect
+    uint8_t                         bssid[6];
+    uint8_t                         channel;
+    uint8_t                         unused[16];                                         // IP lease of 1.0.1, not reused: DHCP
+} EEPROM_WIFI_CACHE;
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * static IP configuration, ip = 0: DHCP
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct
+{
+    uint32_t                        ip;
+    uint32_t                        gateway;
+    uint32_t                        netmask;
+    uint32_t                        dns;
+} EEPROM_IP_CONFIG;
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * target board: UART and GPIOs of RESET and BOOT0
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct
+{
+    uint8_t                         kind;                                               // EEPROM_TARGET_xxx
+    uint8_t                         rx_pin;                                             // EEPROM_TARGET_SOFT: RX GPIO (STM32 TX)
+    uint8_t                         tx_pin;                                             // EEPROM_TARGET_SOFT: TX GPIO (STM32 RX)
+    uint8_t                         reset_pin;
+    uint8_t                         boot0_pin;
+    uint8_t                         mux;                                                // 0: no mux, else mux channel + 1
+} EEPROM_TARGET;
 
 /*----------------------------------------------------------------------------------------------------------------------------------------
- * EEPROM values
+ * configuration record, stored at EEPROM offset 0
+ * New fields must be appended: a smaller record of an older firmware is loaded with the new fields set to 0, so 0 must
+ * always be the default value. Increment EEPROM_CONFIG_VERSION only if the meaning of an existing field changes.
  *----------------------------------------------------------------------------------------------------------------------------------------
  */
-extern char                         eeprom_ssid[EEPROM_SSID_LEN + 1];
-extern char                         eeprom_ssidkey[EEPROM_SSID_KEY_LEN + 1];
-extern char                         eeprom_ap_ssid[EEPROM_AP_SSID_LEN + 1];
-extern char                         eeprom_ap_ssidkey[EEPROM_AP_SSID_KEY_LEN + 1];
-extern uint8_t                      eeprom_flags;
+#define EEPROM_CONFIG_MAGIC         0x47464353                                          // "SCFG"
+#define EEPROM_CONFIG_VERSION       1
+
+typedef struct
+{
+    uint32_t                        magic;                                              // EEPROM_CONFIG_MAGIC
+    uint16_t                        version;                                            // EEPROM_CONFIG_VERSION
+    uint16_t                        size;                                               // size of stored record
+    uint32_t                        crc32;                                              // CRC32 of record, computed with crc32 = 0
+
+    uint32_t                        baud;                                               // UART baud rate, 0: ARBITER_DEFAULT_BAUD
+    EEPROM_IP_CONFIG                static_ip;
+    char                            ssid[EEPROM_SSID_LEN + 1];
+    char                            ssidkey[EEPROM_SSID_KEY_LEN + 1];
+    char                            ap_ssid[EEPROM_AP_SSID_LEN + 1];
+    char                            ap_ssidkey[EEPROM_AP_SSID_KEY_LEN + 1];
+    uint8_t                         flags;                                              // EEPROM_FLAG_xxx
+    uint8_t                         verify;                                             // EEPROM_VERIFY_xxx
+    uint8_t                         erase;                                              // EEPROM_ERASE_xxx
+    EEPROM_WIFI_CACHE               wifi_cache;
+    EEPROM_TARGET                   targets[EEPROM_N_TARGETS];
+    char                            fleet_url[EEPROM_FLEET_URL_LEN + 1];                // empty: fleet update disabled
+    uint16_t                        fleet_interval;                                     // minutes, 0: FLEET_DEFAULT_INTERVAL
+} EEPROM_CONFIG;
+
+extern EEPROM_CONFIG                eeprom_config;
 
 /*----------------------------------------------------------------------------------------------------------------------------------------
  * EEPROM access functions
  *----------------------------------------------------------------------------------------------------------------------------------------
  */
-extern void                         eeprom_save_ssid (void);
-extern void                         eeprom_save_ssidkey (void);
-extern void                         eeprom_save_ap_ssid (void);
-extern void                         eeprom_save_ap_ssidkey (void);
-extern void                         eeprom_save_flags (void);
 extern void                         eeprom_commit (void);
 extern void                         eeprom_read (void);
 
@@ -0,0 +1,779 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * fleet.cpp - pull based fleet update: poll a manifest, download and flash changed images
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <ESP8266WiFi.h>
+#include <LittleFS.h>
+#include "fleet.h"
+#include "httpclient.h"
+#include "http.h"
+#include "eepromdata.h"
+#include "stm32flash.h"
+#include "arbiter.h"
+#include "metrics.h"
+
+#define FLEET_STATE_MAGIC           0x31544C46                                          // "FLT1"
+#define FLEET_BUFSIZE               512                                                 // buffer for hashing of files
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * parsed manifest
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct
+{
+    String                          url;                                                // absolute URL of image
+    String                          fname;                                              // local filename in FLEET_DIR
+    String                          version;
+    uint8_t                         sha256[IMAGE_SHA256_LEN];
+    bool                            sha256_valid;
+    uint32_t                        size;
+    uint32_t                        base_address;
+} FLEET_MANIFEST;
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * download of image: written to FLEET_TMP_FNAME, hashed on the fly
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct
+{
+    File                            fp;
+    br_sha256_context               sha256_ctx;
+    uint32_t                        len;                                                // bytes received
+    bool                            write_failed;
+} FLEET_DOWNLOAD;
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * update: cooperative job, called by fleet_loop ()
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define FLEET_JOB_IDLE              0
+#define FLEET_JOB_DOWNLOAD          1                                                   // image is downloaded in the background
+#define FLEET_JOB_FLASH             2                                                   // image downloaded, waiting for idle UART
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * manifest text, max. FLEET_MANIFEST_MAXLEN bytes
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct
+{
+    char                            text[FLEET_MANIFEST_MAXLEN + 1];
+    uint16_t                        len;
+} FLEET_TEXT;
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * global data:
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint8_t                      fleet_buf[FLEET_BUFSIZE];
+static uint8_t                      fleet_job;                                          // FLEET_JOB_xxx
+static FLEET_MANIFEST               fleet_manifest;                                     // manifest of running update
+static FLEET_DOWNLOAD               fleet_dl;
+static bool                         fleet_requested;                                    // check at next fleet_loop ()
+static unsigned long                fleet_last_check;                                   // millis () of last check
+static unsigned long                fleet_wait = FLEET_FIRST_CHECK_MSEC;                // msec from last check to next check
+static String                       fleet_result;                                       // result of last check
+static File                         fleet_log_fp;
+static uint32_t                     fleet_log_len;
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * parse 64 hex digits
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static bool
+fleet_parse_sha256 (const char * s, uint8_t * sha256)
+{
+    char        hex[3];
+    uint8_t     i;
+
+    if (strlen (s) != 2 * IMAGE_SHA256_LEN)
+    {
+        return false;
+    }
+
+    hex[2] = '\0';
+
+    for (i = 0; i < IMAGE_SHA256_LEN; i++)
+    {
+        hex[0] = s[2 * i];
+        hex[1] = s[2 * i + 1];
+
+        if (! isxdigit (hex[0]) || ! isxdigit (hex[1]))
+        {
+            return false;
+        }
+
+        sha256[i] = strtoul (hex, (char **) 0, 16);
+    }
+    return true;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * resolve image reference of manifest: absolute URL, absolute path on manifest server or path relative to manifest URL
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static String
+fleet_resolve_url (String base_url, String ref)
+{
+    int     pos;
+
+    if (ref.indexOf ("://") >= 0)
+    {
+        return ref;
+    }
+
+    if (ref.startsWith ("/"))
+    {
+        pos = base_url.indexOf ("://");
+        pos = base_url.indexOf ('/', pos < 0 ? 0 : pos + 3);
+        return (pos < 0 ? base_url : base_url.substring (0, pos)) + ref;
+    }
+
+    pos = base_url.lastIndexOf ('/');
+    return base_url.substring (0, pos + 1) + ref;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * local filename of image: last path component of URL, restricted to [A-Za-z0-9._-]. The suffix determines the image format.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static String
+fleet_image_fname (String url)
+{
+    String          name;
+    unsigned int    i;
+    int             pos;
+    char            ch;
+
+    pos = url.indexOf ('?');
+
+    if (pos >= 0)
+    {
+        url = url.substring (0, pos);
+    }
+
+    name = url.substring (url.lastIndexOf ('/') + 1);
+
+    if (name.length () == 0 || name.length () > FLEET_FNAME_LEN || name.charAt (0) == '.')
+    {
+        return "";
+    }
+
+    for (i = 0; i < name.length (); i++)
+    {
+        ch = name.charAt (i);
+
+        if (! ((ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z') || (ch >= '0' && ch <= '9') || ch == '.' || ch == '_' || ch == '-'))
+        {
+            return "";
+        }
+    }
+
+    return (String) FLEET_DIR "/" + name;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * parse manifest text, modifies text
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static bool
+fleet_parse_manifest (char * text, String manifest_url, FLEET_MANIFEST * m, String & errmsg)
+{
+    char *      line;
+    char *      next;
+    char *      value;
+    char *      p;
+    String      image;
+
+    m->sha256_valid = false;
+    m->size         = 0;
+    m->base_address = IMAGE_BIN_BASE_DEFAULT;
+
+    for (line = text; line; line = next)
+    {
+        next = strchr (line, '\n');
+
+        if (next)
+        {
+            *next++ = '\0';
+        }
+
+        p = line + strlen (line);
+
+        while (p > line && (p[-1] == '\r' || p[-1] == ' ' || p[-1] == '\t'))
+        {
+            *--p = '\0';
+        }
+
+        value = strchr (line, '=');
+
+        if (*line == '\0' || *line == '#' || ! value)
+        {
+            continue;
+        }
+
+        *value++ = '\0';
+
+        if (! strcmp (line, "image"))
+        {
+            image = value;
+        }
+        else if (! strcmp (line, "version"))
+        {
+            m->version = value;
+            m->version = m->version.substring (0, FLEET_VERSION_LEN);
+        }
+        else if (! strcmp (line, "sha256"))
+        {
+            m->sha256_valid = fleet_parse_sha256 (value, m->sha256);
+        }
+        else if (! strcmp (line, "size"))
+        {
+            m->size = strtoul (value, (char **) 0, 0);
+        }
+        else if (! strcmp (line, "base"))
+        {
+            m->base_address = strtoul (value, (char **) 0, 0);
+        }
+    }
+
+    if (image.length () == 0 || ! m->sha256_valid || m->size == 0)
+    {
+        errmsg = "manifest incomplete, need image, sha256 and size";
+        return false;
+    }
+
+    m->url      = fleet_resolve_url (manifest_url, image);
+    m->fname    = fleet_image_fname (m->url);
+
+    if (m->fname.length () == 0 || image_format (m->fname) == IMAGE_FORMAT_NONE)
+    {
+        errmsg = "unsupported image filename";
+        return false;
+    }
+
+    return true;
+}
+
+static int
+fleet_text_output (void * ctx, const uint8_t * buf, size_t len)
+{
+    FLEET_TEXT * t = (FLEET_TEXT *) ctx;
+
+    memcpy (t->text + t->len, buf, len);                                               // httpclient_get () checks maxlen
+    t->len += len;
+    return 0;
+}
+
+static int
+fleet_download_output (void * ctx, const uint8_t * buf, size_t len)
+{
+    FLEET_DOWNLOAD * d = (FLEET_DOWNLOAD *) ctx;
+
+    br_sha256_update (&d->sha256_ctx, buf, len);
+    d->len += len;
+
+    if (d->fp.write (buf, len) != len)
+    {
+        d->write_failed = true;
+        return -1;
+    }
+    return 0;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * fetch and parse manifest
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static bool
+fleet_get_manifest (String url, FLEET_MANIFEST * m, String & errmsg)
+{
+    static FLEET_TEXT   t;
+
+    t.len = 0;
+
+    if (httpclient_get (url, FLEET_MANIFEST_MAXLEN, fleet_text_output, &t, errmsg) < 0)
+    {
+        errmsg = "manifest " + errmsg;
+        return false;
+    }
+
+    t.text[t.len] = '\0';
+    return fleet_parse_manifest (t.text, url, m, errmsg);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * SHA-256 of a local file
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static bool
+fleet_file_sha256 (String fname, uint32_t size, uint8_t * sha256)
+{
+    br_sha256_context   ctx;
+    size_t              n;
+
+    File f = LittleFS.open (fname, "r");
+
+    if (! f)
+    {
+        return false;
+    }
+
+    if (f.size () != size)
+    {
+        f.close ();
+        return false;
+    }
+
+    br_sha256_init (&ctx);
+
+    while ((n = f.read (fleet_buf, FLEET_BUFSIZE)) > 0)
+    {
+        br_sha256_update (&ctx, fleet_buf, n);
+    }
+
+    f.close ();
+    br_sha256_out (&ctx, sha256);
+    return true;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * start download of image to m->fname, keeps an already downloaded file with matching hash, e.g. after a failed flash
+ * Returns 1 if already downloaded, 0 if the download is started, see fleet_download_poll (), -1 on error
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+fleet_download_start (FLEET_MANIFEST * m, String & errmsg)
+{
+    uint8_t                 sha256[IMAGE_SHA256_LEN];
+    FSInfo                  fs_info;
+    Dir                     dir;
+
+    if (fleet_file_sha256 (m->fname, m->size, sha256) && ! memcmp (sha256, m->sha256, IMAGE_SHA256_LEN))
+    {
+        http_send_FS ("Image already downloaded<BR>\r\n");
+        return 1;
+    }
+
+    dir = LittleFS.openDir (FLEET_DIR);                                                 // remove previous image, keep state and log
+
+    while (dir.next ())
+    {
+        String path = (String) FLEET_DIR "/" + dir.fileName ();
+
+        if (! path.equals (FLEET_STATE_FNAME) && ! path.equals (FLEET_LOG_FNAME))
+        {
+            LittleFS.remove (path);
+        }
+    }
+
+    LittleFS.info (fs_info);
+
+    if (fs_info.usedBytes + m->size + FLEET_SPACE_RESERVE > fs_info.totalBytes)
+    {
+        errmsg = "not enough space in file system";
+        return -1;
+    }
+
+    fleet_dl.fp = LittleFS.open (FLEET_TMP_FNAME, "w");
+
+    if (! fleet_dl.fp)
+    {
+        errmsg = "cannot create " FLEET_TMP_FNAME;
+        return -1;
+    }
+
+    br_sha256_init (&fleet_dl.sha256_ctx);
+    fleet_dl.len            = 0;
+    fleet_dl.write_failed   = false;
+
+    if (! httpclient_start (m->url, m->size, errmsg))
+    {
+        fleet_dl.fp.close ();
+        LittleFS.remove (FLEET_TMP_FNAME);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * continue download with the data received meanwhile, the complete image is checked against size and hash of the manifest
+ * Returns HTTPCLIENT_BUSY while downloading, HTTPCLIENT_DONE if the image is complete and valid, -1 on error
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+fleet_download_poll (FLEET_MANIFEST * m, String & errmsg)
+{
+    uint8_t     sha256[IMAGE_SHA256_LEN];
+    int         rtc;
+
+    rtc = httpclient_poll (fleet_download_output, &fleet_dl, errmsg);
+
+    if (rtc == HTTPCLIENT_BUSY)
+    {
+        return rtc;
+    }
+
+    fleet_dl.fp.close ();
+
+    if (rtc < 0)
+    {
+        if (fleet_dl.write_failed)
+        {
+            errmsg = "cannot write " FLEET_TMP_FNAME;
+        }
+    }
+    else if (fleet_dl.len != m->size)
+    {
+        errmsg = "size mismatch";
+        rtc = -1;
+    }
+    else
+    {
+        br_sha256_out (&fleet_dl.sha256_ctx, sha256);
+
+        if (memcmp (sha256, m->sha256, IMAGE_SHA256_LEN) != 0)
+        {
+            errmsg = "SHA-256 mismatch";
+            rtc = -1;
+        }
+        else if (! LittleFS.rename (FLEET_TMP_FNAME, m->fname))
+        {
+            errmsg = "could not rename file";
+            rtc = -1;
+        }
+    }
+
+    if (rtc < 0)
+    {
+        LittleFS.remove (FLEET_TMP_FNAME);
+    }
+
+    return rtc;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * output of http_flush () during an update, truncated after FLEET_LOG_MAXLEN bytes
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+fleet_log_output (void * ctx, const uint8_t * buf, size_t len)
+{
+    (void) ctx;
+
+    if (fleet_log_len + len > FLEET_LOG_MAXLEN)
+    {
+        len = FLEET_LOG_MAXLEN - fleet_log_len;
+    }
+
+    if (len > 0 && fleet_log_fp)
+    {
+        fleet_log_fp.write (buf, len);
+        fleet_log_len += len;
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * load/save state of last update
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static bool
+fleet_state_load (FLEET_STATE * st)
+{
+    bool    rtc = false;
+
+    File f = LittleFS.open (FLEET_STATE_FNAME, "r");
+
+    if (f)
+    {
+        if (f.read ((uint8_t *) st, sizeof (FLEET_STATE)) == sizeof (FLEET_STATE) && st->magic == FLEET_STATE_MAGIC)
+        {
+            rtc = true;
+        }
+
+        f.close ();
+    }
+
+    return rtc;
+}
+
+static bool
+fleet_state_save (FLEET_STATE * st)
+{
+    bool    rtc = false;
+
+    st->magic = FLEET_STATE_MAGIC;
+
+    File f = LittleFS.open (FLEET_STATE_FNAME, "w");
+
+    if (f)
+    {
+        if (f.write ((uint8_t *) st, sizeof (FLEET_STATE)) == sizeof (FLEET_STATE))
+        {
+            rtc = true;
+        }
+
+        f.close ();
+    }
+
+    return rtc;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * output of the update goes to FLEET_LOG_FNAME, only while fleet_loop () is running: the web server shares http_send ()
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+fleet_log_begin (void)
+{
+    http_redirect (fleet_log_output, 0);
+}
+
+static void
+fleet_log_end (void)
+{
+    http_flush ();
+    http_redirect (0, 0);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * end of update, schedule next check
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+fleet_finish (int rtc)
+{
+    uint16_t    interval = eeprom_config.fleet_interval ? eeprom_config.fleet_interval : FLEET_DEFAULT_INTERVAL;
+
+    if (fleet_job != FLEET_JOB_IDLE)
+    {
+        http_send_string (fleet_result + "<BR>\r\n");
+        http_flush ();
+        fleet_log_fp.close ();
+        metrics_count (rtc >= 0 ? METRICS_FLEET_UPDATES : METRICS_FLEET_FAILED, 1);
+        fleet_job = FLEET_JOB_IDLE;
+    }
+
+    fleet_wait          = rtc < 0 ? FLEET_RETRY_MSEC : interval * 60000UL;
+    fleet_last_check    = millis ();
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * flash downloaded image, the downloaded file is removed afterwards: the flasher keeps the last flashed image anyway
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+fleet_flash (FLEET_MANIFEST * m)
+{
+    FLEET_STATE             st;
+    IMAGE_LAST              last;
+    int                     rtc;
+
+    rtc = stm32_flash_from_local (m->fname, m->base_address, STM32_FLASH_FLAG_INCREMENTAL);
+
+    if (rtc >= 0)
+    {
+        stm32_reset ();
+
+        memset (&st, 0, sizeof (st));
+        memcpy (st.file_sha256, m->sha256, IMAGE_SHA256_LEN);
+
+        if (image_last_load (&last))
+        {
+            memcpy (st.last_sha256, last.sha256, IMAGE_SHA256_LEN);
+        }
+
+        strncpy (st.version, m->version.c_str (), FLEET_VERSION_LEN);
+        fleet_state_save (&st);
+        LittleFS.remove (m->fname);
+        fleet_result = "Updated to version " + m->version;
+    }
+    else
+    {
+        fleet_result = "Flashing of version " + m->version + " failed";
+    }
+
+    return rtc;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * fetch manifest, start update if changed
+ * Returns -1 on error, 0 if up to date, 1 if the update is started, see fleet_job
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+fleet_check (void)
+{
+    FLEET_MANIFEST *        m = &fleet_manifest;
+    FLEET_STATE             st;
+    IMAGE_LAST              last;
+    String                  errmsg;
+    bool                    last_valid;
+    int                     rtc;
+
+    metrics_count (METRICS_FLEET_CHECKS, 1);
+
+    if (! fleet_get_manifest (eeprom_config.fleet_url, m, errmsg))
+    {
+        fleet_result = "Check failed: " + errmsg;
+        metrics_count (METRICS_FLEET_FAILED, 1);
+        return -1;
+    }
+
+    last_valid = image_last_load (&last);
+
+    if (fleet_state_load (&st) && ! memcmp (st.file_sha256, m->sha256, IMAGE_SHA256_LEN) &&
+        last_valid && ! memcmp (st.last_sha256, last.sha256, IMAGE_SHA256_LEN))
+    {
+        fleet_result = (String) "Up to date, version " + st.version;
+        return 0;
+    }
+
+    fleet_log_fp    = LittleFS.open (FLEET_LOG_FNAME, "w");
+    fleet_log_len   = 0;
+    fleet_job       = FLEET_JOB_DOWNLOAD;
+
+    http_send_string ("Fleet update to version " + m->version + " from " + m->url + "<BR>\r\n");
+    rtc = fleet_download_start (m, errmsg);
+
+    if (rtc < 0)
+    {
+        fleet_result = "Download failed: " + errmsg;
+        return -1;
+    }
+
+    if (rtc > 0)
+    {
+        fleet_job = FLEET_JOB_FLASH;
+    }
+
+    fleet_result = "Downloading version " + m->version;
+    return 1;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * fleet_request () - check at next call of fleet_loop ()
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+fleet_request (void)
+{
+    fleet_requested = true;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * fleet_status () - result of last check and time of next check
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+String
+fleet_status (void)
+{
+    unsigned long   elapsed = millis () - fleet_last_check;
+    String          s;
+
+    if (eeprom_config.fleet_url[0] == '\0')
+    {
+        return "disabled";
+    }
+
+    if (fleet_job == FLEET_JOB_DOWNLOAD)
+    {
+        return fleet_result + ": " + fleet_dl.len + " of " + fleet_manifest.size + " bytes";
+    }
+
+    if (fleet_job == FLEET_JOB_FLASH)
+    {
+        return fleet_result + ": downloaded, waiting for idle UART";
+    }
+
+    s = fleet_result.length () > 0 ? fleet_result + ", next" : (String) "Next";
+
+    if (fleet_requested || elapsed >= fleet_wait)
+    {
+        return s + " check pending";
+    }
+
+    return s + " check in " + ((fleet_wait - elapsed) / 60000UL + 1) + " min";
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * fleet_loop () - check periodically, download in the background and flash while the UART is idle, called by loop ()
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+fleet_loop (void)
+{
+    String      errmsg;
+    int         rtc;
+
+    if (fleet_job == FLEET_JOB_IDLE)
+    {
+        if (eeprom_config.fleet_url[0] == '\0' || (! fleet_requested && millis () - fleet_last_check < fleet_wait))
+        {
+            return;
+        }
+
+        if (WiFi.status () != WL_CONNECTED)
+        {
+            return;                                                                     // try again at next call
+        }
+
+        fleet_requested = false;
+        fleet_log_begin ();
+        rtc = fleet_check ();
+
+        if (rtc <= 0)
+        {
+            fleet_finish (rtc);
+        }
+
+        fleet_log_end ();
+    }
+    else if (fleet_job == FLEET_JOB_DOWNLOAD)
+    {
+        fleet_log_begin ();
+        rtc = fleet_download_poll (&fleet_manifest, errmsg);
+
+        if (rtc < 0)
+        {
+            fleet_result = "Download failed: " + errmsg;
+            fleet_finish (rtc);
+        }
+        else if (rtc == HTTPCLIENT_DONE)
+        {
+            fleet_job = FLEET_JOB_FLASH;
+        }
+
+        fleet_log_end ();
+    }
+    else if (arbiter_owner () == ARBITER_OWNER_CONSOLE && ! stm32_dump_active ())
+    {
+        fleet_log_begin ();
+        fleet_finish (fleet_flash (&fleet_manifest));
+        fleet_log_end ();
+    }
+}
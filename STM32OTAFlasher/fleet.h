@@ -0,0 +1,77 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * fleet.h - pull based fleet update: poll a manifest, download and flash changed images
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef FLEET_H
+#define FLEET_H
+
+#include "image.h"
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * The manifest at eeprom_config.fleet_url is a small text file of key=value lines, e.g. written by tools/fleetserver.py:
+ *
+ *     image=firmware.hex                       URL of image, absolute or relative to the manifest URL
+ *     version=1.2.3                            free text, only displayed
+ *     sha256=0123...cdef                       SHA-256 of the image file
+ *     size=40960                               size of the image file in bytes
+ *     base=0x08000000                          optional: base address of raw binary images
+ *
+ * The image is downloaded only if the manifest differs from the image flashed by the last fleet update, or if the last flashed image
+ * has been changed in the meantime, e.g. by a manual upload.
+ * The download runs in the background, fleet_loop () stores only the data received since its last call. The complete image is checked
+ * against size and SHA-256 of the manifest and flashed as soon as the UART is idle. After flashing the downloaded file is removed,
+ * the flasher keeps the flat image of the last flash anyway.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define FLEET_DIR                   "/fleet"                                            // downloaded image
+#define FLEET_STATE_FNAME           FLEET_DIR "/state.inf"
+#define FLEET_TMP_FNAME             FLEET_DIR "/image.tmp"
+#define FLEET_LOG_FNAME             FLEET_DIR "/fleet.log"                              // output of last update
+#define FLEET_LOG_MAXLEN            8192
+#define FLEET_MANIFEST_MAXLEN       512
+#define FLEET_VERSION_LEN           31
+#define FLEET_FNAME_LEN             31                                                  // max. length of image filename
+#define FLEET_DEFAULT_INTERVAL      60                                                  // minutes between checks
+#define FLEET_FIRST_CHECK_MSEC      30000UL                                             // first check after start of services
+#define FLEET_RETRY_MSEC            300000UL                                            // next check after an error
+#define FLEET_SPACE_RESERVE         16384                                               // free space kept for flat image and metadata
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * state of last successful fleet update, stored in FLEET_STATE_FNAME
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct
+{
+    uint32_t                        magic;
+    uint8_t                         file_sha256[IMAGE_SHA256_LEN];                      // SHA-256 of image file, see manifest
+    uint8_t                         last_sha256[IMAGE_SHA256_LEN];                      // SHA-256 of IMAGE_LAST_BIN after flashing
+    char                            version[FLEET_VERSION_LEN + 1];
+} FLEET_STATE;
+
+extern void                         fleet_request (void);
+extern String                       fleet_status (void);
+extern void                         fleet_loop (void);
+
+#endif // FLEET_H
@@ -0,0 +1,175 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * hsdecoder.cpp - streaming LZSS decoder, compatible with heatshrink
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <Arduino.h>
+#include "hsdecoder.h"
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * Stream format (bits MSB first):
+ *   1 <8 bits literal>
+ *   0 <HS_WINDOW_SZ2 bits offset - 1> <HS_LOOKAHEAD_SZ2 bits count - 1>      copy count bytes from offset bytes back
+ * The last byte is padded with 0 bits which never complete a backref.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define HS_STATE_TAG                0
+#define HS_STATE_LITERAL            1
+#define HS_STATE_INDEX              2
+#define HS_STATE_COUNT              3
+
+#define HS_WINDOW_MASK              (HS_WINDOW_SIZE - 1)
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * hs_decoder_init () - initialize decoder
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+hs_decoder_init (HS_DECODER * hs)
+{
+    memset (hs->window, 0, HS_WINDOW_SIZE);
+    hs->outlen  = 0;
+    hs->head    = 0;
+    hs->state   = HS_STATE_TAG;
+    hs->nbits   = 0;
+    hs->bits    = 0;
+    hs->index   = 0;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * output one decoded byte
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+hs_decoder_put (HS_DECODER * hs, uint8_t ch, HS_OUTPUT_FUNC func, void * ctx)
+{
+    int rtc = 0;
+
+    hs->window[hs->head & HS_WINDOW_MASK] = ch;
+    hs->head++;
+    hs->outbuf[hs->outlen++] = ch;
+
+    if (hs->outlen == HS_OUTBUF_SIZE)
+    {
+        rtc = (*func) (ctx, hs->outbuf, hs->outlen);
+        hs->outlen = 0;
+    }
+    return rtc;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * hs_decoder_feed () - decode next chunk of compressed data, chunks may split tokens anywhere
+ * Returns -1 if output function aborts
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+int
+hs_decoder_feed (HS_DECODER * hs, const uint8_t * buf, size_t len, HS_OUTPUT_FUNC func, void * ctx)
+{
+    size_t      i;
+    uint8_t     mask;
+    uint16_t    count;
+
+    for (i = 0; i < len; i++)
+    {
+        for (mask = 0x80; mask; mask >>= 1)
+        {
+            hs->bits = (hs->bits << 1) | ((buf[i] & mask) ? 1 : 0);
+            hs->nbits++;
+
+            switch (hs->state)
+            {
+                case HS_STATE_TAG:
+                {
+                    hs->state = hs->bits ? HS_STATE_LITERAL : HS_STATE_INDEX;
+                    hs->nbits = 0;
+                    hs->bits  = 0;
+                    break;
+                }
+                case HS_STATE_LITERAL:
+                {
+                    if (hs->nbits == 8)
+                    {
+                        if (hs_decoder_put (hs, hs->bits, func, ctx) < 0)
+                        {
+                            return -1;
+                        }
+
+                        hs->state = HS_STATE_TAG;
+                        hs->nbits = 0;
+                        hs->bits  = 0;
+                    }
+                    break;
+                }
+                case HS_STATE_INDEX:
+                {
+                    if (hs->nbits == HS_WINDOW_SZ2)
+                    {
+                        hs->index = hs->bits + 1;
+                        hs->state = HS_STATE_COUNT;
+                        hs->nbits = 0;
+                        hs->bits  = 0;
+                    }
+                    break;
+                }
+                case HS_STATE_COUNT:
+                {
+                    if (hs->nbits == HS_LOOKAHEAD_SZ2)
+                    {
+                        for (count = hs->bits + 1; count > 0; count--)
+                        {
+                            if (hs_decoder_put (hs, hs->window[(hs->head - hs->index) & HS_WINDOW_MASK], func, ctx) < 0)
+                            {
+                                return -1;
+                            }
+                        }
+
+                        hs->state = HS_STATE_TAG;
+                        hs->nbits = 0;
+                        hs->bits  = 0;
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * hs_decoder_finish () - pass remaining output
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+int
+hs_decoder_finish (HS_DECODER * hs, HS_OUTPUT_FUNC func, void * ctx)
+{
+    int rtc = 0;
+
+    if (hs->outlen > 0)
+    {
+        rtc = (*func) (ctx, hs->outbuf, hs->outlen);
+        hs->outlen = 0;
+    }
+    return rtc;
+}
@@ -0,0 +1,57 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * hsdecoder.h - streaming LZSS decoder, compatible with heatshrink
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef HSDECODER_H
+#define HSDECODER_H
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * Parameters must match the encoder, e.g.: heatshrink -e -w 11 -l 4 firmware.bin firmware.bin.hs
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define HS_WINDOW_SZ2               11                                                  // window size: 2^11 = 2048 bytes
+#define HS_LOOKAHEAD_SZ2            4                                                   // max. backref length: 2^4 = 16 bytes
+#define HS_WINDOW_SIZE              (1 << HS_WINDOW_SZ2)
+#define HS_OUTBUF_SIZE              256                                                 // output is passed in chunks of this size
+
+typedef int (*HS_OUTPUT_FUNC) (void * ctx, const uint8_t * buf, size_t len);             // return -1 to abort
+
+typedef struct
+{
+    uint8_t                         window[HS_WINDOW_SIZE];                             // last decoded bytes
+    uint8_t                         outbuf[HS_OUTBUF_SIZE];
+    uint16_t                        outlen;
+    uint16_t                        head;                                               // write position in window
+    uint8_t                         state;                                              // next expected token part
+    uint8_t                         nbits;                                              // number of bits collected
+    uint16_t                        bits;                                               // collected bits
+    uint16_t                        index;                                              // backref offset
+} HS_DECODER;
+
+extern void                         hs_decoder_init (HS_DECODER * hs);
+extern int                          hs_decoder_feed (HS_DECODER * hs, const uint8_t * buf, size_t len, HS_OUTPUT_FUNC func, void * ctx);
+extern int                          hs_decoder_finish (HS_DECODER * hs, HS_OUTPUT_FUNC func, void * ctx);
+
+#endif // HSDECODER_H
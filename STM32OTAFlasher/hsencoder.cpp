@@ -0,0 +1,135 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * hsencoder.cpp - heatshrink compatible block encoder
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <Arduino.h>
+#include "hsencoder.h"
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * bit writer
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct
+{
+    uint8_t *                       out;
+    size_t                          out_size;
+    size_t                          len;                                                // complete bytes in out
+    uint8_t                         bits;                                               // pending bits, MSB first
+    uint8_t                         nbits;
+    bool                            overflow;
+} HS_BIT_WRITER;
+
+static void
+hs_put_bits (HS_BIT_WRITER * bw, uint16_t value, uint8_t count)
+{
+    while (count-- > 0)
+    {
+        bw->bits = (bw->bits << 1) | ((value >> count) & 0x01);
+        bw->nbits++;
+
+        if (bw->nbits == 8)
+        {
+            if (bw->len < bw->out_size)
+            {
+                bw->out[bw->len++] = bw->bits;
+            }
+            else
+            {
+                bw->overflow = true;
+            }
+
+            bw->bits  = 0;
+            bw->nbits = 0;
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * hs_encode () - compress a block, decodable by a freshly initialized HS_DECODER
+ * The backref search is greedy and limited to HS_ENCODER_SEARCH_DEPTH bytes to keep the encoder fast.
+ * Returns compressed length, 0 if it doesn't fit into out_size bytes
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+size_t
+hs_encode (const uint8_t * in, size_t len, uint8_t * out, size_t out_size)
+{
+    HS_BIT_WRITER   bw          = { out, out_size, 0, 0, 0, false };
+    size_t          max_count   = 1 << HS_LOOKAHEAD_SZ2;
+    size_t          pos         = 0;
+    size_t          best_len;
+    size_t          best_off;
+    size_t          max_len;
+    size_t          depth;
+    size_t          off;
+    size_t          n;
+
+    while (pos < len && ! bw.overflow)
+    {
+        best_len    = 0;
+        best_off    = 0;
+        max_len     = len - pos < max_count ? len - pos : max_count;
+        depth       = pos < HS_ENCODER_SEARCH_DEPTH ? pos : HS_ENCODER_SEARCH_DEPTH;
+
+        for (off = 1; off <= depth && best_len < max_len; off++)
+        {
+            if (in[pos - off] != in[pos])
+            {
+                continue;
+            }
+
+            for (n = 1; n < max_len && in[pos - off + n] == in[pos + n]; n++)        // may overlap, decoder copies byte by byte
+            {
+                ;
+            }
+
+            if (n > best_len)
+            {
+                best_len = n;
+                best_off = off;
+            }
+        }
+
+        if (best_len >= HS_ENCODER_MIN_MATCH)
+        {
+            hs_put_bits (&bw, 0, 1);
+            hs_put_bits (&bw, best_off - 1, HS_WINDOW_SZ2);
+            hs_put_bits (&bw, best_len - 1, HS_LOOKAHEAD_SZ2);
+            pos += best_len;
+        }
+        else
+        {
+            hs_put_bits (&bw, 1, 1);
+            hs_put_bits (&bw, in[pos], 8);
+            pos++;
+        }
+    }
+
+    if (bw.nbits > 0)                                                                   // pad with 0 bits: incomplete backref tag
+    {
+        hs_put_bits (&bw, 0, 8 - bw.nbits);
+    }
+
+    return bw.overflow ? 0 : bw.len;
+}
@@ -33,12 +33,25 @@
 #include "http.h"
 #include "eepromdata.h"
 #include "stm32flash.h"
+#include "image.h"
+#include "upload.h"
+#include "cas.h"
+#include "metrics.h"
+#include "conlog.h"
+#include "trace.h"
+#include "transport.h"
+#include "arbiter.h"
+#include "target.h"
+#include "fleet.h"
 
 /*----------------------------------------------------------------------------------------------------------------------------------------
  * global data:
  *----------------------------------------------------------------------------------------------------------------------------------------
  */
 static const char *                 host = "stm32flasher";
+static HTTP_OUTPUT_FUNC             http_output_func;                                   // redirected output, see http_redirect ()
+static void *                       http_output_ctx;
+static bool                         http_started;
 
 ESP8266WebServer                    httpServer(80);
 ESP8266HTTPUpdateServer             httpUpdater;
@@ -71,9 +84,29 @@ http_send_string (String s)
 void
 http_flush (void)
 {
-    httpServer.sendContent(sResponse);
+    if (http_output_func)
+    {
+        (void) (*http_output_func) (http_output_ctx, (const uint8_t *) sResponse.c_str(), sResponse.length());
+    }
+    else
+    {
+        httpServer.sendContent(sResponse);
+    }
     sResponse = "";
 }
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * redirect output of http_flush () to func, e.g. for jobs not started by a http request. func = NULL: send to http client again
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+http_redirect (HTTP_OUTPUT_FUNC func, void * ctx)
+{
+    sResponse           = "";
+    http_output_func    = func;
+    http_output_ctx     = ctx;
+}
+
 /*----------------------------------------------------------------------------------------------------------------------------------------
  * send http header
  *----------------------------------------------------------------------------------------------------------------------------------------
@@ -176,13 +209,124 @@ html_trailer (void)
     http_send ("</html>\r\n");
 }
 
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * get address or length from argument, e.g. 0x08000000 or 65536
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint32_t
+get_address_arg (String name, uint32_t default_value)
+{
+    String value = httpServer.arg(name);
+
+    if (value.length() == 0)
+    {
+        return default_value;
+    }
+    return strtoul (value.c_str(), (char **) 0, 0);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * get base address of raw binary images from argument "base", e.g. 0x08000000
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint32_t
+get_base_address (void)
+{
+    return get_address_arg ("base", IMAGE_BIN_BASE_DEFAULT);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * get flash flags from arguments:
+ *   incr=1 erases and programs only changed pages
+ *   rec=1 records the UART session
+ *   go=1 starts the image with bootloader command GO instead of leaving the STM32 in the bootloader
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint8_t
+get_flash_flags (void)
+{
+    uint8_t flags = 0;
+
+    if (httpServer.arg("incr").equals ("1"))
+    {
+        flags |= STM32_FLASH_FLAG_INCREMENTAL;
+    }
+
+    if (httpServer.arg("rec").equals ("1"))
+    {
+        flags |= STM32_FLASH_FLAG_RECORD;
+    }
+
+    if (httpServer.arg("go").equals ("1"))
+    {
+        flags |= STM32_FLASH_FLAG_GO;
+    }
+    return flags;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * get targets of farm from arguments t0=1 ... t3=1, returns bit mask
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint8_t
+get_farm_targets (void)
+{
+    uint8_t targets = 0;
+    uint8_t idx;
+
+    for (idx = 0; idx < TARGET_MAX; idx++)
+    {
+        if (httpServer.arg((String) "t" + idx).equals ("1"))
+        {
+            targets |= 1 << idx;
+        }
+    }
+    return targets;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * get GPIO number from argument, returns 0 if invalid
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint8_t
+get_pin_arg (String name)
+{
+    String  arg = httpServer.arg(name);
+    long    pin = arg.toInt ();
+
+    arg.trim ();
+    return (arg.length () > 0 && arg == String (pin) && pin >= 0 && pin <= 16) ? pin : TARGET_PIN_INVALID;
+}
+
 static void
 handle_pre_actions (String action)
 {
     if (action.equals ("delete"))
     {
         String fname = httpServer.arg("fname");
-        LittleFS.remove (fname);
+
+        if (image_format (fname) == IMAGE_FORMAT_MANIFEST)
+        {
+            cas_remove (fname);                                                         // remove unused chunks, too
+        }
+        else
+        {
+            LittleFS.remove (fname);
+            image_info_remove (fname);
+        }
+    }
+    else if (action.equals ("store"))
+    {
+        String fname = httpServer.arg("fname");
+        String man_fname;
+        String msg;
+
+        if (! cas_store (fname, get_base_address (), man_fname, msg))
+        {
+            msg = "Store failed: " + msg;
+        }
+
+        sResponse += msg + "<BR>\r\n";
     }
 }
 
@@ -193,18 +337,33 @@ handle_post_actions (String action)
     {
         String fname = httpServer.arg("fname");
         sResponse += (String) "<BR>\r\n";
-        stm32_check_hex_file (fname);
+        stm32_check_image_file (fname, get_base_address ());
     }
 }
 
 static void
 show_directory (String action, String url, bool verbose)
 {
+    EEPROM_TARGET   target;
+    String          farm_input;
+    int             n_targets = 0;
+    uint8_t         idx;
     FSInfo fs_info;
     LittleFS.info(fs_info);
 
     handle_pre_actions (action);
 
+    for (idx = 0; idx < TARGET_MAX; idx++)                                              // farm: checkbox for each configured target
+    {
+        if (target_get (idx, &target))
+        {
+            farm_input += (String) "  <input type='checkbox' name='t" + idx + "' value='1' checked title='" + target_name (idx) + "'>" + idx + "\r\n";
+            n_targets++;
+        }
+    }
+
+    farm_input += "  <select name='mode'><option value='0'>Seq.</option><option value='1'>Interl.</option></select>\r\n";
+
     if (verbose)
     {
         sResponse += (String) "<table>\r\n";
@@ -227,8 +386,7 @@ show_directory (String action, String url, bool verbose)
     while (dir.next())
     {
         String  filename;
-        String  suffix;
-        int     len;
+        uint8_t format;
         int     siz;
 
         if(dir.fileSize())
@@ -244,6 +402,11 @@ show_directory (String action, String url, bool verbose)
 
         filename = dir.fileName();
 
+        if (dir.isDirectory() || image_is_info_file (filename))
+        {
+            continue;
+        }
+
         sResponse += "<tr>";
         sResponse += "<td>";
         sResponse += filename;
@@ -251,50 +414,119 @@ show_directory (String action, String url, bool verbose)
         sResponse += siz;
         sResponse += "</td>";
 
-        len = filename.length();
-        
-        if (len > 4)
+        sResponse += "<td>\r\n";
+        sResponse += "<form action='";
+        sResponse += url;
+        sResponse += "' method='GET'>\r\n";
+        sResponse += "  <input type='hidden' name='action' value='delete'>\r\n";
+        sResponse += "  <input type='hidden' name='fname'  value='";
+        sResponse += filename;
+        sResponse += "'>\r\n";
+        sResponse += "  <input type='submit' value='Delete'>\r\n";
+        sResponse += "</form>\r\n";
+        sResponse += "</td>\r\n";
+
+        format = image_format (filename);
+
+        if (format != IMAGE_FORMAT_NONE)
         {
-            suffix = filename.substring (len - 4);
-            suffix.toLowerCase();
+            String base_input = "";
+
+            if ((format & IMAGE_FORMAT_MASK) == IMAGE_FORMAT_BIN)
+            {
+                base_input = "  <input type='text' name='base' value='0x08000000' size='10'>\r\n";
+            }
 
             sResponse += "<td>\r\n";
             sResponse += "<form action='";
             sResponse += url;
             sResponse += "' method='GET'>\r\n";
-            sResponse += "  <input type='hidden' name='action' value='delete'>\r\n";
+            sResponse += "  <input type='hidden' name='action' value='check'>\r\n";
             sResponse += "  <input type='hidden' name='fname'  value='";
             sResponse += filename;
             sResponse += "'>\r\n";
-            sResponse += "  <input type='submit' value='Delete'>\r\n";
+            sResponse += base_input;
+            sResponse += "  <input type='submit' value='Check'>\r\n";
             sResponse += "</form>\r\n";
             sResponse += "</td>\r\n";
 
-            if (suffix.equals(".hex"))
+            sResponse += "<td>\r\n";
+            sResponse += "<form action='/flash' method='GET'>\r\n";
+            sResponse += "  <input type='hidden' name='action' value='flash'>\r\n";
+            sResponse += "  <input type='hidden' name='fname'  value='";
+            sResponse += filename;
+            sResponse += "'>\r\n";
+            sResponse += base_input;
+
+            if ((format & IMAGE_FORMAT_MASK) != IMAGE_FORMAT_DELTA)                     // patches are always flashed incrementally
+            {
+                sResponse += "  <input type='checkbox' name='incr' value='1' title='erase and program only changed pages'>Incr.\r\n";
+            }
+
+            sResponse += "  <input type='checkbox' name='rec' value='1' title='record UART session in " TRANSPORT_SESSION_FNAME "'>Rec.\r\n";
+            sResponse += "  <input type='checkbox' name='go' value='1' title='start image without reset, always done for SRAM images'>Run\r\n";
+
+            sResponse += "  <input type='submit' value='Flash'>\r\n";
+            sResponse += "</form>\r\n";
+            sResponse += "</td>\r\n";
+
+            if (n_targets > 1)
             {
                 sResponse += "<td>\r\n";
-                sResponse += "<form action='";
-                sResponse += url;
-                sResponse += "' method='GET'>\r\n";
-                sResponse += "  <input type='hidden' name='action' value='check'>\r\n";
+                sResponse += "<form action='/flash' method='GET'>\r\n";
+                sResponse += "  <input type='hidden' name='action' value='farm'>\r\n";
                 sResponse += "  <input type='hidden' name='fname'  value='";
                 sResponse += filename;
                 sResponse += "'>\r\n";
-                sResponse += "  <input type='submit' value='Check'>\r\n";
+                sResponse += base_input;
+                sResponse += farm_input;
+                sResponse += "  <input type='submit' value='Farm' title='flash all checked targets'>\r\n";
                 sResponse += "</form>\r\n";
                 sResponse += "</td>\r\n";
+            }
 
+            sResponse += "<td>\r\n";
+            sResponse += "<form action='/flash' method='GET'>\r\n";
+            sResponse += "  <input type='hidden' name='action' value='verify'>\r\n";
+            sResponse += "  <input type='hidden' name='fname'  value='";
+            sResponse += filename;
+            sResponse += "'>\r\n";
+            sResponse += base_input;
+            sResponse += "  <input type='submit' value='Verify' title='compare flash with image, nothing is written'>\r\n";
+            sResponse += "</form>\r\n";
+            sResponse += "</td>\r\n";
+
+            if ((format & IMAGE_FORMAT_MASK) != IMAGE_FORMAT_MANIFEST)
+            {
                 sResponse += "<td>\r\n";
-                sResponse += "<form action='/flash' method='GET'>\r\n";
-                sResponse += "  <input type='hidden' name='action' value='flash'>\r\n";
+                sResponse += "<form action='";
+                sResponse += url;
+                sResponse += "' method='GET'>\r\n";
+                sResponse += "  <input type='hidden' name='action' value='store'>\r\n";
                 sResponse += "  <input type='hidden' name='fname'  value='";
                 sResponse += filename;
                 sResponse += "'>\r\n";
-                sResponse += "  <input type='submit' value='Flash'>\r\n";
+                sResponse += base_input;
+                sResponse += "  <input type='submit' value='Store' title='store in image library as .man'>\r\n";
                 sResponse += "</form>\r\n";
                 sResponse += "</td>\r\n";
             }
         }
+        else if (filename.endsWith (STM32_RECIPE_SUFFIX))                              // several images in one job
+        {
+            sResponse += "<td></td>\r\n";
+            sResponse += "<td>\r\n";
+            sResponse += "<form action='/flash' method='GET'>\r\n";
+            sResponse += "  <input type='hidden' name='action' value='flash'>\r\n";
+            sResponse += "  <input type='hidden' name='fname'  value='";
+            sResponse += filename;
+            sResponse += "'>\r\n";
+            sResponse += "  <input type='checkbox' name='rec' value='1' title='record UART session in " TRANSPORT_SESSION_FNAME "'>Rec.\r\n";
+            sResponse += "  <input type='checkbox' name='go' value='1' title='start lowest segment without reset'>Run\r\n";
+            sResponse += "  <input type='submit' value='Flash' title='erase and flash all segments of recipe'>\r\n";
+            sResponse += "</form>\r\n";
+            sResponse += "</td>\r\n";
+        }
         sResponse += "</tr>\r\n";
     }
 
@@ -302,33 +534,156 @@ show_directory (String action, String url, bool verbose)
     handle_post_actions (action);
 }
 
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * upload sink, used by multipart and raw body uploads
+ *
+ * HEX files are checked while uploading. An invalid file is removed as soon as the first bad record arrives,
+ * a valid file is stored together with its image info, so flashing can skip the check pass.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static File                         upload_fp = (File) 0;
+static String                       upload_filename;
+static bool                         upload_check;
+static bool                         upload_failed;
+static String                       upload_errmsg;
+static IMAGE_READER                 upload_rd;
+static uint32_t                     upload_size;
+
 static void
-handle_doupload ()
+upload_begin (String filename, uint32_t base_address)
 {
-    static File   fp = (File) 0;
-    static String filename;
-    String action = String ();
+    uint8_t format;
 
-    HTTPUpload& uploadfile = httpServer.upload();
+    if (!filename.startsWith("/"))
+    {
+        filename = "/" + filename;
+    }
 
-    if (uploadfile.status == UPLOAD_FILE_START)
+    upload_filename = filename;
+    upload_failed   = false;
+    upload_errmsg   = "";
+    upload_size     = 0;
+
+    LittleFS.remove(upload_filename);
+    image_info_remove (upload_filename);
+    upload_fp = LittleFS.open (upload_filename, "w");
+
+    if (! upload_fp)
     {
-        filename = uploadfile.filename;
+        upload_failed = true;
+        upload_errmsg = (String) "could not create file: " + upload_filename;
+    }
+
+    format = image_format (upload_filename);
+    upload_check = (format != IMAGE_FORMAT_NONE);
+    image_reader_begin (&upload_rd, format, base_address, 0, 0);                        // IMAGE_FORMAT_NONE: only hash
+}
 
-        if (!filename.startsWith("/"))
+static void
+upload_write (uint8_t * buf, size_t len)
+{
+    if (upload_fp)
+    {
+        if (image_reader_feed (&upload_rd, buf, len) < 0)
         {
-            filename = "/" + filename;
+            upload_fp.close();                                              // reject file, ignore rest of upload
+            upload_fp = (File) 0;
+            LittleFS.remove (upload_filename);
+            upload_failed = true;
+            upload_errmsg = (String) "Image file rejected: " + upload_rd.errmsg;
         }
+        else
+        {
+            if (upload_fp.write (buf, len) != len)
+            {
+                upload_fp.close();
+                upload_fp = (File) 0;
+                LittleFS.remove (upload_filename);
+                upload_failed = true;
+                upload_errmsg = "write error, file system full?";
+            }
 
-        LittleFS.remove(filename);
-        fp = LittleFS.open (filename, "w");
+            upload_size += len;
+        }
     }
-    else if (uploadfile.status == UPLOAD_FILE_WRITE)
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * finish upload
+ * expected_sha256: hex string of SHA-256 of file content, empty if not known
+ * Returns false if upload failed
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static bool
+upload_end (String expected_sha256)
+{
+    if (upload_fp)
     {
-        if (fp)
+        upload_fp.close();
+        upload_fp = (File) 0;
+
+        if (image_reader_end (&upload_rd) < 0)
+        {
+            upload_failed = true;
+            upload_errmsg = (String) "Image file rejected: " + upload_rd.errmsg;
+        }
+
+        if (! upload_failed && expected_sha256.length() > 0)
+        {
+            expected_sha256.toLowerCase();
+
+            if (! expected_sha256.equals (image_sha256_string (upload_rd.info.sha256)))
+            {
+                upload_failed = true;
+                upload_errmsg = "SHA-256 mismatch";
+            }
+        }
+
+        if (upload_failed)
         {
-            fp.write (uploadfile.buf, uploadfile.currentSize);
+            LittleFS.remove (upload_filename);
         }
+        else if (upload_check)
+        {
+            image_info_save (upload_filename, &upload_rd.info);
+        }
+    }
+
+    return ! upload_failed;
+}
+
+static void
+upload_abort (void)
+{
+    if (upload_fp)
+    {
+        upload_fp.close();
+        upload_fp = (File) 0;
+        LittleFS.remove (upload_filename);
+    }
+
+    upload_failed = true;
+    upload_errmsg = "upload aborted";
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * handle file upload (multipart/form-data)
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+handle_doupload ()
+{
+    String action = String ();
+
+    HTTPUpload& uploadfile = httpServer.upload();
+
+    if (uploadfile.status == UPLOAD_FILE_START)
+    {
+        upload_begin (uploadfile.filename, IMAGE_BIN_BASE_DEFAULT);
+    }
+    else if (uploadfile.status == UPLOAD_FILE_WRITE)
+    {
+        upload_write (uploadfile.buf, uploadfile.currentSize);
     } 
     else if (uploadfile.status == UPLOAD_FILE_END)
     {
@@ -337,21 +692,25 @@ handle_doupload ()
 
         html_header (title, url, false);
 
-        if (fp)
-        {                                    
-            fp.close();
-            fp = (File) 0;
-
+        if (upload_end (""))
+        {
             sResponse += F("File upload successful.<BR>\r\n"); 
             sResponse += F("Uploaded File Name: ");
             sResponse += uploadfile.filename;
             sResponse += "\r\n";
+
+            if (upload_check)
+            {
+                sResponse += F("<BR>Image file check successful, SHA-256: ");
+                sResponse += image_sha256_string (upload_rd.info.sha256);
+                sResponse += "\r\n";
+            }
         }
         else
         {
-            sResponse += F("could not create file: ");
-            sResponse += filename;
-            sResponse += F("\r\n");
+            sResponse += F("<font color='red'>");
+            sResponse += upload_errmsg;
+            sResponse += F("</font>\r\n");
         }
 
         sResponse += F("<P>\r\n");
@@ -359,6 +718,150 @@ handle_doupload ()
         html_trailer ();
         httpServer.send(200, "text/html", sResponse);
     }
+    else if (uploadfile.status == UPLOAD_FILE_ABORTED)
+    {
+        upload_abort ();
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * handle raw body upload: PUT /upload?fname=<name>[&sha256=<hex>][&base=<addr>][&flash=1[&incr=1][&go=1]]
+ *
+ * The request body is the file content, e.g. curl -T firmware.hex "http://stm32flasher/upload?fname=firmware.hex"
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+handle_rawupload ()
+{
+    HTTPRaw& raw = httpServer.raw();
+
+    if (raw.status == RAW_START)
+    {
+        upload_begin (httpServer.arg("fname"), get_base_address ());
+    }
+    else if (raw.status == RAW_WRITE)
+    {
+        upload_write (raw.buf, raw.currentSize);
+    }
+    else if (raw.status == RAW_END)
+    {
+        upload_end (httpServer.arg("sha256"));
+    }
+    else if (raw.status == RAW_ABORTED)
+    {
+        upload_abort ();
+    }
+}
+
+static void
+handle_rawupload_result ()
+{
+    if (httpServer.arg("fname").length() == 0)
+    {
+        httpServer.send(400, "text/plain", "missing argument fname\r\n");
+    }
+    else if (upload_failed)
+    {
+        httpServer.send(400, "text/plain", (String) "ERROR " + upload_errmsg + "\r\n");
+    }
+    else if (httpServer.arg("flash").equals ("1") && upload_check)
+    {
+        httpServer.setContentLength(CONTENT_LENGTH_UNKNOWN);
+        httpServer.send(200, "text/html", "");
+        sResponse = "";
+        stm32_flash_from_local (upload_filename, get_base_address (), get_flash_flags ());
+        http_flush ();
+        httpServer.sendContent("");
+    }
+    else
+    {
+        httpServer.send(200, "text/plain", (String) "OK " + upload_filename + " " + upload_size + " " + image_sha256_string (upload_rd.info.sha256) + "\r\n");
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * handle chunked upload:
+ *
+ * PUT /chunk?id=<id>&offset=<n>[&fname=<name>][&size=<total>]      body is data of chunk, fname is required for 1st chunk
+ * GET /chunk?id=<id>                                               get received ranges
+ * GET /chunk?id=<id>&action=complete&sha256=<hex>[&size=<total>][&base=<addr>]  check hash and store file as fname
+ * GET /chunk?id=<id>&action=cancel                                 remove unfinished upload
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static bool                         chunk_ok;
+static String                       chunk_errmsg;
+
+static void
+handle_rawchunk ()
+{
+    HTTPRaw& raw = httpServer.raw();
+
+    if (raw.status == RAW_START)
+    {
+        chunk_errmsg = "";
+        chunk_ok = upload_chunk_begin (httpServer.arg("id"), httpServer.arg("fname"), httpServer.arg("offset").toInt(),
+                                       httpServer.arg("size").toInt(), chunk_errmsg);
+    }
+    else if (raw.status == RAW_WRITE)
+    {
+        if (chunk_ok)
+        {
+            chunk_ok = upload_chunk_write (raw.buf, raw.currentSize, chunk_errmsg);
+        }
+    }
+    else if (raw.status == RAW_END || raw.status == RAW_ABORTED)                        // keep data of aborted chunk
+    {
+        if (! upload_chunk_end () && chunk_ok)
+        {
+            chunk_ok = false;
+            chunk_errmsg = "too many gaps or state not saved";
+        }
+    }
+}
+
+static void
+handle_chunk ()
+{
+    String  id      = httpServer.arg("id");
+    String  action  = httpServer.arg("action");
+    String  status;
+
+    if (httpServer.method() == HTTP_PUT && ! chunk_ok)
+    {
+        httpServer.send(400, "text/plain", (String) "ERROR " + chunk_errmsg + "\r\n");
+    }
+    else if (action.equals ("complete"))
+    {
+        String  fname;
+        String  errmsg;
+
+        if (upload_chunk_complete (id, httpServer.arg("sha256"), httpServer.arg("size").toInt(), get_base_address (), fname, errmsg))
+        {
+            httpServer.send(200, "text/plain", (String) "OK " + fname + "\r\n");
+        }
+        else
+        {
+            httpServer.send(400, "text/plain", (String) "ERROR " + errmsg + "\r\n");
+        }
+    }
+    else if (action.equals ("cancel"))
+    {
+        upload_chunk_cancel (id);
+        httpServer.send(200, "text/plain", "OK\r\n");
+    }
+    else
+    {
+        status = upload_chunk_status (id);
+
+        if (status.length() > 0)
+        {
+            httpServer.send(200, "text/plain", status);
+        }
+        else
+        {
+            httpServer.send(404, "text/plain", "ERROR unknown upload id\r\n");
+        }
+    }
 }
 
 void
@@ -370,10 +873,48 @@ handle_main ()
     html_header (title, url, false);
 
     sResponse += "<H3 style='margin-left:10px'>Welcome to STM32 OTA Flasher!</H3>";
+    sResponse += "<P style='margin-left:10px'>WiFi: " + wifi_status () + "\r\n";
     html_trailer ();
     httpServer.send(200, "text/html", sResponse);
 }
 
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * IP address as string, 0: empty string
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static String
+ip_string (uint32_t ip)
+{
+    return ip != 0 ? IPAddress(ip).toString() : (String) "";
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * get IP address argument, empty: 0, returns false if invalid
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static bool
+get_ip_arg (String name, uint32_t * ip)
+{
+    String      value = httpServer.arg(name);
+    IPAddress   addr;
+
+    value.trim ();
+
+    if (value.length() == 0)
+    {
+        *ip = 0;
+        return true;
+    }
+
+    if (! addr.fromString(value.c_str()))
+    {
+        return false;
+    }
+
+    *ip = (uint32_t) addr;
+    return true;
+}
+
 void
 handle_net()
 {
@@ -390,24 +931,30 @@ handle_net()
     {
         String  pssid     = httpServer.arg ("ssid");
         String  pkey      = httpServer.arg ("key");
+        EEPROM_IP_CONFIG ip_config;
 
-        if (! pssid.equals (eeprom_ssid))
+        if (! pssid.equals (eeprom_config.ssid))
         {
-            pssid.toCharArray(eeprom_ssid, EEPROM_SSID_LEN);
-            eeprom_save_ssid ();
+            pssid.toCharArray(eeprom_config.ssid, EEPROM_SSID_LEN + 1);
+            eeprom_config.wifi_cache.valid = 0;                                         // cached BSSID belongs to old SSID
         }
 
-        if (! pkey.equals (eeprom_ssidkey))
+        pkey.toCharArray (eeprom_config.ssidkey, EEPROM_SSID_KEY_LEN + 1);
+
+        if (! get_ip_arg ("ip", &ip_config.ip) || ! get_ip_arg ("gw", &ip_config.gateway) ||
+            ! get_ip_arg ("mask", &ip_config.netmask) || ! get_ip_arg ("dns", &ip_config.dns) ||
+            (ip_config.ip != 0 && ip_config.netmask == 0))
         {
-            pkey.toCharArray (eeprom_ssidkey, EEPROM_SSID_KEY_LEN);
-            eeprom_save_ssidkey ();
+            msg = "Invalid IP address or netmask missing!";
+        }
+        else
+        {
+            eeprom_config.static_ip = ip_config;
+            eeprom_config.flags &= ~EEPROM_FLAG_BOOT_AS_AP;
+            connect = true;
         }
 
-        eeprom_flags &= ~EEPROM_FLAG_BOOT_AS_AP;
-        eeprom_save_flags ();
-        eeprom_commit ();
-
-        connect = true;
+        eeprom_commit ();                                                               // writes only if changed
     }
     else if (action.equals ("ap"))
     {
@@ -420,22 +967,10 @@ handle_net()
         }
         else
         {
-            if (! ap_ssid.equals (eeprom_ap_ssid))
-            {
-                ap_ssid.toCharArray(eeprom_ap_ssid, EEPROM_AP_SSID_LEN);
-                eeprom_save_ap_ssid ();
-            }
-    
-            if (! ap_key.equals (eeprom_ap_ssidkey))
-            {
-                ap_key.toCharArray (eeprom_ap_ssidkey, EEPROM_AP_SSID_KEY_LEN);
-                eeprom_save_ap_ssidkey ();
-            }
-    
-            eeprom_flags |= EEPROM_FLAG_BOOT_AS_AP;
-            eeprom_save_flags ();
+            ap_ssid.toCharArray(eeprom_config.ap_ssid, EEPROM_AP_SSID_LEN + 1);
+            ap_key.toCharArray (eeprom_config.ap_ssidkey, EEPROM_AP_SSID_KEY_LEN + 1);
+            eeprom_config.flags |= EEPROM_FLAG_BOOT_AS_AP;
             eeprom_commit ();
-    
             ap = true;
         }
     }
@@ -452,16 +987,33 @@ handle_net()
     }
     else
     {
+        sResponse += "<P style='margin-left:10px'>" + wifi_status () + "\r\n";
         sResponse += (String) "<form method=\"GET\" action=\"/\">\r\n";
         sResponse += (String) "  <div style='margin:10px;padding:10px;border:1px lightgray solid; width:360px;'>\r\n";
         sResponse += (String) "  <table>\r\n";
         sResponse += (String) "    <tr>\r\n";
         sResponse += (String) "      <td width='100'>SSID</td>\r\n";
-        sResponse += (String) "      <td width='100'><input type=\"text\" id=\"ssid\" name=\"ssid\" value=\"" + eeprom_ssid + "\" maxlength=\"32\" size=\"32\"></td>\r\n";
+        sResponse += (String) "      <td width='100'><input type=\"text\" id=\"ssid\" name=\"ssid\" value=\"" + eeprom_config.ssid + "\" maxlength=\"32\" size=\"32\"></td>\r\n";
         sResponse += (String) "    </tr>\r\n";
         sResponse += (String) "    <tr>\r\n";
         sResponse += (String) "      <td>Key</td>\r\n";
-        sResponse += (String) "      <td><input type=\"text\" id=\"key\" name=\"key\" value=\"" + eeprom_ssidkey + "\" maxlength=\"64\" size=\"32\"></td>\r\n";
+        sResponse += (String) "      <td><input type=\"text\" id=\"key\" name=\"key\" value=\"" + eeprom_config.ssidkey + "\" maxlength=\"64\" size=\"32\"></td>\r\n";
+        sResponse += (String) "    </tr>\r\n";
+        sResponse += (String) "    <tr>\r\n";
+        sResponse += (String) "      <td>IP</td>\r\n";
+        sResponse += (String) "      <td><input type=\"text\" name=\"ip\" value=\"" + ip_string (eeprom_config.static_ip.ip) + "\" maxlength=\"15\" size=\"15\" title=\"empty: DHCP\"></td>\r\n";
+        sResponse += (String) "    </tr>\r\n";
+        sResponse += (String) "    <tr>\r\n";
+        sResponse += (String) "      <td>Gateway</td>\r\n";
+        sResponse += (String) "      <td><input type=\"text\" name=\"gw\" value=\"" + ip_string (eeprom_config.static_ip.gateway) + "\" maxlength=\"15\" size=\"15\"></td>\r\n";
+        sResponse += (String) "    </tr>\r\n";
+        sResponse += (String) "    <tr>\r\n";
+        sResponse += (String) "      <td>Netmask</td>\r\n";
+        sResponse += (String) "      <td><input type=\"text\" name=\"mask\" value=\"" + ip_string (eeprom_config.static_ip.netmask) + "\" maxlength=\"15\" size=\"15\"></td>\r\n";
+        sResponse += (String) "    </tr>\r\n";
+        sResponse += (String) "    <tr>\r\n";
+        sResponse += (String) "      <td>DNS</td>\r\n";
+        sResponse += (String) "      <td><input type=\"text\" name=\"dns\" value=\"" + ip_string (eeprom_config.static_ip.dns) + "\" maxlength=\"15\" size=\"15\"></td>\r\n";
         sResponse += (String) "    </tr>\r\n";
         sResponse += (String) "    <tr>\r\n";
         sResponse += (String) "      <td></td>\r\n";
@@ -476,11 +1028,11 @@ handle_net()
         sResponse += (String) "  <table>\r\n";
         sResponse += (String) "    <tr>\r\n";
         sResponse += (String) "      <td width='100'>AP SSID</td>\r\n";
-        sResponse += (String) "      <td width='100'><input type=\"text\" id=\"ssid\" name=\"ap_ssid\" value=\"" + eeprom_ap_ssid + "\" maxlength=\"32\" size=\"32\"></td>\r\n";
+        sResponse += (String) "      <td width='100'><input type=\"text\" id=\"ssid\" name=\"ap_ssid\" value=\"" + eeprom_config.ap_ssid + "\" maxlength=\"32\" size=\"32\"></td>\r\n";
         sResponse += (String) "    </tr>\r\n";
         sResponse += (String) "    <tr>\r\n";
         sResponse += (String) "      <td>Key</td>\r\n";
-        sResponse += (String) "      <td><input type=\"text\" id=\"key\" name=\"ap_key\" value=\"" + eeprom_ap_ssidkey + "\" maxlength=\"64\" size=\"32\"></td>\r\n";
+        sResponse += (String) "      <td><input type=\"text\" id=\"key\" name=\"ap_key\" value=\"" + eeprom_config.ap_ssidkey + "\" maxlength=\"64\" size=\"32\"></td>\r\n";
         sResponse += (String) "    </tr>\r\n";
         sResponse += (String) "    <tr>\r\n";
         sResponse += (String) "      <td></td>\r\n";
@@ -501,13 +1053,11 @@ handle_net()
 
     if (connect)
     {
-        delay (1000);
-        wifi_connect (eeprom_ssid, eeprom_ssidkey, true);
+        wifi_request_connect ();
     }
     else if (ap)
     {
-        delay (1000);
-        wifi_ap (eeprom_ap_ssid, eeprom_ap_ssidkey);
+        wifi_request_ap ();
     }
 }
 
@@ -561,6 +1111,7 @@ handle_flash ()
     String    title       = "Flash STM32";
     String    url         = "/flash";
     String    action      = httpServer.arg("action");
+    uint8_t   idx;
 
     html_header (title, url, false);
     httpServer.setContentLength(CONTENT_LENGTH_UNKNOWN);        // unknown length of output
@@ -577,16 +1128,242 @@ handle_flash ()
         String fname = httpServer.arg("fname");
 
         sResponse += (String) "<BR>\r\n";
-        stm32_flash_from_local (fname);
+        stm32_flash_from_local (fname, get_base_address (), get_flash_flags ());
+    }
+    else if (action.equals ("verify"))
+    {
+        String fname = httpServer.arg("fname");
+
+        sResponse += (String) "<BR>\r\n";
+        stm32_verify_from_local (fname, get_base_address ());
+    }
+    else if (action.equals ("farm"))
+    {
+        String fname = httpServer.arg("fname");
+
+        sResponse += (String) "<BR>\r\n";
+        stm32_farm_from_local (fname, get_base_address (), get_farm_targets (), httpServer.arg("mode").toInt ());
+    }
+    else if (action.equals ("replay"))
+    {
+        sResponse += (String) "<BR>\r\n";
+        stm32_replay_from_local (httpServer.arg("fname"), get_base_address (), httpServer.arg("session"), get_flash_flags ());
     }
     else if (action.equals ("reset"))
     {
         stm32_reset ();
     }
+    else if (action.equals ("dump"))
+    {
+        String errmsg;
+
+        sResponse += (String) "<BR>\r\n";
+
+        if (! stm32_dump_start (httpServer.arg("fname"), get_address_arg ("start", IMAGE_BIN_BASE_DEFAULT), get_address_arg ("len", 0), errmsg))
+        {
+            sResponse += "Read-out failed: " + errmsg + "<BR>\r\n";
+        }
+    }
+    else if (action.equals ("trace_on"))
+    {
+        if (! trace_enable (true))
+        {
+            sResponse += F("<BR>Not enough memory for trace buffer<BR>\r\n");
+        }
+    }
+    else if (action.equals ("trace_off"))
+    {
+        trace_enable (false);
+    }
+    else if (action.equals ("trace_clear"))
+    {
+        trace_clear ();
+    }
+    else if (action.equals ("settings"))
+    {
+        eeprom_config.baud      = get_address_arg ("baud", 0);
+        eeprom_config.verify    = httpServer.arg("verify").toInt ();
+        eeprom_config.erase     = httpServer.arg("erase").toInt ();
+        eeprom_commit ();
+
+        if (arbiter_owner () == ARBITER_OWNER_CONSOLE)                                 // else set at end of session
+        {
+            arbiter_uart_begin (arbiter_baud (), ARBITER_DEFAULT_CONFIG);
+        }
+    }
+    else if (action.equals ("targets"))
+    {
+        if (arbiter_owner () == ARBITER_OWNER_CONSOLE)
+        {
+            for (idx = 0; idx < TARGET_MAX; idx++)
+            {
+                EEPROM_TARGET t;
+
+                t.kind         = httpServer.arg((String) "k" + idx).toInt ();
+                t.rx_pin       = get_pin_arg ((String) "rx" + idx);
+                t.tx_pin       = get_pin_arg ((String) "tx" + idx);
+                t.reset_pin    = get_pin_arg ((String) "reset" + idx);
+                t.boot0_pin    = get_pin_arg ((String) "boot0" + idx);
+                t.mux          = httpServer.arg((String) "mux" + idx).toInt ();
+
+                if (t.kind > EEPROM_TARGET_EMULATED || t.mux > TARGET_MUX_CHANNELS)
+                {
+                    t.kind = EEPROM_TARGET_NONE;
+                }
+
+                if (! target_pins_valid (&t))                                           // keep old configuration
+                {
+                    sResponse += (String) "<BR>Target " + idx + ": missing, duplicate or reserved GPIO (" TARGET_PINS_RESERVED
+                                 ", GPIO16 not as RX), not changed<BR>\r\n";
+                    continue;
+                }
+
+                if (t.kind != EEPROM_TARGET_SOFT)                                       // don't store unused pins
+                {
+                    t.rx_pin    = 0;
+                    t.tx_pin    = 0;
+                }
+
+                if (t.kind != EEPROM_TARGET_UART && t.kind != EEPROM_TARGET_SOFT)
+                {
+                    t.reset_pin = 0;
+                    t.boot0_pin = 0;
+                }
+
+                eeprom_config.targets[idx] = t;
+            }
+
+            eeprom_commit ();
+            target_setup ();
+        }
+        else
+        {
+            sResponse += (String) "<BR>UART in use by " + arbiter_owner_name () + ", try again later<BR>\r\n";
+        }
+    }
+    else if (action.equals ("fleet"))
+    {
+        String fleet_url = httpServer.arg("fleet_url");
+
+        fleet_url.trim ();
+
+        if (fleet_url.length () == 0 || (fleet_url.startsWith ("http://") && fleet_url.length () <= EEPROM_FLEET_URL_LEN))
+        {
+            strcpy (eeprom_config.fleet_url, fleet_url.c_str ());
+            eeprom_config.fleet_interval = httpServer.arg("fleet_interval").toInt ();
+            eeprom_commit ();
+        }
+        else
+        {
+            sResponse += (String) "<BR>Manifest URL must start with http:// and have max. " + EEPROM_FLEET_URL_LEN + " characters<BR>\r\n";
+        }
+    }
+    else if (action.equals ("fleet_check"))
+    {
+        fleet_request ();                                                               // checked by fleet_loop () after this request
+    }
 
     sResponse += (String) "<form method='GET' action='" + url + "'>\r\n";
     sResponse += (String) "<P><button type='submit' name=\"action\" value=\"reset\">Reset STM32</button>\r\n";
     sResponse += (String) "</form>\r\n";
+
+    sResponse += (String) "<form method='GET' action='" + url + "'>\r\n";
+    sResponse += (String) "<P>Flash from URL <input type='text' name='fname' value='http://' size='32' title='streamed to STM32, not stored'>\r\n";
+    sResponse += (String) "base <input type='text' name='base' value='0x08000000' size='10' title='raw binary only, 0x2xxxxxxx: load into SRAM and run'>\r\n";
+    sResponse += (String) "<input type='checkbox' name='go' value='1' title='start image without reset'>Run\r\n";
+    sResponse += (String) "<button type='submit' name='action' value='flash'>Flash</button>\r\n";
+    sResponse += (String) "</form>\r\n";
+
+    sResponse += (String) "<form method='GET' action='" + url + "'>\r\n";
+    sResponse += (String) "<P>Read out flash: start <input type='text' name='start' value='0x08000000' size='10'>\r\n";
+    sResponse += (String) "length <input type='text' name='len' value='0x10000' size='8'>\r\n";
+    sResponse += (String) "file <input type='text' name='fname' value='/backup.bin' size='16' title='suffix .hex: INTEL HEX, else binary'>\r\n";
+    sResponse += (String) "<button type='submit' name='action' value='dump'>Save</button>\r\n";
+    sResponse += (String) "<button type='submit' formaction='/dump'>Download</button>\r\n";
+    sResponse += (String) "</form>\r\n";
+
+    sResponse += (String) "<form method='GET' action='" + url + "'>\r\n";
+    sResponse += (String) "<P>Replay session: file <input type='text' name='session' value='" TRANSPORT_SESSION_FNAME "' size='16'>\r\n";
+    sResponse += (String) "image <input type='text' name='fname' value='' size='16'>\r\n";
+    sResponse += (String) "<input type='checkbox' name='incr' value='1'>Incr.\r\n";
+    sResponse += (String) "<button type='submit' name='action' value='replay' title='flash image against recorded STM32 responses'>Replay</button>\r\n";
+    sResponse += (String) "</form>\r\n";
+
+    if (stm32_dump_status ().length () > 0)
+    {
+        sResponse += "<P>" + stm32_dump_status () + " <a href='" + url + "'>Refresh</a>\r\n";
+    }
+
+    sResponse += (String) "<form method='GET' action='" + url + "'>\r\n";
+
+    if (trace_enabled ())
+    {
+        sResponse += (String) "<P>Bootloader trace: " + trace_count () + " records\r\n";
+        sResponse += (String) "<button type='submit' name='action' value='trace_off'>Disable</button>\r\n";
+        sResponse += (String) "<button type='submit' name='action' value='trace_clear'>Clear</button>\r\n";
+        sResponse += (String) "<button type='submit' formaction='/trace'>Download</button>\r\n";
+    }
+    else
+    {
+        sResponse += (String) "<P>Bootloader trace: off\r\n";
+        sResponse += (String) "<button type='submit' name='action' value='trace_on'>Enable</button>\r\n";
+    }
+
+    sResponse += (String) "</form>\r\n";
+    sResponse += (String) "<form method='GET' action='" + url + "'>\r\n";
+    sResponse += (String) "<P>Settings: baud <input type='text' name='baud' value='" + arbiter_baud () + "' size='7'>\r\n";
+    sResponse += (String) "verify <select name='verify'><option value='0'>GET CHECKSUM if supported</option>";
+    sResponse += (String) "<option value='1'" + (eeprom_config.verify == EEPROM_VERIFY_READBACK ? " selected" : "") + ">Read back</option></select>\r\n";
+    sResponse += (String) "erase <select name='erase'><option value='0'>Mass erase unless Incr.</option>";
+    sResponse += (String) "<option value='1'" + (eeprom_config.erase == EEPROM_ERASE_PAGES ? " selected" : "") + ">Changed pages</option></select>\r\n";
+    sResponse += (String) "<button type='submit' name='action' value='settings'>Save</button>\r\n";
+    sResponse += (String) "</form>\r\n";
+
+    sResponse += (String) "<form method='GET' action='" + url + "'>\r\n";
+    sResponse += (String) "<P>Targets:\r\n<table>\r\n";
+    sResponse += (String) "<tr bgcolor='#e0e0e0'><th>#</th><th>Type</th><th>RX</th><th>TX</th><th>RESET</th><th>BOOT0</th><th>Mux</th></tr>\r\n";
+
+    for (idx = 0; idx < TARGET_MAX; idx++)
+    {
+        static const char * kinds[] = { "-", "UART", "Software serial", "Emulated" };
+        EEPROM_TARGET *     t       = eeprom_config.targets + idx;
+        uint8_t             i;
+
+        sResponse += (String) "<tr><td>" + idx + "</td><td><select name='k" + idx + "'>";
+
+        for (i = 0; i <= EEPROM_TARGET_EMULATED; i++)
+        {
+            sResponse += (String) "<option value='" + i + "'" + (t->kind == i ? " selected" : "") + ">" + (idx == 0 && i == 0 ? "Built-in" : kinds[i]) + "</option>";
+        }
+
+        sResponse += (String) "</select></td>\r\n";
+        sResponse += (String) "<td><input type='text' name='rx" + idx + "' value='" + t->rx_pin + "' size='2'></td>";
+        sResponse += (String) "<td><input type='text' name='tx" + idx + "' value='" + t->tx_pin + "' size='2'></td>";
+        sResponse += (String) "<td><input type='text' name='reset" + idx + "' value='" + t->reset_pin + "' size='2'></td>";
+        sResponse += (String) "<td><input type='text' name='boot0" + idx + "' value='" + t->boot0_pin + "' size='2'></td>";
+        sResponse += (String) "<td><select name='mux" + idx + "'><option value='0'>-</option>";
+
+        for (i = 1; i <= TARGET_MUX_CHANNELS; i++)
+        {
+            sResponse += (String) "<option value='" + i + "'" + (t->mux == i ? " selected" : "") + ">" + (i - 1) + "</option>";
+        }
+
+        sResponse += (String) "</select></td></tr>\r\n";
+    }
+
+    sResponse += (String) "</table>\r\n";
+    sResponse += (String) "<button type='submit' name='action' value='targets'>Save</button>\r\n";
+    sResponse += (String) "</form>\r\n";
+
+    sResponse += (String) "<form method='GET' action='" + url + "'>\r\n";
+    sResponse += (String) "<P>Fleet update: manifest <input type='text' name='fleet_url' value='" + eeprom_config.fleet_url + "' size='32' title='empty: disabled'>\r\n";
+    sResponse += (String) "every <input type='text' name='fleet_interval' value='" +
+                 (eeprom_config.fleet_interval ? eeprom_config.fleet_interval : FLEET_DEFAULT_INTERVAL) + "' size='4'> min\r\n";
+    sResponse += (String) "<button type='submit' name='action' value='fleet'>Save</button>\r\n";
+    sResponse += (String) "<button type='submit' name='action' value='fleet_check'>Check now</button>\r\n";
+    sResponse += (String) "<BR>" + fleet_status () + " <a href='/fleet'>Log</a>\r\n";
+    sResponse += (String) "</form>\r\n";
+    sResponse += (String) "<P>Console log: " + (conlog_end () - conlog_start ()) + " bytes <a href='/log'>Tail</a>\r\n";
     html_trailer ();                                        // send trailer part
     http_flush ();
     httpServer.sendContent("");                             // EOF: empty line
@@ -594,12 +1371,191 @@ handle_flash ()
 
 
 /*----------------------------------------------------------------------------------------------------------------------------------------
- * http_init
+ * flash read-out as download: GET /dump?start=<addr>&len=<len>&fname=<name>, fname suffix .hex: INTEL HEX, else binary
+ * Data is streamed directly from the STM32 to the client, nothing is stored in LittleFS.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static String                       dump_fname;
+static bool                         dump_headers_sent;
+
+static int
+dump_http_output (void * ctx, const uint8_t * buf, size_t len)
+{
+    (void) ctx;
+
+    if (! dump_headers_sent)                                                            // first data: bootloader connected
+    {
+        httpServer.sendHeader("Content-Disposition", "attachment; filename=\"" + dump_fname + "\"");
+        httpServer.setContentLength(CONTENT_LENGTH_UNKNOWN);
+        httpServer.send(200, "application/octet-stream", "");
+        dump_headers_sent = true;
+    }
+
+    httpServer.sendContent((const char *) buf, len);
+    return httpServer.client().connected() ? 0 : -1;
+}
+
+static void
+handle_dump ()
+{
+    String      fname   = httpServer.arg("fname");
+    uint32_t    start   = get_address_arg ("start", IMAGE_BIN_BASE_DEFAULT);
+    uint32_t    len     = get_address_arg ("len", 0);
+    uint8_t     format  = image_format (fname) == IMAGE_FORMAT_HEX ? STM32_DUMP_FORMAT_HEX : STM32_DUMP_FORMAT_BIN;
+    String      errmsg;
+
+    if (len == 0)
+    {
+        httpServer.send(400, "text/plain", "missing argument len\r\n");
+        return;
+    }
+
+    dump_fname          = fname.substring (fname.lastIndexOf ('/') + 1);
+    dump_headers_sent   = false;
+
+    if (dump_fname.length () == 0)
+    {
+        dump_fname = format == STM32_DUMP_FORMAT_HEX ? "backup.hex" : "backup.bin";
+    }
+
+    if (stm32_dump_stream (start, len, format, dump_http_output, 0, errmsg) < 0 && ! dump_headers_sent)
+    {
+        httpServer.send(500, "text/plain", "ERROR " + errmsg + "\r\n");
+    }
+    else
+    {
+        httpServer.sendContent("");                                                     // EOF, client sees truncated file on error
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * output function for streamed downloads with known length
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+stream_http_output (void * ctx, const uint8_t * buf, size_t len)
+{
+    (void) ctx;
+    httpServer.sendContent((const char *) buf, len);
+    return httpServer.client().connected() ? 0 : -1;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * bootloader trace as download: GET /trace, see trace.h for file format and tools/stm32trace.py for a decoder
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+
+static void
+handle_trace ()
+{
+    if (! trace_enabled ())
+    {
+        httpServer.send(404, "text/plain", "trace disabled\r\n");
+        return;
+    }
+
+    httpServer.sendHeader("Content-Disposition", "attachment; filename=\"trace.bin\"");
+    httpServer.setContentLength(trace_file_size ());
+    httpServer.send(200, "application/octet-stream", "");
+    trace_send (stream_http_output, 0);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * persistent console log as text: GET /log?tail=<len> (default) or GET /log?offset=<offset>[&len=<len>]
+ * Offsets count log bytes since creation of the log. X-Log-Offset and X-Log-End give the returned range, a live tail polls
+ * with offset=<X-Log-End>. X-Log-Start is the oldest byte still stored.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+handle_log ()
+{
+    uint32_t    start   = conlog_start ();
+    uint32_t    end     = conlog_end ();
+    uint32_t    offset;
+    uint32_t    len;
+
+    if (httpServer.hasArg("offset"))
+    {
+        offset  = get_address_arg ("offset", start);
+        len     = get_address_arg ("len", end - start);
+    }
+    else
+    {
+        len     = get_address_arg ("tail", CONLOG_TAIL_DEFAULT);
+        offset  = len < end - start ? end - len : start;
+    }
+
+    if (offset < start)
+    {
+        offset = start;
+    }
+
+    if (offset > end)
+    {
+        offset = end;
+    }
+
+    if (len > end - offset)
+    {
+        len = end - offset;
+    }
+
+    httpServer.sendHeader("X-Log-Start", String(start));
+    httpServer.sendHeader("X-Log-Offset", String(offset));
+    httpServer.sendHeader("X-Log-End", String(offset + len));
+    httpServer.sendHeader("X-Log-Boot", String(conlog_boot ()));
+    httpServer.setContentLength(CONTENT_LENGTH_UNKNOWN);                                // bytes of lost blocks are skipped
+    httpServer.send(200, "text/plain", "");
+    conlog_read (offset, len, stream_http_output, 0);                                   // client sees truncated text on error
+    httpServer.sendContent("");                                                         // EOF
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * output of last fleet update: GET /fleet
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+handle_fleet ()
+{
+    File f = LittleFS.open (FLEET_LOG_FNAME, "r");
+
+    if (! f)
+    {
+        httpServer.send(404, "text/plain", "no fleet update yet\r\n");
+        return;
+    }
+
+    httpServer.streamFile(f, "text/html");
+    f.close ();
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * flash job metrics since boot in Prometheus text format: GET /metrics
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+handle_metrics ()
+{
+    httpServer.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    httpServer.send(200, "text/plain; version=0.0.4", "");
+    sResponse = "";
+    metrics_send ();
+    httpServer.sendContent("");
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * http_init - called again after a reconnect or AP fallback: only announce the (new) address
  *----------------------------------------------------------------------------------------------------------------------------------------
  */
 void
 http_setup (void)
 {
+    if (http_started)
+    {
+        MDNS.announce();
+        return;
+    }
+
     LittleFS.begin();
     MDNS.begin(host);
     httpUpdater.setup(&httpServer);
@@ -609,8 +1565,18 @@ http_setup (void)
     httpServer.on("/upd", handle_upd);
     httpServer.on("/upl", handle_upl);
     httpServer.on("/flash", handle_flash);
+    httpServer.on("/dump", HTTP_GET, handle_dump);
+    httpServer.on("/metrics", HTTP_GET, handle_metrics);
+    httpServer.on("/trace", HTTP_GET, handle_trace);
+    httpServer.on("/log", HTTP_GET, handle_log);
+    httpServer.on("/fleet", HTTP_GET, handle_fleet);
     httpServer.on("/doupload", HTTP_POST, []() { httpServer.send(200); }, handle_doupload );
+    httpServer.on("/upload", HTTP_PUT, handle_rawupload_result, handle_rawupload );
+    httpServer.on("/upload", HTTP_POST, handle_rawupload_result, handle_rawupload );
+    httpServer.on("/chunk", HTTP_PUT, handle_chunk, handle_rawchunk );
+    httpServer.on("/chunk", HTTP_GET, handle_chunk);
     MDNS.addService("http", "tcp", 80);
+    http_started = true;
 }
 
 void
@@ -30,9 +30,12 @@
 #define FS(str)             String(F(str)).c_str()
 #define http_send_FS(x)     http_send(FS(x))                                         // leave string constants in flash memory
 
+typedef int (*HTTP_OUTPUT_FUNC) (void * ctx, const uint8_t * buf, size_t len);
+
 extern void                 http_send (const char *);
 extern void                 http_send_string (String);
 extern void                 http_flush (void);
+extern void                 http_redirect (HTTP_OUTPUT_FUNC, void *);
 extern void                 http_setup (void);
 extern void                 http_loop (void);
 
@@ -0,0 +1,244 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * httpclient.cpp - simple http client: GET with bounded buffer
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <ESP8266WiFi.h>
+#include <ESP8266HTTPClient.h>
+#include "httpclient.h"
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * request: connection and progress of body
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct
+{
+    WiFiClient                      client;
+    HTTPClient                      http;
+    int                             size;                                               // -1: unknown, read until close
+    uint32_t                        maxlen;
+    uint32_t                        total;                                              // bytes of body passed to func
+    unsigned long                   last;                                               // millis () of last data
+} HTTPCLIENT_REQUEST;
+
+static uint8_t                      httpclient_buf[HTTPCLIENT_BUFSIZE];
+static HTTPCLIENT_REQUEST           httpclient_bg;                                      // background download, see httpclient_start ()
+static bool                         httpclient_bg_active;
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * send GET request, check status and size of body
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static bool
+httpclient_open (HTTPCLIENT_REQUEST * req, String url, uint32_t maxlen, String & errmsg)
+{
+    int     code;
+
+    req->http.useHTTP10 (true);                                                         // no chunked encoding, body is read from stream
+    req->http.setTimeout (HTTPCLIENT_TIMEOUT_MSEC);
+
+    if (! req->http.begin (req->client, url))
+    {
+        errmsg = "invalid URL " + url;
+        return false;
+    }
+
+    code = req->http.GET ();
+
+    if (code != HTTP_CODE_OK)
+    {
+        errmsg = url + ": " + (code < 0 ? HTTPClient::errorToString (code) : (String) "HTTP status " + code);
+        req->http.end ();
+        return false;
+    }
+
+    req->size   = req->http.getSize ();
+    req->maxlen = maxlen;
+    req->total  = 0;
+    req->last   = millis ();
+
+    if (req->size > 0 && (uint32_t) req->size > maxlen)
+    {
+        errmsg = (String) "too large: " + req->size + " bytes";
+        req->http.end ();
+        return false;
+    }
+
+    return true;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * pass received data of body in chunks of HTTPCLIENT_BUFSIZE to func, max. max_buffers chunks
+ * Returns HTTPCLIENT_DONE, HTTPCLIENT_BUSY if the body is not complete yet or -1 on error
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+httpclient_read (HTTPCLIENT_REQUEST * req, uint8_t max_buffers, IMAGE_OUTPUT_FUNC func, void * ctx, String & errmsg)
+{
+    WiFiClient *    stream  = req->http.getStreamPtr ();
+    uint8_t         buffers = 0;
+    size_t          n;
+
+    while (req->size < 0 || req->total < (uint32_t) req->size)
+    {
+        n = stream->available ();
+
+        if (n > 0)
+        {
+            if (buffers == max_buffers)
+            {
+                return HTTPCLIENT_BUSY;
+            }
+
+            if (n > HTTPCLIENT_BUFSIZE)
+            {
+                n = HTTPCLIENT_BUFSIZE;
+            }
+
+            n = stream->read (httpclient_buf, n);
+
+            if (req->total + n > req->maxlen)
+            {
+                errmsg = (String) "more than " + req->maxlen + " bytes";
+                return -1;
+            }
+
+            if ((*func) (ctx, httpclient_buf, n) < 0)
+            {
+                errmsg = "aborted";
+                return -1;
+            }
+
+            req->total += n;
+            req->last   = millis ();
+            buffers++;
+        }
+        else if (! stream->connected ())
+        {
+            break;
+        }
+        else if (millis () - req->last > HTTPCLIENT_TIMEOUT_MSEC)
+        {
+            errmsg = "timeout";
+            return -1;
+        }
+        else
+        {
+            return HTTPCLIENT_BUSY;
+        }
+    }
+
+    if (req->size >= 0 && req->total != (uint32_t) req->size)
+    {
+        errmsg = (String) "connection closed after " + req->total + " of " + req->size + " bytes";
+        return -1;
+    }
+
+    return HTTPCLIENT_DONE;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * httpclient_get () - GET url, pass body to func, max. maxlen bytes
+ * Returns number of bytes or -1 on error
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+int32_t
+httpclient_get (String url, uint32_t maxlen, IMAGE_OUTPUT_FUNC func, void * ctx, String & errmsg)
+{
+    HTTPCLIENT_REQUEST  req;
+    uint32_t            total;
+    int                 rtc;
+
+    if (! httpclient_open (&req, url, maxlen, errmsg))
+    {
+        return -1;
+    }
+
+    do
+    {
+        total   = req.total;
+        rtc     = httpclient_read (&req, 1, func, ctx, errmsg);
+
+        if (rtc == HTTPCLIENT_BUSY && req.total == total)                              // wait for data
+        {
+            delay (1);
+        }
+    } while (rtc == HTTPCLIENT_BUSY);
+
+    req.http.end ();
+    return rtc < 0 ? -1 : (int32_t) req.total;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * httpclient_start () - start background download: GET url, the body of max. maxlen bytes is read by httpclient_poll ()
+ * Only the response header is awaited, a running background download is stopped
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+bool
+httpclient_start (String url, uint32_t maxlen, String & errmsg)
+{
+    httpclient_stop ();
+    httpclient_bg_active = httpclient_open (&httpclient_bg, url, maxlen, errmsg);
+    return httpclient_bg_active;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * httpclient_poll () - pass data received since the last call to func, max. HTTPCLIENT_POLL_BUFFERS chunks, to be called by loop ()
+ * Returns HTTPCLIENT_BUSY until the body is complete, then HTTPCLIENT_DONE, or -1 on error. The download ends with DONE or error.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+int
+httpclient_poll (IMAGE_OUTPUT_FUNC func, void * ctx, String & errmsg)
+{
+    int     rtc;
+
+    if (! httpclient_bg_active)
+    {
+        errmsg = "no download";
+        return -1;
+    }
+
+    rtc = httpclient_read (&httpclient_bg, HTTPCLIENT_POLL_BUFFERS, func, ctx, errmsg);
+
+    if (rtc != HTTPCLIENT_BUSY)
+    {
+        httpclient_stop ();
+    }
+
+    return rtc;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * httpclient_stop () - stop background download
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+httpclient_stop (void)
+{
+    if (httpclient_bg_active)
+    {
+        httpclient_bg.http.end ();
+        httpclient_bg_active = false;
+    }
+}
@@ -0,0 +1,56 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * httpclient.h - simple http client: GET with bounded buffer
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef HTTPCLIENT_H
+#define HTTPCLIENT_H
+
+#include "image.h"
+
+#define HTTPCLIENT_BUFSIZE          512                                                 // receive buffer
+#define HTTPCLIENT_TIMEOUT_MSEC     10000                                               // max. time without data
+#define HTTPCLIENT_POLL_BUFFERS     4                                                   // max. chunks per httpclient_poll ()
+
+#define HTTPCLIENT_DONE             0                                                   // httpclient_poll (): body complete
+#define HTTPCLIENT_BUSY             1                                                   // httpclient_poll (): call again
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * httpclient_get () passes the body in chunks of max. HTTPCLIENT_BUFSIZE bytes to func. Data not yet read stays in the TCP receive
+ * window: if func is slow, e.g. while programming the STM32, the server is throttled by TCP flow control and the download continues
+ * in the background while func is running.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+extern int32_t                      httpclient_get (String url, uint32_t maxlen, IMAGE_OUTPUT_FUNC func, void * ctx, String & errmsg);
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * Background download, one at a time: httpclient_start () sends the request, httpclient_poll () is called by loop () and passes
+ * only the data received meanwhile to func, so loop () isn't blocked while the server is sending.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+extern bool                         httpclient_start (String url, uint32_t maxlen, String & errmsg);
+extern int                          httpclient_poll (IMAGE_OUTPUT_FUNC func, void * ctx, String & errmsg);
+extern void                         httpclient_stop (void);
+
+#endif // HTTPCLIENT_H
@@ -0,0 +1,1507 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * image.cpp - STM32 image readers: INTEL HEX, Motorola S-record, raw binary, delta patch, library manifest
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <ESP8266WiFi.h>
+#include <LittleFS.h>
+#include "image.h"
+#include "stm32flash.h"
+
+#define hex2toi(pp)                 htoi(pp, 2)
+
+#define IMAGE_INFO_MAGIC            0x31474D49                                          // "IMG1"
+#define IMAGE_LAST_MAGIC            0x3154534C                                          // "LST1"
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * delta patch format (suffix .dlt), all values little endian, created by tools/mkdelta.py:
+ *
+ *   header:    "STMD" version(1) reserved(3) old_sha256(32) base_address(4) size(4) new_sha256(32)
+ *   ops:       0x01 src_offset(4) len(4)       COPY len bytes of last flashed image from src_offset
+ *              0x02 len(4) data(len)           DATA: insert len bytes
+ *              0x00                            END
+ *
+ * old_sha256 must match the last flashed image (IMAGE_LAST), the output is a flat binary of size bytes at base_address.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define DELTA_VERSION               1
+#define DELTA_OP_END                0x00
+#define DELTA_OP_COPY               0x01
+#define DELTA_OP_DATA               0x02
+
+#define DELTA_STATE_HEADER          0
+#define DELTA_STATE_OP              1
+#define DELTA_STATE_DATA            2
+#define DELTA_STATE_DONE            3
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * CRC32 (IEEE 802.3), 4 bit table to save RAM
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static const uint32_t               crc32_tab[16] =
+{
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+uint32_t
+image_crc32 (uint32_t crc, const uint8_t * buf, size_t len)
+{
+    size_t  i;
+
+    crc = ~crc;
+
+    for (i = 0; i < len; i++)
+    {
+        crc ^= buf[i];
+        crc = (crc >> 4) ^ crc32_tab[crc & 0x0F];
+        crc = (crc >> 4) ^ crc32_tab[crc & 0x0F];
+    }
+
+    return ~crc;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * convert SHA-256 digest to hex string
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+String
+image_sha256_string (const uint8_t * sha256)
+{
+    char    buf[2 * IMAGE_SHA256_LEN + 1];
+    int     i;
+
+    for (i = 0; i < IMAGE_SHA256_LEN; i++)
+    {
+        sprintf (buf + 2 * i, "%02x", sha256[i]);
+    }
+
+    return (String) buf;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * image_format () - get image format by suffix of filename, IMAGE_FORMAT_COMPRESSED is set for suffix .hs
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint8_t
+image_format (String fname)
+{
+    String  suffix;
+    uint8_t format;
+    int     pos = fname.lastIndexOf('.');
+
+    if (pos < 0)
+    {
+        return IMAGE_FORMAT_NONE;
+    }
+
+    suffix = fname.substring (pos);
+    suffix.toLowerCase();
+
+    if (suffix.equals (".hs"))                                                          // e.g. firmware.bin.hs
+    {
+        format = image_format (fname.substring (0, pos));
+
+        if (format != IMAGE_FORMAT_NONE)
+        {
+            format |= IMAGE_FORMAT_COMPRESSED;
+        }
+        return format;
+    }
+
+    if (suffix.equals (".hex") || suffix.equals (".ihx"))
+    {
+        return IMAGE_FORMAT_HEX;
+    }
+
+    if (suffix.equals (".srec") || suffix.equals (".s19") || suffix.equals (".s28") || suffix.equals (".s37") || suffix.equals (".mot"))
+    {
+        return IMAGE_FORMAT_SREC;
+    }
+
+    if (suffix.equals (".bin"))
+    {
+        return IMAGE_FORMAT_BIN;
+    }
+
+    if (suffix.equals (".dlt"))
+    {
+        return IMAGE_FORMAT_DELTA;
+    }
+
+    if (suffix.equals (IMAGE_MANIFEST_SUFFIX))
+    {
+        return IMAGE_FORMAT_MANIFEST;
+    }
+
+    return IMAGE_FORMAT_NONE;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * set error message, returns -1
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+image_reader_error (IMAGE_READER * rd, const char * msg, int value1, int value2)
+{
+    snprintf (rd->errmsg, sizeof (rd->errmsg), msg, rd->line, value1, value2);
+    rd->failed = true;
+    return -1;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * pass image data to callback, update info
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+image_reader_data (IMAGE_READER * rd, uint32_t address, uint8_t * data, uint16_t len)
+{
+    if (len > 0)
+    {
+        if (rd->info.address_min > address)
+        {
+            rd->info.address_min = address;
+        }
+
+        if (rd->info.address_max < address + len - 1)
+        {
+            rd->info.address_max = address + len - 1;
+        }
+
+        rd->info.data_bytes += len;
+        rd->info.crc32 = image_crc32 (rd->info.crc32, data, len);
+
+        if (rd->data_func && (*rd->data_func) (rd->data_ctx, address, data, len) < 0)
+        {
+            return image_reader_error (rd, "line %d: aborted", 0, 0);
+        }
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * handle one INTEL HEX record stored in linebuf
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+image_reader_hex_record (IMAGE_READER * rd)
+{
+    char *          linebuf = rd->linebuf;
+    int             len     = rd->idx;
+    unsigned char   datalen;
+    unsigned char   addrh;
+    unsigned char   addrl;
+    unsigned char   rectype;
+    unsigned char   chcksum;
+    uint32_t        drlo;                                                               // DATA Record Load Offset
+    uint32_t        value;
+    char *          dataptr;
+    int             sum;
+    int             dri;
+
+    if (linebuf[0] != ':' || len < 11)
+    {
+        return image_reader_error (rd, "line %d: invalid INTEL HEX format, len: %d", len, 0);
+    }
+
+    datalen = hex2toi (linebuf +  1);
+    addrh   = hex2toi (linebuf +  3);
+    addrl   = hex2toi (linebuf +  5);
+    drlo    = (addrh << 8 | addrl);
+    rectype = hex2toi (linebuf + 7);
+    dataptr = linebuf + 9;
+
+    if (len != 9 + 2 * datalen + 2)
+    {
+        return image_reader_error (rd, "line %d: invalid len: %d, expected %d", len, 9 + 2 * datalen + 2);
+    }
+
+    sum = datalen + addrh + addrl + rectype;
+
+    for (dri = 0; dri < datalen; dri++)
+    {
+        rd->databuf[dri] = hex2toi (dataptr);
+        sum += rd->databuf[dri];
+        dataptr += 2;
+    }
+
+    sum = (0x100 - (sum & 0xff)) & 0xff;
+    chcksum = hex2toi (dataptr);
+
+    if (sum != chcksum)
+    {
+        return image_reader_error (rd, "line %d: invalid checksum: sum: 0x%02X chcksum: 0x%02X", sum, chcksum);
+    }
+
+    if (rectype == 0)                                                                   // Data Record
+    {
+        return image_reader_data (rd, rd->ulba + drlo, rd->databuf, datalen);
+    }
+    else if (rectype == 1)                                                              // End of File Record
+    {
+        rd->eof_record_found = true;
+    }
+    else if (rectype >= 2 && rectype <= 5)                                              // Extended Segment/Linear Address, Start Segment/Linear Address
+    {
+        if (drlo != 0)
+        {
+            return image_reader_error (rd, "line %d: rectype = %d: address field is 0x%04X", rectype, drlo);
+        }
+
+        value = 0;
+
+        for (dri = 0; dri < datalen; dri++)
+        {
+            value <<= 8;
+            value |= rd->databuf[dri];
+        }
+
+        if (rectype == 2)                                                               // Extended Segment Address Record
+        {
+            rd->ulba = value << 4;
+        }
+        else if (rectype == 3)                                                          // Start Segment Address Record: CS:IP
+        {
+            rd->info.start_address = ((value >> 16) << 4) + (value & 0xFFFF);
+        }
+        else if (rectype == 4)                                                          // Extended Linear Address Record
+        {
+            rd->ulba = value << 16;
+        }
+        else                                                                            // Start Linear Address Record
+        {
+            rd->info.start_address = value;
+        }
+    }
+    else
+    {
+        return image_reader_error (rd, "line %d: unsupported record type: %d", rectype, 0);
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * handle one Motorola S-record stored in linebuf
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+image_reader_srec_record (IMAGE_READER * rd)
+{
+    char *          linebuf = rd->linebuf;
+    int             len     = rd->idx;
+    unsigned char   rectype;
+    unsigned char   count;                                                              // number of bytes: address + data + checksum
+    unsigned char   chcksum;
+    int             addrlen;
+    uint32_t        address;
+    char *          dataptr;
+    int             sum;
+    int             i;
+
+    if (linebuf[0] != 'S' || len < 4 || linebuf[1] < '0' || linebuf[1] > '9')
+    {
+        return image_reader_error (rd, "line %d: invalid S-record format, len: %d", len, 0);
+    }
+
+    rectype = linebuf[1] - '0';
+    count   = hex2toi (linebuf + 2);
+    dataptr = linebuf + 4;
+
+    if (len != 4 + 2 * count)
+    {
+        return image_reader_error (rd, "line %d: invalid len: %d, expected %d", len, 4 + 2 * count);
+    }
+
+    switch (rectype)
+    {
+        case 0: case 1: case 5: case 9:     addrlen = 2;    break;
+        case 2: case 6: case 8:             addrlen = 3;    break;
+        case 3: case 7:                     addrlen = 4;    break;
+        default:                            return image_reader_error (rd, "line %d: unsupported record type: S%d", rectype, 0);
+    }
+
+    if (count < addrlen + 1)
+    {
+        return image_reader_error (rd, "line %d: S%d record too short", rectype, 0);
+    }
+
+    sum = count;
+
+    for (i = 0; i < count - 1; i++)
+    {
+        rd->databuf[i] = hex2toi (dataptr);
+        sum += rd->databuf[i];
+        dataptr += 2;
+    }
+
+    sum = ~sum & 0xff;
+    chcksum = hex2toi (dataptr);
+
+    if (sum != chcksum)
+    {
+        return image_reader_error (rd, "line %d: invalid checksum: sum: 0x%02X chcksum: 0x%02X", sum, chcksum);
+    }
+
+    address = 0;
+
+    for (i = 0; i < addrlen; i++)
+    {
+        address <<= 8;
+        address |= rd->databuf[i];
+    }
+
+    if (rectype >= 1 && rectype <= 3)                                                   // S1, S2, S3: data
+    {
+        return image_reader_data (rd, address, rd->databuf + addrlen, count - 1 - addrlen);
+    }
+    else if (rectype >= 7)                                                              // S7, S8, S9: start address, termination
+    {
+        rd->info.start_address = address;
+        rd->eof_record_found = true;
+    }
+                                                                                        // S0 (header), S5, S6 (record count): ignore
+    return 0;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * handle one line
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+image_reader_record (IMAGE_READER * rd)
+{
+    rd->linebuf[rd->idx] = '\0';
+
+    if (rd->format == IMAGE_FORMAT_HEX)
+    {
+        return image_reader_hex_record (rd);
+    }
+    return image_reader_srec_record (rd);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * get 32 bit little endian value
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint32_t
+get_le32 (const uint8_t * p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * pass patched data to callback
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+image_delta_output (IMAGE_READER * rd, const uint8_t * data, uint32_t len)
+{
+    IMAGE_DELTA *   d = rd->delta;
+
+    if (d->out_offset + len > d->size)
+    {
+        return image_reader_error (rd, "op %d: output exceeds image size %d", d->size, 0);
+    }
+
+    br_sha256_update (&d->sha256_ctx, data, len);
+    d->out_offset += len;
+
+    return image_reader_data (rd, d->base_address + d->out_offset - len, (uint8_t *) data, len);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * check patch header, open last flashed image
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+image_delta_header (IMAGE_READER * rd)
+{
+    IMAGE_DELTA *   d = rd->delta;
+    IMAGE_LAST      last;
+
+    if (memcmp (d->header, "STMD", 4) != 0 || d->header[4] != DELTA_VERSION)
+    {
+        return image_reader_error (rd, "op %d: invalid patch header, version %d", d->header[4], 0);
+    }
+
+    if (! image_last_load (&last))
+    {
+        return image_reader_error (rd, "op %d: no last flashed image available", 0, 0);
+    }
+
+    if (memcmp (d->header + 8, last.sha256, IMAGE_SHA256_LEN) != 0)
+    {
+        return image_reader_error (rd, "op %d: patch does not match last flashed image", 0, 0);
+    }
+
+    d->base_address = get_le32 (d->header + 40);
+    d->size         = get_le32 (d->header + 44);
+
+    if (d->size == 0)
+    {
+        return image_reader_error (rd, "op %d: empty image", 0, 0);
+    }
+
+    d->old_fp = LittleFS.open (IMAGE_LAST_BIN, "r");
+
+    if (! d->old_fp)
+    {
+        return image_reader_error (rd, "op %d: cannot open last flashed image", 0, 0);
+    }
+
+    br_sha256_init (&d->sha256_ctx);
+    return 0;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * execute COPY op: read from last flashed image
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+image_delta_copy (IMAGE_READER * rd, uint32_t src_offset, uint32_t len)
+{
+    IMAGE_DELTA *   d = rd->delta;
+    uint32_t        n;
+
+    if (src_offset + len < src_offset || src_offset + len > d->old_fp.size ())
+    {
+        return image_reader_error (rd, "op %d: copy source 0x%X exceeds last flashed image", src_offset, 0);
+    }
+
+    if (! d->old_fp.seek (src_offset))
+    {
+        return image_reader_error (rd, "op %d: seek to 0x%X failed", src_offset, 0);
+    }
+
+    while (len > 0)
+    {
+        n = len < sizeof (rd->databuf) ? len : sizeof (rd->databuf);
+
+        if (d->old_fp.read (rd->databuf, n) != n)
+        {
+            return image_reader_error (rd, "op %d: read error in last flashed image", 0, 0);
+        }
+
+        if (image_delta_output (rd, rd->databuf, n) < 0)
+        {
+            return -1;
+        }
+
+        len -= n;
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * parse delta patch, rd->line counts the ops
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+image_delta_parse (IMAGE_READER * rd, const uint8_t * buf, size_t len)
+{
+    IMAGE_DELTA *   d = rd->delta;
+    uint8_t         oplen;
+    uint32_t        n;
+
+    while (len > 0 && d->state != DELTA_STATE_DONE)                                     // ignore everything behind END
+    {
+        if (d->state == DELTA_STATE_HEADER)
+        {
+            d->header[d->idx++] = *buf++;
+            len--;
+
+            if (d->idx == IMAGE_DELTA_HEADER_LEN)
+            {
+                if (image_delta_header (rd) < 0)
+                {
+                    return -1;
+                }
+
+                d->idx = 0;
+                d->state = DELTA_STATE_OP;
+            }
+        }
+        else if (d->state == DELTA_STATE_OP)
+        {
+            d->op[d->idx++] = *buf++;
+            len--;
+
+            switch (d->op[0])
+            {
+                case DELTA_OP_END:  oplen = 1;  break;
+                case DELTA_OP_COPY: oplen = 9;  break;
+                case DELTA_OP_DATA: oplen = 5;  break;
+                default:            return image_reader_error (rd, "op %d: invalid op code 0x%02X", d->op[0], 0);
+            }
+
+            if (d->idx == oplen)
+            {
+                rd->line++;
+                d->idx = 0;
+
+                if (d->op[0] == DELTA_OP_END)
+                {
+                    d->state = DELTA_STATE_DONE;
+                    rd->eof_record_found = true;
+                }
+                else if (d->op[0] == DELTA_OP_COPY)
+                {
+                    if (image_delta_copy (rd, get_le32 (d->op + 1), get_le32 (d->op + 5)) < 0)
+                    {
+                        return -1;
+                    }
+                }
+                else
+                {
+                    d->data_len = get_le32 (d->op + 1);
+
+                    if (d->data_len > 0)
+                    {
+                        d->state = DELTA_STATE_DATA;
+                    }
+                }
+            }
+        }
+        else                                                                            // DELTA_STATE_DATA
+        {
+            n = len < d->data_len ? len : d->data_len;
+
+            if (image_delta_output (rd, buf, n) < 0)
+            {
+                return -1;
+            }
+
+            buf += n;
+            len -= n;
+            d->data_len -= n;
+
+            if (d->data_len == 0)
+            {
+                d->state = DELTA_STATE_OP;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * finish delta patch: check size and SHA-256 of patched image
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+image_delta_end (IMAGE_READER * rd)
+{
+    IMAGE_DELTA *   d = rd->delta;
+    uint8_t         sha256[IMAGE_SHA256_LEN];
+
+    if (d->state != DELTA_STATE_DONE)
+    {
+        return image_reader_error (rd, "op %d: no END op found. File may be incomplete.", 0, 0);
+    }
+
+    if (d->out_offset != d->size)
+    {
+        return image_reader_error (rd, "op %d: patched image has %d bytes, expected %d", d->out_offset, d->size);
+    }
+
+    br_sha256_out (&d->sha256_ctx, sha256);
+
+    if (memcmp (sha256, d->header + 48, IMAGE_SHA256_LEN) != 0)
+    {
+        return image_reader_error (rd, "op %d: SHA-256 of patched image does not match", 0, 0);
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * image_cas_chunk_path () - get filename of library chunk
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+String
+image_cas_chunk_path (const uint8_t * id)
+{
+    char    buf[2 * IMAGE_CAS_ID_LEN + 1];
+    int     i;
+
+    for (i = 0; i < IMAGE_CAS_ID_LEN; i++)
+    {
+        sprintf (buf + 2 * i, "%02x", id[i]);
+    }
+
+    return (String) IMAGE_CAS_DIR + "/" + buf;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * read one chunk of library image, check its id and pass data to callback
+ * The chunk is hashed before any of its data is passed: the info of a checked manifest is cached, so a chunk file corrupted
+ * later would otherwise be detected only after part of it has been flashed.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+image_manifest_chunk (IMAGE_READER * rd)
+{
+    IMAGE_MANIFEST_READER * m = rd->manifest;
+    br_sha256_context       ctx;
+    uint8_t                 sha256[IMAGE_SHA256_LEN];
+    uint32_t                len;
+    uint32_t                n;
+    uint32_t                i;
+    bool                    empty = true;
+
+    if (m->chunk >= m->header.n_chunks)
+    {
+        return image_reader_error (rd, "chunk %d: more chunks than announced (%d)", m->header.n_chunks, 0);
+    }
+
+    len = m->header.size - m->out_offset;
+
+    if (len > IMAGE_CAS_CHUNK_SIZE)
+    {
+        len = IMAGE_CAS_CHUNK_SIZE;
+    }
+
+    for (i = 0; i < IMAGE_CAS_ID_LEN; i++)
+    {
+        if (m->id[i])
+        {
+            empty = false;
+            break;
+        }
+    }
+
+    if (empty)                                                                          // nothing to write, but hash it
+    {
+        memset (rd->databuf, 0xFF, sizeof (rd->databuf));
+
+        for (i = 0; i < len; i += n)
+        {
+            n = len - i < sizeof (rd->databuf) ? len - i : sizeof (rd->databuf);
+            br_sha256_update (&m->sha256_ctx, rd->databuf, n);
+        }
+    }
+    else
+    {
+        File f = LittleFS.open (image_cas_chunk_path (m->id), "r");
+
+        if (! f || f.size () != len)
+        {
+            return image_reader_error (rd, "chunk %d: chunk file missing or has wrong size", 0, 0);
+        }
+
+        br_sha256_init (&ctx);
+
+        for (i = 0; i < len; i += n)                                                    // 1st pass: check id
+        {
+            n = len - i < sizeof (rd->databuf) ? len - i : sizeof (rd->databuf);
+
+            if (f.read (rd->databuf, n) != n)
+            {
+                f.close ();
+                return image_reader_error (rd, "chunk %d: read error", 0, 0);
+            }
+
+            br_sha256_update (&ctx, rd->databuf, n);
+        }
+
+        br_sha256_out (&ctx, sha256);
+
+        if (memcmp (sha256, m->id, IMAGE_CAS_ID_LEN) != 0)
+        {
+            f.close ();
+            return image_reader_error (rd, "chunk %d: chunk file corrupted", 0, 0);
+        }
+
+        if (! f.seek (0, SeekSet))
+        {
+            f.close ();
+            return image_reader_error (rd, "chunk %d: read error", 0, 0);
+        }
+
+        for (i = 0; i < len; i += n)                                                    // 2nd pass: pass data
+        {
+            n = len - i < sizeof (rd->databuf) ? len - i : sizeof (rd->databuf);
+
+            if (f.read (rd->databuf, n) != n)
+            {
+                f.close ();
+                return image_reader_error (rd, "chunk %d: read error", 0, 0);
+            }
+
+            br_sha256_update (&m->sha256_ctx, rd->databuf, n);
+
+            if (image_reader_data (rd, m->header.base_address + m->out_offset + i, rd->databuf, n) < 0)
+            {
+                f.close ();
+                return -1;
+            }
+        }
+
+        f.close ();
+    }
+
+    m->out_offset += len;
+    m->chunk++;
+    rd->line = m->chunk;
+    return 0;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * parse manifest of library image, rd->line counts the chunks
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+image_manifest_parse (IMAGE_READER * rd, const uint8_t * buf, size_t len)
+{
+    IMAGE_MANIFEST_READER * m = rd->manifest;
+
+    while (len > 0)
+    {
+        if (! m->header_complete)
+        {
+            ((uint8_t *) &m->header)[m->idx++] = *buf++;
+            len--;
+
+            if (m->idx == sizeof (IMAGE_MANIFEST))
+            {
+                if (m->header.magic != IMAGE_MANIFEST_MAGIC || m->header.size == 0 ||
+                    m->header.n_chunks != (m->header.size + IMAGE_CAS_CHUNK_SIZE - 1) / IMAGE_CAS_CHUNK_SIZE)
+                {
+                    return image_reader_error (rd, "chunk %d: invalid manifest header", 0, 0);
+                }
+
+                br_sha256_init (&m->sha256_ctx);
+                m->header_complete = true;
+                m->idx = 0;
+            }
+        }
+        else
+        {
+            m->id[m->idx++] = *buf++;
+            len--;
+
+            if (m->idx == IMAGE_CAS_ID_LEN)
+            {
+                if (image_manifest_chunk (rd) < 0)
+                {
+                    return -1;
+                }
+
+                m->idx = 0;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * finish manifest: check number of chunks and SHA-256 of image
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+image_manifest_end (IMAGE_READER * rd)
+{
+    IMAGE_MANIFEST_READER * m = rd->manifest;
+    uint8_t                 sha256[IMAGE_SHA256_LEN];
+
+    if (! m->header_complete || m->chunk != m->header.n_chunks || m->idx != 0)
+    {
+        return image_reader_error (rd, "chunk %d: manifest incomplete, expected %d chunks", m->header.n_chunks, 0);
+    }
+
+    br_sha256_out (&m->sha256_ctx, sha256);
+
+    if (memcmp (sha256, m->header.sha256, IMAGE_SHA256_LEN) != 0)
+    {
+        return image_reader_error (rd, "chunk %d: SHA-256 of image does not match manifest", 0, 0);
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * free decoder, delta and manifest state
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+image_reader_free (IMAGE_READER * rd)
+{
+    if (rd->hs)
+    {
+        free (rd->hs);
+        rd->hs = (HS_DECODER *) 0;
+    }
+
+    if (rd->delta)
+    {
+        if (rd->delta->old_fp)
+        {
+            rd->delta->old_fp.close ();
+        }
+
+        delete rd->delta;
+        rd->delta = (IMAGE_DELTA *) 0;
+    }
+
+    if (rd->manifest)
+    {
+        free (rd->manifest);
+        rd->manifest = (IMAGE_MANIFEST_READER *) 0;
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * image_reader_begin () - start reading a new image
+ *
+ * base_address is only used for raw binary images
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+image_reader_begin (IMAGE_READER * rd, uint8_t format, uint32_t base_address, IMAGE_DATA_FUNC data_func, void * data_ctx)
+{
+    image_reader_free (rd);                                                             // previous image not finished
+
+    memset (rd, 0, sizeof (IMAGE_READER));
+    rd->format              = format & IMAGE_FORMAT_MASK;
+    rd->base_address        = base_address;
+    rd->info.address_min    = 0xffffffff;
+    rd->data_func           = data_func;
+    rd->data_ctx            = data_ctx;
+    br_sha256_init (&rd->sha256_ctx);
+
+    if (format & IMAGE_FORMAT_COMPRESSED)
+    {
+        rd->hs = (HS_DECODER *) malloc (sizeof (HS_DECODER));                           // window is only needed while reading
+
+        if (rd->hs)
+        {
+            hs_decoder_init (rd->hs);
+        }
+        else
+        {
+            image_reader_error (rd, "line %d: out of memory", 0, 0);
+        }
+    }
+
+    if (rd->format == IMAGE_FORMAT_DELTA)
+    {
+        rd->delta = new IMAGE_DELTA ();                                                 // holds a File, so no malloc ()
+    }
+    else if (rd->format == IMAGE_FORMAT_MANIFEST)
+    {
+        rd->manifest = (IMAGE_MANIFEST_READER *) calloc (1, sizeof (IMAGE_MANIFEST_READER));
+
+        if (! rd->manifest)
+        {
+            image_reader_error (rd, "line %d: out of memory", 0, 0);
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * parse decoded image data
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+image_reader_parse (void * ctx, const uint8_t * buf, size_t len)
+{
+    IMAGE_READER *  rd = (IMAGE_READER *) ctx;
+    size_t          i;
+    char            ch;
+
+    if (rd->format == IMAGE_FORMAT_BIN)
+    {
+        rd->bin_offset += len;
+        return image_reader_data (rd, rd->base_address + rd->bin_offset - len, (uint8_t *) buf, len);
+    }
+
+    if (rd->format == IMAGE_FORMAT_DELTA)
+    {
+        return image_delta_parse (rd, buf, len);
+    }
+
+    if (rd->format == IMAGE_FORMAT_MANIFEST)
+    {
+        return image_manifest_parse (rd, buf, len);
+    }
+
+    if (rd->format != IMAGE_FORMAT_HEX && rd->format != IMAGE_FORMAT_SREC)
+    {
+        return 0;
+    }
+
+    for (i = 0; i < len && ! rd->eof_record_found; i++)                                 // ignore everything behind EOF record
+    {
+        ch = buf[i];
+
+        if (ch == '\n')
+        {
+            rd->line++;
+
+            if (rd->idx > 0)
+            {
+                if (image_reader_record (rd) < 0)
+                {
+                    return -1;
+                }
+
+                rd->idx = 0;
+            }
+        }
+        else if (ch != '\r')
+        {
+            if (rd->idx < IMAGE_LINE_BUFSIZE - 1)
+            {
+                rd->linebuf[rd->idx] = ch;
+                rd->idx++;
+            }
+            else
+            {
+                return image_reader_error (rd, "line %d: line too long", 0, 0);
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * image_reader_feed () - feed next chunk of image file, chunks may split lines or compressed tokens anywhere
+ * Returns -1 on error
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+int
+image_reader_feed (IMAGE_READER * rd, const uint8_t * buf, size_t len)
+{
+    if (rd->failed)
+    {
+        return -1;
+    }
+
+    br_sha256_update (&rd->sha256_ctx, buf, len);
+    rd->info.file_size += len;
+
+    if (rd->hs)
+    {
+        return hs_decoder_feed (rd->hs, buf, len, image_reader_parse, rd);
+    }
+    return image_reader_parse (rd, buf, len);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * image_reader_end () - finish image, handles last line without newline
+ * Returns -1 on error
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+int
+image_reader_end (IMAGE_READER * rd)
+{
+    br_sha256_out (&rd->sha256_ctx, rd->info.sha256);
+
+    if (rd->hs && ! rd->failed)
+    {
+        hs_decoder_finish (rd->hs, image_reader_parse, rd);
+    }
+
+    if (rd->delta && ! rd->failed)
+    {
+        image_delta_end (rd);
+    }
+
+    if (rd->manifest && ! rd->failed)
+    {
+        image_manifest_end (rd);
+    }
+
+    image_reader_free (rd);
+
+    if (rd->failed)
+    {
+        return -1;
+    }
+
+    if (rd->format == IMAGE_FORMAT_HEX || rd->format == IMAGE_FORMAT_SREC)
+    {
+        if (rd->idx > 0 && ! rd->eof_record_found)
+        {
+            rd->line++;
+
+            if (image_reader_record (rd) < 0)
+            {
+                return -1;
+            }
+        }
+
+        if (! rd->eof_record_found)
+        {
+            return image_reader_error (rd, "no EOF/termination record found. File may be incomplete.", 0, 0);
+        }
+    }
+    else if (rd->format == IMAGE_FORMAT_BIN && rd->bin_offset == 0)
+    {
+        return image_reader_error (rd, "empty file", 0, 0);
+    }
+
+    if (rd->info.data_bytes == 0)
+    {
+        rd->info.address_min = 0;
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * image_read_file () - read complete image file, reader must be initialized by image_reader_begin ()
+ * Returns -1 on error
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define IMAGE_READ_BUFSIZE          512
+
+int
+image_read_file (String fname, IMAGE_READER * rd)
+{
+    uint8_t     buf[IMAGE_READ_BUFSIZE];
+    int         len;
+
+    File f = LittleFS.open (fname, "r");
+
+    if (! f)
+    {
+        rd->failed = true;
+        strcpy (rd->errmsg, "cannot open file");
+        return -1;
+    }
+
+    while ((len = f.read (buf, IMAGE_READ_BUFSIZE)) > 0)
+    {
+        if (image_reader_feed (rd, buf, len) < 0)
+        {
+            break;
+        }
+
+        yield ();
+    }
+
+    f.close ();
+
+    return image_reader_end (rd);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * write one INTEL HEX record
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+image_hex_record (IMAGE_HEX_WRITER * w, uint8_t rectype, uint16_t offset, const uint8_t * data, uint8_t len)
+{
+    char        buf[1 + 2 * (4 + 255 + 1) + 2 + 1];
+    uint8_t     sum;
+    int         pos;
+    uint8_t     i;
+
+    sum = len + (offset >> 8) + (offset & 0xFF) + rectype;
+    pos = sprintf (buf, ":%02X%04X%02X", len, offset, rectype);
+
+    for (i = 0; i < len; i++)
+    {
+        sum += data[i];
+        pos += sprintf (buf + pos, "%02X", data[i]);
+    }
+
+    pos += sprintf (buf + pos, "%02X\r\n", (uint8_t) (0x100 - sum));
+    return (*w->out_func) (w->out_ctx, (uint8_t *) buf, pos);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * image_hex_writer_begin () - start writing INTEL HEX
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+image_hex_writer_begin (IMAGE_HEX_WRITER * w, IMAGE_OUTPUT_FUNC out_func, void * out_ctx)
+{
+    w->ulba     = 0xFFFFFFFF;                                                           // force Extended Linear Address record
+    w->out_func = out_func;
+    w->out_ctx  = out_ctx;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * image_hex_writer_data () - write data as INTEL HEX data records
+ * Returns -1 if output failed
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+int
+image_hex_writer_data (IMAGE_HEX_WRITER * w, uint32_t address, const uint8_t * data, uint16_t len)
+{
+    uint8_t     ulba_data[2];
+    uint16_t    n;
+
+    while (len > 0)
+    {
+        if ((address & 0xFFFF0000) != w->ulba)
+        {
+            w->ulba         = address & 0xFFFF0000;
+            ulba_data[0]    = w->ulba >> 24;
+            ulba_data[1]    = w->ulba >> 16;
+
+            if (image_hex_record (w, 4, 0, ulba_data, 2) < 0)
+            {
+                return -1;
+            }
+        }
+
+        n = IMAGE_HEX_RECORD_LEN - (address % IMAGE_HEX_RECORD_LEN);                    // keep records aligned
+
+        if (n > len)
+        {
+            n = len;
+        }
+
+        if (image_hex_record (w, 0, address & 0xFFFF, data, n) < 0)
+        {
+            return -1;
+        }
+
+        address += n;
+        data    += n;
+        len     -= n;
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * image_hex_writer_end () - write Start Linear Address (if not 0) and End of File record
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+int
+image_hex_writer_end (IMAGE_HEX_WRITER * w, uint32_t start_address)
+{
+    uint8_t     sla[4];
+
+    if (start_address)
+    {
+        sla[0] = start_address >> 24;
+        sla[1] = start_address >> 16;
+        sla[2] = start_address >> 8;
+        sla[3] = start_address;
+
+        if (image_hex_record (w, 5, 0, sla, 4) < 0)
+        {
+            return -1;
+        }
+    }
+
+    return image_hex_record (w, 1, 0, (uint8_t *) 0, 0);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * image_info_load () - load info of a checked image
+ * Returns false if image was not checked or has changed since
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+bool
+image_info_load (String fname, IMAGE_INFO * info)
+{
+    uint32_t    magic   = 0;
+    bool        rtc     = false;
+
+    File f = LittleFS.open (fname + IMAGE_INFO_SUFFIX, "r");
+
+    if (f)
+    {
+        if (f.read ((uint8_t *) &magic, sizeof (magic)) == sizeof (magic) && magic == IMAGE_INFO_MAGIC &&
+            f.read ((uint8_t *) info, sizeof (IMAGE_INFO)) == sizeof (IMAGE_INFO))
+        {
+            rtc = true;
+        }
+
+        f.close ();
+    }
+
+    if (rtc)
+    {
+        File img = LittleFS.open (fname, "r");
+
+        if (! img || img.size () != info->file_size)                                    // file replaced or truncated
+        {
+            rtc = false;
+        }
+
+        if (img)
+        {
+            img.close ();
+        }
+    }
+
+    return rtc;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * image_info_save () - mark image as checked
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+bool
+image_info_save (String fname, IMAGE_INFO * info)
+{
+    uint32_t    magic   = IMAGE_INFO_MAGIC;
+    bool        rtc     = false;
+
+    File f = LittleFS.open (fname + IMAGE_INFO_SUFFIX, "w");
+
+    if (f)
+    {
+        if (f.write ((uint8_t *) &magic, sizeof (magic)) == sizeof (magic) &&
+            f.write ((uint8_t *) info, sizeof (IMAGE_INFO)) == sizeof (IMAGE_INFO))
+        {
+            rtc = true;
+        }
+
+        f.close ();
+    }
+
+    return rtc;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * image_info_remove () - remove check mark of image
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+image_info_remove (String fname)
+{
+    LittleFS.remove (fname + IMAGE_INFO_SUFFIX);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * image_is_info_file () - check if file is an image info file
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+bool
+image_is_info_file (String fname)
+{
+    return fname.endsWith (IMAGE_INFO_SUFFIX);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * image_flat_open () - create flat binary file
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+bool
+image_flat_open (IMAGE_FLAT * flat, const char * fname, uint32_t base_address)
+{
+    flat->fp            = LittleFS.open (fname, "w");
+    flat->base_address  = base_address;
+    flat->size          = 0;
+    flat->failed        = ! flat->fp;
+    return ! flat->failed;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * image_flat_write () - write data at offset (address - base address), data may come in any order
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+bool
+image_flat_write (IMAGE_FLAT * flat, uint32_t address, uint8_t * data, uint16_t len)
+{
+    uint8_t     fill[64];
+    uint32_t    offset;
+    uint32_t    n;
+
+    if (flat->failed || address < flat->base_address)
+    {
+        flat->failed = true;
+        return false;
+    }
+
+    offset = address - flat->base_address;
+
+    if (offset > flat->size)                                                            // gap: fill with 0xFF (erased flash)
+    {
+        memset (fill, 0xFF, sizeof (fill));
+        flat->fp.seek (flat->size);
+
+        while (flat->size < offset)
+        {
+            n = offset - flat->size < sizeof (fill) ? offset - flat->size : sizeof (fill);
+
+            if (flat->fp.write (fill, n) != n)
+            {
+                flat->failed = true;
+                return false;
+            }
+
+            flat->size += n;
+        }
+    }
+    else if (flat->fp.position () != offset)
+    {
+        flat->fp.seek (offset);
+    }
+
+    if (flat->fp.write (data, len) != len)
+    {
+        flat->failed = true;
+        return false;
+    }
+
+    if (flat->size < offset + len)
+    {
+        flat->size = offset + len;
+    }
+
+    return true;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * image_flat_close () - close flat binary file
+ * Returns false if a write failed
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+bool
+image_flat_close (IMAGE_FLAT * flat)
+{
+    if (flat->fp)
+    {
+        flat->fp.close ();
+    }
+
+    return ! flat->failed;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * image_last_load () - load info of last flashed image
+ * Returns false if there is no (valid) last flashed image
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+bool
+image_last_load (IMAGE_LAST * last)
+{
+    uint32_t    magic   = 0;
+    bool        rtc     = false;
+
+    File f = LittleFS.open (IMAGE_LAST_INF, "r");
+
+    if (f)
+    {
+        if (f.read ((uint8_t *) &magic, sizeof (magic)) == sizeof (magic) && magic == IMAGE_LAST_MAGIC &&
+            f.read ((uint8_t *) last, sizeof (IMAGE_LAST)) == sizeof (IMAGE_LAST))
+        {
+            rtc = true;
+        }
+
+        f.close ();
+    }
+
+    if (rtc)
+    {
+        File img = LittleFS.open (IMAGE_LAST_BIN, "r");
+
+        if (! img || img.size () != last->size)
+        {
+            rtc = false;
+        }
+
+        if (img)
+        {
+            img.close ();
+        }
+    }
+
+    return rtc;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * image_last_commit () - make IMAGE_LAST_TMP the last flashed image, called after successful flashing
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+bool
+image_last_commit (uint32_t base_address)
+{
+    br_sha256_context   ctx;
+    IMAGE_LAST          last;
+    uint32_t            magic   = IMAGE_LAST_MAGIC;
+    uint8_t             buf[IMAGE_READ_BUFSIZE];
+    int                 len;
+    bool                rtc     = false;
+
+    File img = LittleFS.open (IMAGE_LAST_TMP, "r");
+
+    if (! img)
+    {
+        return false;
+    }
+
+    br_sha256_init (&ctx);
+    last.base_address   = base_address;
+    last.size           = img.size ();
+
+    while ((len = img.read (buf, IMAGE_READ_BUFSIZE)) > 0)
+    {
+        br_sha256_update (&ctx, buf, len);
+        yield ();
+    }
+
+    img.close ();
+    br_sha256_out (&ctx, last.sha256);
+
+    LittleFS.remove (IMAGE_LAST_INF);
+    LittleFS.remove (IMAGE_LAST_BIN);
+
+    if (! LittleFS.rename (IMAGE_LAST_TMP, IMAGE_LAST_BIN))
+    {
+        return false;
+    }
+
+    File f = LittleFS.open (IMAGE_LAST_INF, "w");
+
+    if (f)
+    {
+        if (f.write ((uint8_t *) &magic, sizeof (magic)) == sizeof (magic) &&
+            f.write ((uint8_t *) &last, sizeof (IMAGE_LAST)) == sizeof (IMAGE_LAST))
+        {
+            rtc = true;
+        }
+
+        f.close ();
+    }
+
+    return rtc;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * image_last_remove () - forget last flashed image, e.g. if flashing failed and target content is unknown
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+image_last_remove (void)
+{
+    LittleFS.remove (IMAGE_LAST_INF);
+    LittleFS.remove (IMAGE_LAST_BIN);
+    LittleFS.remove (IMAGE_LAST_TMP);
+}
@@ -0,0 +1,223 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * image.h - STM32 image readers: INTEL HEX, Motorola S-record, raw binary, delta patch, library manifest
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <bearssl/bearssl_hash.h>
+#include <FS.h>
+#include "hsdecoder.h"
+
+#define IMAGE_FORMAT_NONE           0                                                   // no image, only hash file content
+#define IMAGE_FORMAT_HEX            1                                                   // INTEL HEX
+#define IMAGE_FORMAT_SREC           2                                                   // Motorola S-record
+#define IMAGE_FORMAT_BIN            3                                                   // raw binary, needs base address
+#define IMAGE_FORMAT_DELTA          4                                                   // binary patch against last flashed image
+#define IMAGE_FORMAT_MANIFEST       5                                                   // image stored in chunk library, see cas.h
+#define IMAGE_FORMAT_MASK           0x0F
+#define IMAGE_FORMAT_COMPRESSED     0x80                                                // flag: compressed, suffix .hs, see hsdecoder.h
+
+#define IMAGE_BIN_BASE_DEFAULT      0x08000000                                          // default base address of raw binary images
+
+#define IMAGE_LINE_BUFSIZE          256                                                 // max. length of a HEX or S-record line
+#define IMAGE_SHA256_LEN            32                                                  // length of SHA-256 digest
+#define IMAGE_INFO_SUFFIX           ".inf"                                              // suffix of image info files
+
+#define IMAGE_LAST_DIR              "/last"                                             // last flashed image as flat binary
+#define IMAGE_LAST_BIN              IMAGE_LAST_DIR "/image.bin"
+#define IMAGE_LAST_TMP              IMAGE_LAST_DIR "/image.tmp"
+#define IMAGE_LAST_INF              IMAGE_LAST_DIR "/image.inf"
+
+#define IMAGE_CAS_DIR               "/cas"                                              // content addressed chunks of library images
+#define IMAGE_CAS_CHUNK_SIZE        8192                                                // = LittleFS block size, one block per chunk file
+#define IMAGE_CAS_ID_LEN            12                                                  // chunk id: first 12 bytes of SHA-256 of chunk
+#define IMAGE_MANIFEST_SUFFIX       ".man"
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * callback for image data: called with address and data of each data record or binary chunk
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef int (*IMAGE_DATA_FUNC) (void * ctx, uint32_t address, uint8_t * data, uint16_t len);           // return -1 to abort
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * callback for output of image writers
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef int (*IMAGE_OUTPUT_FUNC) (void * ctx, const uint8_t * buf, size_t len);                         // return -1 to abort
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * state of INTEL HEX writer
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define IMAGE_HEX_RECORD_LEN        16                                                  // data bytes per record
+
+typedef struct
+{
+    uint32_t                        ulba;                                               // current Upper Linear Base Address
+    IMAGE_OUTPUT_FUNC               out_func;
+    void *                          out_ctx;
+} IMAGE_HEX_WRITER;
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * image info, stored in <fname>.inf after a successful check
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct
+{
+    uint32_t                        file_size;                                          // size of image file in bytes (compressed)
+    uint32_t                        address_min;                                        // minimum address (incl.)
+    uint32_t                        address_max;                                        // maximum address (incl.)
+    uint32_t                        start_address;                                      // start address record (HEX type 3/5, S7-S9), 0 if none
+    uint32_t                        data_bytes;                                         // number of payload bytes
+    uint32_t                        crc32;                                              // CRC32 of payload bytes
+    uint8_t                         sha256[IMAGE_SHA256_LEN];                           // SHA-256 of image file
+} IMAGE_INFO;
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * last flashed image, stored in IMAGE_LAST_INF
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct
+{
+    uint32_t                        base_address;                                       // address of 1st byte
+    uint32_t                        size;                                               // size of flat binary
+    uint8_t                         sha256[IMAGE_SHA256_LEN];                           // SHA-256 of flat binary
+} IMAGE_LAST;
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * flat binary file: image data written at offset (address - base address), gaps filled with 0xFF
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct
+{
+    File                            fp;
+    uint32_t                        base_address;
+    uint32_t                        size;                                               // current file size
+    bool                            failed;
+} IMAGE_FLAT;
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * state of delta reader, see image.cpp for patch format
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define IMAGE_DELTA_HEADER_LEN      80
+
+typedef struct
+{
+    uint8_t                         state;
+    uint8_t                         header[IMAGE_DELTA_HEADER_LEN];                     // patch header
+    uint8_t                         op[9];                                              // current op code and arguments
+    uint16_t                        idx;                                                // bytes in header or op
+    uint32_t                        base_address;                                       // of new image
+    uint32_t                        size;                                               // of new image
+    uint32_t                        out_offset;                                         // offset of next output byte
+    uint32_t                        data_len;                                           // remaining bytes of DATA op
+    File                            old_fp;                                             // last flashed image
+    br_sha256_context               sha256_ctx;                                         // SHA-256 of output
+} IMAGE_DELTA;
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * manifest of library image: header followed by n_chunks chunk ids, a chunk id of all zeros stands for an empty (0xFF) chunk
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define IMAGE_MANIFEST_MAGIC        0x314E414D                                          // "MAN1"
+
+typedef struct
+{
+    uint32_t                        magic;
+    uint32_t                        base_address;                                       // address of 1st byte
+    uint32_t                        size;                                               // size of flat binary
+    uint32_t                        n_chunks;
+    uint8_t                         sha256[IMAGE_SHA256_LEN];                           // SHA-256 of flat binary
+} IMAGE_MANIFEST;
+
+typedef struct
+{
+    IMAGE_MANIFEST                  header;
+    bool                            header_complete;
+    uint8_t                         id[IMAGE_CAS_ID_LEN];                               // current chunk id
+    uint16_t                        idx;                                                // bytes in header or id
+    uint32_t                        chunk;                                              // number of chunks read
+    uint32_t                        out_offset;                                         // offset of next output byte
+    br_sha256_context               sha256_ctx;                                         // SHA-256 of output
+} IMAGE_MANIFEST_READER;
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * state of incremental image reader
+ * Readers must be static (or zero initialized), image_reader_begin () frees the decoder of an unfinished previous image.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct
+{
+    uint8_t                         format;                                             // IMAGE_FORMAT_xxx without flags
+    uint32_t                        base_address;                                       // base address of raw binary
+    uint32_t                        bin_offset;                                         // offset of next byte of raw binary
+    HS_DECODER *                    hs;                                                 // decoder of compressed image, else NULL
+    IMAGE_DELTA *                   delta;                                              // state of delta reader, else NULL
+    IMAGE_MANIFEST_READER *         manifest;                                           // state of manifest reader, else NULL
+    char                            linebuf[IMAGE_LINE_BUFSIZE];                        // current line
+    uint8_t                         databuf[256];                                       // decoded data of current record
+    int                             idx;                                                // index in linebuf
+    int                             line;                                               // current line number
+    uint32_t                        ulba;                                               // Upper Linear/Segment Base Address
+    bool                            eof_record_found;                                   // End of File/termination record seen
+    bool                            failed;                                             // true if an error occured
+    char                            errmsg[80];                                         // error message if failed
+    IMAGE_INFO                      info;                                               // collected info
+    br_sha256_context               sha256_ctx;                                         // SHA-256 of file content
+    IMAGE_DATA_FUNC                 data_func;                                          // callback for data, may be NULL
+    void *                          data_ctx;                                           // context for callback
+} IMAGE_READER;
+
+extern uint8_t                      image_format (String fname);
+extern void                         image_reader_begin (IMAGE_READER * rd, uint8_t format, uint32_t base_address, IMAGE_DATA_FUNC data_func, void * data_ctx);
+extern int                          image_reader_feed (IMAGE_READER * rd, const uint8_t * buf, size_t len);
+extern int                          image_reader_end (IMAGE_READER * rd);
+extern int                          image_read_file (String fname, IMAGE_READER * rd);
+
+extern void                         image_hex_writer_begin (IMAGE_HEX_WRITER * w, IMAGE_OUTPUT_FUNC out_func, void * out_ctx);
+extern int                          image_hex_writer_data (IMAGE_HEX_WRITER * w, uint32_t address, const uint8_t * data, uint16_t len);
+extern int                          image_hex_writer_end (IMAGE_HEX_WRITER * w, uint32_t start_address);
+
+extern uint32_t                     image_crc32 (uint32_t crc, const uint8_t * buf, size_t len);
+extern String                       image_sha256_string (const uint8_t * sha256);
+
+extern bool                         image_info_load (String fname, IMAGE_INFO * info);
+extern bool                         image_info_save (String fname, IMAGE_INFO * info);
+extern void                         image_info_remove (String fname);
+extern bool                         image_is_info_file (String fname);
+
+extern bool                         image_flat_open (IMAGE_FLAT * flat, const char * fname, uint32_t base_address);
+extern bool                         image_flat_write (IMAGE_FLAT * flat, uint32_t address, uint8_t * data, uint16_t len);
+extern bool                         image_flat_close (IMAGE_FLAT * flat);
+
+extern bool                         image_last_load (IMAGE_LAST * last);
+extern bool                         image_last_commit (uint32_t base_address);
+extern void                         image_last_remove (void);
+
+extern String                       image_cas_chunk_path (const uint8_t * id);
+
+#endif // IMAGE_H
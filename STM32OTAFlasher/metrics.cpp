@@ -0,0 +1,198 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * metrics.cpp - flash job metrics since boot, Prometheus text format
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <Arduino.h>
+#include "http.h"
+#include "metrics.h"
+#include "console.h"
+#include "conlog.h"
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * histogram of phase durations, bucket limits in msec
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static const uint32_t               metrics_buckets[] = { 10, 50, 100, 500, 1000, 5000, 10000, 30000, 60000, 300000 };
+#define METRICS_N_BUCKETS           (sizeof (metrics_buckets) / sizeof (metrics_buckets[0]))
+
+typedef struct
+{
+    uint32_t                        bucket[METRICS_N_BUCKETS];                          // not cumulative, +Inf = count
+    uint32_t                        count;
+    uint32_t                        sum;                                                // msec
+} METRICS_HISTOGRAM;
+
+static METRICS_HISTOGRAM            metrics_phases[METRICS_N_PHASES];
+static uint32_t                     metrics_counters[METRICS_N_COUNTERS];
+
+static const char *                 metrics_phase_names[METRICS_N_PHASES] =
+{
+    "entry", "get", "unprotect", "parse", "plan", "erase", "program", "verify", "run", "wifi"
+};
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * metrics_observe () - add duration of a phase
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+metrics_observe (uint8_t phase, unsigned long msec)
+{
+    METRICS_HISTOGRAM * h;
+    uint8_t             i;
+
+    if (phase >= METRICS_N_PHASES)
+    {
+        return;
+    }
+
+    h = metrics_phases + phase;
+
+    for (i = 0; i < METRICS_N_BUCKETS; i++)
+    {
+        if (msec <= metrics_buckets[i])
+        {
+            h->bucket[i]++;
+            break;
+        }
+    }
+
+    h->count++;
+    h->sum += msec;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * metrics_count () - increment counter
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+metrics_count (uint8_t counter, uint32_t n)
+{
+    if (counter < METRICS_N_COUNTERS)
+    {
+        metrics_counters[counter] += n;
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * send one counter
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+metrics_send_counter (const char * name, const char * help, const char * labels, uint32_t value)
+{
+    char    buf[160];
+
+    if (help)                                                                           // one line per call, long names and help texts
+    {
+        snprintf (buf, sizeof (buf), "# HELP stm32flasher_%s %s\n", name, help);
+        http_send (buf);
+        snprintf (buf, sizeof (buf), "# TYPE stm32flasher_%s counter\n", name);
+        http_send (buf);
+    }
+
+    snprintf (buf, sizeof (buf), "stm32flasher_%s%s %u\n", name, labels, value);
+    http_send (buf);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * metrics_send () - send all metrics in Prometheus text format, response header must be sent already
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+metrics_send (void)
+{
+    METRICS_HISTOGRAM * h;
+    char                buf[128];
+    uint32_t            cumulative;
+    uint8_t             phase;
+    uint8_t             i;
+
+    http_send_FS ("# HELP stm32flasher_phase_seconds Duration of flash job phases and WiFi connects\n");
+    http_send_FS ("# TYPE stm32flasher_phase_seconds histogram\n");
+
+    for (phase = 0; phase < METRICS_N_PHASES; phase++)
+    {
+        h = metrics_phases + phase;
+        cumulative = 0;
+
+        for (i = 0; i < METRICS_N_BUCKETS; i++)
+        {
+            cumulative += h->bucket[i];
+            sprintf (buf, "stm32flasher_phase_seconds_bucket{phase=\"%s\",le=\"%u.%03u\"} %u\n", metrics_phase_names[phase],
+                     metrics_buckets[i] / 1000, metrics_buckets[i] % 1000, cumulative);
+            http_send (buf);
+        }
+
+        sprintf (buf, "stm32flasher_phase_seconds_bucket{phase=\"%s\",le=\"+Inf\"} %u\n", metrics_phase_names[phase], h->count);
+        http_send (buf);
+        sprintf (buf, "stm32flasher_phase_seconds_sum{phase=\"%s\"} %u.%03u\n", metrics_phase_names[phase], h->sum / 1000, h->sum % 1000);
+        http_send (buf);
+        sprintf (buf, "stm32flasher_phase_seconds_count{phase=\"%s\"} %u\n", metrics_phase_names[phase], h->count);
+        http_send (buf);
+        http_flush ();
+    }
+
+    metrics_send_counter ("bytes_programmed_total", "Bytes written to STM32 flash", "", metrics_counters[METRICS_BYTES_PROGRAMMED]);
+    metrics_send_counter ("bytes_read_total", "Bytes read from STM32 memory", "", metrics_counters[METRICS_BYTES_READ]);
+    metrics_send_counter ("retries_total", "Retries to synchronize with bootloader", "", metrics_counters[METRICS_RETRIES]);
+    metrics_send_counter ("nacks_total", "NACKs received from bootloader", "", metrics_counters[METRICS_NACKS]);
+    metrics_send_counter ("timeouts_total", "Timeouts waiting for bootloader", "", metrics_counters[METRICS_TIMEOUTS]);
+    metrics_send_counter ("jobs_total", "Finished flash and verify jobs", "{result=\"ok\"}", metrics_counters[METRICS_JOBS_OK]);
+    metrics_send_counter ("jobs_total", (const char *) 0, "{result=\"failed\"}", metrics_counters[METRICS_JOBS_FAILED]);
+    metrics_send_counter ("wifi_connects_total", "WiFi connects", "{mode=\"fast\"}", metrics_counters[METRICS_WIFI_FAST]);
+    metrics_send_counter ("wifi_connects_total", (const char *) 0, "{mode=\"scan\"}", metrics_counters[METRICS_WIFI_SCAN]);
+    metrics_send_counter ("wifi_fast_connect_failures_total", "Fast connects with cached BSSID falling back to scan", "", metrics_counters[METRICS_WIFI_FAST_FAILED]);
+    metrics_send_counter ("wifi_connect_failures_total", "Failed connect attempts with scan", "", metrics_counters[METRICS_WIFI_FAILED]);
+    metrics_send_counter ("wifi_link_lost_total", "Lost WiFi connections", "", metrics_counters[METRICS_WIFI_LINK_LOST]);
+
+    metrics_send_counter ("fleet_checks_total", "Fetched fleet manifests", "", metrics_counters[METRICS_FLEET_CHECKS]);
+    metrics_send_counter ("fleet_updates_total", "Images flashed by fleet update", "", metrics_counters[METRICS_FLEET_UPDATES]);
+    metrics_send_counter ("fleet_failures_total", "Failed fleet checks and updates", "", metrics_counters[METRICS_FLEET_FAILED]);
+
+    metrics_send_counter ("console_rx_bytes_total", "Console bytes from STM32", "", console_stats.rx_bytes);
+    metrics_send_counter ("console_tx_bytes_total", "Console bytes to STM32", "", console_stats.tx_bytes);
+    metrics_send_counter ("console_rx_dropped_total", "Console bytes dropped, client too slow", "", console_stats.rx_dropped);
+    metrics_send_counter ("console_uart_overruns_total", "UART receive buffer overruns", "", console_stats.uart_overruns);
+    metrics_send_counter ("console_input_rejected_total", "Console input of clients without write access", "", console_stats.input_rejected);
+
+    metrics_send_counter ("log_bytes_total", "Console bytes written to persistent log", "", conlog_stats.raw_bytes);
+    metrics_send_counter ("log_stored_bytes_total", "Persistent log bytes written to LittleFS after compression", "", conlog_stats.stored_bytes);
+    metrics_send_counter ("log_blocks_total", "Persistent log blocks written", "", conlog_stats.blocks);
+    metrics_send_counter ("log_write_microseconds_total", "Time spent compressing and writing the persistent log", "", conlog_stats.busy_usec);
+    metrics_send_counter ("log_write_errors_total", "Persistent log blocks lost by write errors", "", conlog_stats.write_errors);
+
+    http_send_FS ("# HELP stm32flasher_log_write_max_microseconds Longest persistent log block write\n# TYPE stm32flasher_log_write_max_microseconds gauge\n");
+    sprintf (buf, "stm32flasher_log_write_max_microseconds %lu\n", (unsigned long) conlog_stats.max_usec);
+    http_send (buf);
+
+    http_send_FS ("# HELP stm32flasher_console_clients Connected console clients\n# TYPE stm32flasher_console_clients gauge\n");
+    sprintf (buf, "stm32flasher_console_clients %d\n", console_n_clients ());
+    http_send (buf);
+
+    http_send_FS ("# HELP stm32flasher_uptime_seconds Time since boot\n# TYPE stm32flasher_uptime_seconds gauge\n");
+    sprintf (buf, "stm32flasher_uptime_seconds %lu\n", millis () / 1000);
+    http_send (buf);
+    http_flush ();
+}
@@ -0,0 +1,63 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * metrics.h - flash job metrics since boot, Prometheus text format
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef METRICS_H
+#define METRICS_H
+
+#define METRICS_PHASE_ENTRY         0                                                   // reset into bootloader and synchronize
+#define METRICS_PHASE_GET           1                                                   // GET command
+#define METRICS_PHASE_UNPROTECT     2                                                   // write unprotect and re-sync
+#define METRICS_PHASE_PARSE         3                                                   // check image file
+#define METRICS_PHASE_PLAN          4                                                   // incremental flashing: compare with last image
+#define METRICS_PHASE_ERASE         5
+#define METRICS_PHASE_PROGRAM       6                                                   // write memory, without verify
+#define METRICS_PHASE_VERIFY        7                                                   // read back or checksum
+#define METRICS_PHASE_RUN           8                                                   // reset into application
+#define METRICS_PHASE_WIFI          9                                                   // WiFi connect until link is up
+#define METRICS_N_PHASES            10
+
+#define METRICS_BYTES_PROGRAMMED    0
+#define METRICS_BYTES_READ          1                                                   // read-out and verify
+#define METRICS_RETRIES             2                                                   // retries to enter bootloader
+#define METRICS_NACKS               3
+#define METRICS_TIMEOUTS            4
+#define METRICS_JOBS_OK             5
+#define METRICS_JOBS_FAILED         6
+#define METRICS_WIFI_FAST           7                                                   // connects with cached BSSID and channel
+#define METRICS_WIFI_SCAN           8                                                   // connects with scan
+#define METRICS_WIFI_FAST_FAILED    9                                                   // fast connects falling back to scan
+#define METRICS_WIFI_FAILED         10                                                  // failed connect attempts with scan
+#define METRICS_WIFI_LINK_LOST      11
+#define METRICS_FLEET_CHECKS        12                                                  // fetched fleet manifests
+#define METRICS_FLEET_UPDATES       13                                                  // successful fleet updates
+#define METRICS_FLEET_FAILED        14                                                  // failed fleet checks and updates
+#define METRICS_N_COUNTERS          15
+
+extern void                         metrics_observe (uint8_t phase, unsigned long msec);
+extern void                         metrics_count (uint8_t counter, uint32_t n);
+extern void                         metrics_send (void);
+
+#endif // METRICS_H
@@ -0,0 +1,616 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * rfc2217.cpp - remote serial port server (RFC 2217) for the STM32 UART
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+/*
+ * A client connected to RFC2217_PORT owns the UART exclusively. It may change baud rate, data size, parity and stop bits.
+ * DTR drives RESET (DTR on = RESET active), RTS drives BOOT0 (RTS on = BOOT0 high), so e.g.
+ *
+ *     stm32flash -b 921600 -i 'rts,dtr,-dtr:-rts,dtr,-dtr' rfc2217://<host>:2217   (via a local RFC 2217 bridge)
+ *     python3 -m serial.tools.miniterm rfc2217://<host>:2217 115200
+ *
+ * can reset the STM32 into its bootloader. UART settings and pins are restored when the client disconnects.
+ * A client is refused while the flasher owns the UART, see arbiter.h.
+ */
+#include <ESP8266WiFi.h>
+#include <WiFiClient.h>
+#include "rfc2217.h"
+#include "arbiter.h"
+#include "stm32flash.h"
+#include "image.h"
+
+#define IAC                         255
+#define DONT                        254
+#define DO                          253
+#define WONT                        252
+#define WILL                        251
+#define SB                          250
+#define SE                          240
+
+#define OPT_BINARY                  0
+#define OPT_SGA                     3
+#define OPT_COM_PORT                44
+
+#define CPO_SET_BAUDRATE            1                                                   // client -> server, server answer: + 100
+#define CPO_SET_DATASIZE            2
+#define CPO_SET_PARITY              3
+#define CPO_SET_STOPSIZE            4
+#define CPO_SET_CONTROL             5
+#define CPO_FLOWCONTROL_SUSPEND     8
+#define CPO_FLOWCONTROL_RESUME      9
+#define CPO_SET_LINESTATE_MASK      10
+#define CPO_SET_MODEMSTATE_MASK     11
+#define CPO_PURGE_DATA              12
+#define CPO_SERVER_OFFSET           100
+
+#define PARITY_NONE                 1
+#define PARITY_ODD                  2
+#define PARITY_EVEN                 3
+
+#define STOPSIZE_1                  1
+#define STOPSIZE_2                  2
+
+#define CONTROL_FLOW_REQUEST        0
+#define CONTROL_FLOW_NONE           1
+#define CONTROL_BREAK_REQUEST       4
+#define CONTROL_BREAK_OFF           6
+#define CONTROL_DTR_REQUEST         7
+#define CONTROL_DTR_ON              8
+#define CONTROL_DTR_OFF             9
+#define CONTROL_RTS_REQUEST         10
+#define CONTROL_RTS_ON              11
+#define CONTROL_RTS_OFF             12
+#define CONTROL_INFLOW_REQUEST      13
+#define CONTROL_INFLOW_NONE         14
+
+#define STATE_DATA                  0                                                   // states of telnet parser
+#define STATE_IAC                   1
+#define STATE_OPTION                2                                                   // after WILL, WONT, DO, DONT
+#define STATE_SB                    3
+#define STATE_SB_IAC                4
+
+#define SB_BUFSIZE                  16
+
+static WiFiServer                   rfc2217_server(RFC2217_PORT);
+static WiFiClient                   rfc2217_client;
+static bool                         rfc2217_started;
+static bool                         rfc2217_active;
+static bool                         rfc2217_suspended;                                  // client sent FLOWCONTROL-SUSPEND
+
+static uint8_t                      opt_remote;                                         // options enabled on client side (DO sent)
+static uint8_t                      opt_local;                                          // options enabled on our side (WILL sent)
+
+static uint8_t                      parser_state;
+static uint8_t                      parser_verb;                                        // WILL, WONT, DO, DONT
+static uint8_t                      sb_buf[SB_BUFSIZE];
+static uint8_t                      sb_len;
+
+static uint32_t                     uart_baud;
+static uint8_t                      uart_datasize;
+static uint8_t                      uart_parity;
+static uint8_t                      uart_stopsize;
+static bool                         line_dtr;
+static bool                         line_rts;
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * rfc2217_setup () - start server
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+rfc2217_setup (void)
+{
+    if (! rfc2217_started)
+    {
+        rfc2217_server.begin();
+        rfc2217_started = true;
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * reconfigure UART with current settings
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+rfc2217_uart_begin (void)
+{
+    static const uint8_t    datasizes[4]    = { UART_NB_BIT_5, UART_NB_BIT_6, UART_NB_BIT_7, UART_NB_BIT_8 };
+    uint8_t                 config;
+
+    config = datasizes[uart_datasize - 5];
+    config |= uart_parity == PARITY_EVEN ? UART_PARITY_EVEN : uart_parity == PARITY_ODD ? UART_PARITY_ODD : UART_PARITY_NONE;
+    config |= uart_stopsize == STOPSIZE_2 ? UART_NB_STOP_BIT_2 : UART_NB_STOP_BIT_1;
+
+    arbiter_uart_begin (uart_baud, (SerialConfig) config);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * send telnet command or COM-PORT-OPTION answer
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+rfc2217_send_option (uint8_t verb, uint8_t option)
+{
+    uint8_t buf[3] = { IAC, verb, option };
+    rfc2217_client.write (buf, 3);
+}
+
+static void
+rfc2217_send_sb (uint8_t cmd, const uint8_t * value, uint8_t len)
+{
+    uint8_t buf[4 + 2 * 4 + 2];
+    uint8_t n = 0;
+    uint8_t i;
+
+    buf[n++] = IAC;
+    buf[n++] = SB;
+    buf[n++] = OPT_COM_PORT;
+    buf[n++] = cmd + CPO_SERVER_OFFSET;
+
+    for (i = 0; i < len; i++)
+    {
+        buf[n++] = value[i];
+
+        if (value[i] == IAC)
+        {
+            buf[n++] = IAC;
+        }
+    }
+
+    buf[n++] = IAC;
+    buf[n++] = SE;
+    rfc2217_client.write (buf, n);
+}
+
+static void
+rfc2217_send_sb_byte (uint8_t cmd, uint8_t value)
+{
+    rfc2217_send_sb (cmd, &value, 1);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * answer WILL, WONT, DO, DONT: accept binary and suppress go ahead in both directions, COM-PORT-OPTION on client side.
+ * Requests for an already enabled option are not acknowledged again to avoid negotiation loops.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint8_t
+rfc2217_option_bit (uint8_t option)
+{
+    switch (option)
+    {
+        case OPT_BINARY:    return 0x01;
+        case OPT_SGA:       return 0x02;
+        case OPT_COM_PORT:  return 0x04;
+        default:            return 0x00;
+    }
+}
+
+static void
+rfc2217_option (uint8_t verb, uint8_t option)
+{
+    uint8_t bit = rfc2217_option_bit (option);
+
+    switch (verb)
+    {
+        case WILL:
+        {
+            if (! bit)
+            {
+                rfc2217_send_option (DONT, option);
+            }
+            else if (! (opt_remote & bit))
+            {
+                opt_remote |= bit;
+                rfc2217_send_option (DO, option);
+            }
+            break;
+        }
+        case DO:
+        {
+            if (! bit || option == OPT_COM_PORT)
+            {
+                rfc2217_send_option (WONT, option);
+            }
+            else if (! (opt_local & bit))
+            {
+                opt_local |= bit;
+                rfc2217_send_option (WILL, option);
+            }
+            break;
+        }
+        case WONT:
+        {
+            opt_remote &= ~bit;
+            break;
+        }
+        case DONT:
+        {
+            opt_local &= ~bit;
+            break;
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * handle COM-PORT-OPTION subnegotiation, value 0 of a SET command is a request of the current value
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+rfc2217_subnegotiation (void)
+{
+    uint8_t     value[4];
+    uint32_t    baud;
+
+    if (sb_len < 2 || sb_buf[0] != OPT_COM_PORT)
+    {
+        return;
+    }
+
+    switch (sb_buf[1])
+    {
+        case CPO_SET_BAUDRATE:
+        {
+            if (sb_len >= 6)
+            {
+                baud = ((uint32_t) sb_buf[2] << 24) | ((uint32_t) sb_buf[3] << 16) | ((uint32_t) sb_buf[4] << 8) | sb_buf[5];
+
+                if (baud != 0 && baud != uart_baud)
+                {
+                    uart_baud = baud;
+                    rfc2217_uart_begin ();
+                }
+            }
+
+            value[0] = uart_baud >> 24;
+            value[1] = uart_baud >> 16;
+            value[2] = uart_baud >> 8;
+            value[3] = uart_baud;
+            rfc2217_send_sb (CPO_SET_BAUDRATE, value, 4);
+            break;
+        }
+        case CPO_SET_DATASIZE:
+        {
+            if (sb_len >= 3 && sb_buf[2] >= 5 && sb_buf[2] <= 8 && sb_buf[2] != uart_datasize)
+            {
+                uart_datasize = sb_buf[2];
+                rfc2217_uart_begin ();
+            }
+
+            rfc2217_send_sb_byte (CPO_SET_DATASIZE, uart_datasize);
+            break;
+        }
+        case CPO_SET_PARITY:                                                            // mark and space are not supported
+        {
+            if (sb_len >= 3 && sb_buf[2] >= PARITY_NONE && sb_buf[2] <= PARITY_EVEN && sb_buf[2] != uart_parity)
+            {
+                uart_parity = sb_buf[2];
+                rfc2217_uart_begin ();
+            }
+
+            rfc2217_send_sb_byte (CPO_SET_PARITY, uart_parity);
+            break;
+        }
+        case CPO_SET_STOPSIZE:                                                          // 1.5 stop bits are not supported
+        {
+            if (sb_len >= 3 && (sb_buf[2] == STOPSIZE_1 || sb_buf[2] == STOPSIZE_2) && sb_buf[2] != uart_stopsize)
+            {
+                uart_stopsize = sb_buf[2];
+                rfc2217_uart_begin ();
+            }
+
+            rfc2217_send_sb_byte (CPO_SET_STOPSIZE, uart_stopsize);
+            break;
+        }
+        case CPO_SET_CONTROL:
+        {
+            uint8_t answer = sb_len >= 3 ? sb_buf[2] : CONTROL_FLOW_REQUEST;
+
+            switch (answer)
+            {
+                case CONTROL_DTR_ON:        line_dtr = true;    stm32_set_reset (true);     break;
+                case CONTROL_DTR_OFF:       line_dtr = false;   stm32_set_reset (false);    break;
+                case CONTROL_RTS_ON:        line_rts = true;    stm32_set_boot0 (true);     break;
+                case CONTROL_RTS_OFF:       line_rts = false;   stm32_set_boot0 (false);    break;
+                case CONTROL_DTR_REQUEST:   answer = line_dtr ? CONTROL_DTR_ON : CONTROL_DTR_OFF;  break;
+                case CONTROL_RTS_REQUEST:   answer = line_rts ? CONTROL_RTS_ON : CONTROL_RTS_OFF;  break;
+                case CONTROL_BREAK_REQUEST: answer = CONTROL_BREAK_OFF;                     break;
+                default:
+                {
+                    if (answer < CONTROL_BREAK_REQUEST)                                     // no outbound flow control
+                    {
+                        answer = CONTROL_FLOW_NONE;
+                    }
+                    else if (answer >= CONTROL_INFLOW_REQUEST)                              // no inbound flow control
+                    {
+                        answer = CONTROL_INFLOW_NONE;
+                    }
+                    break;                                                                  // BREAK on/off: ignored
+                }
+            }
+
+            rfc2217_send_sb_byte (CPO_SET_CONTROL, answer);
+            break;
+        }
+        case CPO_FLOWCONTROL_SUSPEND:
+        {
+            rfc2217_suspended = true;
+            rfc2217_send_sb (CPO_FLOWCONTROL_SUSPEND, value, 0);
+            break;
+        }
+        case CPO_FLOWCONTROL_RESUME:
+        {
+            rfc2217_suspended = false;
+            rfc2217_send_sb (CPO_FLOWCONTROL_RESUME, value, 0);
+            break;
+        }
+        case CPO_SET_LINESTATE_MASK:                                                    // no notifications are sent, accept any mask
+        case CPO_SET_MODEMSTATE_MASK:
+        {
+            rfc2217_send_sb_byte (sb_buf[1], sb_len >= 3 ? sb_buf[2] : 0);
+            break;
+        }
+        case CPO_PURGE_DATA:
+        {
+            if (sb_len >= 3 && (sb_buf[2] == 1 || sb_buf[2] == 3))                      // 1: receive buffer, 3: both
+            {
+                while (Serial.available ())
+                {
+                    Serial.read ();
+                }
+            }
+
+            rfc2217_send_sb_byte (CPO_PURGE_DATA, sb_len >= 3 ? sb_buf[2] : 0);
+            break;
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * parse telnet stream from client, data bytes are written into buf
+ * Returns number of data bytes
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static size_t
+rfc2217_parse (const uint8_t * in, size_t len, uint8_t * buf)
+{
+    size_t      n = 0;
+    size_t      i;
+    uint8_t     ch;
+
+    for (i = 0; i < len; i++)
+    {
+        ch = in[i];
+
+        switch (parser_state)
+        {
+            case STATE_DATA:
+            {
+                if (ch == IAC)
+                {
+                    parser_state = STATE_IAC;
+                }
+                else
+                {
+                    buf[n++] = ch;
+                }
+                break;
+            }
+            case STATE_IAC:
+            {
+                if (ch == IAC)                                                          // escaped 0xFF
+                {
+                    buf[n++] = ch;
+                    parser_state = STATE_DATA;
+                }
+                else if (ch == WILL || ch == WONT || ch == DO || ch == DONT)
+                {
+                    parser_verb = ch;
+                    parser_state = STATE_OPTION;
+                }
+                else if (ch == SB)
+                {
+                    sb_len = 0;
+                    parser_state = STATE_SB;
+                }
+                else                                                                    // NOP, AYT etc.: ignored
+                {
+                    parser_state = STATE_DATA;
+                }
+                break;
+            }
+            case STATE_OPTION:
+            {
+                rfc2217_option (parser_verb, ch);
+                parser_state = STATE_DATA;
+                break;
+            }
+            case STATE_SB:
+            {
+                if (ch == IAC)
+                {
+                    parser_state = STATE_SB_IAC;
+                }
+                else if (sb_len < SB_BUFSIZE)
+                {
+                    sb_buf[sb_len++] = ch;
+                }
+                break;
+            }
+            case STATE_SB_IAC:
+            {
+                if (ch == SE)
+                {
+                    rfc2217_subnegotiation ();
+                    parser_state = STATE_DATA;
+                }
+                else
+                {
+                    if (ch == IAC && sb_len < SB_BUFSIZE)                               // escaped 0xFF
+                    {
+                        sb_buf[sb_len++] = ch;
+                    }
+                    parser_state = STATE_SB;
+                }
+                break;
+            }
+        }
+    }
+    return n;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * start session: server proposes the options, pyserial and other clients also negotiate on their own
+ * The client may erase and write the flash, so the last flashed image no longer describes the target.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+rfc2217_begin (void)
+{
+    rfc2217_client.setNoDelay (true);
+    image_last_remove ();                                                               // next flash can't be incremental
+
+    parser_state        = STATE_DATA;
+    rfc2217_suspended   = false;
+    rfc2217_active      = true;
+    uart_baud           = arbiter_baud ();
+    uart_datasize       = 8;
+    uart_parity         = PARITY_EVEN;
+    uart_stopsize       = STOPSIZE_1;
+    line_dtr            = false;
+    line_rts            = false;
+
+    opt_local           = rfc2217_option_bit (OPT_BINARY) | rfc2217_option_bit (OPT_SGA);
+    opt_remote          = rfc2217_option_bit (OPT_BINARY) | rfc2217_option_bit (OPT_COM_PORT);
+
+    rfc2217_send_option (WILL, OPT_BINARY);
+    rfc2217_send_option (DO, OPT_BINARY);
+    rfc2217_send_option (WILL, OPT_SGA);
+    rfc2217_send_option (DO, OPT_COM_PORT);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * end session: restore UART settings, release RESET and BOOT0
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+rfc2217_end (void)
+{
+    rfc2217_client.stop ();
+    rfc2217_active = false;
+
+    stm32_set_reset (false);
+    stm32_set_boot0 (false);
+
+    arbiter_uart_begin (arbiter_baud (), ARBITER_DEFAULT_CONFIG);
+    arbiter_release (ARBITER_OWNER_REMOTE);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * rfc2217_loop () - serve client
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+rfc2217_loop (void)
+{
+    static uint8_t  in[256];
+    static uint8_t  out[2 * 256];
+    size_t          space;
+    size_t          n;
+    size_t          i;
+    size_t          o;
+    int             len;
+
+    if (rfc2217_server.hasClient ())
+    {
+        if (rfc2217_active)
+        {
+            rfc2217_server.available ().stop ();                                        // only one client
+        }
+        else if (! arbiter_acquire (ARBITER_OWNER_REMOTE))
+        {
+            WiFiClient refused = rfc2217_server.available ();
+
+            refused.print ((String) "UART in use by " + arbiter_owner_name () + "\r\n");
+            refused.stop ();
+        }
+        else
+        {
+            rfc2217_client = rfc2217_server.available ();
+            rfc2217_begin ();
+        }
+    }
+
+    if (! rfc2217_active)
+    {
+        return;
+    }
+
+    if (! rfc2217_client.connected ())
+    {
+        rfc2217_end ();
+        return;
+    }
+
+    // client -> UART: never more data bytes than the UART can take without blocking
+
+    if ((space = Serial.availableForWrite ()) > 0 && rfc2217_client.available () > 0)
+    {
+        len = rfc2217_client.read (in, space < sizeof (in) ? space : sizeof (in));
+
+        if (len > 0)
+        {
+            n = rfc2217_parse (in, len, out);
+            Serial.write (out, n);
+        }
+    }
+
+    // UART -> client, IAC is doubled
+
+    if (! rfc2217_suspended && (space = rfc2217_client.availableForWrite ()) >= 2 && (n = Serial.available ()) > 0)
+    {
+        if (n > space / 2)
+        {
+            n = space / 2;
+        }
+
+        if (n > sizeof (in))
+        {
+            n = sizeof (in);
+        }
+
+        n = Serial.read ((char *) in, n);
+
+        for (i = 0, o = 0; i < n; i++)
+        {
+            out[o++] = in[i];
+
+            if (in[i] == IAC)
+            {
+                out[o++] = IAC;
+            }
+        }
+
+        rfc2217_client.write (out, o);
+    }
+}
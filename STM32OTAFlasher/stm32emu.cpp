@@ -0,0 +1,575 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * stm32emu.cpp - emulated STM32 bootloader, used as target for tests without hardware
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "stm32emu.h"
+
+#define EMU_BEGIN                   0x7F
+#define EMU_ACK                     0x79
+#define EMU_NACK                    0x1F
+#define EMU_VERSION                 0x31                                                // bootloader version 3.1
+
+#define EMU_CMD_GET                 0x00
+#define EMU_CMD_GET_VERSION         0x01
+#define EMU_CMD_GET_ID              0x02
+#define EMU_CMD_READ_MEMORY         0x11
+#define EMU_CMD_GO                  0x21
+#define EMU_CMD_WRITE_MEMORY        0x31
+#define EMU_CMD_EXT_ERASE           0x44
+#define EMU_CMD_WRITE_UNPROTECT     0x73
+
+#define EMU_STATE_RUNNING           0                                                   // application is running, input is ignored
+#define EMU_STATE_SYNC              1                                                   // bootloader waits for EMU_BEGIN
+#define EMU_STATE_CMD               2                                                   // command + complement
+#define EMU_STATE_ADDRESS           3                                                   // address + checksum
+#define EMU_STATE_READ_LEN          4                                                   // length + complement
+#define EMU_STATE_WRITE_DATA        5                                                   // length, data, checksum
+#define EMU_STATE_ERASE             6                                                   // number of pages, page numbers, checksum
+
+#define EMU_BUFLEN                  260
+#define EMU_N_PAGES                 (STM32EMU_FLASH_SIZE / STM32EMU_PAGE_SIZE)
+
+static const uint8_t                emu_get_response[] =
+{
+    11, EMU_VERSION, EMU_CMD_GET, EMU_CMD_GET_VERSION, EMU_CMD_GET_ID, EMU_CMD_READ_MEMORY, EMU_CMD_GO, EMU_CMD_WRITE_MEMORY,
+    EMU_CMD_EXT_ERASE, 0x63, EMU_CMD_WRITE_UNPROTECT, 0x82, 0x92
+};
+
+static uint8_t                      emu_state[STM32EMU_MAX];                            // state of each device, only kept between commands
+static uint8_t                      emu_idx;                                            // selected device
+static uint32_t                     emu_go[STM32EMU_MAX];                               // address of last GO, 0 if none
+
+static uint8_t                      emu_cmd;                                            // current command
+static uint32_t                     emu_address;                                        // address of current command
+static uint8_t                      emu_in[EMU_BUFLEN];                                 // received bytes of current state
+static uint16_t                     emu_in_len;
+static uint16_t                     emu_in_need;                                        // bytes needed to complete current state
+static uint8_t                      emu_out[EMU_BUFLEN];                                // response
+static uint16_t                     emu_out_rpos;
+static uint16_t                     emu_out_wpos;
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * queue response bytes
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+emu_send (const uint8_t * buf, uint16_t len)
+{
+    if (emu_out_rpos == emu_out_wpos)
+    {
+        emu_out_rpos = 0;
+        emu_out_wpos = 0;
+    }
+
+    while (len > 0 && emu_out_wpos < EMU_BUFLEN)
+    {
+        emu_out[emu_out_wpos++] = *buf++;
+        len--;
+    }
+}
+
+static void
+emu_send_byte (uint8_t ch)
+{
+    emu_send (&ch, 1);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * switch to next state, need: number of bytes to receive
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+emu_next (uint8_t state, uint16_t need)
+{
+    emu_state[emu_idx]  = state;
+    emu_in_len          = 0;
+    emu_in_need         = need;
+}
+
+static void
+emu_nack (void)
+{
+    emu_send_byte (EMU_NACK);
+    emu_next (EMU_STATE_CMD, 2);
+}
+
+static uint8_t
+emu_xor (const uint8_t * buf, uint16_t len)
+{
+    uint8_t     sum = 0;
+
+    while (len--)
+    {
+        sum ^= *buf++;
+    }
+    return sum;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * open flash or SRAM file of selected device, create erased flash or cleared SRAM if missing
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static File
+emu_mem_open (bool sram)
+{
+    String      fname   = sram ? stm32emu_sram_fname (emu_idx) : stm32emu_flash_fname (emu_idx);
+    uint32_t    size    = sram ? STM32EMU_SRAM_SIZE : STM32EMU_FLASH_SIZE;
+    File        fp      = LittleFS.open (fname, "r+");
+    uint8_t     buf[64];
+    uint32_t    n;
+
+    if (! fp || fp.size () != size)
+    {
+        fp.close ();
+        LittleFS.mkdir (STM32EMU_DIR);
+        fp = LittleFS.open (fname, "w");
+        memset (buf, sram ? 0x00 : 0xFF, sizeof (buf));
+
+        for (n = 0; n < size && fp; n += sizeof (buf))
+        {
+            fp.write (buf, sizeof (buf));
+        }
+
+        fp.close ();
+        fp = LittleFS.open (fname, "r+");
+    }
+    return fp;
+}
+
+static bool
+emu_in_flash (uint32_t address, uint32_t len)
+{
+    return address >= STM32EMU_FLASH_BASE && address + len <= STM32EMU_FLASH_BASE + STM32EMU_FLASH_SIZE;
+}
+
+static bool
+emu_in_sram (uint32_t address, uint32_t len)
+{
+    return address >= STM32EMU_SRAM_BASE && address + len <= STM32EMU_SRAM_BASE + STM32EMU_SRAM_SIZE;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * memory operations: address and len must be inside of flash or SRAM
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static bool
+emu_mem_read (uint32_t address, uint8_t * buf, uint16_t len)
+{
+    bool        sram    = emu_in_sram (address, len);
+    File        fp      = emu_mem_open (sram);
+    uint32_t    offset  = address - (sram ? STM32EMU_SRAM_BASE : STM32EMU_FLASH_BASE);
+    bool        rtc     = fp && fp.seek (offset, SeekSet) && fp.read (buf, len) == len;
+
+    fp.close ();
+    return rtc;
+}
+
+static bool
+emu_mem_write (uint32_t address, const uint8_t * data, uint16_t len)
+{
+    uint8_t     old[256];
+    bool        sram    = emu_in_sram (address, len);
+    File        fp      = emu_mem_open (sram);
+    uint32_t    offset  = address - (sram ? STM32EMU_SRAM_BASE : STM32EMU_FLASH_BASE);
+    uint16_t    i;
+    bool        rtc     = false;
+
+    if (sram)
+    {
+        rtc = fp && fp.seek (offset, SeekSet) && fp.write (data, len) == len;
+    }
+    else if (fp && fp.seek (offset, SeekSet) && fp.read (old, len) == len)
+    {
+        for (i = 0; i < len; i++)
+        {
+            old[i] &= data[i];                                                          // programming can only clear bits
+        }
+
+        rtc = fp.seek (offset, SeekSet) && fp.write (old, len) == len;
+    }
+
+    fp.close ();
+    return rtc;
+}
+
+static bool
+emu_flash_erase (uint16_t page)
+{
+    uint8_t     buf[64];
+    File        fp  = emu_mem_open (false);
+    uint16_t    n;
+    bool        rtc = fp && fp.seek ((uint32_t) page * STM32EMU_PAGE_SIZE, SeekSet);
+
+    memset (buf, 0xFF, sizeof (buf));
+
+    for (n = 0; rtc && n < STM32EMU_PAGE_SIZE; n += sizeof (buf))
+    {
+        rtc = fp.write (buf, sizeof (buf)) == sizeof (buf);
+    }
+
+    fp.close ();
+    return rtc;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * command complete
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+emu_command (void)
+{
+    static const uint8_t    id[]        = { 1, STM32EMU_PID >> 8, STM32EMU_PID & 0xFF };
+    static const uint8_t    version[]   = { EMU_VERSION, 0x00, 0x00 };
+
+    if (emu_in[0] != (uint8_t) ~emu_in[1])
+    {
+        emu_nack ();
+        return;
+    }
+
+    emu_cmd = emu_in[0];
+
+    switch (emu_cmd)
+    {
+        case EMU_CMD_GET:
+            emu_send_byte (EMU_ACK);
+            emu_send (emu_get_response, sizeof (emu_get_response));
+            emu_send_byte (EMU_ACK);
+            emu_next (EMU_STATE_CMD, 2);
+            break;
+        case EMU_CMD_GET_VERSION:
+            emu_send_byte (EMU_ACK);
+            emu_send (version, sizeof (version));
+            emu_send_byte (EMU_ACK);
+            emu_next (EMU_STATE_CMD, 2);
+            break;
+        case EMU_CMD_GET_ID:
+            emu_send_byte (EMU_ACK);
+            emu_send (id, sizeof (id));
+            emu_send_byte (EMU_ACK);
+            emu_next (EMU_STATE_CMD, 2);
+            break;
+        case EMU_CMD_READ_MEMORY:
+        case EMU_CMD_WRITE_MEMORY:
+        case EMU_CMD_GO:
+            emu_send_byte (EMU_ACK);
+            emu_next (EMU_STATE_ADDRESS, 5);
+            break;
+        case EMU_CMD_EXT_ERASE:
+            emu_send_byte (EMU_ACK);
+            emu_next (EMU_STATE_ERASE, 2);
+            break;
+        case EMU_CMD_WRITE_UNPROTECT:                                                   // device resets after 2nd ACK
+            emu_send_byte (EMU_ACK);
+            emu_send_byte (EMU_ACK);
+            emu_next (EMU_STATE_SYNC, 1);
+            break;
+        default:
+            emu_nack ();
+            break;
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * address of READ MEMORY, WRITE MEMORY or GO complete
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+emu_address_complete (void)
+{
+    emu_address = ((uint32_t) emu_in[0] << 24) | ((uint32_t) emu_in[1] << 16) | ((uint32_t) emu_in[2] << 8) | emu_in[3];
+
+    if (emu_xor (emu_in, 4) != emu_in[4] || ! (emu_in_flash (emu_address, 1) || emu_in_sram (emu_address, 1)))
+    {
+        emu_nack ();
+        return;
+    }
+
+    emu_send_byte (EMU_ACK);
+
+    if (emu_cmd == EMU_CMD_READ_MEMORY)
+    {
+        emu_next (EMU_STATE_READ_LEN, 2);
+    }
+    else if (emu_cmd == EMU_CMD_WRITE_MEMORY)
+    {
+        emu_next (EMU_STATE_WRITE_DATA, 1);
+    }
+    else
+    {
+        emu_go[emu_idx] = emu_address;
+        emu_next (EMU_STATE_RUNNING, 0);                                                // GO: jump to application
+    }
+}
+
+static void
+emu_read_complete (void)
+{
+    uint8_t     buf[256];
+    uint16_t    len = emu_in[0] + 1;
+
+    if (emu_in[0] != (uint8_t) ~emu_in[1] || ! (emu_in_flash (emu_address, len) || emu_in_sram (emu_address, len)) ||
+        ! emu_mem_read (emu_address, buf, len))
+    {
+        emu_nack ();
+        return;
+    }
+
+    emu_send_byte (EMU_ACK);
+    emu_send (buf, len);
+    emu_next (EMU_STATE_CMD, 2);
+}
+
+static void
+emu_write_complete (void)
+{
+    uint16_t    len = emu_in[0] + 1;
+
+    if (emu_xor (emu_in, len + 1) != emu_in[len + 1] ||
+        ! (emu_in_flash (emu_address, len) || (emu_in_sram (emu_address, len) && emu_address >= STM32EMU_SRAM_USER)) ||
+        ! emu_mem_write (emu_address, emu_in + 1, len))
+    {
+        emu_nack ();
+        return;
+    }
+
+    emu_send_byte (EMU_ACK);
+    emu_next (EMU_STATE_CMD, 2);
+}
+
+static void
+emu_erase_complete (void)
+{
+    uint16_t    n = (emu_in[0] << 8) | emu_in[1];
+    uint16_t    page;
+    uint16_t    i;
+    bool        rtc = true;
+
+    if (emu_xor (emu_in, emu_in_len - 1) != emu_in[emu_in_len - 1])
+    {
+        emu_nack ();
+        return;
+    }
+
+    if (n >= 0xFFF0)                                                                    // mass erase, bank erase
+    {
+        for (page = 0; rtc && page < EMU_N_PAGES; page++)
+        {
+            rtc = emu_flash_erase (page);
+        }
+    }
+    else
+    {
+        for (i = 0; rtc && i <= n; i++)
+        {
+            page = (emu_in[2 + 2 * i] << 8) | emu_in[3 + 2 * i];
+            rtc = page < EMU_N_PAGES && emu_flash_erase (page);
+        }
+    }
+
+    if (! rtc)
+    {
+        emu_nack ();
+        return;
+    }
+
+    emu_send_byte (EMU_ACK);
+    emu_next (EMU_STATE_CMD, 2);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * process one byte sent to the selected device
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+emu_input (uint8_t ch)
+{
+    uint8_t     state = emu_state[emu_idx];
+    uint16_t    n;
+
+    if (state == EMU_STATE_RUNNING)
+    {
+        return;
+    }
+
+    if (state == EMU_STATE_SYNC)
+    {
+        if (ch == EMU_BEGIN)
+        {
+            emu_send_byte (EMU_ACK);
+            emu_next (EMU_STATE_CMD, 2);
+        }
+        return;
+    }
+
+    emu_in[emu_in_len++] = ch;
+
+    if (state == EMU_STATE_WRITE_DATA && emu_in_len == 1)
+    {
+        emu_in_need = emu_in[0] + 3;                                                    // length, data, checksum
+    }
+    else if (state == EMU_STATE_ERASE && emu_in_len == 2)
+    {
+        n = (emu_in[0] << 8) | emu_in[1];
+        emu_in_need = n >= 0xFFF0 ? 3 : 2 * (n + 1) + 3;                                // number, page numbers, checksum
+
+        if (emu_in_need > EMU_BUFLEN)
+        {
+            emu_nack ();
+            return;
+        }
+    }
+
+    if (emu_in_len < emu_in_need)
+    {
+        return;
+    }
+
+    switch (state)
+    {
+        case EMU_STATE_CMD:         emu_command ();             break;
+        case EMU_STATE_ADDRESS:     emu_address_complete ();    break;
+        case EMU_STATE_READ_LEN:    emu_read_complete ();       break;
+        case EMU_STATE_WRITE_DATA:  emu_write_complete ();      break;
+        case EMU_STATE_ERASE:       emu_erase_complete ();      break;
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * transport functions
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+emu_available (void)
+{
+    return emu_out_wpos - emu_out_rpos;
+}
+
+static int
+emu_read (void)
+{
+    if (emu_out_rpos == emu_out_wpos)
+    {
+        return -1;
+    }
+    return emu_out[emu_out_rpos++];
+}
+
+static size_t
+emu_write (const uint8_t * buf, size_t len)
+{
+    size_t      i;
+
+    for (i = 0; i < len; i++)
+    {
+        emu_input (buf[i]);
+    }
+    return len;
+}
+
+static void
+emu_flush (void)
+{
+}
+
+const TRANSPORT transport_stm32emu = { emu_available, emu_read, emu_write, emu_flush };
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * stm32emu_select () - select device, pending response bytes of the previous device are dropped
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+stm32emu_select (uint8_t idx)
+{
+    if (idx < STM32EMU_MAX)
+    {
+        emu_idx         = idx;
+        emu_out_rpos    = 0;
+        emu_out_wpos    = 0;
+        emu_in_len      = 0;
+        emu_in_need     = 2;
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * stm32emu_reset () - reset device: start bootloader if boot0 is set, else application
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+stm32emu_reset (uint8_t idx, bool boot0)
+{
+    if (idx < STM32EMU_MAX)
+    {
+        emu_state[idx]  = boot0 ? EMU_STATE_SYNC : EMU_STATE_RUNNING;
+        emu_go[idx]     = 0;
+
+        if (idx == emu_idx)
+        {
+            stm32emu_select (idx);
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * stm32emu_running () - true if application is running
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+bool
+stm32emu_running (uint8_t idx)
+{
+    return idx < STM32EMU_MAX && emu_state[idx] == EMU_STATE_RUNNING;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * stm32emu_flash_fname () - name of flash file
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+String
+stm32emu_flash_fname (uint8_t idx)
+{
+    return (String) STM32EMU_DIR "/" + idx + ".bin";
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * stm32emu_sram_fname () - name of SRAM file
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+String
+stm32emu_sram_fname (uint8_t idx)
+{
+    return (String) STM32EMU_DIR "/" + idx + ".ram";
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * stm32emu_go_address () - address of the last GO command, 0 if the device has been reset since
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint32_t
+stm32emu_go_address (uint8_t idx)
+{
+    return idx < STM32EMU_MAX ? emu_go[idx] : 0;
+}
@@ -0,0 +1,60 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * stm32emu.h - emulated STM32 bootloader, used as target for tests without hardware
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef STM32EMU_H
+#define STM32EMU_H
+
+#include "transport.h"
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * The emulator answers the bootloader commands GET, GET VERSION, GET ID, READ MEMORY, WRITE MEMORY, EXT ERASE, WRITE UNPROTECT
+ * and GO like a STM32F103 medium density device. The flash memory of each emulated device is stored in STM32EMU_DIR/<n>.bin.
+ * Like real flash, WRITE MEMORY can only clear bits, so a missing erase is detected by the read back.
+ * SRAM is stored in STM32EMU_DIR/<n>.ram, WRITE MEMORY to the first STM32EMU_SRAM_USER - STM32EMU_SRAM_BASE bytes used by the
+ * bootloader is refused. GO does not execute anything, it only records the address, see stm32emu_go_address ().
+ * Commands must not be interleaved between devices: stm32emu_select () may only be called between two commands.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define STM32EMU_DIR                "/emu"
+#define STM32EMU_MAX                4                                                   // number of emulated devices
+#define STM32EMU_PID                0x410                                               // STM32F103 medium density
+#define STM32EMU_FLASH_BASE         0x08000000
+#define STM32EMU_FLASH_SIZE         0x10000                                             // 64K
+#define STM32EMU_PAGE_SIZE          1024
+#define STM32EMU_SRAM_BASE          0x20000000
+#define STM32EMU_SRAM_SIZE          0x5000                                              // 20K
+#define STM32EMU_SRAM_USER          0x20000200                                          // first SRAM address not used by bootloader
+
+extern const TRANSPORT              transport_stm32emu;
+
+extern void                         stm32emu_select (uint8_t idx);
+extern void                         stm32emu_reset (uint8_t idx, bool boot0);
+extern bool                         stm32emu_running (uint8_t idx);
+extern String                       stm32emu_flash_fname (uint8_t idx);
+extern String                       stm32emu_sram_fname (uint8_t idx);
+extern uint32_t                     stm32emu_go_address (uint8_t idx);
+
+#endif // STM32EMU_H
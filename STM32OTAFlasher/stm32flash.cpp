@@ -37,16 +37,18 @@
 #include <FS.h>
 #include "http.h"
 #include <LittleFS.h>
-
-#if 0 // yet not used
-#include <ESP8266httpUpdate.h>
+#include "image.h"
+#include "stm32flash.h"
+#include "metrics.h"
+#include "trace.h"
+#include "transport.h"
+#include "arbiter.h"
+#include "eepromdata.h"
+#include "target.h"
 #include "httpclient.h"
-#endif
 
 #define hex2toi(pp)                         htoi(pp, 2)
 
-#define STM32_RESET_PIN                     4
-#define STM32_BOOT0_PIN                     5
 #define STM32_TX_PIN                        13      // RXD2
 #define STM32_RX_PIN                        15      // RXD2
 
@@ -66,6 +68,7 @@
 #define STM32_CMD_WRITE_UNPROTECT           0x73    // disables the write protection for all Flash memory sectors
 #define STM32_CMD_READOUT_PROTECT           0x82    // enables the read protection
 #define STM32_CMD_READOUT_UNPROTECT         0x92    // disables the read protection
+#define STM32_CMD_GET_CHECKSUM              0xA1    // computes a CRC value on a given memory area (newer bootloaders only)
 
 #define STM32_INFO_BOOTLOADER_VERSION_IDX   0       // Bootloader version (0 < Version < 255), example: 0x10 = Version 1.0
 #define STM32_INFO_GET_CMD_IDX              1       // 0x00 - Get command
@@ -79,9 +82,11 @@
 #define STM32_INFO_WRITE_UNPROTECT_CMD_IDX  9       // 0x73 - Write Unprotect command
 #define STM32_INFO_READOUT_PROTECT          10      // 0x82 - Readout Protect command
 #define STM32_INFO_READOUT_UNPROTECT        11      // 0x92 - Readout Unprotect command
-#define STM32_INFO_SIZE                     12      // number of bytes in INFO array
+                                                    // further commands, e.g. 0xA1 - Get Checksum, in any order, see stm32_has_command ()
+#define STM32_INFO_SIZE                     32      // number of bytes in INFO array
 
 static uint8_t                              bootloader_info[STM32_INFO_SIZE];
+static int                                  bootloader_info_len;                                // number of bytes received by GET
 
 #define STM32_VERSION_BOOTLOADER_VERSION    0       // Bootloader version (0 < Version < 255), example: 0x10 = Version 1.0
 #define STM32_VERSION_OPTION_BYTE1          1       // option byte 1
@@ -95,11 +100,50 @@ static uint8_t                              bootloader_info[STM32_INFO_SIZE];
 #define STM32_ID_BYTE2                      1       // production id byte 2
 #define STM32_ID_SIZE                       2       // number of bytes in ID array
 
-// yet not used
-// static uint8_t                              bootloader_id[STM32_ID_SIZE];
+static uint8_t                              bootloader_id[STM32_ID_SIZE];
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * flash layout by product id, needed to erase single pages (incremental flashing)
+ *
+ * page_size == 0: single bank of sectors 4 x 16K, 1 x 64K, n x 128K (F2, F4)
+ * Devices with pages smaller than PAGESIZE (L0), other sector layouts (F7) or a 2nd bank depending on the option bytes (F42x/F43x
+ * and F469/F479: DB1M) are not listed and always get a mass erase.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define STM32_FLASH_BASE                    0x08000000
+#define STM32_SRAM_BASE                     0x20000000
+#define STM32_SRAM_END                      0x30000000
+
+typedef struct
+{
+    uint16_t    pid;
+    uint16_t    page_size;
+} STM32_FLASH_LAYOUT;
+
+static const STM32_FLASH_LAYOUT             stm32_flash_layouts[] =
+{
+    { 0x440, 1024 }, { 0x444, 1024 }, { 0x445, 1024 }, { 0x448, 2048 }, { 0x442, 2048 },                            // F0
+    { 0x412, 1024 }, { 0x410, 1024 }, { 0x414, 2048 }, { 0x418, 2048 }, { 0x420, 1024 }, { 0x428, 2048 },           // F1
+    { 0x430, 2048 },
+    { 0x422, 2048 }, { 0x438, 2048 }, { 0x439, 2048 }, { 0x446, 2048 }, { 0x432, 2048 },                            // F3
+    { 0x416,  256 }, { 0x429,  256 }, { 0x427,  256 }, { 0x436,  256 }, { 0x437,  256 },                            // L1
+    { 0x460, 2048 }, { 0x466, 2048 }, { 0x467, 2048 },                                                              // G0
+    { 0x415, 2048 }, { 0x435, 2048 }, { 0x462, 2048 }, { 0x464, 2048 },                                             // L4
+    { 0x411,    0 }, { 0x413,    0 }, { 0x423,    0 }, { 0x433,    0 }, { 0x431,    0 },                            // F2, F4
+    { 0x458,    0 }, { 0x441,    0 }, { 0x421,    0 }, { 0x463,    0 },
+};
+
+#define STM32_N_FLASH_LAYOUTS               (sizeof (stm32_flash_layouts) / sizeof (STM32_FLASH_LAYOUT))
+
+static const STM32_FLASH_LAYOUT *           stm32_flash_layout;                                 // NULL: unknown device
+
+#define STM32_MAX_UNITS                     2048                                                // max. number of erasable pages/sectors
+static uint8_t                              stm32_erase_map[STM32_MAX_UNITS / 8];               // bit set: page/sector must be erased
 
 #define STM32_BUFLEN                        256
 static uint8_t                              stm32_buf[STM32_BUFLEN + 1];                        // one more byte for checksum
+static unsigned long                        stm32_entry_time;                                   // time of reset into bootloader
+static const TRANSPORT *                    stm32_uart = &transport_serial;                     // transport of selected target, see target.h
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
  * hex to integer
@@ -150,9 +194,9 @@ stm32_serial_poll (unsigned long timeout, int log_error)
     unsigned long    curtime = millis ();
     unsigned int ch;
 
-    Serial.flush ();
+    stm32_uart->flush ();
 
-    while (Serial.available() <= 0)
+    while (stm32_uart->available () <= 0)
     {
         yield ();
 
@@ -166,7 +210,7 @@ stm32_serial_poll (unsigned long timeout, int log_error)
         }
     }
 
-    ch = Serial.read ();
+    ch = stm32_uart->read ();
     return (int) ch;
 }
 
@@ -180,8 +224,13 @@ wait_for_ack (long timeout, int show_errors)
 {
     int ch;
 
-    if ((ch = stm32_serial_poll(timeout, 0)) < 0)
+    ch = stm32_serial_poll(timeout, 0);
+    trace_response (ch);
+
+    if (ch < 0)
     {
+        metrics_count (METRICS_TIMEOUTS, 1);
+
         if (show_errors)
         {
             http_send_FS ("timeout, no ACK<BR>\r\n");
@@ -191,6 +240,11 @@ wait_for_ack (long timeout, int show_errors)
     }
     else if (ch != STM32_ACK)
     {
+        if (ch == STM32_NACK)
+        {
+            metrics_count (METRICS_NACKS, 1);
+        }
+
         if (show_errors)
         {
             char buf[32];
@@ -211,14 +265,34 @@ wait_for_ack (long timeout, int show_errors)
 static void
 stm32_write_cmd (uint8_t cmd)
 {
-    while (Serial.available())
+    while (stm32_uart->available ())
     {
-        Serial.read();
+        stm32_uart->read ();
     }
+    trace_command (cmd);
     stm32_buf[0] = cmd;
     stm32_buf[1] = ~cmd;
-    Serial.write (stm32_buf, 2);
-    Serial.flush ();
+    stm32_uart->write (stm32_buf, 2);
+    stm32_uart->flush ();
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * check if command is in command list of GET, e.g. 0xA1 may follow special commands like 0x50, 0x51
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static bool
+stm32_has_command (uint8_t cmd)
+{
+    int     i;
+
+    for (i = STM32_INFO_GET_CMD_IDX; i < bootloader_info_len && i < STM32_INFO_SIZE; i++)
+    {
+        if (bootloader_info[i] == cmd)
+        {
+            return true;
+        }
+    }
+    return false;
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
@@ -322,7 +396,6 @@ stm32_get_version (uint8_t * buf, int maxlen)
  * STM32 bootloader command: GET ID
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-#if 0 // yet not used
 static int
 stm32_get_id (uint8_t * buf, int maxlen)
 {
@@ -368,7 +441,6 @@ stm32_get_id (uint8_t * buf, int maxlen)
     }
     return n_bytes;
 }
-#endif // 0
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
  * STM32 bootloader command: READ MEMORY
@@ -381,6 +453,7 @@ stm32_read_memory (uint32_t address, unsigned int len)
     int           ch;
 
     stm32_write_cmd (bootloader_info[STM32_INFO_READ_MEMORY_CMD_IDX]);
+    trace_args (address, len);
 
     if (wait_for_ack (1000, 1) < 0)
     {
@@ -394,8 +467,8 @@ stm32_read_memory (uint32_t address, unsigned int len)
     stm32_buf[3] = address & 0xFF;
     stm32_buf[4] = stm32_buf[0] ^ stm32_buf[1] ^ stm32_buf[2] ^ stm32_buf[3];
 
-    Serial.write (stm32_buf, 5);
-    Serial.flush ();
+    stm32_uart->write (stm32_buf, 5);
+    stm32_uart->flush ();
 
     if (wait_for_ack (1000, 1) < 0)
     {
@@ -409,8 +482,8 @@ stm32_read_memory (uint32_t address, unsigned int len)
 
     stm32_buf[0] = len - 1;
     stm32_buf[1] = ~stm32_buf[0];
-    Serial.write (stm32_buf, 2);
-    Serial.flush ();
+    stm32_uart->write (stm32_buf, 2);
+    stm32_uart->flush ();
 
     if (wait_for_ack (1000, 1) < 0)
     {
@@ -433,18 +506,136 @@ stm32_read_memory (uint32_t address, unsigned int len)
         }
     }
 
+    metrics_count (METRICS_BYTES_READ, len);
     return len;
 }
 
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * send 32 bit value MSB first, followed by XOR checksum
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+stm32_write_word (uint32_t value)
+{
+    stm32_buf[0] = (value >> 24) & 0xFF;
+    stm32_buf[1] = (value >> 16) & 0xFF;
+    stm32_buf[2] = (value >>  8) & 0xFF;
+    stm32_buf[3] = value & 0xFF;
+    stm32_buf[4] = stm32_buf[0] ^ stm32_buf[1] ^ stm32_buf[2] ^ stm32_buf[3];
+
+    stm32_uart->write (stm32_buf, 5);
+    stm32_uart->flush ();
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * STM32 bootloader command: GET CHECKSUM
+ *
+ * CRC of len bytes (multiple of 4) at address, computed by the CRC unit of the STM32: polynomial 0x04C11DB7, initial value 0xFFFFFFFF
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+stm32_get_checksum (uint32_t address, uint32_t len, uint32_t * crc)
+{
+    uint8_t     sum;
+    int         ch;
+    int         i;
+
+    stm32_write_cmd (STM32_CMD_GET_CHECKSUM);
+    trace_args (address, len);
+
+    if (wait_for_ack (1000, 0) < 0)
+    {
+        return -1;
+    }
+
+    stm32_write_word (address);
+
+    if (wait_for_ack (1000, 0) < 0)
+    {
+        return -1;
+    }
+
+    stm32_write_word (len / 4);                                                     // size in 32 bit words
+
+    if (wait_for_ack (1000, 0) < 0)
+    {
+        return -1;
+    }
+
+    stm32_write_word (0x04C11DB7);                                                  // polynomial
+
+    if (wait_for_ack (1000, 0) < 0)
+    {
+        return -1;
+    }
+
+    stm32_write_word (0xFFFFFFFF);                                                  // initial value
+
+    if (wait_for_ack (5000, 0) < 0)
+    {
+        return -1;
+    }
+
+    *crc = 0;
+    sum = 0;
+
+    for (i = 0; i < 4; i++)
+    {
+        ch = stm32_serial_poll (1000, 0);
+
+        if (ch < 0)
+        {
+            return -1;
+        }
+
+        *crc = (*crc << 8) | ch;
+        sum ^= ch;
+    }
+
+    ch = stm32_serial_poll (1000, 0);
+
+    if (ch < 0 || ch != sum)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * CRC like the CRC unit of the STM32: 32 bit words in memory (little endian) order, MSB first, no reflection, no final XOR
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint32_t
+stm32_crc (uint32_t crc, const uint8_t * buf, uint32_t len)
+{
+    uint32_t    word;
+    uint32_t    i;
+    int         bit;
+
+    for (i = 0; i + 3 < len; i += 4)
+    {
+        word = buf[i] | (buf[i + 1] << 8) | (buf[i + 2] << 16) | ((uint32_t) buf[i + 3] << 24);
+        crc ^= word;
+
+        for (bit = 0; bit < 32; bit++)
+        {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : (crc << 1);
+        }
+    }
+
+    return crc;
+}
+
 /*-------------------------------------------------------------------------------------------------------------------------------------------
  * STM32 bootloader command: GO
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-#if 0 // yet not used
 static int
 stm32_go (uint32_t address)
 {
     stm32_write_cmd (bootloader_info[STM32_INFO_GO_CMD_IDX]);
+    trace_args (address, 0);
 
     if (wait_for_ack (1000, 1) < 0)
     {
@@ -458,8 +649,8 @@ stm32_go (uint32_t address)
     stm32_buf[3] = address & 0xFF;
     stm32_buf[4] = stm32_buf[0] ^ stm32_buf[1] ^ stm32_buf[2] ^ stm32_buf[3];
 
-    Serial.write (stm32_buf, 5);
-    Serial.flush ();
+    stm32_uart->write (stm32_buf, 5);
+    stm32_uart->flush ();
 
     if (wait_for_ack (1000, 1) < 0)
     {
@@ -467,7 +658,6 @@ stm32_go (uint32_t address)
     }
     return 0;
 }
-#endif // 0
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
  * STM32 bootloader command: WRITE MEMORY
@@ -487,6 +677,7 @@ stm32_write_memory (uint8_t * image, uint32_t address, unsigned int len)
     }
 
     stm32_write_cmd (bootloader_info[STM32_INFO_WRITE_MEMORY_CMD_IDX]);
+    trace_args (address, len);
 
     if (wait_for_ack (1000, 1) < 0)
     {
@@ -500,8 +691,8 @@ stm32_write_memory (uint8_t * image, uint32_t address, unsigned int len)
     stm32_buf[3] = address & 0xFF;
     stm32_buf[4] = stm32_buf[0] ^ stm32_buf[1] ^ stm32_buf[2] ^ stm32_buf[3];
 
-    Serial.write (stm32_buf, 5);
-    Serial.flush ();
+    stm32_uart->write (stm32_buf, 5);
+    stm32_uart->flush ();
 
     if (wait_for_ack (1000, 1) < 0)
     {
@@ -515,18 +706,18 @@ stm32_write_memory (uint8_t * image, uint32_t address, unsigned int len)
 
     stm32_buf[0] = len - 1;
     sum = stm32_buf[0];
-    Serial.write (stm32_buf, 1);
-    Serial.flush ();
+    stm32_uart->write (stm32_buf, 1);
+    stm32_uart->flush ();
 
     for (i = 0; i < len; i++)
     {
         sum ^= image[i];
     }
 
-    Serial.write (image, len);
+    stm32_uart->write (image, len);
     stm32_buf[0] = sum;
-    Serial.write (stm32_buf, 1);
-    Serial.flush ();
+    stm32_uart->write (stm32_buf, 1);
+    stm32_uart->flush ();
 
     if (wait_for_ack (1000, 1) < 0)
     {
@@ -583,6 +774,7 @@ stm32_erase (uint8_t * pagenumbers, uint16_t n_pages)
     }
 
     stm32_write_cmd (bootloader_info[STM32_INFO_ERASE_CMD_IDX]);
+    trace_args (0, n_pages);
 
     if (wait_for_ack (1000, 1) < 0)
     {
@@ -594,7 +786,7 @@ stm32_erase (uint8_t * pagenumbers, uint16_t n_pages)
     n_pages &= 0xFF;                                // 0xFFFF -> 0xFF
 
     stm32_buf[0] = n_pages;
-    Serial.write (stm32_buf, 1);
+    stm32_uart->write (stm32_buf, 1);
 
     if (real_pages == 0)
     {
@@ -607,14 +799,14 @@ stm32_erase (uint8_t * pagenumbers, uint16_t n_pages)
         for (i = 0; i < real_pages; i++)
         {
             stm32_buf[0] = pagenumbers[i];
-            Serial.write (stm32_buf, 1);
+            stm32_uart->write (stm32_buf, 1);
             sum ^= pagenumbers[i];
         }
     }
 
     stm32_buf[0] = sum;
-    Serial.write (stm32_buf, 1);
-    Serial.flush ();
+    stm32_uart->write (stm32_buf, 1);
+    stm32_uart->flush ();
 
     if (wait_for_ack (35000, 1) < 0)
     {
@@ -641,6 +833,7 @@ stm32_ext_erase (uint16_t * pagenumbers, uint16_t n_pages)
     uint8_t     sum;
 
     stm32_write_cmd (bootloader_info[STM32_INFO_ERASE_CMD_IDX]);
+    trace_args (0, n_pages);
 
     if (wait_for_ack (1000, 1) < 0)
     {
@@ -657,8 +850,8 @@ stm32_ext_erase (uint16_t * pagenumbers, uint16_t n_pages)
         stm32_buf[1] = n_pages & 0xFF;                                  // LSB
         stm32_buf[2] = stm32_buf[0] ^ stm32_buf[1];                     // checksum
 
-        Serial.write (stm32_buf, 3);
-        Serial.flush ();
+        stm32_uart->write (stm32_buf, 3);
+        stm32_uart->flush ();
 
         if (wait_for_ack (35000, 1) < 0)
         {
@@ -669,7 +862,7 @@ stm32_ext_erase (uint16_t * pagenumbers, uint16_t n_pages)
     {
         stm32_buf[0] = n_pages >> 8;                                    // MSB
         stm32_buf[1] = n_pages & 0xFF;                                  // LSB
-        Serial.write (stm32_buf, 2);
+        stm32_uart->write (stm32_buf, 2);
 
         sum = stm32_buf[0] ^ stm32_buf[1];
 
@@ -678,12 +871,12 @@ stm32_ext_erase (uint16_t * pagenumbers, uint16_t n_pages)
             stm32_buf[0] = pagenumbers[i] >> 8;                         // MSB
             stm32_buf[1] = pagenumbers[i] & 0xFF;                       // LSB
             sum ^= stm32_buf[0] ^ stm32_buf[1];
-            Serial.write (stm32_buf, 2);
+            stm32_uart->write (stm32_buf, 2);
         }
 
         stm32_buf[0] = sum;
-        Serial.write (stm32_buf, 1);
-        Serial.flush ();
+        stm32_uart->write (stm32_buf, 1);
+        stm32_uart->flush ();
 
         if (wait_for_ack (35000, 1) < 0)
         {
@@ -698,767 +891,2524 @@ stm32_ext_erase (uint16_t * pagenumbers, uint16_t n_pages)
     return 0;
 }
 
-#define PAGESIZE        256
-static uint32_t         start_address   = 0x00000000;                   // address of program start
-
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * stm32_flash_image (do_flash) - check or flash image
- *
- * do_flash == false: only check file
- * do_flash == true: check and flash file
+ * erase flash before programming
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-#define LINE_BUFSIZE    256
 static int
-stm32_flash_image (String fname, bool do_flash)
+stm32_erase_flash (void)
 {
-    char            linebuf[LINE_BUFSIZE];
-    char            logbuf[128];
-    uint32_t        i;
-    int             len;
-    int             line;
-    uint8_t         pagebuf[PAGESIZE];
-    uint32_t        pageaddr        = 0xffffffff;
-    uint32_t        pageidx         = 0;
-    unsigned char   datalen;
-    uint32_t        address_min     = 0xffffffff;               // minimum address (incl.)
-    uint32_t        address_max     = 0x00000000;               // maximum address (incl.)
-    uint32_t        last_address    = 0x00000000;
-    uint32_t        drlo;                                       // DATA Record Load Offset (current address, 2 bytes)
-    uint32_t        ulba            = 0x00000000;               // Upper Linear Base Address (address offset, 4 bytes)
-    unsigned char   dri;                                        // Data Record Index
-    uint32_t        bytes_written;
-    uint32_t        bytes_read;
-    uint32_t        pages_written;
-    int             eof_record_found = 0;
-    int             idx;
-    int             ch;
-    int             errors = 0;
-    int             rtc = 0;
+    int rtc;
 
-    if (do_flash)
+    if (bootloader_info[STM32_INFO_ERASE_CMD_IDX] == STM32_CMD_ERASE)
+    {
+        http_send_FS ("Erasing flash (standard method)... ");
+        http_flush ();
+        rtc = stm32_erase (0, 0);
+    }
+    else if (bootloader_info[STM32_INFO_ERASE_CMD_IDX] == STM32_CMD_EXT_ERASE)
     {
-        http_send_FS ("Flashing STM32...<br/>");
+        http_send_FS ("Erasing flash (extended method)... ");
         http_flush ();
+        rtc = stm32_ext_erase (0, 0);
     }
     else
     {
-        http_send_FS ("Checking HEX file ");
-        http_send_string (fname);
-        http_send_FS (" ...<br/>");
+        http_send_FS ("Unknown erase method<br>");
+        http_flush ();
+        rtc = -1;
     }
 
-    File f = LittleFS.open(fname, "r");
-
-    if (f)
+    if (rtc >= 0)
     {
-        line            = 0;
-        bytes_read      = 0;
-        bytes_written   = 0;
-        pages_written   = 0;
-
-        while(f.available())
-        {
-            idx = 0;
+        http_send_FS ("successful!<br>\r\n");
+        http_flush ();
+    }
 
-            while ((ch = f.read ()) != EOF)
-            {
-                if (ch != '\r')
-                {
-                    if (ch == '\n')
-                    {
-                        linebuf[idx] = '\0';
-                        break;
-                    }
-                    else if (idx < LINE_BUFSIZE - 1)
-                    {
-                        linebuf[idx] = ch;
-                        idx++;
-                    }
-                }
-            }
+    return rtc;
+}
 
-            if (idx == 0)
-            {
-                break;
-            }
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * get erasable page or sector containing address
+ * Returns number of page/sector, -1 if unknown
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+stm32_flash_unit (uint32_t address, uint32_t * start, uint32_t * size)
+{
+    uint32_t    offset;
+    int         unit;
 
-            line++;
-            bytes_read += idx;
+    if (! stm32_flash_layout || address < STM32_FLASH_BASE)
+    {
+        return -1;
+    }
 
-            len = idx;
-    
-            if (linebuf[0] == ':' && len >= 11)
-            {
-                unsigned char   addrh;
-                unsigned char   addrl;
-                unsigned char   rectype;
-                char *          dataptr;
-                unsigned char   chcksum;
-                int             sum = 0;
-                unsigned char   ch;
-    
-                datalen = hex2toi (linebuf +  1);
-                addrh   = hex2toi (linebuf +  3);
-                addrl   = hex2toi (linebuf +  5);
-                drlo    = (addrh << 8 | addrl);
-                rectype = hex2toi (linebuf + 7);
-                dataptr = linebuf + 9;
-    
-                sum = datalen + addrh + addrl + rectype;
-    
-                if (len == 9 + 2 * datalen + 2)
-                {
-                    if (rectype == 0)                               // Data Record
-                    {
-                        for (dri = 0; dri < datalen; dri++)
-                        {
-                            ch = hex2toi (dataptr);
-    
-                            pageidx = ulba + drlo + dri;
-    
-                            if (pageidx - pageaddr >= PAGESIZE)
-                            {
-                                if (pageaddr != 0xffffffff)
-                                {
-                                    if (do_flash)
-                                    {
-                                        // flash (pagebuf, pageaddr, pageidx - pageaddr);
-                                        if (stm32_write_memory (pagebuf, pageaddr, pageidx - pageaddr) < 0)
-                                        {
-                                            rtc = -1;
-                                            break;
-                                        }
-        
-                                        yield ();
-        
-                                        if (stm32_read_memory (pageaddr, pageidx - pageaddr) < 0)
-                                        {
-                                            rtc = -1;
-                                            break;
-                                        }
-        
-                                        yield ();
-        
-                                        if (memcmp (pagebuf, stm32_buf, pageidx - pageaddr) != 0)
-                                        {
-                                            errors++;
-                                            char tmpbuf[32];
-                                            http_send_FS ("verify failed at address=\r\n");
-                                            sprintf (tmpbuf, "%08X \r\n", pageaddr);
-                                            http_send (tmpbuf);
-                                            sprintf (tmpbuf, "len=%d<BR>\r\n", pageidx - pageaddr);
-                                            http_send (tmpbuf);
-                                            http_send_FS ("pagebuf:<BR><pre>\r\n");
-        
-                                            for (i = 0; i < pageidx - pageaddr; i++)
-                                            {
-                                                sprintf (tmpbuf, "%02X ", pagebuf[i]);
-                                                http_send (tmpbuf);
-                                                yield ();
-                                            }
-        
-                                            http_send_FS ("</pre><BR>\r\n");
-        
-                                            http_send_FS ("stm32_buf:<BR><pre>\r\n");
-        
-                                            for (i = 0; i < pageidx - pageaddr; i++)
-                                            {
-                                                sprintf (tmpbuf, "%02X ", stm32_buf[i]);
-                                                http_send (tmpbuf);
-                                                yield ();
-                                            }
-        
-                                            http_send_FS ("</pre><BR>\r\n");
-                                            rtc = -1;
-                                            break;
-                                        }
-        
-                                        bytes_written += pageidx - pageaddr;
-                                    }
-
-                                    pages_written++;
-
-                                    if (do_flash)
-                                    {
-                                        http_send_FS (".");
-    
-                                        if (pages_written % 80 == 0)
-                                        {
-                                            http_send_FS ("<br>");
-                                        }
-
-                                        http_flush ();
-                                    }
-                                }
-    
-                                pageaddr = ulba + drlo + dri;
-                                memset (pagebuf, 0xFF, PAGESIZE);
-                            }
-    
-                            pagebuf[pageidx - pageaddr] = ch;
-
-                            if (! do_flash) // only check
-                            {
-                                if (last_address && last_address + 1 != ulba + drlo + dri)
-                                {
-                                    // sprintf (logbuf, "Info: gap in line %d, addr 0x%08X. This is normal.\r\n", line, ulba + drlo + dri);
-                                    // http_send (logbuf);
-                                }
-                                last_address = ulba + drlo + dri;
-                            }
-
-                            if (address_min > ulba + drlo + dri)
-                            {
-                                address_min = ulba + drlo + dri;
-                            }
-    
-                            if (address_max < ulba + drlo + dri)
-                            {
-                                address_max = ulba + drlo + dri;
-                            }
-    
-                            sum += ch;
-                            dataptr +=2;
-                        }
-    
-                        if (rtc == -1)
-                        {
-                            break;
-                        }
-                    }
-                    else if (rectype == 1)                          // End of File Record
-                    {
-                        eof_record_found = 1;
-
-                        for (dri = 0; dri < datalen; dri++)
-                        {
-                            ch = hex2toi (dataptr);
-    
-                            sum += ch;
-                            dataptr +=2;
-                        }
-    
-                        if (pageidx - pageaddr > 0)
-                        {
-                            pageidx++;                              // we have to go behind last byte
-
-                            if (do_flash)
-                            {
-                                // flash (pagebuf, pageaddr, pageidx - pageaddr);
-                                if (stm32_write_memory (pagebuf, pageaddr, pageidx - pageaddr) < 0)
-                                {
-                                    rtc = -1;
-                                    break;
-                                }
-        
-                                yield ();
-        
-                                if (stm32_read_memory (pageaddr, pageidx - pageaddr) < 0)
-                                {
-                                    rtc = -1;
-                                    break;
-                                }
-        
-                                yield ();
-        
-                                if (memcmp (pagebuf, stm32_buf, pageidx - pageaddr) != 0)
-                                {
-                                    errors++;
-
-                                    char tmpbuf[32];
-
-                                    http_send_FS ("verify failed at address \r\n");
-                                    sprintf (tmpbuf, "%08X<BR>\r\n", pageaddr);
-                                    http_send (tmpbuf);
-                                    http_send_FS ("pagebuf:<BR><pre>\r\n");
-
-                                    for (i = 0; i < pageidx - pageaddr; i++)
-                                    {
-                                        sprintf (tmpbuf, "%02X ", pagebuf[i]);
-                                        http_send (tmpbuf);
-                                        yield ();
-                                    }
-
-                                    http_send_FS ("</pre><BR>\r\n");
-                                    http_send_FS ("stm32_buf:<BR><pre>\r\n");
-        
-                                    for (i = 0; i < pageidx - pageaddr; i++)
-                                    {
-                                        sprintf (tmpbuf, "%02X ", stm32_buf[i]);
-                                        http_send (tmpbuf);
-                                        yield ();
-                                    }
-        
-                                    http_send_FS ("</pre><BR>\r\n");
-                                    rtc = -1;
-                                    break;
-                                }
-        
-                                bytes_written += pageidx - pageaddr;
-                                pageidx = 0;
-                                memset (pagebuf, 0xFF, PAGESIZE);
-                            }
-
-                            pages_written++;
-
-                            if (do_flash)
-                            {
-                                http_send_FS (".");
-    
-                                if (pages_written % 80 == 0)
-                                {
-                                    http_send_FS ("<br>");
-                                }
-                                http_flush ();
-                            }
-                        }
-                        break;                                      // stop reading here
-                    }
-                    else if (rectype == 4)                          // Extended Linear Address Record
-                    {
-                        if (drlo == 0)
-                        {
-                            ulba = 0;
-    
-                            for (dri = 0; dri < datalen; dri++)
-                            {
-                                ch = hex2toi (dataptr);
-    
-                                ulba <<= 8;
-                                ulba |= ch;
-    
-                                sum += ch;
-                                dataptr +=2;
-                            }
-    
-                            ulba <<= 16;
-                        }
-                        else
-                        {
-                            sprintf (logbuf, "line %d: rectype = %d: address field is 0x%04X\r\n", line, rectype, drlo);
-                            http_send (logbuf);
-                            rtc = -1;
-                            break;
-                        }
-                    }
-                    else if (rectype == 5)                          // Start Linear Address Record
-                    {
-                        if (drlo == 0)
-                        {
-                            start_address = 0;
-    
-                            for (dri = 0; dri < datalen; dri++)
-                            {
-                                ch = hex2toi (dataptr);
-    
-                                start_address <<= 8;
-                                start_address |= ch;
-    
-                                sum += ch;
-                                dataptr +=2;
-                            }
-                        }
-                        else
-                        {
-                            sprintf (logbuf, "line %d: rectype = %d: address field is 0x%04X\r\n", line, rectype, drlo);
-                            http_send (logbuf);
-                            rtc = -1;
-                            break;
-                        }
-                    }
-                    else
-                    {
-                        sprintf (logbuf, "line %d: unsupported record type: %d\r\n", line, rectype);
-                        http_send (logbuf);
-                        rtc = -1;
-                        break;
-                    }
-    
-                    sum = (0x100 - (sum & 0xff)) & 0xff;
-                    chcksum = hex2toi (dataptr);
-    
-                    if (sum != chcksum)
-                    {
-                        sprintf (logbuf, "invalid checksum: sum: 0x%02X chcksum: 0x%02X\r\n", sum, chcksum);
-                        http_send (logbuf);
-                        rtc = -1;
-                        break;
-                    }
-                }
-                else
-                {
-                    sprintf (logbuf, "invalid len: %d, expected %d\r\n", len, 12 + 2 * datalen + 2);
-                    http_send (logbuf);
-                    rtc = -1;
-                    break;
-                }
-            }
-            else
-            {
-                sprintf (logbuf, "invalid INTEL HEX format, len: %d\r\n", len);
-                http_send (logbuf);
-                rtc = -1;
-                break;
-            }
-        }
-    
-        f.close();
+    offset = address - STM32_FLASH_BASE;
 
-        if (do_flash)
-        {
-            sprintf (logbuf, "<BR>Lines read: %d<BR>\r\n", line);
-            http_send (logbuf);
-            sprintf (logbuf, "Pages flashed: %u<BR>\r\n", pages_written);
-            http_send (logbuf);
-            sprintf (logbuf, "Bytes flashed: %u<BR>\r\n", bytes_written);
-            http_send (logbuf);
-            sprintf (logbuf, "Flash write errors: %d<BR>\r\n", errors);
-            http_send (logbuf);
-    
-            if (rtc == 0)
-            {
-                http_send_FS ("Flash successful<BR>\r\n");
-            }
-            else
-            {
-                http_send_FS ("Flash failed<BR>\r\n");
-            }
-        }
-        else
-        {
-            if (rtc == 0 && ! eof_record_found)
-            {
-                http_send_FS ("Error: no EOF record found. HEX file may be incomplete.<BR>\r\n");
-                rtc = -1;
-            }
+    if (stm32_flash_layout->page_size)
+    {
+        unit    = offset / stm32_flash_layout->page_size;
+        *size   = stm32_flash_layout->page_size;
+        *start  = STM32_FLASH_BASE + unit * stm32_flash_layout->page_size;
+        return unit;
+    }
 
-            if (rtc == 0)
-            {
-                http_send_FS ("<BR>Check successful<BR>\r\n");
-                sprintf (logbuf, "File size: %d<BR>\r\n", bytes_read + 2 * line);
-                http_send (logbuf);
-            }
-            else
-            {
-                http_send_FS ("Check failed<BR>\r\n");
-            }
-        }
+    if (offset < 0x10000)
+    {
+        unit    = offset / 0x4000;
+        *start  = unit * 0x4000;
+        *size   = 0x4000;
     }
-    else
+    else if (offset < 0x20000)
     {
-        http_send_FS ("error: cannot open file<br/>");
-        rtc = -1;
+        unit    = 4;
+        *start  = 0x10000;
+        *size   = 0x10000;
     }
-
-    if (do_flash)
+    else
     {
-        http_flush ();
+        unit    = 4 + offset / 0x20000;
+        *start  = (unit - 4) * 0x20000;
+        *size   = 0x20000;
     }
 
-    return rtc;
+    *start += STM32_FLASH_BASE;
+    return unit;
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * start STM32 bootloader
+ * read from flat binary file, bytes outside of file are 0xFF (erased flash)
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-#define N_RETRIES    4
-
-static int
-stm32_bootloader (String fname, int do_unprotect)
+static void
+stm32_flat_read (File & fp, uint32_t base_address, uint32_t address, uint8_t * buf, uint16_t len)
 {
-    char          buffer[256];
-    int           i;
-    int           ch;
-    unsigned long time1;
-    unsigned long time2;
-    int           rtc = 0;
+    uint32_t    size = fp.size ();
+    uint16_t    i;
 
-    buffer[0] = STM32_BEGIN;
+    memset (buf, 0xFF, len);
 
-    for (i = 0; i < N_RETRIES; i++)
+    if (address + len <= base_address || address >= base_address + size)
     {
-        http_send_FS ("Trying to enter bootloader mode...<br>\r\n");
-        http_flush ();
-        Serial.write (buffer, 1);
-        ch = stm32_serial_poll (1000, 1);
+        return;
+    }
 
-        if (ch == STM32_ACK)
-        {
-            break;
-        }
+    i = 0;
+
+    if (address < base_address)
+    {
+        i = base_address - address;
     }
 
-    if (i == N_RETRIES)
+    if (address + len > base_address + size)
     {
-        return -1;
+        len = base_address + size - address;
     }
 
-    rtc = stm32_get (bootloader_info, STM32_INFO_SIZE);
+    fp.seek (address + i - base_address);
+    fp.read (buf + i, len - i);
+}
 
-    if (rtc < 0)
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * plan incremental erase: compare last flashed image with new flat image IMAGE_LAST_TMP page by page
+ * Returns number of pages/sectors to erase, -1 if not possible
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+stm32_plan_erase (IMAGE_LAST * last, uint32_t base_address, int * n_units)
+{
+    uint8_t     buf[STM32_BUFLEN];
+    uint32_t    range_start;
+    uint32_t    range_end;
+    uint32_t    address;
+    uint32_t    unit_start;
+    uint32_t    unit_size;
+    uint32_t    n;
+    int         unit;
+    int         n_changed = 0;
+    bool        changed;
+
+    File old_fp = LittleFS.open (IMAGE_LAST_BIN, "r");
+    File new_fp = LittleFS.open (IMAGE_LAST_TMP, "r");
+
+    if (! old_fp || ! new_fp)
     {
-        return rtc;
+        return -1;
     }
 
-    http_send_FS ("Bootloader version: ");
-    sprintf (buffer, "%X.%X", bootloader_info[STM32_INFO_BOOTLOADER_VERSION_IDX] >> 4, bootloader_info[STM32_INFO_BOOTLOADER_VERSION_IDX] & 0x0F);
-    http_send (buffer);
-    http_send_FS ("<BR>\r\n");
-
-#if 0
-    rtc = stm32_get_version (bootloader_version, STM32_VERSION_SIZE);
+    range_start = last->base_address < base_address ? last->base_address : base_address;
+    range_end   = last->base_address + last->size;
 
-    if (rtc < 0)
+    if (range_end < base_address + new_fp.size ())
     {
-        return rtc;
+        range_end = base_address + new_fp.size ();
     }
 
-    http_send_FS ("Option Bytes: ");
-    sprintf (buffer, "0x%02X 0x%02X", bootloader_version[STM32_VERSION_OPTION_BYTE1], bootloader_version[STM32_VERSION_OPTION_BYTE2]);
-    http_send (buffer);
-    http_send_FS ("<BR>\r\n");
-#endif
+    memset (stm32_erase_map, 0, sizeof (stm32_erase_map));
+    *n_units = 0;
+    address = range_start;
 
-    if (do_unprotect)
+    while (address < range_end)
     {
-        rtc = stm32_write_unprotect ();
+        unit = stm32_flash_unit (address, &unit_start, &unit_size);
 
-        if (rtc >= 0)
+        if (unit < 0 || unit >= STM32_MAX_UNITS)
         {
-            delay (500);
+            n_changed = -1;
+            break;
+        }
 
-            http_send_FS ("Flash now unprotected<BR>\r\n");
-            http_flush ();
-            buffer[0] = STM32_BEGIN;
+        changed = false;
 
-            http_send_FS ("Trying to enter bootloader mode again...");
-            http_flush ();
+        for (address = unit_start; address < unit_start + unit_size && address < range_end && ! changed; address += n)
+        {
+            n = unit_start + unit_size - address;
 
-            for (i = 0; i < N_RETRIES; i++)
+            if (n > STM32_BUFLEN)
             {
-                Serial.write (buffer, 1);
-                ch = stm32_serial_poll (1000, 1);
+                n = STM32_BUFLEN;
+            }
 
-                if (ch == STM32_ACK)
-                {
-                    break;
-                }
+            stm32_flat_read (old_fp, last->base_address, address, buf, n);
+            stm32_flat_read (new_fp, base_address, address, stm32_buf, n);
+
+            if (memcmp (buf, stm32_buf, n) != 0)
+            {
+                changed = true;
             }
 
-            if (i < N_RETRIES)
+            yield ();
+        }
+
+        if (changed)
+        {
+            stm32_erase_map[unit / 8] |= 1 << (unit % 8);
+            n_changed++;
+        }
+
+        (*n_units)++;
+        address = unit_start + unit_size;
+    }
+
+    old_fp.close ();
+    new_fp.close ();
+    return n_changed;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * check if a page/sector is marked for erasing, pages written by page assembler never span two units
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static bool
+stm32_unit_changed (uint32_t address)
+{
+    uint32_t    unit_start;
+    uint32_t    unit_size;
+    int         unit = stm32_flash_unit (address, &unit_start, &unit_size);
+
+    return unit >= 0 && unit < STM32_MAX_UNITS && (stm32_erase_map[unit / 8] & (1 << (unit % 8)));
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * erase pages/sectors marked in stm32_erase_map
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define ERASE_BATCH     32
+
+static int
+stm32_erase_units (void)
+{
+    uint16_t    units[ERASE_BATCH];
+    uint8_t     units8[ERASE_BATCH];
+    uint16_t    n = 0;
+    int         unit;
+    int         i;
+    int         rtc = 0;
+
+    for (unit = 0; unit <= STM32_MAX_UNITS && rtc >= 0; unit++)
+    {
+        if (unit < STM32_MAX_UNITS && (stm32_erase_map[unit / 8] & (1 << (unit % 8))))
+        {
+            units[n++] = unit;
+        }
+
+        if (n > 0 && (n == ERASE_BATCH || unit == STM32_MAX_UNITS))
+        {
+            if (bootloader_info[STM32_INFO_ERASE_CMD_IDX] == STM32_CMD_EXT_ERASE)
             {
-                http_send_FS ("successful<br>\r\n");
-                http_flush ();
+                rtc = stm32_ext_erase (units, n);
             }
             else
             {
-                http_send_FS ("failed<br>\r\n");
+                for (i = 0; i < n; i++)
+                {
+                    if (units[i] > 0xFF)                                            // standard erase: 8 bit page numbers only
+                    {
+                        return -1;
+                    }
+                    units8[i] = units[i];
+                }
+
+                rtc = stm32_erase (units8, n);
             }
+
+            http_send_FS (".");
+            http_flush ();
+            n = 0;
         }
     }
-    else
-    {
-        rtc = 0;
-    }
 
-    if (rtc >= 0)
+    return rtc;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * verify memory: read back and compare
+ * Returns -1 on error
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+stm32_verify_memory (uint8_t * data, uint32_t address, unsigned int len)
+{
+    char            tmpbuf[32];
+    unsigned int    i;
+
+    if (stm32_read_memory (address, len) < 0)
     {
-        time1 = millis ();
-        rtc = stm32_flash_image (fname, false);
-        time1 = millis () - time1;
+        return -1;
     }
 
-    if (rtc >= 0)
+    yield ();
+
+    if (memcmp (data, stm32_buf, len) != 0)
     {
-        if (bootloader_info[STM32_INFO_ERASE_CMD_IDX] == STM32_CMD_ERASE)
+        http_send_FS ("verify failed at address \r\n");
+        sprintf (tmpbuf, "%08X ", address);
+        http_send (tmpbuf);
+        sprintf (tmpbuf, "len=%d<BR>\r\n", len);
+        http_send (tmpbuf);
+        http_send_FS ("pagebuf:<BR><pre>\r\n");
+
+        for (i = 0; i < len; i++)
         {
-            http_send_FS ("Erasing flash (standard method)... ");
-            http_flush ();
-            rtc = stm32_erase (0, 0);
-        }
-        else if (bootloader_info[STM32_INFO_ERASE_CMD_IDX] == STM32_CMD_EXT_ERASE)
-        {
-            http_send_FS ("Erasing flash (extended method)... ");
-            http_flush ();
-            rtc = stm32_ext_erase (0, 0);
+            sprintf (tmpbuf, "%02X ", data[i]);
+            http_send (tmpbuf);
+            yield ();
         }
-        else
+
+        http_send_FS ("</pre><BR>\r\n");
+        http_send_FS ("stm32_buf:<BR><pre>\r\n");
+
+        for (i = 0; i < len; i++)
         {
-            http_send_FS ("Unknown erase method<br>");
-            http_flush ();
-            rtc = -1;
+            sprintf (tmpbuf, "%02X ", stm32_buf[i]);
+            http_send (tmpbuf);
+            yield ();
         }
 
-        if (rtc >= 0)
+        http_send_FS ("</pre><BR>\r\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * farm: the same image is flashed to several targets, see stm32_farm_from_local ()
+ * The GET response is saved for each target, it's restored if the target is selected again.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static uint8_t                              stm32_farm_info[TARGET_MAX][STM32_INFO_SIZE];
+static int                                  stm32_farm_info_len[TARGET_MAX];
+
+static void
+stm32_farm_select (uint8_t idx)
+{
+    stm32_uart = target_select (idx);
+    memcpy (bootloader_info, stm32_farm_info[idx], STM32_INFO_SIZE);
+    bootloader_info_len = stm32_farm_info_len[idx];
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * page assembler: collects image data of all formats into pages of PAGESIZE bytes, aligned to PAGESIZE
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define PAGESIZE        256
+
+typedef struct
+{
+    uint8_t         buf[PAGESIZE];
+    uint32_t        addr;                                       // address of page, 0xffffffff if empty
+    uint16_t        first;                                      // offset of first used byte
+    uint16_t        last;                                       // offset behind last used byte
+    uint32_t        pages_written;
+    uint32_t        pages_skipped;                              // unchanged or empty pages
+    uint32_t        bytes_written;
+    unsigned long   verify_time;                                // msec spent in stm32_verify_memory ()
+    int             errors;
+    int             rtc;
+    IMAGE_FLAT *    flat;                                       // save pages as flat binary, may be NULL
+    bool            incremental;                                // write only pages marked in stm32_erase_map
+    uint8_t         targets;                                    // farm: bit mask of targets written in turn, 0: selected target
+} PAGE_ASSEMBLER;
+
+static PAGE_ASSEMBLER   page_asm;
+
+static void
+page_asm_begin (PAGE_ASSEMBLER * pa, IMAGE_FLAT * flat, bool incremental, uint8_t targets)
+{
+    pa->addr            = 0xffffffff;
+    pa->pages_written   = 0;
+    pa->pages_skipped   = 0;
+    pa->bytes_written   = 0;
+    pa->verify_time     = 0;
+    pa->errors          = 0;
+    pa->rtc             = 0;
+    pa->flat            = flat;
+    pa->incremental     = incremental;
+    pa->targets         = targets;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * check if address is in SRAM: no erase needed, empty pages must be written, see stm32_bootloader ()
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static bool
+stm32_is_sram (uint32_t address)
+{
+    return address >= STM32_SRAM_BASE && address < STM32_SRAM_END;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * check if page contains only 0xFF: nothing to write into erased flash
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static bool
+page_asm_empty (PAGE_ASSEMBLER * pa)
+{
+    uint16_t    i;
+
+    for (i = pa->first; i < pa->last; i++)
+    {
+        if (pa->buf[i] != 0xFF)
         {
-            http_send_FS ("successful!<br>\r\n");
-            http_flush ();
+            return false;
         }
     }
+    return true;
+}
 
-    if (rtc >= 0)
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * write bytes start to end of current page into selected target and read them back
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+page_asm_program (PAGE_ASSEMBLER * pa, uint16_t start, uint16_t end)
+{
+    unsigned long   verify_start;
+    int             rtc;
+
+    if (stm32_write_memory (pa->buf + start, pa->addr + start, end - start) < 0)
     {
-        time2 = millis ();
-        rtc = stm32_flash_image (fname, true);
-        time2 = millis () - time2;
+        return -1;
+    }
 
-        sprintf (buffer, "%lu", time1); 
-        http_send_FS ("Check time: ");
-        http_send (buffer);
-        http_send_FS (" msec<BR>");
+    yield ();
 
-        sprintf (buffer, "%lu", time2); 
-        http_send_FS ("Flash time: ");
-        http_send (buffer);
-        http_send_FS (" msec<BR>");
+    verify_start = millis ();
+    rtc = stm32_verify_memory (pa->buf + start, pa->addr + start, end - start);
+    pa->verify_time += millis () - verify_start;
+
+    if (rtc < 0)
+    {
+        pa->errors++;
+        return -1;
     }
 
-    return rtc;
+    metrics_count (METRICS_BYTES_PROGRAMMED, end - start);
+    return 0;
 }
 
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * download image
+ * write current page, start and length are aligned to 4 bytes, gaps are filled with 0xFF
+ * Farm: the page is written to all targets in pa->targets, a failing target is removed, the page fails only if no target is left.
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-#if 0
-#define MAX_LINEBUFLEN  255
-bool
-stm32_flash_download_image (const char * host, const char * path, const char * filename)
+static int
+page_asm_flush (PAGE_ASSEMBLER * pa)
 {
-    unsigned char   linebuf[MAX_LINEBUFLEN + 1];
-    int             len;                                                // content len
-    int             read_len;                                           // bytes read in current line
-    bool            rtc = false;
+    uint16_t        start;
+    uint16_t        end;
+    uint8_t         idx;
+    int             rtc;
 
-    http_send_FS ("Downloading ");
-    http_send (filename);
-    http_send_FS ("... ");
-    http_flush();
-
-    len = httpclient (host, path, filename);
-
-    if (len > 0)
+    if (pa->addr != 0xffffffff && pa->rtc == 0 && pa->flat)
     {
-        File f = LittleFS.open("stm32.hex", "w");
-    
-        while (len > 0)
+        if (! image_flat_write (pa->flat, pa->addr + pa->first, pa->buf + pa->first, pa->last - pa->first))
         {
-            read_len = httpclient_read_line (linebuf, MAX_LINEBUFLEN, &len);
+            http_send_FS ("Cannot save flashed image<BR>\r\n");
+            pa->rtc = -1;
+        }
+    }
 
-            if (read_len > 0)
-            {
-                f.write (linebuf, read_len);
-            }
-            else
+    if (pa->addr != 0xffffffff && pa->rtc == 0 &&
+        ((page_asm_empty (pa) && ! stm32_is_sram (pa->addr)) || (pa->incremental && ! stm32_unit_changed (pa->addr))))
+    {
+        pa->pages_skipped++;
+    }
+    else if (pa->addr != 0xffffffff && pa->rtc == 0)
+    {
+        start   = pa->first & ~3;
+        end     = (pa->last + 3) & ~3;
+
+        if (pa->targets == 0)
+        {
+            rtc = page_asm_program (pa, start, end);
+        }
+        else
+        {
+            for (idx = 0; idx < TARGET_MAX; idx++)
             {
-                break;
+                if (pa->targets & (1 << idx))
+                {
+                    stm32_farm_select (idx);
+
+                    if (page_asm_program (pa, start, end) < 0)
+                    {
+                        pa->targets &= ~(1 << idx);
+                        http_send_string (target_name (idx) + " failed<BR>\r\n");
+                    }
+                }
             }
-        }
-    
-        f.close();
 
-        httpclient_stop ();
+            rtc = pa->targets ? 0 : -1;
+        }
 
-        if (len > 0)                                                                // data remaining?
+        if (rtc < 0)
         {
-            http_send_FS ("http read error<br/>");
+            pa->rtc = -1;
         }
         else
         {
-            http_send_FS ("done.<br/>");
-            rtc = true;
-        }
+            pa->bytes_written += end - start;
+            pa->pages_written++;
 
-        http_flush();
-    }
-    else
-    {
-        http_send_FS ("<font color='red'>host connection failed.</font><BR>");
-        rtc = false;
+            http_send_FS (".");
+
+            if (pa->pages_written % 80 == 0)
+            {
+                http_send_FS ("<br>");
+            }
+
+            http_flush ();
+        }
     }
-    return rtc;
+
+    pa->addr = 0xffffffff;
+    return pa->rtc;
 }
-#endif
 
-static void
-stm32_activate_bootloader (void)
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * image data callback of page assembler
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+page_asm_data (void * ctx, uint32_t address, uint8_t * data, uint16_t len)
 {
-    digitalWrite(STM32_BOOT0_PIN, HIGH);                    // activate BOOT0 GPIO5
-    pinMode(STM32_RESET_PIN, OUTPUT);                       // RESET to output
-    digitalWrite(STM32_RESET_PIN, LOW);                     // activate RESET
-    delay (200);                                            // wait 200ms
-    pinMode(STM32_RESET_PIN, INPUT);                        // release RESET
+    PAGE_ASSEMBLER *    pa = (PAGE_ASSEMBLER *) ctx;
+    uint32_t            pageaddr;
+    uint16_t            offset;
+    uint16_t            n;
 
-    while (stm32_serial_poll (1000, 0) >= 0)                // flush characters in serial input
+    while (len > 0 && pa->rtc == 0)
     {
-        ;
+        pageaddr = address & ~(PAGESIZE - 1);
+
+        if (pageaddr != pa->addr)
+        {
+            if (page_asm_flush (pa) < 0)
+            {
+                break;
+            }
+
+            pa->addr    = pageaddr;
+            pa->first   = PAGESIZE;
+            pa->last    = 0;
+            memset (pa->buf, 0xFF, PAGESIZE);
+        }
+
+        offset  = address - pageaddr;
+        n       = PAGESIZE - offset;
+
+        if (n > len)
+        {
+            n = len;
+        }
+
+        memcpy (pa->buf + offset, data, n);
+
+        if (pa->first > offset)
+        {
+            pa->first = offset;
+        }
+
+        if (pa->last < offset + n)
+        {
+            pa->last = offset + n;
+        }
+
+        address += n;
+        data    += n;
+        len     -= n;
     }
+
+    return pa->rtc;
 }
 
+static IMAGE_READER     flash_rd;                           // used for flashing and flattening, one at a time
+static IMAGE_FLAT       flash_flat;
+static unsigned long    stream_busy_time;                   // msec spent in decoder and programming while streaming
+static bool             stream_erase_pending;               // erase flash when first data arrives, see stm32_bootloader_stream ()
+
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * check hex file
+ * check if image is a URL, see stm32_stream_image ()
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-void
-stm32_check_hex_file (String fname)
+static bool
+stm32_is_url (String fname)
 {
-    stm32_flash_image (fname, false);
+    return fname.startsWith ("http://");
 }
 
-/*-------------------------------------------------------------------------------------------------------------------------------------------
- * flash STM32
- * cmd = 0xFF: run some tests
- *-------------------------------------------------------------------------------------------------------------------------------------------
- */
-void
-stm32_flash_from_local (String fname)
+static int
+stm32_stream_data (void * ctx, const uint8_t * buf, size_t len)
 {
-    stm32_activate_bootloader ();
-    http_send_FS ("Start Bootloader<BR>\r\n");
-    http_flush ();
-    stm32_bootloader (fname, 1);
-    http_send_FS ("End Bootloader<BR>\r\n");
-    http_flush ();
+    IMAGE_READER *  rd      = (IMAGE_READER *) ctx;
+    unsigned long   start   = millis ();
+    int             rtc;
+
+    if (stream_erase_pending)
+    {
+        stream_erase_pending = false;
+
+        if (stm32_erase_flash () < 0)
+        {
+            rd->failed = true;
+            strcpy (rd->errmsg, "Erase failed");
+            return -1;
+        }
+
+        metrics_observe (METRICS_PHASE_ERASE, millis () - start);
+        start = millis ();
+    }
+
+    rtc = image_reader_feed (rd, buf, len);
+    stream_busy_time += millis () - start;
+    return rtc;
 }
 
-#if 0 // yet not used
 /*-------------------------------------------------------------------------------------------------------------------------------------------
- * flash STM32
- * cmd = 0xFF: run some tests
+ * stm32_stream_image () - feed image from http server into reader, nothing is stored in LittleFS
+ *
+ * Each received chunk is decoded and its complete pages are programmed before the next chunk is read. Meanwhile the TCP stack
+ * keeps receiving into its window, so download and programming overlap, and a full window throttles the server.
  *-------------------------------------------------------------------------------------------------------------------------------------------
  */
-void
-stm32_flash_from_server (const char * host, const char * path, const char * filename)
+static int
+stm32_stream_image (String url, IMAGE_READER * rd)
 {
-    LittleFS.begin();
+    String  errmsg;
+    int32_t len;
+    bool    failed;
+    int     rtc;
+
+    stream_busy_time = 0;
+    len     = httpclient_get (url, 0xFFFFFFFF, stm32_stream_data, rd, errmsg);
+    failed  = rd->failed;                                   // error in image or flash, see page_asm_data ()
+    rtc     = image_reader_end (rd);
 
-    if (stm32_flash_download_image(host, path, filename))
+    if (len < 0 && ! failed)
     {
-        stm32_flash_from_local (filename);
+        rd->failed = true;
+        snprintf (rd->errmsg, sizeof (rd->errmsg), "Download failed: %s", errmsg.c_str ());
+        rtc = -1;
     }
 
-    LittleFS.remove("stm32.hex");
-    LittleFS.end();
+    return rtc;
 }
-#endif
-void
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * stm32_flash_image () - flash image file or image streamed from http:// URL, flash must be erased
+ *
+ * base_address is only used for raw binary images
+ * flat != NULL: save flashed image as flat binary
+ * incremental: write only pages marked in stm32_erase_map
+ * targets: farm, bit mask of targets written in turn, see page_asm_flush (), 0: selected target
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+stm32_flash_image (String fname, uint8_t format, uint32_t base_address, IMAGE_FLAT * flat, bool incremental, uint8_t targets)
+{
+    IMAGE_READER *      rd = &flash_rd;
+    char                logbuf[128];
+    unsigned long       flash_time;
+    int                 rtc;
+
+    http_send_FS ("Flashing STM32...<br/>");
+    http_flush ();
+
+    flash_time = millis ();
+
+    page_asm_begin (&page_asm, flat, incremental, targets);
+    image_reader_begin (rd, format, base_address, page_asm_data, &page_asm);
+
+    if (stm32_is_url (fname))
+    {
+        rtc = stm32_stream_image (fname, rd);
+    }
+    else
+    {
+        rtc = image_read_file (fname, rd);
+    }
+
+    if (rtc == 0)
+    {
+        rtc = page_asm_flush (&page_asm);                           // write last page
+    }
+    else if (page_asm.rtc == 0)                                     // error in image file, not in flash
+    {
+        http_send (rd->errmsg);
+        http_send_FS ("<BR>\r\n");
+    }
+
+    flash_time = millis () - flash_time;
+    metrics_observe (METRICS_PHASE_PROGRAM, flash_time - page_asm.verify_time);
+    metrics_observe (METRICS_PHASE_VERIFY, page_asm.verify_time);
+
+    sprintf (logbuf, "<BR>Bytes read: %u<BR>\r\n", rd->info.file_size);
+    http_send (logbuf);
+    sprintf (logbuf, "Pages flashed: %u, skipped: %u<BR>\r\n", page_asm.pages_written, page_asm.pages_skipped);
+    http_send (logbuf);
+    sprintf (logbuf, "Bytes flashed: %u<BR>\r\n", page_asm.bytes_written);
+    http_send (logbuf);
+    sprintf (logbuf, "Flash write errors: %d<BR>\r\n", page_asm.errors);
+    http_send (logbuf);
+
+    if (stm32_is_url (fname))
+    {
+        sprintf (logbuf, "Programming: %lu msec, waiting for network: %lu msec<BR>\r\n", stream_busy_time, flash_time - stream_busy_time);
+        http_send (logbuf);
+    }
+
+    if (rtc == 0)
+    {
+        http_send_FS ("Flash successful<BR>\r\n");
+    }
+    else
+    {
+        http_send_FS ("Flash failed<BR>\r\n");
+    }
+
+    http_flush ();
+    return rtc;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * stm32_check_image () - check image file and mark it as checked
+ *
+ * Files already checked during upload are not read again.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+stm32_check_image (String fname, uint32_t base_address, IMAGE_INFO * info)
+{
+    static IMAGE_READER     rd;
+    char                    logbuf[128];
+    uint8_t                 format = image_format (fname);
+    int                     rtc = 0;
+
+    if ((format & IMAGE_FORMAT_MASK) == IMAGE_FORMAT_DELTA)
+    {
+        image_info_remove (fname);                                  // patch depends on last flashed image: check again
+    }
+
+    if (format == IMAGE_FORMAT_NONE)
+    {
+        http_send_FS ("Unknown image format: ");
+        http_send_string (fname);
+        http_send_FS ("<br/>\r\n");
+        return -1;
+    }
+
+    if (image_info_load (fname, &rd.info) && ((format & IMAGE_FORMAT_MASK) != IMAGE_FORMAT_BIN || rd.info.address_min == base_address))
+    {
+        http_send_FS ("Image file ");
+        http_send_string (fname);
+        http_send_FS (" already checked<br/>\r\n");
+        *info = rd.info;
+        return 0;
+    }
+
+    http_send_FS ("Checking image file ");
+    http_send_string (fname);
+    http_send_FS (" ...<br/>");
+
+    image_reader_begin (&rd, format, base_address, 0, 0);
+
+    if (image_read_file (fname, &rd) < 0)
+    {
+        http_send (rd.errmsg);
+        http_send_FS ("<BR>\r\nCheck failed<BR>\r\n");
+        rtc = -1;
+    }
+    else
+    {
+        http_send_FS ("<BR>Check successful<BR>\r\n");
+        sprintf (logbuf, "File size: %u<BR>\r\n", rd.info.file_size);
+        http_send (logbuf);
+        sprintf (logbuf, "Address range: 0x%08X - 0x%08X<BR>\r\n", rd.info.address_min, rd.info.address_max);
+        http_send (logbuf);
+        sprintf (logbuf, "Data bytes: %u, CRC32: 0x%08X<BR>\r\n", rd.info.data_bytes, rd.info.crc32);
+        http_send (logbuf);
+        http_send_FS ("SHA-256: ");
+        http_send_string (image_sha256_string (rd.info.sha256));
+        http_send_FS ("<BR>\r\n");
+        image_info_save (fname, &rd.info);
+        *info = rd.info;
+    }
+
+    return rtc;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * image data callback for flattening
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+flat_data (void * ctx, uint32_t address, uint8_t * data, uint16_t len)
+{
+    return image_flat_write ((IMAGE_FLAT *) ctx, address, data, len) ? 0 : -1;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * stm32_plan_incremental () - convert image into flat binary IMAGE_LAST_TMP and compare it with the last flashed image
+ * Returns number of pages/sectors to erase, -1 if incremental flashing is not possible
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+stm32_plan_incremental (String fname, uint32_t base_address, IMAGE_INFO * info)
+{
+    IMAGE_LAST  last;
+    char        logbuf[128];
+    int         n_units;
+    int         n_changed;
+
+    if (! stm32_flash_layout)
+    {
+        http_send_FS ("Flash layout of device unknown, using full erase<BR>\r\n");
+        return -1;
+    }
+
+    if (! image_last_load (&last))
+    {
+        http_send_FS ("No last flashed image, using full erase<BR>\r\n");
+        return -1;
+    }
+
+    image_flat_open (&flash_flat, IMAGE_LAST_TMP, info->address_min);
+    image_reader_begin (&flash_rd, image_format (fname), base_address, flat_data, &flash_flat);
+
+    if (image_read_file (fname, &flash_rd) < 0 || ! image_flat_close (&flash_flat))
+    {
+        http_send_FS ("Cannot convert image into flat binary, using full erase<BR>\r\n");
+        return -1;
+    }
+
+    n_changed = stm32_plan_erase (&last, info->address_min, &n_units);
+
+    if (n_changed < 0)
+    {
+        http_send_FS ("Image exceeds known flash layout, using full erase<BR>\r\n");
+        return -1;
+    }
+
+    sprintf (logbuf, "Pages/sectors changed: %d of %d<BR>\r\n", n_changed, n_units);
+    http_send (logbuf);
+    http_flush ();
+    return n_changed;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * address ranges covered by the data records of an image, collected while flattening
+ * If an image has more than VERIFY_MAX_RANGES separate ranges, the last range is extended, so the gap in between is compared, too.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define VERIFY_MAX_RANGES       32
+
+typedef struct
+{
+    IMAGE_FLAT *    flat;
+    uint32_t        start[VERIFY_MAX_RANGES];
+    uint32_t        end[VERIFY_MAX_RANGES];                                         // excl.
+    uint16_t        n;
+} VERIFY_RANGES;
+
+static int
+verify_ranges_data (void * ctx, uint32_t address, uint8_t * data, uint16_t len)
+{
+    VERIFY_RANGES * vr  = (VERIFY_RANGES *) ctx;
+    uint32_t        end = address + len;
+    uint16_t        i;
+
+    for (i = 0; i < vr->n; i++)                                                     // adjacent or overlapping range?
+    {
+        if (address <= vr->end[i] && end >= vr->start[i])
+        {
+            break;
+        }
+    }
+
+    if (i == vr->n && vr->n < VERIFY_MAX_RANGES)
+    {
+        vr->start[i]    = address;
+        vr->end[i]      = end;
+        vr->n++;
+    }
+    else
+    {
+        if (i == vr->n)
+        {
+            i = vr->n - 1;
+        }
+
+        if (vr->start[i] > address)
+        {
+            vr->start[i] = address;
+        }
+
+        if (vr->end[i] < end)
+        {
+            vr->end[i] = end;
+        }
+    }
+
+    return flat_data (vr->flat, address, data, len);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * sort ranges by address and merge overlapping ranges, ranges may have grown into each other
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+verify_ranges_merge (VERIFY_RANGES * vr)
+{
+    uint32_t    start;
+    uint32_t    end;
+    uint16_t    i;
+    uint16_t    j;
+    uint16_t    n;
+
+    for (i = 1; i < vr->n; i++)                                                     // insertion sort, n is small
+    {
+        start   = vr->start[i];
+        end     = vr->end[i];
+
+        for (j = i; j > 0 && vr->start[j - 1] > start; j--)
+        {
+            vr->start[j]    = vr->start[j - 1];
+            vr->end[j]      = vr->end[j - 1];
+        }
+
+        vr->start[j]    = start;
+        vr->end[j]      = end;
+    }
+
+    for (i = 1, n = vr->n ? 1 : 0; i < vr->n; i++)
+    {
+        if (vr->start[i] <= vr->end[n - 1])
+        {
+            if (vr->end[n - 1] < vr->end[i])
+            {
+                vr->end[n - 1] = vr->end[i];
+            }
+        }
+        else
+        {
+            vr->start[n]    = vr->start[i];
+            vr->end[n]      = vr->end[i];
+            n++;
+        }
+    }
+
+    vr->n = n;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * stm32_verify_image () - compare image with flash content, nothing is erased or written
+ *
+ * Only the address ranges covered by the data records of the image are compared, gaps between them are not, see VERIFY_RANGES.
+ * The ranges are compared page by page (sector by sector on F2/F4, VERIFY_BLOCKSIZE on unknown devices), using the
+ * GET CHECKSUM command if the bootloader supports it, else by reading back. Ranges are extended to 32 bit words, the flasher
+ * writes the rest of a partly used word as 0xFF.
+ * Returns -1 on error or mismatch
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define VERIFY_BLOCKSIZE        1024
+#define VERIFY_MAX_REPORTED     32                                                  // max. number of reported mismatching pages
+
+static int
+stm32_verify_image (String fname, uint32_t base_address, IMAGE_INFO * info)
+{
+    static VERIFY_RANGES    ranges;
+    uint8_t     buf[STM32_BUFLEN];
+    char        logbuf[80];
+    uint32_t    start;
+    uint32_t    end;
+    uint32_t    address;
+    uint32_t    block_start;
+    uint32_t    block_size;
+    uint32_t    block_end;
+    uint32_t    a;
+    uint32_t    n;
+    uint32_t    crc;
+    uint32_t    target_crc;
+    uint32_t    n_blocks    = 0;
+    uint32_t    n_mismatch  = 0;
+    bool        use_crc     = stm32_has_command (STM32_CMD_GET_CHECKSUM) && eeprom_config.verify != EEPROM_VERIFY_READBACK;
+    bool        mismatch;
+    uint16_t    r;
+    int         rtc = 0;
+
+    ranges.flat = &flash_flat;
+    ranges.n    = 0;
+    image_flat_open (&flash_flat, IMAGE_LAST_TMP, info->address_min);
+    image_reader_begin (&flash_rd, image_format (fname), base_address, verify_ranges_data, &ranges);
+
+    if (image_read_file (fname, &flash_rd) < 0 || ! image_flat_close (&flash_flat))
+    {
+        http_send_FS ("Cannot convert image into flat binary<BR>\r\n");
+        LittleFS.remove (IMAGE_LAST_TMP);
+        return -1;
+    }
+
+    File fp = LittleFS.open (IMAGE_LAST_TMP, "r");
+
+    if (! fp)
+    {
+        return -1;
+    }
+
+    verify_ranges_merge (&ranges);
+    sprintf (logbuf, "Address ranges of image: %u<BR>\r\n", ranges.n);
+    http_send (logbuf);
+    http_send_FS (use_crc ? "Verifying with GET CHECKSUM...<BR>\r\n" : "Verifying by reading back...<BR>\r\n");
+    http_flush ();
+
+    for (r = 0, address = 0, end = 0; rtc == 0; address = block_end)
+    {
+        if (address >= end)                                                         // next range
+        {
+            if (r == ranges.n)
+            {
+                break;
+            }
+
+            start   = ranges.start[r] & ~3;
+            end     = (ranges.end[r] + 3) & ~3;
+            address = start > address ? start : address;                           // ranges may share a word
+            r++;
+
+            if (address >= end)
+            {
+                block_end = address;
+                continue;
+            }
+        }
+
+        if (stm32_flash_unit (address, &block_start, &block_size) < 0)
+        {
+            block_start = address & ~(VERIFY_BLOCKSIZE - 1);
+            block_size  = VERIFY_BLOCKSIZE;
+        }
+
+        block_end = block_start + block_size < end ? block_start + block_size : end;
+        mismatch = false;
+
+        if (use_crc)
+        {
+            crc = 0xFFFFFFFF;
+
+            for (a = address; a < block_end; a += n)
+            {
+                n = block_end - a < STM32_BUFLEN ? block_end - a : STM32_BUFLEN;
+                stm32_flat_read (fp, info->address_min, a, buf, n);
+                crc = stm32_crc (crc, buf, n);
+            }
+
+            if (stm32_get_checksum (address, block_end - address, &target_crc) < 0)
+            {
+                http_send_FS ("GET CHECKSUM failed, verifying by reading back<BR>\r\n");
+                use_crc = false;
+            }
+            else
+            {
+                mismatch = (crc != target_crc);
+            }
+        }
+
+        if (! use_crc)
+        {
+            for (a = address; a < block_end && ! mismatch; a += n)
+            {
+                n = block_end - a < STM32_BUFLEN ? block_end - a : STM32_BUFLEN;
+                stm32_flat_read (fp, info->address_min, a, buf, n);
+
+                if (stm32_read_memory (a, n) < 0)
+                {
+                    rtc = -1;
+                    break;
+                }
+
+                mismatch = (memcmp (buf, stm32_buf, n) != 0);
+                yield ();
+            }
+        }
+
+        n_blocks++;
+
+        if (mismatch)
+        {
+            n_mismatch++;
+
+            if (n_mismatch <= VERIFY_MAX_REPORTED)
+            {
+                sprintf (logbuf, "Mismatch: 0x%08X - 0x%08X<BR>\r\n", address, block_end - 1);
+                http_send (logbuf);
+                http_flush ();
+            }
+        }
+    }
+
+    fp.close ();
+    LittleFS.remove (IMAGE_LAST_TMP);
+
+    if (rtc == 0)
+    {
+        sprintf (logbuf, "Pages verified: %u, mismatching: %u<BR>\r\n", n_blocks, n_mismatch);
+        http_send (logbuf);
+
+        if (n_mismatch == 0)
+        {
+            http_send_FS ("Target matches image<BR>\r\n");
+        }
+        else
+        {
+            http_send_FS ("Target differs from image<BR>\r\n");
+            rtc = -1;
+        }
+    }
+    else
+    {
+        http_send_FS ("Verify failed<BR>\r\n");
+    }
+
+    return rtc;
+}
+
+#define N_RETRIES    4
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * connect to activated bootloader: synchronize baudrate and get command set
+ * verbose: send progress to browser
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+stm32_connect (bool verbose)
+{
+    uint8_t       begin = STM32_BEGIN;
+    unsigned long get_time;
+    int           i;
+    int           ch;
+
+    for (i = 0; i < N_RETRIES; i++)
+    {
+        if (verbose)
+        {
+            http_send_FS ("Trying to enter bootloader mode...<br>\r\n");
+            http_flush ();
+        }
+
+        trace_command (STM32_BEGIN);
+        stm32_uart->write (&begin, 1);
+        ch = stm32_serial_poll (1000, 1);
+        trace_response (ch);
+
+        if (ch == STM32_ACK)
+        {
+            break;
+        }
+    }
+
+    metrics_count (METRICS_RETRIES, i < N_RETRIES ? i : N_RETRIES - 1);
+
+    if (i == N_RETRIES)
+    {
+        return -1;
+    }
+
+    metrics_observe (METRICS_PHASE_ENTRY, millis () - stm32_entry_time);
+
+    get_time = millis ();
+    bootloader_info_len = stm32_get (bootloader_info, STM32_INFO_SIZE);
+    metrics_observe (METRICS_PHASE_GET, millis () - get_time);
+    return bootloader_info_len;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * get product id and flash layout
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+stm32_identify (void)
+{
+    char        buffer[64];
+    uint16_t    pid;
+    int         i;
+
+    stm32_flash_layout = (const STM32_FLASH_LAYOUT *) 0;
+
+    if (stm32_get_id (bootloader_id, STM32_ID_SIZE) >= STM32_ID_SIZE)
+    {
+        pid = (bootloader_id[STM32_ID_BYTE1] << 8) | bootloader_id[STM32_ID_BYTE2];
+        sprintf (buffer, "Product ID: 0x%03X<BR>\r\n", pid);
+        http_send (buffer);
+
+        for (i = 0; i < (int) STM32_N_FLASH_LAYOUTS; i++)
+        {
+            if (stm32_flash_layouts[i].pid == pid)
+            {
+                stm32_flash_layout = stm32_flash_layouts + i;
+                break;
+            }
+        }
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * connect to activated bootloader, identify STM32 and remove write protection
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+stm32_prepare (int do_unprotect)
+{
+    char          buffer[64];
+    int           i;
+    int           ch;
+    unsigned long phase_time;
+    int           rtc;
+
+    rtc = stm32_connect (true);
+
+    if (rtc < 0)
+    {
+        return rtc;
+    }
+
+    http_send_FS ("Bootloader version: ");
+    sprintf (buffer, "%X.%X", bootloader_info[STM32_INFO_BOOTLOADER_VERSION_IDX] >> 4, bootloader_info[STM32_INFO_BOOTLOADER_VERSION_IDX] & 0x0F);
+    http_send (buffer);
+    http_send_FS ("<BR>\r\n");
+
+    stm32_identify ();
+
+#if 0
+    rtc = stm32_get_version (bootloader_version, STM32_VERSION_SIZE);
+
+    if (rtc < 0)
+    {
+        return rtc;
+    }
+
+    http_send_FS ("Option Bytes: ");
+    sprintf (buffer, "0x%02X 0x%02X", bootloader_version[STM32_VERSION_OPTION_BYTE1], bootloader_version[STM32_VERSION_OPTION_BYTE2]);
+    http_send (buffer);
+    http_send_FS ("<BR>\r\n");
+#endif
+
+    if (do_unprotect)
+    {
+        phase_time = millis ();
+        rtc = stm32_write_unprotect ();
+
+        if (rtc >= 0)
+        {
+            delay (500);
+
+            http_send_FS ("Flash now unprotected<BR>\r\n");
+            http_flush ();
+            buffer[0] = STM32_BEGIN;
+
+            http_send_FS ("Trying to enter bootloader mode again...");
+            http_flush ();
+
+            for (i = 0; i < N_RETRIES; i++)
+            {
+                trace_command (STM32_BEGIN);
+                stm32_uart->write ((uint8_t *) buffer, 1);
+                ch = stm32_serial_poll (1000, 1);
+                trace_response (ch);
+
+                if (ch == STM32_ACK)
+                {
+                    break;
+                }
+            }
+
+            metrics_count (METRICS_RETRIES, i < N_RETRIES ? i : N_RETRIES - 1);
+
+            if (i < N_RETRIES)
+            {
+                http_send_FS ("successful<br>\r\n");
+                http_flush ();
+            }
+            else
+            {
+                http_send_FS ("failed<br>\r\n");
+            }
+        }
+
+        metrics_observe (METRICS_PHASE_UNPROTECT, millis () - phase_time);
+    }
+    else
+    {
+        rtc = 0;
+    }
+
+    return rtc;
+}
+
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * start image with command GO instead of a reset
+ *
+ * The bootloader expects the address of the vector table: it loads MSP from address and jumps to the reset handler at address + 4.
+ * So GO uses the lowest address of the image, the start address record (entry point) is only checked to lie within the image.
+ * BOOT0 is released, so a later reset starts the application from flash.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+stm32_run (IMAGE_INFO * info, uint8_t flags)
+{
+    char            logbuf[96];
+    uint32_t        entry = info->start_address & ~1;                   // clear thumb bit
+    unsigned long   run_time = millis ();
+    int             rtc;
+
+    if (info->start_address && (entry < info->address_min || entry > info->address_max))
+    {
+        sprintf (logbuf, "Entry point 0x%08X outside of image, not started<BR>\r\n", info->start_address);
+        http_send (logbuf);
+        return -1;
+    }
+
+    sprintf (logbuf, "Starting image at 0x%08X... ", info->address_min);
+    http_send (logbuf);
+    rtc = stm32_go (info->address_min);
+    http_send_FS (rtc >= 0 ? "successful!<br>\r\n" : "failed!<br>\r\n");
+
+    if (rtc >= 0 && ! (flags & STM32_FLASH_FLAG_REPLAY))
+    {
+        target_set_boot0 (false);
+    }
+
+    metrics_observe (METRICS_PHASE_RUN, millis () - run_time);
+    return rtc;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * flash image streamed from http server
+ * The image can't be checked in advance: the whole flash is erased when the first data arrives, each page is verified after writing.
+ * The flashed image is not saved, so the next flash can't be incremental.
+ * A raw binary with a base address in SRAM is loaded without erasing the flash, HEX and S-record images are always flash images.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+stm32_bootloader_stream (String url, uint32_t base_address, uint8_t flags)
+{
+    char          buffer[32];
+    String        path = url;
+    uint8_t       format;
+    bool          erase;
+    unsigned long flash_time = millis ();
+    int           pos = path.indexOf ('?');
+    int           rtc;
+
+    if (pos >= 0)
+    {
+        path = path.substring (0, pos);
+    }
+
+    format = image_format (path);
+
+    if (format == IMAGE_FORMAT_NONE || (format & IMAGE_FORMAT_MASK) == IMAGE_FORMAT_DELTA || (format & IMAGE_FORMAT_MASK) == IMAGE_FORMAT_MANIFEST)
+    {
+        http_send_FS ("Image format not supported for streaming<BR>\r\n");
+        return -1;
+    }
+
+    erase = (format & IMAGE_FORMAT_MASK) != IMAGE_FORMAT_BIN || ! stm32_is_sram (base_address);
+    stream_erase_pending = erase;                                   // not before the server has answered
+    rtc = stm32_flash_image (url, format, base_address, (IMAGE_FLAT *) 0, false, 0);
+
+    if (stream_erase_pending)                                       // no data received, flash unchanged
+    {
+        stream_erase_pending = false;
+    }
+    else if (erase && ! (flags & STM32_FLASH_FLAG_REPLAY))
+    {
+        image_last_remove ();
+    }
+
+    sprintf (buffer, "%lu", millis () - flash_time);
+    http_send_FS ("Flash time: ");
+    http_send (buffer);
+    http_send_FS (" msec<BR>");
+
+    if (rtc >= 0 && ((flags & STM32_FLASH_FLAG_GO) || stm32_is_sram (flash_rd.info.address_min)))
+    {
+        rtc = stm32_run (&flash_rd.info, flags);
+    }
+
+    return rtc;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * recipe: several images flashed in one job, see stm32flash.h
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct
+{
+    String          fname;
+    uint8_t         format;
+    uint32_t        base_address;                           // raw binary only
+    IMAGE_INFO      info;
+} STM32_SEGMENT;
+
+static STM32_SEGMENT    stm32_segments[STM32_RECIPE_MAX_SEGMENTS];
+static uint8_t          stm32_n_segments;
+
+static bool
+stm32_is_recipe (String fname)
+{
+    return fname.endsWith (STM32_RECIPE_SUFFIX);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * load recipe: one line per segment "<image file> [<base address>]", '#' starts a comment
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+stm32_recipe_load (String fname)
+{
+    static char     text[STM32_RECIPE_MAXLEN + 1];
+    char *          line;
+    char *          next;
+    char *          name;
+    char *          base;
+    char *          p;
+    int             len;
+
+    File f = LittleFS.open (fname, "r");
+
+    if (! f)
+    {
+        http_send_FS ("Cannot open recipe<BR>\r\n");
+        return -1;
+    }
+
+    len = f.read ((uint8_t *) text, STM32_RECIPE_MAXLEN + 1);
+    f.close ();
+
+    if (len > STM32_RECIPE_MAXLEN)
+    {
+        http_send_FS ("Recipe too large<BR>\r\n");
+        return -1;
+    }
+
+    text[len < 0 ? 0 : len] = '\0';
+    stm32_n_segments = 0;
+
+    for (line = text; line; line = next)
+    {
+        next = strchr (line, '\n');
+
+        if (next)
+        {
+            *next++ = '\0';
+        }
+
+        p = strchr (line, '#');
+
+        if (p)
+        {
+            *p = '\0';
+        }
+
+        name = strtok_r (line, " \t\r", &p);
+
+        if (! name)
+        {
+            continue;
+        }
+
+        base = strtok_r ((char *) 0, " \t\r", &p);
+
+        if (stm32_n_segments == STM32_RECIPE_MAX_SEGMENTS)
+        {
+            http_send_FS ("Too many segments in recipe<BR>\r\n");
+            return -1;
+        }
+
+        stm32_segments[stm32_n_segments].fname          = name;
+        stm32_segments[stm32_n_segments].base_address   = base ? strtoul (base, (char **) 0, 0) : IMAGE_BIN_BASE_DEFAULT;
+        stm32_n_segments++;
+    }
+
+    if (stm32_n_segments == 0)
+    {
+        http_send_FS ("Empty recipe<BR>\r\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * check all segments, sort them by address and reject segments sharing a page of the page assembler
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+stm32_recipe_check (void)
+{
+    STM32_SEGMENT   tmp;
+    STM32_SEGMENT * seg;
+    char            logbuf[128];
+    uint8_t         i;
+    uint8_t         j;
+
+    for (i = 0; i < stm32_n_segments; i++)
+    {
+        seg = stm32_segments + i;
+        seg->format = image_format (seg->fname);
+
+        if ((seg->format & IMAGE_FORMAT_MASK) == IMAGE_FORMAT_DELTA || stm32_is_url (seg->fname))
+        {
+            http_send_string (seg->fname + ": delta patches and URLs are not allowed in recipes<BR>\r\n");
+            return -1;
+        }
+
+        if (stm32_check_image (seg->fname, seg->base_address, &seg->info) < 0)
+        {
+            return -1;
+        }
+
+        if (seg->info.data_bytes == 0)
+        {
+            http_send_string (seg->fname + ": no data<BR>\r\n");
+            return -1;
+        }
+
+        if (stm32_is_sram (seg->info.address_min))
+        {
+            http_send_string (seg->fname + ": SRAM images are not allowed in recipes<BR>\r\n");
+            return -1;
+        }
+
+        for (j = i; j > 0 && stm32_segments[j - 1].info.address_min > stm32_segments[j].info.address_min; j--)
+        {
+            tmp                     = stm32_segments[j];
+            stm32_segments[j]       = stm32_segments[j - 1];
+            stm32_segments[j - 1]   = tmp;
+        }
+    }
+
+    for (i = 1; i < stm32_n_segments; i++)
+    {
+        if ((stm32_segments[i].info.address_min & ~(PAGESIZE - 1)) <= stm32_segments[i - 1].info.address_max)
+        {
+            sprintf (logbuf, "Segments %s and %s overlap or share a page of %u bytes<BR>\r\n",
+                     stm32_segments[i - 1].fname.c_str (), stm32_segments[i].fname.c_str (), PAGESIZE);
+            http_send (logbuf);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * erase plan of recipe: all pages/sectors touched by a segment
+ * Whole pages/sectors are erased, a warning lists those also containing flash outside of the segments, e.g. a 1K parameter block
+ * in a 16K sector of a F4.
+ * Returns number of pages/sectors to erase, -1 if not possible
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+stm32_recipe_plan (void)
+{
+    char        logbuf[128];
+    uint32_t    address;
+    uint32_t    unit_start;
+    uint32_t    unit_size;
+    uint32_t    unit_end;
+    uint32_t    covered;
+    uint32_t    from;
+    uint32_t    to;
+    uint8_t     i;
+    uint8_t     j;
+    int         unit;
+    int         n_units = 0;
+
+    memset (stm32_erase_map, 0, sizeof (stm32_erase_map));
+
+    for (i = 0; i < stm32_n_segments; i++)
+    {
+        for (address = stm32_segments[i].info.address_min; address <= stm32_segments[i].info.address_max; address = unit_start + unit_size)
+        {
+            unit = stm32_flash_unit (address, &unit_start, &unit_size);
+
+            if (unit < 0 || unit >= STM32_MAX_UNITS)
+            {
+                return -1;
+            }
+
+            if (! (stm32_erase_map[unit / 8] & (1 << (unit % 8))))
+            {
+                stm32_erase_map[unit / 8] |= 1 << (unit % 8);
+                n_units++;
+                unit_end    = unit_start + unit_size - 1;
+                covered     = 0;
+
+                for (j = 0; j < stm32_n_segments; j++)                  // segments don't overlap, see stm32_recipe_check ()
+                {
+                    from    = stm32_segments[j].info.address_min > unit_start ? stm32_segments[j].info.address_min : unit_start;
+                    to      = stm32_segments[j].info.address_max < unit_end ? stm32_segments[j].info.address_max : unit_end;
+
+                    if (from <= to)
+                    {
+                        covered += to - from + 1;
+                    }
+                }
+
+                if (covered < unit_size)
+                {
+                    sprintf (logbuf, "Warning: erasing 0x%08X - 0x%08X also clears %u bytes outside of the segments<BR>\r\n",
+                             unit_start, unit_end, unit_size - covered);
+                    http_send (logbuf);
+                }
+            }
+        }
+    }
+
+    return n_units;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * flash recipe: one bootloader session, one erase of all pages/sectors of all segments, then the segments in address order
+ * Flash outside of the erased pages/sectors is kept, see stm32_recipe_plan (). The flashed image is not saved, so the next flash
+ * can't be incremental. After success the target is reset once, unless it is started with GO.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+stm32_bootloader_recipe (String fname, uint8_t flags)
+{
+    IMAGE_INFO      info;
+    char            buffer[64];
+    unsigned long   flash_time = millis ();
+    unsigned long   phase_time;
+    uint8_t         i;
+    int             n_units;
+    int             rtc;
+
+    phase_time = millis ();
+    rtc = stm32_recipe_load (fname);
+
+    if (rtc >= 0)
+    {
+        rtc = stm32_recipe_check ();
+    }
+
+    metrics_observe (METRICS_PHASE_PARSE, millis () - phase_time);
+
+    if (rtc < 0)
+    {
+        return rtc;
+    }
+
+    phase_time = millis ();
+    n_units = stm32_recipe_plan ();
+    metrics_observe (METRICS_PHASE_PLAN, millis () - phase_time);
+
+    if (n_units < 0)
+    {
+        http_send_FS ("Unknown flash layout, cannot erase single pages/sectors<BR>\r\n");
+        return -1;
+    }
+
+    sprintf (buffer, "Erasing %d pages/sectors of %u segments... ", n_units, stm32_n_segments);
+    http_send (buffer);
+    http_flush ();
+    phase_time = millis ();
+    rtc = stm32_erase_units ();
+    metrics_observe (METRICS_PHASE_ERASE, millis () - phase_time);
+    http_send_FS (rtc >= 0 ? "successful!<br>\r\n" : "failed!<br>\r\n");
+
+    for (i = 0; i < stm32_n_segments && rtc >= 0; i++)
+    {
+        sprintf (buffer, "Segment 0x%08X - 0x%08X: ", stm32_segments[i].info.address_min, stm32_segments[i].info.address_max);
+        http_send (buffer);
+        http_send_string (stm32_segments[i].fname + "<BR>\r\n");
+        rtc = stm32_flash_image (stm32_segments[i].fname, stm32_segments[i].format, stm32_segments[i].base_address, (IMAGE_FLAT *) 0, false, 0);
+    }
+
+    if (! (flags & STM32_FLASH_FLAG_REPLAY))
+    {
+        image_last_remove ();
+    }
+
+    sprintf (buffer, "%lu", millis () - flash_time);
+    http_send_FS ("Flash time: ");
+    http_send (buffer);
+    http_send_FS (" msec<BR>");
+
+    if (rtc >= 0 && (flags & STM32_FLASH_FLAG_GO))
+    {
+        info = stm32_segments[0].info;                              // segments are sorted, vector table is in 1st segment
+
+        for (i = 1; i < stm32_n_segments; i++)
+        {
+            info.address_max = stm32_segments[i].info.address_max;
+
+            if (! info.start_address)
+            {
+                info.start_address = stm32_segments[i].info.start_address;
+            }
+        }
+
+        rtc = stm32_run (&info, flags);
+    }
+    else if (rtc >= 0 && ! (flags & STM32_FLASH_FLAG_REPLAY))
+    {
+        http_send_FS ("STM32 reset<BR>\r\n");
+        stm32_reset ();
+    }
+
+    return rtc;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * start STM32 bootloader
+ *
+ * An image in SRAM is loaded and started without erasing the flash, the last flashed image stays valid for incremental flashing.
+ * It must be linked above the SRAM used by the bootloader, e.g. 0x20000200 on F1, see AN2606.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+stm32_bootloader (String fname, uint32_t base_address, int do_unprotect, uint8_t flags)
+{
+    IMAGE_INFO    info;
+    char          buffer[256];
+    uint8_t       format = image_format (fname);
+    int           n_changed = -1;
+    bool          sram = false;
+    unsigned long time1;
+    unsigned long time2;
+    unsigned long phase_time;
+    int           rtc = 0;
+
+    rtc = stm32_prepare (do_unprotect);
+
+    if (rtc >= 0 && stm32_is_url (fname))
+    {
+        return stm32_bootloader_stream (fname, base_address, flags);
+    }
+
+    if (rtc >= 0 && stm32_is_recipe (fname))
+    {
+        return stm32_bootloader_recipe (fname, flags);
+    }
+
+    if (rtc >= 0)
+    {
+        time1 = millis ();
+        rtc = stm32_check_image (fname, base_address, &info);
+        time1 = millis () - time1;
+        metrics_observe (METRICS_PHASE_PARSE, time1);
+        sram = stm32_is_sram (info.address_min);
+    }
+
+    if (rtc >= 0)
+    {
+        time2 = millis ();
+
+        if (! sram && ((flags & STM32_FLASH_FLAG_INCREMENTAL) || (format & IMAGE_FORMAT_MASK) == IMAGE_FORMAT_DELTA ||
+                       eeprom_config.erase == EEPROM_ERASE_PAGES))
+        {
+            phase_time = millis ();
+            n_changed = stm32_plan_incremental (fname, base_address, &info);
+            metrics_observe (METRICS_PHASE_PLAN, millis () - phase_time);
+        }
+
+        if (sram)                                                   // load into SRAM, flash and last flashed image are kept
+        {
+            http_send_FS ("Image in SRAM, flash is not erased<BR>\r\n");
+            rtc = stm32_flash_image (fname, format, base_address, (IMAGE_FLAT *) 0, false, 0);
+        }
+        else if (n_changed >= 0)
+        {
+            http_send_FS ("Erasing changed pages/sectors... ");
+            http_flush ();
+            phase_time = millis ();
+            rtc = stm32_erase_units ();
+            metrics_observe (METRICS_PHASE_ERASE, millis () - phase_time);
+            http_send_FS (rtc >= 0 ? "successful!<br>\r\n" : "failed!<br>\r\n");
+
+            if (rtc >= 0)                                           // flash the flat binary, it's already saved
+            {
+                rtc = stm32_flash_image (IMAGE_LAST_TMP, IMAGE_FORMAT_BIN, info.address_min, (IMAGE_FLAT *) 0, true, 0);
+            }
+        }
+        else
+        {
+            phase_time = millis ();
+            rtc = stm32_erase_flash ();
+            metrics_observe (METRICS_PHASE_ERASE, millis () - phase_time);
+
+            if (rtc >= 0)
+            {
+                image_flat_open (&flash_flat, IMAGE_LAST_TMP, info.address_min);
+                rtc = stm32_flash_image (fname, format, base_address, &flash_flat, false, 0);
+
+                if (! image_flat_close (&flash_flat))
+                {
+                    rtc = -1;
+                }
+            }
+        }
+
+        if (sram || (flags & STM32_FLASH_FLAG_REPLAY))
+        {
+            LittleFS.remove (IMAGE_LAST_TMP);                       // flash unchanged or target is simulated, keep last flashed image
+        }
+        else if (rtc >= 0)
+        {
+            image_last_commit (info.address_min);
+        }
+        else
+        {
+            image_last_remove ();                                   // content of flash unknown
+        }
+
+        time2 = millis () - time2;
+
+        sprintf (buffer, "%lu", time1); 
+        http_send_FS ("Check time: ");
+        http_send (buffer);
+        http_send_FS (" msec<BR>");
+
+        sprintf (buffer, "%lu", time2); 
+        http_send_FS ("Flash time: ");
+        http_send (buffer);
+        http_send_FS (" msec<BR>");
+    }
+
+    if (rtc >= 0 && ((flags & STM32_FLASH_FLAG_GO) || sram))
+    {
+        rtc = stm32_run (&info, flags);
+    }
+
+    return rtc;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * start UART session of flasher, see arbiter.h
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static bool
+stm32_acquire_uart (String & errmsg)
+{
+    if (! arbiter_acquire (ARBITER_OWNER_FLASHER))
+    {
+        errmsg = (String) "UART in use by " + arbiter_owner_name ();
+        return false;
+    }
+
+    stm32_uart = target_select (0);                                 // single target functions use target 0
+    return true;
+}
+
+static void
+stm32_activate_bootloader (void)
+{
+    stm32_entry_time = millis ();
+    target_set_boot0 (true);                                // activate BOOT0
+    target_set_reset (true);                                // activate RESET
+    delay (200);                                            // wait 200ms
+    target_set_reset (false);                               // release RESET
+
+    while (stm32_serial_poll (1000, 0) >= 0)                // flush characters in serial input
+    {
+        ;
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * flash read-out: cooperative job, called by loop (), reads one block per call
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct
+{
+    bool                active;
+    bool                failed;
+    uint8_t             format;                                     // STM32_DUMP_FORMAT_xxx
+    uint32_t            start;                                      // start address
+    uint32_t            address;                                    // next address to read
+    uint32_t            end;                                        // end address (excl.)
+    unsigned long       start_time;
+    unsigned long       elapsed;                                    // msec
+    String              fname;
+    String              errmsg;
+    File                fp;
+    IMAGE_HEX_WRITER    hex;
+} STM32_DUMP;
+
+static STM32_DUMP       stm32_dump;
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * output callback: write into file
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+stm32_dump_file_out (void * ctx, const uint8_t * buf, size_t len)
+{
+    File * fp = (File *) ctx;
+
+    return fp->write (buf, len) == len ? 0 : -1;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * read next block of flash and pass it to output function
+ * Returns number of bytes read, -1 on error. Messages of the bootloader commands are returned in errmsg, not sent.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+stm32_dump_block (uint32_t address, uint32_t end, uint8_t format, IMAGE_HEX_WRITER * hex, IMAGE_OUTPUT_FUNC out_func, void * out_ctx,
+                  String & errmsg)
+{
+    String      saved_response = sResponse;
+    uint32_t    len = end - address;
+    int         rtc;
+
+    if (len > STM32_BUFLEN)
+    {
+        len = STM32_BUFLEN;
+    }
+
+    sResponse = "";
+    rtc = stm32_read_memory (address, len);
+
+    if (rtc < 0)
+    {
+        errmsg = sResponse.length () > 0 ? sResponse : "READ MEMORY failed, flash read protected?";
+    }
+    else if (format == STM32_DUMP_FORMAT_HEX)
+    {
+        rtc = image_hex_writer_data (hex, address, stm32_buf, len);
+    }
+    else
+    {
+        rtc = (*out_func) (out_ctx, stm32_buf, len);
+    }
+
+    if (rtc < 0 && errmsg.length () == 0)
+    {
+        errmsg = "write failed";
+    }
+
+    sResponse = saved_response;
+    return rtc < 0 ? -1 : (int) len;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * stm32_dump_start () - start reading flash into file, fname suffix .hex: INTEL HEX, else binary
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+bool
+stm32_dump_start (String fname, uint32_t address, uint32_t len, String & errmsg)
+{
+    if (stm32_dump.active)
+    {
+        errmsg = "read-out already in progress";
+        return false;
+    }
+
+    if (len == 0)
+    {
+        errmsg = "length is 0";
+        return false;
+    }
+
+    if (! stm32_acquire_uart (errmsg))
+    {
+        return false;
+    }
+
+    stm32_dump.fp = LittleFS.open (fname, "w");
+
+    if (! stm32_dump.fp)
+    {
+        arbiter_release (ARBITER_OWNER_FLASHER);
+        errmsg = "cannot create " + fname;
+        return false;
+    }
+
+    stm32_activate_bootloader ();
+
+    if (stm32_connect (true) < 0)
+    {
+        stm32_dump.fp.close ();
+        LittleFS.remove (fname);
+        stm32_reset ();
+        arbiter_release (ARBITER_OWNER_FLASHER);
+        errmsg = "cannot connect to bootloader";
+        return false;
+    }
+
+    image_info_remove (fname);
+    stm32_dump.format       = image_format (fname) == IMAGE_FORMAT_HEX ? STM32_DUMP_FORMAT_HEX : STM32_DUMP_FORMAT_BIN;
+    stm32_dump.fname        = fname;
+    stm32_dump.start        = address;
+    stm32_dump.address      = address;
+    stm32_dump.end          = address + len;
+    stm32_dump.errmsg       = "";
+    stm32_dump.failed       = false;
+    stm32_dump.active       = true;
+    stm32_dump.start_time   = millis ();
+    stm32_dump.elapsed      = 0;
+    image_hex_writer_begin (&stm32_dump.hex, stm32_dump_file_out, &stm32_dump.fp);
+    return true;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * stm32_dump_loop () - read next block, to be called by loop ()
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+stm32_dump_loop (void)
+{
+    int     len;
+
+    if (! stm32_dump.active)
+    {
+        return;
+    }
+
+    len = stm32_dump_block (stm32_dump.address, stm32_dump.end, stm32_dump.format, &stm32_dump.hex,
+                            stm32_dump_file_out, &stm32_dump.fp, stm32_dump.errmsg);
+
+    if (len < 0)
+    {
+        stm32_dump.failed = true;
+    }
+    else
+    {
+        stm32_dump.address += len;
+    }
+
+    stm32_dump.elapsed = millis () - stm32_dump.start_time;
+
+    if (stm32_dump.failed || stm32_dump.address >= stm32_dump.end)
+    {
+        if (! stm32_dump.failed && stm32_dump.format == STM32_DUMP_FORMAT_HEX && image_hex_writer_end (&stm32_dump.hex, 0) < 0)
+        {
+            stm32_dump.failed = true;
+            stm32_dump.errmsg = "write failed";
+        }
+
+        stm32_dump.fp.close ();
+
+        if (stm32_dump.failed)
+        {
+            LittleFS.remove (stm32_dump.fname);
+        }
+
+        stm32_dump.active = false;
+        stm32_reset ();                                             // start application again
+        arbiter_release (ARBITER_OWNER_FLASHER);
+    }
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * stm32_dump_active () - check if read-out job is running, the UART belongs to the job then
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+bool
+stm32_dump_active (void)
+{
+    return stm32_dump.active;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * stm32_dump_status () - get progress and throughput of current or last read-out job
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+String
+stm32_dump_status (void)
+{
+    char        buf[128];
+    uint32_t    bytes = stm32_dump.address - stm32_dump.start;
+    uint32_t    rate  = stm32_dump.elapsed ? (uint64_t) bytes * 1000 / stm32_dump.elapsed : 0;
+
+    if (stm32_dump.fname.length () == 0)
+    {
+        return "";
+    }
+
+    sprintf (buf, ": 0x%08X - 0x%08X, %u of %u bytes, %lu msec, %u bytes/sec", stm32_dump.start, stm32_dump.end - 1,
+             bytes, stm32_dump.end - stm32_dump.start, stm32_dump.elapsed, rate);
+
+    if (stm32_dump.active)
+    {
+        return "Reading " + stm32_dump.fname + buf;
+    }
+
+    if (stm32_dump.failed)
+    {
+        return "Read-out of " + stm32_dump.fname + " failed" + buf + ": " + stm32_dump.errmsg;
+    }
+
+    return "Read-out of " + stm32_dump.fname + " finished" + buf;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * stm32_dump_stream () - read flash and pass it directly to out_func, e.g. a HTTP download
+ * Blocks until done. Returns number of bytes read, -1 on error
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+int
+stm32_dump_stream (uint32_t address, uint32_t len, uint8_t format, IMAGE_OUTPUT_FUNC out_func, void * out_ctx, String & errmsg)
+{
+    IMAGE_HEX_WRITER    hex;
+    uint32_t            end = address + len;
+    uint32_t            start = address;
+    int                 n;
+
+    if (stm32_dump.active)
+    {
+        errmsg = "read-out already in progress";
+        return -1;
+    }
+
+    if (! stm32_acquire_uart (errmsg))
+    {
+        return -1;
+    }
+
+    String saved_response = sResponse;                              // nothing must be sent while streaming
+
+    stm32_activate_bootloader ();
+    sResponse = "";
+
+    if (stm32_connect (false) < 0)
+    {
+        sResponse = saved_response;
+        stm32_reset ();
+        arbiter_release (ARBITER_OWNER_FLASHER);
+        errmsg = "cannot connect to bootloader";
+        return -1;
+    }
+
+    sResponse = saved_response;
+
+    image_hex_writer_begin (&hex, out_func, out_ctx);
+
+    while (address < end)
+    {
+        n = stm32_dump_block (address, end, format, &hex, out_func, out_ctx, errmsg);
+
+        if (n < 0)
+        {
+            break;
+        }
+
+        address += n;
+        yield ();
+    }
+
+    if (address >= end && format == STM32_DUMP_FORMAT_HEX)
+    {
+        image_hex_writer_end (&hex, 0);
+    }
+
+    stm32_reset ();
+    arbiter_release (ARBITER_OWNER_FLASHER);
+    return address >= end ? (int) (address - start) : -1;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * check image file
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+stm32_check_image_file (String fname, uint32_t base_address)
+{
+    IMAGE_INFO  info;
+
+    image_info_remove (fname);                              // force a new check
+    stm32_check_image (fname, base_address, &info);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * flash STM32, fname may be a http:// URL, see stm32_bootloader_stream (), or a recipe, see stm32_bootloader_recipe ()
+ * Returns -1 on error
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+int
+stm32_flash_from_local (String fname, uint32_t base_address, uint8_t flags)
+{
+    String  errmsg;
+    int     rtc;
+
+    if (stm32_dump.active)
+    {
+        http_send_FS ("Flash read-out in progress, try again later<BR>\r\n");
+        return -1;
+    }
+
+    if (! stm32_acquire_uart (errmsg))
+    {
+        http_send_string (errmsg + ", try again later<BR>\r\n");
+        return -1;
+    }
+
+    stm32_activate_bootloader ();
+    http_send_FS ("Start Bootloader<BR>\r\n");
+    http_flush ();
+
+    if ((flags & STM32_FLASH_FLAG_RECORD) && stm32_uart == &transport_serial && transport_record_begin (TRANSPORT_SESSION_FNAME))
+    {
+        stm32_uart = &transport_record;
+    }
+
+    rtc = stm32_bootloader (fname, base_address, 1, flags);
+    metrics_count (rtc >= 0 ? METRICS_JOBS_OK : METRICS_JOBS_FAILED, 1);
+
+    if (stm32_uart == &transport_record)
+    {
+        transport_record_end ();
+        stm32_uart = target_select (0);
+        http_send_FS ("Session recorded in " TRANSPORT_SESSION_FNAME "<BR>\r\n");
+    }
+
+    arbiter_release (ARBITER_OWNER_FLASHER);                        // STM32 stays in bootloader until reset or GO
+    http_send_FS ("End Bootloader<BR>\r\n");
+    http_flush ();
+    return rtc;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * replay recorded session: flash image against the recorded STM32 responses, no STM32 is involved
+ * Reports deviations of the sent bytes from the recorded ones and the latency between response and next request.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+stm32_replay_from_local (String fname, uint32_t base_address, String rec_fname, uint8_t flags)
+{
+    String  errmsg;
+    bool    diverged;
+
+    if (stm32_dump.active)
+    {
+        http_send_FS ("Flash read-out in progress, try again later<BR>\r\n");
+        return;
+    }
+
+    if (! transport_replay_begin (rec_fname, errmsg))
+    {
+        http_send_string ("Replay failed: " + errmsg + "<BR>\r\n");
+        return;
+    }
+
+    http_send_FS ("Start Replay<BR>\r\n");
+    http_flush ();
+
+    stm32_uart          = &transport_replay;
+    stm32_entry_time    = millis ();
+    stm32_bootloader (fname, base_address, 1, (flags & ~STM32_FLASH_FLAG_RECORD) | STM32_FLASH_FLAG_REPLAY);
+    stm32_uart          = target_select (0);
+
+    http_send_string (transport_replay_end (&diverged));
+    http_send_FS ("End Replay<BR>\r\n");
+    http_flush ();
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * farm: reset target into bootloader, connect, remove write protection and erase flash
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+stm32_farm_prepare (uint8_t idx)
+{
+    unsigned long   phase_time;
+    int             rtc;
+
+    http_send_string ("<BR>\r\n" + target_name (idx) + "<BR>\r\n");
+    http_flush ();
+
+    stm32_uart = target_select (idx);
+    stm32_activate_bootloader ();
+    rtc = stm32_prepare (1);
+
+    if (rtc >= 0)
+    {
+        phase_time = millis ();
+        rtc = stm32_erase_flash ();
+        metrics_observe (METRICS_PHASE_ERASE, millis () - phase_time);
+    }
+
+    memcpy (stm32_farm_info[idx], bootloader_info, STM32_INFO_SIZE);
+    stm32_farm_info_len[idx] = bootloader_info_len;
+    return rtc;
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * flash one image to several targets, the targets in the bit mask are flashed in the order of their index
+ *
+ * STM32_FARM_SEQUENTIAL: one target after the other. The image is parsed only for the first target, the following targets are
+ * flashed from the flat binary saved meanwhile.
+ * STM32_FARM_INTERLEAVED: all targets are erased first, then the image is parsed once and each page is written to all targets in turn.
+ *
+ * The flash is always mass erased and the targets are reset afterwards. A failing target doesn't stop the others.
+ * The last flashed image (incremental flashing, delta images) belongs to target 0, it's only updated if target 0 is flashed.
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+stm32_farm_from_local (String fname, uint32_t base_address, uint8_t targets, uint8_t mode)
+{
+    IMAGE_INFO      info;
+    EEPROM_TARGET   target;
+    uint8_t         queue[TARGET_MAX];
+    uint8_t         n_queued    = 0;
+    uint8_t         format      = image_format (fname);
+    uint8_t         prepared    = 0;                                // bit mask: targets reset into bootloader
+    uint8_t         ok          = 0;                                // bit mask: targets flashed successfully
+    bool            flat_saved  = false;
+    unsigned long   farm_time;
+    char            buffer[32];
+    String          errmsg;
+    uint8_t         idx;
+    uint8_t         i;
+    int             rtc;
+
+    if (stm32_dump.active)
+    {
+        http_send_FS ("Flash read-out in progress, try again later<BR>\r\n");
+        return;
+    }
+
+    for (idx = 0; idx < TARGET_MAX; idx++)
+    {
+        if ((targets & (1 << idx)) && target_get (idx, &target))
+        {
+            queue[n_queued++] = idx;
+        }
+    }
+
+    if (n_queued == 0)
+    {
+        http_send_FS ("No target selected<BR>\r\n");
+        return;
+    }
+
+    if (! stm32_acquire_uart (errmsg))
+    {
+        http_send_string (errmsg + ", try again later<BR>\r\n");
+        return;
+    }
+
+    farm_time = millis ();
+    http_send_FS ("Start Farm<BR>\r\n");
+    http_flush ();
+
+    rtc = stm32_check_image (fname, base_address, &info);
+
+    if (rtc >= 0 && mode == STM32_FARM_INTERLEAVED)
+    {
+        for (i = 0; i < n_queued; i++)
+        {
+            prepared |= 1 << queue[i];
+
+            if (stm32_farm_prepare (queue[i]) >= 0)
+            {
+                ok |= 1 << queue[i];
+            }
+        }
+
+        if (ok)
+        {
+            http_send_FS ("<BR>\r\n");
+            image_flat_open (&flash_flat, IMAGE_LAST_TMP, info.address_min);
+            rtc = stm32_flash_image (fname, format, base_address, &flash_flat, false, ok);
+            flat_saved = image_flat_close (&flash_flat) && rtc >= 0;
+            ok = rtc >= 0 ? page_asm.targets : 0;
+        }
+    }
+    else if (rtc >= 0)
+    {
+        for (i = 0; i < n_queued; i++)
+        {
+            prepared |= 1 << queue[i];
+
+            if (stm32_farm_prepare (queue[i]) < 0)
+            {
+                continue;
+            }
+
+            if (flat_saved)                                         // image already parsed
+            {
+                rtc = stm32_flash_image (IMAGE_LAST_TMP, IMAGE_FORMAT_BIN, info.address_min, (IMAGE_FLAT *) 0, false, 0);
+            }
+            else
+            {
+                image_flat_open (&flash_flat, IMAGE_LAST_TMP, info.address_min);
+                rtc = stm32_flash_image (fname, format, base_address, &flash_flat, false, 0);
+                flat_saved = image_flat_close (&flash_flat) && rtc >= 0;
+            }
+
+            if (rtc >= 0)
+            {
+                ok |= 1 << queue[i];
+            }
+        }
+    }
+
+    http_send_FS ("<BR>\r\n");
+
+    for (i = 0; i < n_queued; i++)
+    {
+        idx = queue[i];
+        http_send_string (target_name (idx) + ((ok & (1 << idx)) ? ": successful<BR>\r\n" : ": failed<BR>\r\n"));
+        metrics_count ((ok & (1 << idx)) ? METRICS_JOBS_OK : METRICS_JOBS_FAILED, 1);
+
+        if (prepared & (1 << idx))
+        {
+            stm32_uart = target_select (idx);
+            stm32_reset ();
+        }
+    }
+
+    if ((ok & 0x01) && flat_saved)
+    {
+        image_last_commit (info.address_min);
+    }
+    else if (prepared & 0x01)
+    {
+        image_last_remove ();                                       // content of flash unknown
+    }
+
+    LittleFS.remove (IMAGE_LAST_TMP);
+    stm32_uart = target_select (0);
+    arbiter_release (ARBITER_OWNER_FLASHER);
+
+    sprintf (buffer, "%lu", millis () - farm_time);
+    http_send_FS ("Farm time: ");
+    http_send (buffer);
+    http_send_FS (" msec<BR>\r\nEnd Farm<BR>\r\n");
+    http_flush ();
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * verify STM32 flash against image, reset STM32 afterwards
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+stm32_verify_from_local (String fname, uint32_t base_address)
+{
+    IMAGE_INFO      info;
+    char            buffer[64];
+    unsigned long   time1;
+    String          errmsg;
+    int             rtc = -1;
+
+    if (stm32_dump.active)
+    {
+        http_send_FS ("Flash read-out in progress, try again later<BR>\r\n");
+        return;
+    }
+
+    if (! stm32_acquire_uart (errmsg))
+    {
+        http_send_string (errmsg + ", try again later<BR>\r\n");
+        return;
+    }
+
+    stm32_activate_bootloader ();
+    http_send_FS ("Start Bootloader<BR>\r\n");
+    http_flush ();
+
+    if (stm32_connect (true) >= 0 && stm32_check_image (fname, base_address, &info) >= 0)
+    {
+        stm32_identify ();
+        time1 = millis ();
+        rtc = stm32_verify_image (fname, base_address, &info);
+        time1 = millis () - time1;
+        metrics_observe (METRICS_PHASE_VERIFY, time1);
+
+        sprintf (buffer, "%lu", time1);
+        http_send_FS ("Verify time: ");
+        http_send (buffer);
+        http_send_FS (" msec<BR>");
+    }
+
+    metrics_count (rtc >= 0 ? METRICS_JOBS_OK : METRICS_JOBS_FAILED, 1);
+    stm32_reset ();
+    arbiter_release (ARBITER_OWNER_FLASHER);
+    http_send_FS ("STM32 reset<BR>\r\n");
+    http_flush ();
+}
+
+void
 stm32_reset (void)
 {
-    digitalWrite(STM32_BOOT0_PIN, LOW);                     // deactivate BOOT0 GPIO4
-    pinMode(STM32_RESET_PIN, OUTPUT);                       // RESET to output
-    digitalWrite(STM32_RESET_PIN, LOW);                     // activate RESET
+    unsigned long   reset_time = millis ();
+
+    target_set_boot0 (false);                               // deactivate BOOT0
+    target_set_reset (true);                                // activate RESET
     delay (200);                                            // wait 200ms
-    pinMode(STM32_RESET_PIN, INPUT);                        // release RESET
+    target_set_reset (false);                               // release RESET
+    metrics_observe (METRICS_PHASE_RUN, millis () - reset_time);
+}
+
+/*-------------------------------------------------------------------------------------------------------------------------------------------
+ * drive RESET and BOOT0 directly, used by remote serial port (DTR/RTS)
+ *-------------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+stm32_set_reset (bool active)
+{
+    target_set_reset (active);
+}
+
+void
+stm32_set_boot0 (bool high)
+{
+    target_set_boot0 (high);
 }
 
 void
 stm32_flash_setup (void)
 {
-    pinMode(STM32_BOOT0_PIN, OUTPUT);                       // BOOT0 GPIO5
-    digitalWrite(STM32_BOOT0_PIN, LOW);
-    pinMode(STM32_RESET_PIN, INPUT);
+    target_setup ();                                        // RESET and BOOT0 of all targets
     pinMode(STM32_TX_PIN, INPUT);                           // swapped RX, default is input
     pinMode(STM32_RX_PIN, INPUT);                           // swapped TX, default is input
 }
@@ -33,13 +33,41 @@
 #ifndef STM32FLASH_H
 #define STM32FLASH_H
 
-#if 0 // yet not used
-extern void stm32_flash_from_server (const char *, const char *, const char *);
-#endif
+#include "image.h"
+
+#define STM32_FLASH_FLAG_INCREMENTAL    0x01                    // erase and program only flash pages which differ from last flashed image
+#define STM32_FLASH_FLAG_RECORD         0x02                    // record UART session, see transport.h
+#define STM32_FLASH_FLAG_REPLAY         0x04                    // internal: STM32 is simulated by a recorded session
+#define STM32_FLASH_FLAG_GO             0x08                    // start image with bootloader command GO, implied for images in SRAM
+
+#define STM32_FARM_SEQUENTIAL           0                       // farm: flash one target after the other
+#define STM32_FARM_INTERLEAVED          1                       // farm: write each page to all targets in turn
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * recipe: text file with one line per segment "<image file> [<base address>]", e.g. bootloader, application and parameter block
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define STM32_RECIPE_SUFFIX             ".rcp"
+#define STM32_RECIPE_MAX_SEGMENTS       8
+#define STM32_RECIPE_MAXLEN             1024                    // max. size of recipe file
+
+#define STM32_DUMP_FORMAT_BIN           0                       // flash read-out as raw binary
+#define STM32_DUMP_FORMAT_HEX           1                       // flash read-out as INTEL HEX
 
-extern void stm32_check_hex_file (String fname);
-extern void stm32_flash_from_local (String fname);
+extern uint16_t htoi (char * buf, uint8_t max_digits);
+extern void stm32_check_image_file (String fname, uint32_t base_address);
+extern int stm32_flash_from_local (String fname, uint32_t base_address, uint8_t flags);
+extern void stm32_verify_from_local (String fname, uint32_t base_address);
+extern void stm32_replay_from_local (String fname, uint32_t base_address, String rec_fname, uint8_t flags);
+extern void stm32_farm_from_local (String fname, uint32_t base_address, uint8_t targets, uint8_t mode);
+extern bool stm32_dump_start (String fname, uint32_t address, uint32_t len, String & errmsg);
+extern void stm32_dump_loop (void);
+extern bool stm32_dump_active (void);
+extern String stm32_dump_status (void);
+extern int stm32_dump_stream (uint32_t address, uint32_t len, uint8_t format, IMAGE_OUTPUT_FUNC out_func, void * out_ctx, String & errmsg);
 extern void stm32_reset (void);
+extern void stm32_set_reset (bool active);
+extern void stm32_set_boot0 (bool high);
 extern void stm32_flash_setup (void);
 
 #endif
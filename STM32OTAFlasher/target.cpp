@@ -0,0 +1,326 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * target.cpp - target boards: UART and GPIOs of RESET and BOOT0
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <Arduino.h>
+#include <SoftwareSerial.h>
+#include "target.h"
+#include "arbiter.h"
+#include "stm32emu.h"
+
+#if STM32EMU_MAX < TARGET_MAX
+#error STM32EMU_MAX must not be less than TARGET_MAX
+#endif
+
+static uint8_t                      target_idx;                                         // selected target
+static EEPROM_TARGET                target_cur;                                         // configuration of selected target
+static bool                         target_emu_boot0[TARGET_MAX];                       // BOOT0 level of emulated targets
+static SoftwareSerial               target_soft[TARGET_MAX];                            // one port per software serial target
+static EEPROM_TARGET                target_soft_cfg[TARGET_MAX];                        // configuration of started port
+static uint32_t                     target_soft_baud[TARGET_MAX];                       // baud rate of started port, 0: not started
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * software serial
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+soft_available (void)
+{
+    return target_soft[target_idx].available ();
+}
+
+static int
+soft_read (void)
+{
+    return target_soft[target_idx].read ();
+}
+
+static size_t
+soft_write (const uint8_t * buf, size_t len)
+{
+    return target_soft[target_idx].write (buf, len);
+}
+
+static void
+soft_flush (void)
+{
+    target_soft[target_idx].flush ();
+}
+
+static const TRANSPORT              transport_soft = { soft_available, soft_read, soft_write, soft_flush };
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * check GPIO for RESET, BOOT0 or software serial. Reserved: GPIO0 (AP button), GPIO1/GPIO3 (UART0), GPIO6-GPIO11 (SPI flash),
+ * GPIO12/GPIO14 (mux select), GPIO13/GPIO15 (swapped UART)
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static bool
+target_pin_usable (uint8_t pin)
+{
+    static const uint32_t reserved = (1UL << 0) | (1UL << 1) | (1UL << 3) | (0x3FUL << 6) | (0x0FUL << 12);
+
+    return pin <= 16 && ! (reserved & (1UL << pin));
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * target_pins_valid () - check GPIOs of a target configuration, the used pins must be usable and different
+ * GPIO16 has no interrupt, so it can't be the RX pin of a software serial port.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+bool
+target_pins_valid (const EEPROM_TARGET * target)
+{
+    if (target->kind == EEPROM_TARGET_UART)
+    {
+        return target_pin_usable (target->reset_pin) && target_pin_usable (target->boot0_pin) && target->reset_pin != target->boot0_pin;
+    }
+
+    if (target->kind == EEPROM_TARGET_SOFT)
+    {
+        if (! target_pin_usable (target->rx_pin) || ! target_pin_usable (target->tx_pin) || target->rx_pin == 16 ||
+            ! target_pin_usable (target->reset_pin) || ! target_pin_usable (target->boot0_pin))
+        {
+            return false;
+        }
+
+        return __builtin_popcount ((1UL << target->rx_pin) | (1UL << target->tx_pin) |
+                                   (1UL << target->reset_pin) | (1UL << target->boot0_pin)) == 4;   // all different
+    }
+
+    return true;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * target_get () - get configuration of target, returns false if not configured or if its GPIOs are invalid
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+bool
+target_get (uint8_t idx, EEPROM_TARGET * target)
+{
+    if (idx >= TARGET_MAX)
+    {
+        return false;
+    }
+
+    *target = eeprom_config.targets[idx];
+
+    if (idx == 0 && target->kind == EEPROM_TARGET_NONE)                                 // built-in board
+    {
+        memset (target, 0, sizeof (EEPROM_TARGET));
+        target->kind        = EEPROM_TARGET_UART;
+        target->reset_pin   = TARGET_DEFAULT_RESET_PIN;
+        target->boot0_pin   = TARGET_DEFAULT_BOOT0_PIN;
+    }
+
+    return target->kind != EEPROM_TARGET_NONE && target_pins_valid (target);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * target_name () - description of target
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+String
+target_name (uint8_t idx)
+{
+    EEPROM_TARGET   t;
+    String          name = (String) "Target " + idx;
+
+    if (! target_get (idx, &t))
+    {
+        return name + (idx < TARGET_MAX && eeprom_config.targets[idx].kind != EEPROM_TARGET_NONE ? ": invalid GPIO" : ": not configured");
+    }
+
+    switch (t.kind)
+    {
+        case EEPROM_TARGET_UART:
+            name += t.mux ? (String) ": UART, mux channel " + (t.mux - 1) : (String) ": UART";
+            break;
+        case EEPROM_TARGET_SOFT:
+            name += (String) ": software serial, RX GPIO" + t.rx_pin + ", TX GPIO" + t.tx_pin;
+            break;
+        default:
+            return name + ": emulated";
+    }
+
+    return name + ", RESET GPIO" + t.reset_pin + ", BOOT0 GPIO" + t.boot0_pin;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * start software serial port of target, a started port is kept, so switching between targets doesn't leave RX and TX floating
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+target_soft_begin (uint8_t idx, EEPROM_TARGET * t)
+{
+    uint32_t    baud = arbiter_baud () < TARGET_SOFT_MAX_BAUD ? arbiter_baud () : TARGET_SOFT_MAX_BAUD;
+
+    if (target_soft_baud[idx] != baud || target_soft_cfg[idx].rx_pin != t->rx_pin || target_soft_cfg[idx].tx_pin != t->tx_pin)
+    {
+        if (target_soft_baud[idx])
+        {
+            target_soft[idx].end ();                                                    // configuration changed
+        }
+
+        target_soft[idx].begin (baud, SWSERIAL_8E1, t->rx_pin, t->tx_pin);
+        target_soft_cfg[idx]    = *t;
+        target_soft_baud[idx]   = baud;
+    }
+
+    while (target_soft[idx].available ())                                               // drop bytes received while not selected
+    {
+        target_soft[idx].read ();
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * target_select () - select target, returns its transport or NULL if not configured
+ * The UART session must be owned by the flasher, see arbiter.h
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+const TRANSPORT *
+target_select (uint8_t idx)
+{
+    EEPROM_TARGET   t;
+
+    if (! target_get (idx, &t))
+    {
+        return (const TRANSPORT *) 0;
+    }
+
+    target_idx = idx;
+    target_cur = t;
+
+    if (t.kind != EEPROM_TARGET_SOFT && target_soft_baud[idx])                         // target reconfigured
+    {
+        target_soft[idx].end ();
+        target_soft_baud[idx] = 0;
+    }
+
+    if (t.kind == EEPROM_TARGET_SOFT)
+    {
+        target_soft_begin (idx, &t);
+        return &transport_soft;
+    }
+    else if (t.kind == EEPROM_TARGET_EMULATED)
+    {
+        stm32emu_select (idx);
+        return &transport_stm32emu;
+    }
+
+    if (t.mux)
+    {
+        digitalWrite (TARGET_MUX_S0_PIN, ((t.mux - 1) & 0x01) ? HIGH : LOW);
+        digitalWrite (TARGET_MUX_S1_PIN, ((t.mux - 1) & 0x02) ? HIGH : LOW);
+    }
+
+    return &transport_serial;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * target_selected () - index of selected target
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint8_t
+target_selected (void)
+{
+    return target_idx;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * target_set_reset () - drive RESET of selected target, active low, released pin is pulled up by the target
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+target_set_reset (bool active)
+{
+    if (target_cur.kind == EEPROM_TARGET_EMULATED)
+    {
+        if (! active)
+        {
+            stm32emu_reset (target_idx, target_emu_boot0[target_idx]);
+        }
+    }
+    else if (active)
+    {
+        pinMode(target_cur.reset_pin, OUTPUT);                                          // RESET to output
+        digitalWrite(target_cur.reset_pin, LOW);                                        // activate RESET
+    }
+    else
+    {
+        pinMode(target_cur.reset_pin, INPUT);                                           // release RESET
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * target_set_boot0 () - drive BOOT0 of selected target
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+target_set_boot0 (bool high)
+{
+    if (target_cur.kind == EEPROM_TARGET_EMULATED)
+    {
+        target_emu_boot0[target_idx] = high;
+    }
+    else
+    {
+        digitalWrite(target_cur.boot0_pin, high ? HIGH : LOW);
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * target_setup () - initialize GPIOs of all targets, select target 0
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+target_setup (void)
+{
+    EEPROM_TARGET   t;
+    bool            mux = false;
+    uint8_t         idx;
+
+    for (idx = 0; idx < TARGET_MAX; idx++)
+    {
+        if (target_get (idx, &t) && t.kind != EEPROM_TARGET_EMULATED)
+        {
+            pinMode(t.boot0_pin, OUTPUT);
+            digitalWrite(t.boot0_pin, LOW);
+            pinMode(t.reset_pin, INPUT);
+
+            if (t.mux)
+            {
+                mux = true;
+            }
+        }
+    }
+
+    if (mux)
+    {
+        pinMode(TARGET_MUX_S0_PIN, OUTPUT);
+        pinMode(TARGET_MUX_S1_PIN, OUTPUT);
+    }
+
+    target_select (0);
+}
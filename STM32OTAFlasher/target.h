@@ -0,0 +1,59 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * target.h - target boards: UART and GPIOs of RESET and BOOT0
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef TARGET_H
+#define TARGET_H
+
+#include "eepromdata.h"
+#include "transport.h"
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * Target 0 is the built-in board at the swapped UART (GPIO13/GPIO15) with RESET at GPIO4 and BOOT0 at GPIO5, unless configured
+ * otherwise. Further boards are connected by software serial with their own RESET and BOOT0 pins, or share the swapped UART
+ * through a 4 channel multiplexer (e.g. 74HC4052) whose select inputs are driven by TARGET_MUX_S0_PIN and TARGET_MUX_S1_PIN.
+ * All single target functions (flash, verify, read-out, remote serial port) use the selected target, normally target 0.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define TARGET_MAX                  EEPROM_N_TARGETS
+#define TARGET_DEFAULT_RESET_PIN    4
+#define TARGET_DEFAULT_BOOT0_PIN    5
+#define TARGET_MUX_S0_PIN           12
+#define TARGET_MUX_S1_PIN           14
+#define TARGET_MUX_CHANNELS         4
+#define TARGET_SOFT_MAX_BAUD        57600                                               // limit of software serial with parity
+#define TARGET_PIN_INVALID          0xFF                                                // missing or invalid GPIO number
+#define TARGET_PINS_RESERVED        "0, 1, 3, 6-15"                                     // AP button, UART0, SPI flash, mux, swapped UART
+
+extern bool                         target_get (uint8_t idx, EEPROM_TARGET * target);
+extern String                       target_name (uint8_t idx);
+extern bool                         target_pins_valid (const EEPROM_TARGET * target);
+extern const TRANSPORT *            target_select (uint8_t idx);
+extern uint8_t                      target_selected (void);
+extern void                         target_set_reset (bool active);
+extern void                         target_set_boot0 (bool high);
+extern void                         target_setup (void);
+
+#endif // TARGET_H
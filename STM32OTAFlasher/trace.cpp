@@ -0,0 +1,193 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * trace.cpp - trace of STM32 bootloader transactions in a RAM ring buffer
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <Arduino.h>
+#include "trace.h"
+
+static TRACE_RECORD *               trace_buf;                                          // NULL: tracer disabled
+static uint32_t                     trace_total;                                        // number of records since clear
+static uint8_t                      trace_cmd;                                          // current command
+static uint8_t                      trace_stage;
+static uint32_t                     trace_address;
+static uint32_t                     trace_len;
+static uint32_t                     trace_time;                                         // start of current stage
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * trace_enable () - enable or disable tracer, the ring buffer is only allocated while enabled
+ * Returns false if out of memory
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+bool
+trace_enable (bool on)
+{
+    if (on && ! trace_buf)
+    {
+        trace_buf = (TRACE_RECORD *) malloc (TRACE_N_RECORDS * sizeof (TRACE_RECORD));
+
+        if (! trace_buf)
+        {
+            return false;
+        }
+
+        trace_total = 0;
+    }
+    else if (! on && trace_buf)
+    {
+        free (trace_buf);
+        trace_buf = (TRACE_RECORD *) 0;
+        trace_total = 0;
+    }
+
+    return true;
+}
+
+bool
+trace_enabled (void)
+{
+    return trace_buf != (TRACE_RECORD *) 0;
+}
+
+void
+trace_clear (void)
+{
+    trace_total = 0;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * trace_command () - start of a new command
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+trace_command (uint8_t cmd)
+{
+    if (trace_buf)
+    {
+        trace_cmd       = cmd;
+        trace_stage     = 0;
+        trace_address   = 0;
+        trace_len       = 0;
+        trace_time      = micros ();
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * trace_args () - set arguments of current command
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+trace_args (uint32_t address, uint32_t len)
+{
+    trace_address   = address;
+    trace_len       = len;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * trace_response () - store response to current stage, ch < 0: timeout
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+trace_response (int ch)
+{
+    TRACE_RECORD *  rec;
+    uint32_t        now;
+
+    if (trace_buf)
+    {
+        now = micros ();
+        rec = trace_buf + (trace_total % TRACE_N_RECORDS);
+
+        rec->time       = trace_time;
+        rec->latency    = now - trace_time;
+        rec->address    = trace_address;
+        rec->len        = trace_len;
+        rec->response   = ch < 0 ? TRACE_RESPONSE_TIMEOUT : ch;
+        rec->cmd        = trace_cmd;
+        rec->stage      = trace_stage++;
+
+        trace_total++;
+        trace_time = now;                                                               // next stage starts now
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * trace_count () - number of records in ring buffer
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+uint32_t
+trace_count (void)
+{
+    return trace_total < TRACE_N_RECORDS ? trace_total : TRACE_N_RECORDS;
+}
+
+uint32_t
+trace_file_size (void)
+{
+    return sizeof (TRACE_HEADER) + trace_count () * sizeof (TRACE_RECORD);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * trace_send () - output trace file: header and records, oldest first
+ * Returns -1 if output failed
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+int
+trace_send (IMAGE_OUTPUT_FUNC out_func, void * out_ctx)
+{
+    TRACE_HEADER    hdr;
+    uint32_t        n_records   = trace_count ();
+    uint32_t        first       = trace_total - n_records;
+    uint32_t        idx;
+    uint32_t        n;
+
+    hdr.magic       = TRACE_MAGIC;
+    hdr.version     = TRACE_VERSION;
+    hdr.record_size = sizeof (TRACE_RECORD);
+    hdr.reserved    = 0;
+    hdr.n_records   = n_records;
+    hdr.n_lost      = first;
+    hdr.time        = micros ();
+
+    if ((*out_func) (out_ctx, (const uint8_t *) &hdr, sizeof (hdr)) < 0)
+    {
+        return -1;
+    }
+
+    while (n_records > 0)                                                               // at most two parts: up to end of buffer, rest
+    {
+        idx = first % TRACE_N_RECORDS;
+        n   = TRACE_N_RECORDS - idx < n_records ? TRACE_N_RECORDS - idx : n_records;
+
+        if ((*out_func) (out_ctx, (const uint8_t *) (trace_buf + idx), n * sizeof (TRACE_RECORD)) < 0)
+        {
+            return -1;
+        }
+
+        first       += n;
+        n_records   -= n;
+    }
+
+    return 0;
+}
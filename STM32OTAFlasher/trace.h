@@ -0,0 +1,78 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * trace.h - trace of STM32 bootloader transactions in a RAM ring buffer
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "image.h"
+
+#define TRACE_N_RECORDS             256                                                 // size of ring buffer, 20 bytes per record
+#define TRACE_MAGIC                 0x43525453                                          // "STRC"
+#define TRACE_VERSION               1
+
+#define TRACE_RESPONSE_TIMEOUT      0xFFFF                                              // no response byte received
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * one response of the bootloader: a command has one record per ACK (command, address, length/data, ...)
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct __attribute__ ((packed))
+{
+    uint32_t                        time;                                               // micros () at start of stage
+    uint32_t                        latency;                                            // usec until response, incl. transmission
+    uint32_t                        address;                                            // address argument, 0 if none
+    uint32_t                        len;                                                // length or number of pages, 0 if none
+    uint16_t                        response;                                           // ACK, NACK, other byte or TRACE_RESPONSE_TIMEOUT
+    uint8_t                         cmd;                                                // bootloader command, 0x7F = sync
+    uint8_t                         stage;                                              // number of response within command
+} TRACE_RECORD;
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * header of downloaded trace file, followed by n_records records, oldest first, all values little endian
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct __attribute__ ((packed))
+{
+    uint32_t                        magic;
+    uint8_t                         version;
+    uint8_t                         record_size;
+    uint16_t                        reserved;
+    uint32_t                        n_records;
+    uint32_t                        n_lost;                                             // overwritten records
+    uint32_t                        time;                                               // micros () at download
+} TRACE_HEADER;
+
+extern bool                         trace_enable (bool on);
+extern bool                         trace_enabled (void);
+extern void                         trace_clear (void);
+extern void                         trace_command (uint8_t cmd);
+extern void                         trace_args (uint32_t address, uint32_t len);
+extern void                         trace_response (int ch);
+extern uint32_t                     trace_count (void);
+extern uint32_t                     trace_file_size (void);
+extern int                          trace_send (IMAGE_OUTPUT_FUNC out_func, void * out_ctx);
+
+#endif // TRACE_H
@@ -0,0 +1,427 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * transport.cpp - byte transport to STM32 bootloader: UART, UART with session recording, session replay
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "transport.h"
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * UART
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static int
+serial_available (void)
+{
+    return Serial.available ();
+}
+
+static int
+serial_read (void)
+{
+    return Serial.read ();
+}
+
+static size_t
+serial_write (const uint8_t * buf, size_t len)
+{
+    return Serial.write (buf, len);
+}
+
+static void
+serial_flush (void)
+{
+    Serial.flush ();
+}
+
+const TRANSPORT transport_serial = { serial_available, serial_read, serial_write, serial_flush };
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * UART with recording of all bytes into a session file
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#define RECORD_BUFSIZE              256
+
+static File                         record_fp;
+static uint32_t                     record_start;                                       // micros () at begin of session
+static TRANSPORT_RECORD             record_hdr;                                         // current record
+static uint8_t                      record_buf[RECORD_BUFSIZE];
+
+static void
+record_flush (void)
+{
+    if (record_hdr.len > 0)
+    {
+        record_fp.write ((uint8_t *) &record_hdr, sizeof (record_hdr));
+        record_fp.write (record_buf, record_hdr.len);
+        record_hdr.len = 0;
+    }
+}
+
+static void
+record_bytes (uint8_t dir, const uint8_t * buf, size_t len)
+{
+    while (len > 0)
+    {
+        if (record_hdr.len > 0 && (record_hdr.dir != dir || record_hdr.len == RECORD_BUFSIZE))
+        {
+            record_flush ();
+        }
+
+        if (record_hdr.len == 0)
+        {
+            record_hdr.dir  = dir;
+            record_hdr.time = micros () - record_start;
+        }
+
+        record_buf[record_hdr.len++] = *buf++;
+        len--;
+    }
+}
+
+static int
+record_read (void)
+{
+    int         ch = Serial.read ();
+    uint8_t     b;
+
+    if (ch >= 0)
+    {
+        b = ch;
+        record_bytes (TRANSPORT_DIR_RX, &b, 1);
+    }
+    return ch;
+}
+
+static size_t
+record_write (const uint8_t * buf, size_t len)
+{
+    record_bytes (TRANSPORT_DIR_TX, buf, len);
+    return Serial.write (buf, len);
+}
+
+const TRANSPORT transport_record = { serial_available, record_read, record_write, serial_flush };
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * transport_record_begin () - start recording
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+bool
+transport_record_begin (String fname)
+{
+    record_fp = LittleFS.open (fname, "w");
+
+    if (! record_fp)
+    {
+        return false;
+    }
+
+    record_hdr.len  = 0;
+    record_start    = micros ();
+    return true;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * transport_record_end () - stop recording
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+transport_record_end (void)
+{
+    record_flush ();
+    record_fp.close ();
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * session replay: the recorded STM32 responses are played back, the bytes sent by the flasher are compared with the recorded ones.
+ * A response is delivered not earlier than in the recorded session, so timeouts behave as recorded.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct
+{
+    File                            fp;
+    TRANSPORT_RECORD                hdr;                                                // current record, dir = 0: end of session
+    uint16_t                        remaining;                                          // bytes left in current record
+    uint32_t                        start;                                              // micros () at begin of replay
+    uint32_t                        tx_rec_time;                                        // recorded time of last request
+    uint32_t                        tx_time;                                            // replay time of last request
+    uint32_t                        rx_time;                                            // micros () of last received byte
+    bool                            rx_seen;                                            // response received since last write
+    uint32_t                        tx_bytes;
+    uint32_t                        tx_mismatch;
+    uint32_t                        tx_extra;                                           // sent after end of session
+    uint32_t                        rx_skipped;                                         // recorded response bytes not read
+    uint32_t                        first_divergence;                                   // TX offset, 0xFFFFFFFF if none
+    uint32_t                        latency_n;                                          // decision latency: response -> next request
+    uint32_t                        latency_sum;
+    uint32_t                        latency_min;
+    uint32_t                        latency_max;
+} TRANSPORT_REPLAY;
+
+static TRANSPORT_REPLAY             replay;
+
+static void
+replay_next_record (void)
+{
+    while (replay.remaining > 0)                                                        // skip rest of current record
+    {
+        replay.fp.read ();
+        replay.remaining--;
+    }
+
+    if (replay.fp.read ((uint8_t *) &replay.hdr, sizeof (replay.hdr)) == sizeof (replay.hdr) && replay.hdr.len > 0)
+    {
+        replay.remaining = replay.hdr.len;
+    }
+    else
+    {
+        replay.hdr.dir = 0;
+    }
+}
+
+static void
+replay_diverged (void)
+{
+    if (replay.first_divergence == 0xFFFFFFFF)
+    {
+        replay.first_divergence = replay.tx_bytes;
+    }
+}
+
+static int
+replay_available (void)
+{
+    if (replay.hdr.dir == TRANSPORT_DIR_RX)
+    {
+        if (micros () - replay.tx_time >= replay.hdr.time - replay.tx_rec_time)
+        {
+            return replay.remaining;
+        }
+    }
+    return 0;
+}
+
+static int
+replay_read (void)
+{
+    int     ch;
+
+    if (replay_available () <= 0)
+    {
+        return -1;
+    }
+
+    ch = replay.fp.read ();
+    replay.rx_time  = micros ();
+    replay.rx_seen  = true;
+
+    if (--replay.remaining == 0)
+    {
+        replay_next_record ();
+    }
+
+    return ch;
+}
+
+static size_t
+replay_write (const uint8_t * buf, size_t len)
+{
+    uint32_t    latency;
+    size_t      i;
+
+    if (replay.rx_seen)
+    {
+        latency = micros () - replay.rx_time;
+        replay.latency_n++;
+        replay.latency_sum += latency;
+
+        if (latency < replay.latency_min)
+        {
+            replay.latency_min = latency;
+        }
+
+        if (latency > replay.latency_max)
+        {
+            replay.latency_max = latency;
+        }
+
+        replay.rx_seen = false;
+    }
+
+    for (i = 0; i < len; i++)
+    {
+        while (replay.hdr.dir == TRANSPORT_DIR_RX)                                      // flasher didn't wait for recorded response
+        {
+            replay.rx_skipped += replay.remaining;
+            replay_diverged ();
+            replay_next_record ();
+        }
+
+        if (replay.hdr.dir == TRANSPORT_DIR_TX)
+        {
+            if (replay.remaining == replay.hdr.len)                                     // 1st byte of request
+            {
+                replay.tx_rec_time  = replay.hdr.time;
+                replay.tx_time      = micros ();
+            }
+
+            if (replay.fp.read () != buf[i])
+            {
+                replay.tx_mismatch++;
+                replay_diverged ();
+            }
+
+            if (--replay.remaining == 0)
+            {
+                replay_next_record ();
+            }
+        }
+        else
+        {
+            replay.tx_extra++;
+            replay_diverged ();
+        }
+
+        replay.tx_bytes++;
+    }
+
+    return len;
+}
+
+static void
+replay_flush (void)
+{
+}
+
+const TRANSPORT transport_replay = { replay_available, replay_read, replay_write, replay_flush };
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * transport_replay_begin () - start replay of a recorded session
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+bool
+transport_replay_begin (String fname, String & errmsg)
+{
+    replay.fp.close ();
+    replay.fp = LittleFS.open (fname, "r");
+
+    if (! replay.fp)
+    {
+        errmsg = "cannot open " + fname;
+        return false;
+    }
+
+    replay.remaining        = 0;
+    replay.start            = micros ();
+    replay.tx_rec_time      = 0;
+    replay.tx_time          = replay.start;
+    replay.rx_seen          = false;
+    replay.tx_bytes         = 0;
+    replay.tx_mismatch      = 0;
+    replay.tx_extra         = 0;
+    replay.rx_skipped       = 0;
+    replay.first_divergence = 0xFFFFFFFF;
+    replay.latency_n        = 0;
+    replay.latency_sum      = 0;
+    replay.latency_min      = 0xFFFFFFFF;
+    replay.latency_max      = 0;
+
+    replay_next_record ();
+
+    if (replay.hdr.dir == 0)
+    {
+        replay.fp.close ();
+        errmsg = fname + " contains no session";
+        return false;
+    }
+    return true;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * transport_replay_end () - stop replay
+ * Returns report as HTML
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+String
+transport_replay_end (bool * diverged)
+{
+    TRANSPORT_RECORD    hdr;
+    uint32_t            replay_time = micros () - replay.start;
+    uint32_t            rec_time    = replay.hdr.dir ? replay.hdr.time : 0;
+    uint32_t            unused      = 0;
+    char                buf[128];
+    String              report;
+
+    if (replay.hdr.dir)                                                                 // count unused records, get recorded duration
+    {
+        unused = replay.remaining;
+        replay.fp.seek (replay.remaining, SeekCur);
+
+        while (replay.fp.read ((uint8_t *) &hdr, sizeof (hdr)) == sizeof (hdr))
+        {
+            unused  += hdr.len;
+            rec_time = hdr.time;
+            replay.fp.seek (hdr.len, SeekCur);
+        }
+    }
+    else
+    {
+        rec_time = replay.tx_rec_time;
+    }
+
+    replay.fp.close ();
+
+    sprintf (buf, "Bytes sent: %u, mismatching: %u, beyond end of session: %u<BR>\r\n", replay.tx_bytes, replay.tx_mismatch, replay.tx_extra);
+    report += buf;
+    sprintf (buf, "Recorded bytes skipped: %u, not replayed: %u<BR>\r\n", replay.rx_skipped, unused);
+    report += buf;
+
+    if (replay.latency_n > 0)
+    {
+        sprintf (buf, "Decision latency: min %u, avg %u, max %u usec<BR>\r\n", replay.latency_min, replay.latency_sum / replay.latency_n,
+                 replay.latency_max);
+        report += buf;
+    }
+
+    sprintf (buf, "Replay time: %u msec, recorded: %u msec<BR>\r\n", replay_time / 1000, rec_time / 1000);
+    report += buf;
+
+    *diverged = replay.first_divergence != 0xFFFFFFFF || unused > 0;
+
+    if (replay.first_divergence != 0xFFFFFFFF)
+    {
+        sprintf (buf, "Session diverged at byte %u sent<BR>\r\n", replay.first_divergence);
+        report += buf;
+    }
+    else if (unused > 0)
+    {
+        report += F("Session ended early<BR>\r\n");
+    }
+    else
+    {
+        report += F("Session replayed without divergence<BR>\r\n");
+    }
+    return report;
+}
@@ -0,0 +1,66 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * transport.h - byte transport to STM32 bootloader: UART, UART with session recording, session replay
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#define TRANSPORT_SESSION_FNAME     "/session.rec"                                      // default file of recorded session
+#define TRANSPORT_DIR_TX            'T'                                                 // flasher -> STM32
+#define TRANSPORT_DIR_RX            'R'                                                 // STM32 -> flasher
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * transport functions, same semantics as the Serial functions
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct
+{
+    int                             (*available) (void);
+    int                             (*read) (void);
+    size_t                          (*write) (const uint8_t * buf, size_t len);
+    void                            (*flush) (void);
+} TRANSPORT;
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * record of a session file: header followed by len bytes, consecutive bytes of the same direction are combined into one record
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct __attribute__ ((packed))
+{
+    uint8_t                         dir;                                                // TRANSPORT_DIR_TX or TRANSPORT_DIR_RX
+    uint32_t                        time;                                               // usec since start of session, first byte
+    uint16_t                        len;
+} TRANSPORT_RECORD;
+
+extern const TRANSPORT              transport_serial;
+extern const TRANSPORT              transport_record;
+extern const TRANSPORT              transport_replay;
+
+extern bool                         transport_record_begin (String fname);
+extern void                         transport_record_end (void);
+extern bool                         transport_replay_begin (String fname, String & errmsg);
+extern String                       transport_replay_end (bool * diverged);
+
+#endif // TRANSPORT_H
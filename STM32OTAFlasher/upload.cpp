@@ -0,0 +1,531 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * upload.cpp - resumable chunked uploads
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <ESP8266WiFi.h>
+#include <LittleFS.h>
+#include "upload.h"
+#include "image.h"
+#include "conlog.h"
+#include "fleet.h"
+#include "stm32emu.h"
+
+#define UPLOAD_SESSION_MAGIC        0x31504C55                                          // "ULP1"
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * global data:
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static UPLOAD_SESSION               session;                                            // session of current chunk
+static File                         chunk_fp = (File) 0;
+static String                       chunk_id;
+static uint32_t                     chunk_offset;                                       // offset of current chunk
+static uint32_t                     chunk_len;                                          // bytes received of current chunk
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * check upload id: 1 to UPLOAD_ID_LEN characters of [A-Za-z0-9_-]
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static bool
+upload_id_valid (String id)
+{
+    unsigned int    i;
+    char            ch;
+
+    if (id.length() == 0 || id.length() > UPLOAD_ID_LEN)
+    {
+        return false;
+    }
+
+    for (i = 0; i < id.length(); i++)
+    {
+        ch = id.charAt(i);
+
+        if (! ((ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z') || (ch >= '0' && ch <= '9') || ch == '_' || ch == '-'))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * check target filename (without leading '/'): no subdirectory, no "..", not the name of a directory used by the flasher
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static bool
+upload_fname_valid (String fname)
+{
+    static const char * reserved[] = { IMAGE_LAST_DIR, IMAGE_CAS_DIR, CONLOG_DIR, FLEET_DIR, STM32EMU_DIR, UPLOAD_DIR };
+    unsigned int        i;
+
+    if (fname.length() == 0 || fname.indexOf ('/') >= 0 || fname.indexOf ("..") >= 0)
+    {
+        return false;
+    }
+
+    for (i = 0; i < sizeof (reserved) / sizeof (reserved[0]); i++)
+    {
+        if (fname.equals (reserved[i] + 1))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static String
+upload_data_path (String id)
+{
+    return (String) UPLOAD_DIR + "/" + id + ".dat";
+}
+
+static String
+upload_state_path (String id)
+{
+    return (String) UPLOAD_DIR + "/" + id + ".rng";
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * load session state
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static bool
+upload_session_load (String id)
+{
+    bool    rtc = false;
+
+    File f = LittleFS.open (upload_state_path (id), "r");
+
+    if (f)
+    {
+        if (f.read ((uint8_t *) &session, sizeof (session)) == sizeof (session) &&
+            session.magic == UPLOAD_SESSION_MAGIC && session.n_ranges <= UPLOAD_MAX_RANGES)
+        {
+            rtc = true;
+        }
+
+        f.close ();
+    }
+
+    return rtc;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * save session state
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static bool
+upload_session_save (String id)
+{
+    bool    rtc = false;
+
+    File f = LittleFS.open (upload_state_path (id), "w");
+
+    if (f)
+    {
+        if (f.write ((uint8_t *) &session, sizeof (session)) == sizeof (session))
+        {
+            rtc = true;
+        }
+
+        f.close ();
+    }
+
+    return rtc;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * add received range [start, end) to session, merge overlapping and adjacent ranges
+ * Returns false if there are too many gaps
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static bool
+upload_session_add_range (uint32_t start, uint32_t end)
+{
+    uint32_t    new_start[UPLOAD_MAX_RANGES + 1];
+    uint32_t    new_end[UPLOAD_MAX_RANGES + 1];
+    uint16_t    n = 0;
+    uint16_t    i;
+    bool        inserted = false;
+
+    for (i = 0; i < session.n_ranges; i++)
+    {
+        if (session.range_end[i] < start)                                               // range lies before new range
+        {
+            new_start[n]    = session.range_start[i];
+            new_end[n]      = session.range_end[i];
+            n++;
+        }
+        else if (session.range_start[i] > end)                                          // range lies behind new range
+        {
+            if (! inserted)
+            {
+                new_start[n]    = start;
+                new_end[n]      = end;
+                n++;
+                inserted        = true;
+            }
+
+            new_start[n]    = session.range_start[i];
+            new_end[n]      = session.range_end[i];
+            n++;
+        }
+        else                                                                            // overlapping or adjacent: merge
+        {
+            if (start > session.range_start[i])
+            {
+                start = session.range_start[i];
+            }
+
+            if (end < session.range_end[i])
+            {
+                end = session.range_end[i];
+            }
+        }
+    }
+
+    if (! inserted)
+    {
+        new_start[n]    = start;
+        new_end[n]      = end;
+        n++;
+    }
+
+    if (n > UPLOAD_MAX_RANGES)
+    {
+        return false;
+    }
+
+    memcpy (session.range_start, new_start, n * sizeof (uint32_t));
+    memcpy (session.range_end, new_end, n * sizeof (uint32_t));
+    session.n_ranges = n;
+    return true;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * upload_chunk_begin () - start receiving a chunk
+ *
+ * fname and size may be empty/0 if already sent with a previous chunk
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+bool
+upload_chunk_begin (String id, String fname, uint32_t offset, uint32_t size, String & errmsg)
+{
+    String  path;
+
+    chunk_len = 0;
+
+    if (! upload_id_valid (id))
+    {
+        errmsg = "invalid upload id";
+        return false;
+    }
+
+    if (fname.startsWith ("/"))
+    {
+        fname = fname.substring (1);
+    }
+
+    if (fname.length() > UPLOAD_FNAME_LEN)
+    {
+        errmsg = "filename too long";
+        return false;
+    }
+
+    if (fname.length() > 0 && ! upload_fname_valid (fname))
+    {
+        errmsg = "invalid filename";
+        return false;
+    }
+
+    LittleFS.mkdir (UPLOAD_DIR);
+
+    if (! upload_session_load (id))
+    {
+        if (fname.length() == 0)
+        {
+            errmsg = "unknown upload id, fname required";
+            return false;
+        }
+
+        memset (&session, 0, sizeof (session));
+        session.magic = UPLOAD_SESSION_MAGIC;
+        fname.toCharArray (session.fname, UPLOAD_FNAME_LEN + 1);
+    }
+    else if (fname.length() > 0 && ! fname.equals (session.fname))
+    {
+        errmsg = "upload id belongs to another file";
+        return false;
+    }
+
+    if (size > 0)
+    {
+        if (session.size == 0)
+        {
+            FSInfo fs_info;
+            LittleFS.info(fs_info);
+
+            if (size > fs_info.totalBytes - fs_info.usedBytes)
+            {
+                errmsg = "not enough space in file system";
+                return false;
+            }
+
+            session.size = size;
+        }
+        else if (size != session.size)
+        {
+            errmsg = "size differs from previous chunks";
+            return false;
+        }
+    }
+
+    if (session.size > 0 && offset >= session.size)
+    {
+        errmsg = "offset out of range";
+        return false;
+    }
+
+    path = upload_data_path (id);
+    chunk_fp = LittleFS.open (path, LittleFS.exists (path) ? "r+" : "w");
+
+    if (! chunk_fp || ! chunk_fp.seek (offset, SeekSet))
+    {
+        if (chunk_fp)
+        {
+            chunk_fp.close ();
+            chunk_fp = (File) 0;
+        }
+
+        errmsg = "could not open file";
+        return false;
+    }
+
+    chunk_id        = id;
+    chunk_offset    = offset;
+    return true;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * upload_chunk_write () - write data of current chunk
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+bool
+upload_chunk_write (uint8_t * buf, size_t len, String & errmsg)
+{
+    if (! chunk_fp)
+    {
+        return false;
+    }
+
+    if (session.size > 0 && chunk_offset + chunk_len + len > session.size)
+    {
+        errmsg = "chunk exceeds file size";
+        len = session.size - (chunk_offset + chunk_len);
+    }
+
+    if (chunk_fp.write (buf, len) != len)
+    {
+        errmsg = "write error, file system full?";
+        upload_chunk_end ();
+        return false;
+    }
+
+    chunk_len += len;
+    return errmsg.length() == 0;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * upload_chunk_end () - finish current chunk
+ *
+ * Also called if the connection breaks, the data received so far is kept.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+bool
+upload_chunk_end (void)
+{
+    bool    rtc = true;
+
+    if (chunk_fp)
+    {
+        chunk_fp.close ();
+        chunk_fp = (File) 0;
+
+        if (chunk_len > 0)
+        {
+            rtc = upload_session_add_range (chunk_offset, chunk_offset + chunk_len);    // false: too many gaps, chunk is ignored
+        }
+
+        if (! upload_session_save (chunk_id))
+        {
+            rtc = false;
+        }
+    }
+
+    return rtc;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * upload_chunk_status () - get state of upload as text, empty string if id is unknown
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+String
+upload_chunk_status (String id)
+{
+    String      status = "";
+    uint16_t    i;
+
+    if (upload_id_valid (id) && upload_session_load (id))
+    {
+        status += (String) "id " + id + "\r\n";
+        status += (String) "fname " + session.fname + "\r\n";
+        status += (String) "size " + session.size + "\r\n";
+
+        for (i = 0; i < session.n_ranges; i++)
+        {
+            status += (String) "range " + session.range_start[i] + "-" + session.range_end[i] + "\r\n";
+        }
+    }
+
+    return status;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * upload_chunk_complete () - check completeness and hash, move file to its target filename
+ *
+ * Image files are checked and stored with their image info.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+bool
+upload_chunk_complete (String id, String sha256, uint32_t size, uint32_t base_address, String & fname, String & errmsg)
+{
+    static IMAGE_READER     rd;
+    uint8_t                 format;
+    bool                    rtc = true;
+    String                  path;
+
+    if (! upload_id_valid (id) || ! upload_session_load (id))
+    {
+        errmsg = "unknown upload id";
+        return false;
+    }
+
+    if (! upload_fname_valid (session.fname))                                           // session of an older firmware
+    {
+        errmsg = "invalid filename";
+        return false;
+    }
+
+    if (size == 0)
+    {
+        size = session.size;
+    }
+
+    if (size == 0 && session.n_ranges == 1)
+    {
+        size = session.range_end[0];
+    }
+
+    if (session.n_ranges != 1 || session.range_start[0] != 0 || session.range_end[0] < size || size == 0)
+    {
+        errmsg = "upload incomplete";
+        return false;
+    }
+
+    if (sha256.length() == 0)
+    {
+        errmsg = "sha256 required";
+        return false;
+    }
+
+    fname = (String) "/" + session.fname;
+    path = upload_data_path (id);
+
+    File f = LittleFS.open (path, "r+");
+
+    if (! f)
+    {
+        errmsg = "could not open file";
+        return false;
+    }
+
+    f.truncate (size);
+    f.close ();
+
+    format = image_format (fname);
+    image_reader_begin (&rd, format, base_address, 0, 0);                              // IMAGE_FORMAT_NONE: only hash
+
+    if (image_read_file (path, &rd) < 0)
+    {
+        errmsg = (String) "Image file rejected: " + rd.errmsg;
+        rtc = false;
+    }
+
+    sha256.toLowerCase();
+
+    if (rtc && ! sha256.equals (image_sha256_string (rd.info.sha256)))
+    {
+        errmsg = "SHA-256 mismatch";
+        rtc = false;
+    }
+
+    if (rtc)
+    {
+        LittleFS.remove (fname);
+        image_info_remove (fname);
+
+        if (LittleFS.rename (path, fname))
+        {
+            if (format != IMAGE_FORMAT_NONE)
+            {
+                image_info_save (fname, &rd.info);
+            }
+
+            LittleFS.remove (upload_state_path (id));
+        }
+        else
+        {
+            errmsg = "could not rename file";
+            rtc = false;
+        }
+    }
+
+    return rtc;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * upload_chunk_cancel () - remove unfinished upload
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+upload_chunk_cancel (String id)
+{
+    if (upload_id_valid (id))
+    {
+        LittleFS.remove (upload_data_path (id));
+        LittleFS.remove (upload_state_path (id));
+    }
+}
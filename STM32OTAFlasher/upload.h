@@ -0,0 +1,56 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * upload.h - resumable chunked uploads
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ * MIT License
+ *
+ * Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+#define UPLOAD_DIR                  "/upload"                                           // directory of unfinished uploads
+#define UPLOAD_ID_LEN               16                                                  // max. length of upload id
+#define UPLOAD_FNAME_LEN            31                                                  // max. length of target filename
+#define UPLOAD_MAX_RANGES           16                                                  // max. number of received ranges (gaps + 1)
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * state of a chunked upload, stored in UPLOAD_DIR/<id>.rng
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef struct
+{
+    uint32_t                        magic;
+    char                            fname[UPLOAD_FNAME_LEN + 1];                        // target filename
+    uint32_t                        size;                                               // total size, 0 if not yet known
+    uint16_t                        n_ranges;                                           // number of received ranges
+    uint32_t                        range_start[UPLOAD_MAX_RANGES];                     // start offset of range (incl.)
+    uint32_t                        range_end[UPLOAD_MAX_RANGES];                       // end offset of range (excl.)
+} UPLOAD_SESSION;
+
+extern bool                         upload_chunk_begin (String id, String fname, uint32_t offset, uint32_t size, String & errmsg);
+extern bool                         upload_chunk_write (uint8_t * buf, size_t len, String & errmsg);
+extern bool                         upload_chunk_end (void);
+extern String                       upload_chunk_status (String id);
+extern bool                         upload_chunk_complete (String id, String sha256, uint32_t size, uint32_t base_address, String & fname, String & errmsg);
+extern void                         upload_chunk_cancel (String id);
+
+#endif // UPLOAD_H
@@ -0,0 +1,61 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * check.h - minimal test assertions: failed checks are printed and counted, check_exit () returns the exit code of a test
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+#include <string>
+
+static int                          check_failures;
+static int                          check_count;
+
+#define CHECK(cond)                 check ((cond), #cond, __FILE__, __LINE__)
+#define CHECK_STR(got, expected)    check_str ((got), (expected), #got, __FILE__, __LINE__)       // strings of bytes, printed in hex
+
+static inline void
+check (bool ok, const char * what, const char * file, int line)
+{
+    check_count++;
+
+    if (! ok)
+    {
+        printf ("%s:%d: check failed: %s\n", file, line, what);
+        check_failures++;
+    }
+}
+
+static inline void
+check_str (const std::string & got, const std::string & expected, const char * what, const char * file, int line)
+{
+    check (got == expected, what, file, line);
+
+    if (got != expected)
+    {
+        printf ("    expected:");
+
+        for (unsigned char ch : expected)
+        {
+            printf (" %02X", ch);
+        }
+
+        printf ("\n    got:     ");
+
+        for (unsigned char ch : got)
+        {
+            printf (" %02X", ch);
+        }
+
+        printf ("\n");
+    }
+}
+
+static inline int
+check_exit (const char * name)
+{
+    printf ("%s: %d checks, %d failed\n", name, check_count, check_failures);
+    return check_failures ? 1 : 0;
+}
+
+#endif // CHECK_H
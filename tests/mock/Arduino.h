@@ -0,0 +1,297 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * Arduino.h - host mock of the ESP8266 Arduino core, only what the sketch sources under test use
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef MOCK_ARDUINO_H
+#define MOCK_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <string>
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+typedef uint8_t                     byte;
+typedef bool                        boolean;
+
+#define HIGH                        1
+#define LOW                         0
+#define INPUT                       0
+#define OUTPUT                      1
+#define INPUT_PULLUP                2
+
+#define PROGMEM
+#define PSTR(s)                     (s)
+#define IRAM_ATTR
+#define ICACHE_RAM_ATTR
+
+class __FlashStringHelper;
+#define F(s)                        ((const __FlashStringHelper *) (s))
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * time and GPIOs, see mock.cpp: the clock advances with every call, so timeouts of polling loops expire
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+extern unsigned long                millis (void);
+extern unsigned long                micros (void);
+extern void                         delay (unsigned long msec);
+extern void                         delayMicroseconds (unsigned int usec);
+extern void                         yield (void);
+extern void                         pinMode (uint8_t pin, uint8_t mode);
+extern void                         digitalWrite (uint8_t pin, uint8_t level);
+extern int                          digitalRead (uint8_t pin);
+extern long                         random (long max);
+extern long                         random (long min, long max);
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * String
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+class String
+{
+    public:
+        std::string s;
+
+        String () {}
+        String (const char * c)                     { if (c) s = c; }
+        String (const __FlashStringHelper * c)      { s = (const char *) c; }
+        String (const std::string & c) : s (c) {}
+        String (char c)                             { s = c; }
+        String (unsigned char v)                    { s = std::to_string (v); }
+        String (int v)                              { s = std::to_string (v); }
+        String (unsigned int v)                     { s = std::to_string (v); }
+        String (long v)                             { s = std::to_string (v); }
+        String (unsigned long v)                    { s = std::to_string (v); }
+        String (int v, int base)                    { s = number (v, base); }
+        String (unsigned int v, int base)           { s = number (v, base); }
+        String (unsigned long v, int base)          { s = number (v, base); }
+        String (unsigned char v, int base)          { s = number (v, base); }
+
+        String & operator+= (const String & o)      { s += o.s; return *this; }
+        String & operator+= (const char * o)        { s += o; return *this; }
+        String & operator+= (char c)                { s += c; return *this; }
+        String & operator+= (int v)                 { s += std::to_string (v); return *this; }
+        String & operator+= (unsigned int v)        { s += std::to_string (v); return *this; }
+        String & operator+= (long v)                { s += std::to_string (v); return *this; }
+        String & operator+= (unsigned long v)       { s += std::to_string (v); return *this; }
+
+        bool concat (const char * c, unsigned n)    { s.append (c, n); return true; }
+        bool concat (const char * c)                { s += c; return true; }
+        bool concat (char c)                        { s += c; return true; }
+        bool concat (const String & c)              { s += c.s; return true; }
+        bool reserve (unsigned)                     { return true; }
+
+        unsigned length () const                    { return s.size (); }
+        bool isEmpty () const                       { return s.empty (); }
+        const char * c_str () const                 { return s.c_str (); }
+        char charAt (unsigned i) const              { return i < s.size () ? s[i] : 0; }
+        char operator[] (unsigned i) const          { return charAt (i); }
+
+        bool equals (const String & o) const        { return s == o.s; }
+        bool equals (const char * o) const          { return s == o; }
+        bool equalsIgnoreCase (const String & o) const
+        {
+            return s.size () == o.s.size () && std::equal (s.begin (), s.end (), o.s.begin (),
+                                                           [] (char a, char b) { return tolower (a) == tolower (b); });
+        }
+        bool operator== (const String & o) const    { return s == o.s; }
+        bool operator== (const char * o) const      { return s == o; }
+        bool operator!= (const String & o) const    { return s != o.s; }
+        bool operator!= (const char * o) const      { return s != o; }
+        bool startsWith (const String & o) const    { return s.compare (0, o.s.size (), o.s) == 0; }
+        bool endsWith (const String & o) const      { return s.size () >= o.s.size () && s.compare (s.size () - o.s.size (), o.s.size (), o.s) == 0; }
+
+        String substring (unsigned a) const         { return a < s.size () ? String (s.substr (a)) : String (); }
+        String substring (unsigned a, unsigned b) const
+        {
+            return a < b && a < s.size () ? String (s.substr (a, b - a)) : String ();
+        }
+        int indexOf (char c, unsigned from = 0) const               { return pos (s.find (c, from)); }
+        int indexOf (const String & o, unsigned from = 0) const     { return pos (s.find (o.s, from)); }
+        int indexOf (const char * o, unsigned from = 0) const       { return pos (s.find (o, from)); }
+        int lastIndexOf (char c) const                              { return pos (s.rfind (c)); }
+
+        void toLowerCase ()                         { for (auto & c : s) c = tolower (c); }
+        void toUpperCase ()                         { for (auto & c : s) c = toupper (c); }
+        void trim ()
+        {
+            size_t b = s.find_first_not_of (" \t\r\n");
+            size_t e = s.find_last_not_of (" \t\r\n");
+            s = b == std::string::npos ? std::string () : s.substr (b, e - b + 1);
+        }
+        void remove (unsigned i)                    { if (i < s.size ()) s.erase (i); }
+        void remove (unsigned i, unsigned n)        { if (i < s.size ()) s.erase (i, n); }
+        void replace (const String & a, const String & b)
+        {
+            for (size_t p = 0; ! a.s.empty () && (p = s.find (a.s, p)) != std::string::npos; p += b.s.size ())
+            {
+                s.replace (p, a.s.size (), b.s);
+            }
+        }
+        long toInt () const                         { return atol (s.c_str ()); }
+        void toCharArray (char * b, unsigned n) const
+        {
+            if (n > 0)
+            {
+                strncpy (b, s.c_str (), n - 1);
+                b[n - 1] = '\0';
+            }
+        }
+
+    private:
+        static int pos (size_t p)                   { return p == std::string::npos ? -1 : (int) p; }
+        static std::string number (unsigned long v, int base)
+        {
+            char buf[40];
+            snprintf (buf, sizeof (buf), base == 16 ? "%lx" : base == 8 ? "%lo" : "%lu", v);
+            return buf;
+        }
+};
+
+inline String operator+ (const String & a, const String & b)               { String r (a); r += b; return r; }
+inline String operator+ (const String & a, const char * b)                 { String r (a); r += b; return r; }
+inline String operator+ (const char * a, const String & b)                 { String r (a); r += b; return r; }
+inline String operator+ (const String & a, char b)                         { String r (a); r += b; return r; }
+inline String operator+ (const String & a, int b)                          { String r (a); r += b; return r; }
+inline String operator+ (const String & a, unsigned int b)                 { String r (a); r += b; return r; }
+inline String operator+ (const String & a, long b)                         { String r (a); r += b; return r; }
+inline String operator+ (const String & a, unsigned long b)                { String r (a); r += b; return r; }
+inline String operator+ (const String & a, const __FlashStringHelper * b)  { String r (a); r += (const char *) b; return r; }
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * Print and Stream: print () output goes to stdout
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+class Print
+{
+    public:
+        virtual ~Print () {}
+        virtual size_t write (uint8_t ch) = 0;
+        virtual size_t write (const uint8_t * buf, size_t len)
+        {
+            size_t n = 0;
+
+            while (n < len && write (buf[n]))
+            {
+                n++;
+            }
+            return n;
+        }
+        size_t write (const char * buf, size_t len)     { return write ((const uint8_t *) buf, len); }
+        size_t write (const char * str)                 { return write ((const uint8_t *) str, strlen (str)); }
+        virtual int availableForWrite ()                { return 0; }
+        virtual void flush () {}
+
+        size_t print (const char * s)                   { return write (s); }
+        size_t print (const String & s)                 { return write (s.c_str ()); }
+        size_t print (const __FlashStringHelper * s)    { return write ((const char *) s); }
+        size_t print (char c)                           { return write ((uint8_t) c); }
+        size_t print (int v)                            { return print (String (v)); }
+        size_t print (unsigned int v)                   { return print (String (v)); }
+        size_t print (long v)                           { return print (String (v)); }
+        size_t print (unsigned long v)                  { return print (String (v)); }
+        template <typename T> size_t println (T v)      { return print (v) + print ("\r\n"); }
+        size_t println ()                               { return print ("\r\n"); }
+};
+
+class Stream : public Print
+{
+    public:
+        virtual int available () = 0;
+        virtual int read () = 0;
+        virtual int peek () = 0;
+        void setTimeout (unsigned long) {}
+        size_t readBytes (uint8_t * buf, size_t len)
+        {
+            size_t n = 0;
+            int    ch;
+
+            while (n < len && (ch = read ()) >= 0)
+            {
+                buf[n++] = ch;
+            }
+            return n;
+        }
+        size_t readBytes (char * buf, size_t len)       { return readBytes ((uint8_t *) buf, len); }
+};
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * UART: bytes go to the device in peer, e.g. an emulated STM32 board, see testboard.h. Without peer the sketch reads rx and
+ * writes into tx.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+typedef uint8_t                     SerialConfig;
+
+#define UART_NB_BIT_5               0x00
+#define UART_NB_BIT_6               0x04
+#define UART_NB_BIT_7               0x08
+#define UART_NB_BIT_8               0x0C
+#define UART_PARITY_NONE            0x00
+#define UART_PARITY_EVEN            0x02
+#define UART_PARITY_ODD             0x03
+#define UART_NB_STOP_BIT_1          0x10
+#define UART_NB_STOP_BIT_2          0x30
+
+#define SERIAL_8N1                  (UART_NB_BIT_8 | UART_PARITY_NONE | UART_NB_STOP_BIT_1)
+#define SERIAL_8E1                  (UART_NB_BIT_8 | UART_PARITY_EVEN | UART_NB_STOP_BIT_1)
+
+class HardwareSerial : public Stream
+{
+    public:
+        Stream *                    peer;                                               // connected device, NULL: rx and tx
+        std::string                 rx;                                                 // bytes to be read by the sketch
+        std::string                 tx;                                                 // bytes written by the sketch
+        uint32_t                    baud;                                               // settings of last begin ()
+        SerialConfig                config;
+        bool                        swapped;
+
+        HardwareSerial (int) : peer (0), baud (0), config (0), swapped (false) {}
+        void begin (unsigned long b, SerialConfig c = SERIAL_8N1)   { baud = b; config = c; swapped = false; }
+        void end () {}
+        void swap ()                                                { swapped = ! swapped; }
+        size_t setRxBufferSize (size_t n)                           { return n; }
+        int availableForWrite () override                           { return 128; }
+        int available () override                                   { return peer ? peer->available () : (int) rx.size (); }
+        int peek () override                                        { return peer ? peer->peek () : rx.empty () ? -1 : (uint8_t) rx[0]; }
+        int read () override
+        {
+            int ch;
+
+            if (peer)
+            {
+                return peer->read ();
+            }
+
+            if (rx.empty ())
+            {
+                return -1;
+            }
+
+            ch = (uint8_t) rx[0];
+            rx.erase (0, 1);
+            return ch;
+        }
+        size_t read (char * buf, size_t len)                        { return readBytes (buf, len); }
+        size_t write (uint8_t ch) override                          { return write (&ch, 1); }
+        size_t write (const uint8_t * buf, size_t len) override
+        {
+            if (peer)
+            {
+                return peer->write (buf, len);
+            }
+
+            tx.append ((const char *) buf, len);
+            return len;
+        }
+        using Print::write;
+};
+
+extern HardwareSerial               Serial;
+
+#endif // MOCK_ARDUINO_H
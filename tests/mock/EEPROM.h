@@ -0,0 +1,25 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * EEPROM.h - host mock: emulated EEPROM in RAM, erased (0xFF) at start
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef MOCK_EEPROM_H
+#define MOCK_EEPROM_H
+
+#include <Arduino.h>
+
+class EEPROMClass
+{
+    public:
+        uint8_t                     data[4096];
+        int                         commits;
+
+        EEPROMClass () : commits (0)                { memset (data, 0xFF, sizeof (data)); }
+        void begin (size_t) {}
+        const uint8_t * getConstDataPtr () const    { return data; }
+        uint8_t * getDataPtr ()                     { return data; }
+        bool commit ()                              { commits++; return true; }
+};
+
+extern EEPROMClass                  EEPROM;
+
+#endif // MOCK_EEPROM_H
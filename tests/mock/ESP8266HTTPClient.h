@@ -0,0 +1,60 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * ESP8266HTTPClient.h - host mock: GET asks mock_http_get () for the response, without it every request fails
+ *
+ * The body is read by the sketch from to_server of the socket, so the test can send it piecewise. client_open = false: the server
+ * closed the connection.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef MOCK_ESP8266HTTPCLIENT_H
+#define MOCK_ESP8266HTTPCLIENT_H
+
+#include <ESP8266WiFi.h>
+
+#define HTTP_CODE_OK                200
+#define HTTP_CODE_NOT_FOUND         404
+#define HTTPC_ERROR_CONNECTION_FAILED   (-1)
+
+struct MockHttpResponse
+{
+    int                             code;                                               // HTTP status
+    int                             size;                                               // Content-Length, -1: unknown
+    std::shared_ptr<MockSocket>     sock;                                               // NULL: connection failed
+};
+
+extern MockHttpResponse             (*mock_http_get) (const std::string & url);
+
+class HTTPClient
+{
+    public:
+        WiFiClient *                client = 0;
+        std::string                 url;
+        MockHttpResponse            response = { 0, -1, 0 };
+
+        void useHTTP10 (bool) {}
+        void setTimeout (uint16_t) {}
+        bool begin (WiFiClient & c, const String & u)   { client = &c; url = u.c_str (); return true; }
+        int GET ()
+        {
+            response = mock_http_get ? (*mock_http_get) (url) : MockHttpResponse { 0, -1, 0 };
+
+            if (! response.sock)
+            {
+                return HTTPC_ERROR_CONNECTION_FAILED;
+            }
+
+            client->sock = response.sock;
+            return response.code;
+        }
+        int getSize ()                                  { return response.size; }
+        WiFiClient * getStreamPtr ()                    { return client; }
+        void end ()
+        {
+            if (client)
+            {
+                client->stop ();
+            }
+        }
+        static String errorToString (int)               { return "connection failed"; }
+};
+
+#endif // MOCK_ESP8266HTTPCLIENT_H
@@ -0,0 +1,128 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * ESP8266WiFi.h - host mock: TCP connections are in-memory sockets, a test connects with WiFiServer::mock_connect ()
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef MOCK_ESP8266WIFI_H
+#define MOCK_ESP8266WIFI_H
+
+#include <Arduino.h>
+#include <deque>
+#include <map>
+#include <memory>
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * both directions of a connection, seen from the test (client side)
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+struct MockSocket
+{
+    std::string                     to_server;                                          // sent by client, not yet read by the sketch
+    std::string                     to_client;                                          // written by the sketch
+    bool                            client_open = true;                                 // false: client closed the connection
+    bool                            server_open = true;                                 // false: sketch called stop ()
+};
+
+class WiFiClient : public Stream
+{
+    public:
+        std::shared_ptr<MockSocket> sock;
+
+        WiFiClient () {}
+        WiFiClient (std::shared_ptr<MockSocket> s) : sock (s) {}
+        void setNoDelay (bool) {}
+        uint8_t connected ()                        { return sock && sock->server_open && (sock->client_open || ! sock->to_server.empty ()); }
+        explicit operator bool () const             { return (bool) sock; }
+        void stop ()
+        {
+            if (sock)
+            {
+                sock->server_open = false;
+            }
+        }
+        int available () override                   { return sock ? (int) sock->to_server.size () : 0; }
+        int peek () override                        { return available () ? (uint8_t) sock->to_server[0] : -1; }
+        int read () override
+        {
+            uint8_t ch;
+            return read (&ch, 1) == 1 ? ch : -1;
+        }
+        int read (uint8_t * buf, size_t len)
+        {
+            size_t n = available () < (int) len ? available () : len;
+
+            if (n > 0)
+            {
+                memcpy (buf, sock->to_server.data (), n);
+                sock->to_server.erase (0, n);
+            }
+            return n;
+        }
+        int availableForWrite () override           { return sock && sock->server_open && sock->client_open ? 256 : 0; }
+        size_t write (uint8_t ch) override          { return write (&ch, 1); }
+        size_t write (const uint8_t * buf, size_t len) override
+        {
+            if (! sock || ! sock->server_open)
+            {
+                return 0;
+            }
+
+            sock->to_client.append ((const char *) buf, len);
+            return len;
+        }
+        using Print::write;
+};
+
+typedef enum
+{
+    WL_IDLE_STATUS  = 0,
+    WL_CONNECTED    = 3,
+    WL_DISCONNECTED = 6
+} wl_status_t;
+
+class ESP8266WiFiClass
+{
+    public:
+        wl_status_t                 mock_status = WL_CONNECTED;
+
+        wl_status_t status ()                       { return mock_status; }
+};
+
+extern ESP8266WiFiClass             WiFi;
+
+class WiFiServer
+{
+    public:
+        uint16_t                    port;
+
+        WiFiServer (uint16_t p) : port (p) {}
+        void begin () {}
+        bool hasClient ()                           { return ! pending ()[port].empty (); }
+        WiFiClient available ()
+        {
+            WiFiClient  client;
+
+            if (hasClient ())
+            {
+                client = WiFiClient (pending ()[port].front ());
+                pending ()[port].pop_front ();
+            }
+            return client;
+        }
+
+        static std::shared_ptr<MockSocket> mock_connect (uint16_t port)                 // new connection from the test
+        {
+            std::shared_ptr<MockSocket> sock = std::make_shared<MockSocket> ();
+
+            pending ()[port].push_back (sock);
+            return sock;
+        }
+
+    private:
+        static std::map<uint16_t, std::deque<std::shared_ptr<MockSocket>>> & pending ()
+        {
+            static std::map<uint16_t, std::deque<std::shared_ptr<MockSocket>>> p;
+            return p;
+        }
+};
+
+#endif // MOCK_ESP8266WIFI_H
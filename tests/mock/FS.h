@@ -0,0 +1,172 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * FS.h - host mock: files live below a directory of the host, see mock_fs_root ()
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef MOCK_FS_H
+#define MOCK_FS_H
+
+#include <Arduino.h>
+#include <memory>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+enum SeekMode
+{
+    SeekSet = SEEK_SET,
+    SeekCur = SEEK_CUR,
+    SeekEnd = SEEK_END
+};
+
+typedef struct
+{
+    size_t                          totalBytes;
+    size_t                          usedBytes;
+} FSInfo;
+
+extern std::string                  mock_fs_root (void);
+
+class File : public Stream
+{
+    public:
+        std::shared_ptr<FILE>       fp;
+        std::string                 path;
+
+        File () {}
+        File (FILE * f, const std::string & p) : fp (f, fclose), path (p) {}
+        explicit operator bool () const             { return (bool) fp; }
+        void close ()                               { fp.reset (); }
+
+        size_t read (uint8_t * buf, size_t len)     { return fp ? fread (buf, 1, len, fp.get ()) : 0; }
+        int read () override
+        {
+            uint8_t ch;
+            return read (&ch, 1) == 1 ? ch : -1;
+        }
+        int peek () override
+        {
+            int ch = read ();
+
+            if (ch >= 0)
+            {
+                fseek (fp.get (), -1, SEEK_CUR);
+            }
+            return ch;
+        }
+        int available () override                   { return fp ? (int) (size () - position ()) : 0; }
+        size_t write (uint8_t ch) override          { return write (&ch, 1); }
+        size_t write (const uint8_t * buf, size_t len) override
+        {
+            return fp ? fwrite (buf, 1, len, fp.get ()) : 0;
+        }
+        using Print::write;
+        void flush () override
+        {
+            if (fp)
+            {
+                fflush (fp.get ());
+            }
+        }
+
+        bool seek (uint32_t pos, SeekMode mode = SeekSet)   { return fp && fseek (fp.get (), pos, mode) == 0; }
+        size_t position () const                    { return fp ? ftell (fp.get ()) : 0; }
+        size_t size () const
+        {
+            struct stat st;
+
+            if (! fp)
+            {
+                return 0;
+            }
+
+            fflush (fp.get ());
+            return fstat (fileno (fp.get ()), &st) == 0 ? st.st_size : 0;
+        }
+        bool truncate (uint32_t len)
+        {
+            return fp && fflush (fp.get ()) == 0 && ftruncate (fileno (fp.get ()), len) == 0;
+        }
+};
+
+class Dir
+{
+    public:
+        std::vector<std::string>    names;                                              // entries, read at openDir ()
+        size_t                      pos = 0;                                            // next entry + 1
+
+        bool next ()                                { return pos < names.size () ? ++pos : false; }
+        String fileName ()                          { return pos > 0 ? names[pos - 1].c_str () : ""; }
+};
+
+class FS
+{
+    public:
+        bool begin ()                               { return true; }
+        bool info (FSInfo & info)
+        {
+            info.totalBytes = 1024 * 1024;
+            info.usedBytes  = 0;
+            return true;
+        }
+        File open (const String & path, const char * mode)
+        {
+            std::string host    = mock_fs_root () + path.c_str ();
+            std::string m       = std::string (mode) + "b";
+            FILE *      f;
+            struct stat st;
+
+            if (stat (host.c_str (), &st) == 0 && S_ISDIR (st.st_mode))
+            {
+                return File ();
+            }
+
+            if (mode[0] != 'r')                                                     // LittleFS creates missing directories
+            {
+                for (size_t i = mock_fs_root ().size () + 1; i < host.size (); i++)
+                {
+                    if (host[i] == '/')
+                    {
+                        ::mkdir (host.substr (0, i).c_str (), 0755);
+                    }
+                }
+            }
+
+            f = fopen (host.c_str (), m.c_str ());
+            return f ? File (f, host) : File ();
+        }
+        Dir openDir (const String & path)
+        {
+            Dir             dir;
+            DIR *           d = opendir ((mock_fs_root () + path.c_str ()).c_str ());
+            struct dirent * e;
+
+            while (d && (e = readdir (d)) != 0)
+            {
+                if (strcmp (e->d_name, ".") && strcmp (e->d_name, ".."))
+                {
+                    dir.names.push_back (e->d_name);
+                }
+            }
+
+            if (d)
+            {
+                closedir (d);
+            }
+            return dir;
+        }
+        bool exists (const String & path)
+        {
+            struct stat st;
+            return stat ((mock_fs_root () + path.c_str ()).c_str (), &st) == 0;
+        }
+        bool remove (const String & path)           { return ::remove ((mock_fs_root () + path.c_str ()).c_str ()) == 0; }
+        bool mkdir (const String & path)            { return ::mkdir ((mock_fs_root () + path.c_str ()).c_str (), 0755) == 0; }
+        bool rmdir (const String & path)            { return ::rmdir ((mock_fs_root () + path.c_str ()).c_str ()) == 0; }
+        bool rename (const String & from, const String & to)
+        {
+            return ::rename ((mock_fs_root () + from.c_str ()).c_str (), (mock_fs_root () + to.c_str ()).c_str ()) == 0;
+        }
+};
+
+#endif // MOCK_FS_H
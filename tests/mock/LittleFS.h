@@ -0,0 +1,8 @@
+#ifndef MOCK_LITTLEFS_H
+#define MOCK_LITTLEFS_H
+
+#include <FS.h>
+
+extern FS                           LittleFS;
+
+#endif // MOCK_LITTLEFS_H
@@ -0,0 +1,37 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * SoftwareSerial.h - host mock: begin () asks mock_soft_serial_connect () for the device connected to the pins
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef MOCK_SOFTWARESERIAL_H
+#define MOCK_SOFTWARESERIAL_H
+
+#include <Arduino.h>
+
+enum SoftwareSerialConfig
+{
+    SWSERIAL_8N1,
+    SWSERIAL_8E1
+};
+
+extern Stream *                     (*mock_soft_serial_connect) (int8_t rx_pin, int8_t tx_pin, uint32_t baud);
+
+class SoftwareSerial : public Stream
+{
+    public:
+        Stream *                    peer;                                               // connected device, NULL: none
+
+        SoftwareSerial () : peer (0) {}
+        void begin (uint32_t baud, SoftwareSerialConfig, int8_t rx_pin, int8_t tx_pin)
+        {
+            peer = mock_soft_serial_connect ? (*mock_soft_serial_connect) (rx_pin, tx_pin, baud) : 0;
+        }
+        void end ()                                                 { peer = 0; }
+        int available () override                                   { return peer ? peer->available () : 0; }
+        int read () override                                        { return peer ? peer->read () : -1; }
+        int peek () override                                        { return peer ? peer->peek () : -1; }
+        size_t write (uint8_t ch) override                          { return write (&ch, 1); }
+        size_t write (const uint8_t * buf, size_t len) override     { return peer ? peer->write (buf, len) : len; }
+        using Print::write;
+};
+
+#endif // MOCK_SOFTWARESERIAL_H
@@ -0,0 +1,24 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * bearssl_hash.h - host mock: SHA-256 of BearSSL, see mock.cpp
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef MOCK_BEARSSL_HASH_H
+#define MOCK_BEARSSL_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define br_sha256_SIZE              32
+
+typedef struct
+{
+    uint32_t                        h[8];
+    uint64_t                        count;                                              // bytes hashed
+    uint8_t                         block[64];
+} br_sha256_context;
+
+extern void                         br_sha256_init (br_sha256_context * ctx);
+extern void                         br_sha256_update (br_sha256_context * ctx, const void * data, size_t len);
+extern void                         br_sha256_out (const br_sha256_context * ctx, void * out);
+
+#endif // MOCK_BEARSSL_HASH_H
@@ -0,0 +1,241 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * mock.cpp - host mocks of the ESP8266 Arduino core
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <EEPROM.h>
+#include <SoftwareSerial.h>
+#include <ESP8266HTTPClient.h>
+#include <bearssl/bearssl_hash.h>
+#include "mock.h"
+
+HardwareSerial                      Serial(0);
+FS                                  LittleFS;
+EEPROMClass                         EEPROM;
+Stream *                            (*mock_soft_serial_connect) (int8_t rx_pin, int8_t tx_pin, uint32_t baud);
+ESP8266WiFiClass                    WiFi;
+MockHttpResponse                    (*mock_http_get) (const std::string & url);
+
+uint8_t                             mock_pin_mode[MOCK_N_PINS];
+uint8_t                             mock_pin_level[MOCK_N_PINS];
+void                                (*mock_pin_changed) (uint8_t pin);
+
+static unsigned long                mock_usec;
+static std::string                  mock_root = "fs";
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * time: every call advances the clock by 10 usec, so polling loops time out without waiting
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+unsigned long
+micros (void)
+{
+    mock_usec += 10;
+    return mock_usec;
+}
+
+unsigned long
+millis (void)
+{
+    return micros () / 1000;
+}
+
+void
+delay (unsigned long msec)
+{
+    mock_usec += msec * 1000;
+}
+
+void
+delayMicroseconds (unsigned int usec)
+{
+    mock_usec += usec;
+}
+
+void
+yield (void)
+{
+}
+
+long
+random (long max)
+{
+    return max > 0 ? rand () % max : 0;
+}
+
+long
+random (long min, long max)
+{
+    return min + random (max - min);
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * GPIOs
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+pinMode (uint8_t pin, uint8_t mode)
+{
+    if (pin < MOCK_N_PINS)
+    {
+        mock_pin_mode[pin] = mode;
+
+        if (mock_pin_changed)
+        {
+            (*mock_pin_changed) (pin);
+        }
+    }
+}
+
+void
+digitalWrite (uint8_t pin, uint8_t level)
+{
+    if (pin < MOCK_N_PINS)
+    {
+        mock_pin_level[pin] = level;
+
+        if (mock_pin_changed)
+        {
+            (*mock_pin_changed) (pin);
+        }
+    }
+}
+
+int
+digitalRead (uint8_t pin)
+{
+    return pin < MOCK_N_PINS && mock_pin_mode[pin] == OUTPUT ? mock_pin_level[pin] : HIGH;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * file system
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+std::string
+mock_fs_root (void)
+{
+    return mock_root;
+}
+
+void
+mock_fs_reset (const char * dir)
+{
+    std::string cmd = std::string ("rm -rf '") + dir + "' && mkdir -p '" + dir + "'";
+
+    if (system (cmd.c_str ()) != 0)
+    {
+        fprintf (stderr, "cannot create %s\n", dir);
+        exit (1);
+    }
+
+    mock_root = dir;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * SHA-256, FIPS 180-4
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static const uint32_t               sha256_k[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROR(x, n)                   (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void
+sha256_block (br_sha256_context * ctx)
+{
+    uint32_t    w[64];
+    uint32_t    v[8];
+    uint32_t    t1;
+    uint32_t    t2;
+    int         i;
+
+    for (i = 0; i < 16; i++)
+    {
+        w[i] = ((uint32_t) ctx->block[4 * i] << 24) | (ctx->block[4 * i + 1] << 16) | (ctx->block[4 * i + 2] << 8) | ctx->block[4 * i + 3];
+    }
+
+    for (; i < 64; i++)
+    {
+        w[i] = w[i - 16] + (ROR (w[i - 15], 7) ^ ROR (w[i - 15], 18) ^ (w[i - 15] >> 3)) +
+               w[i - 7] + (ROR (w[i - 2], 17) ^ ROR (w[i - 2], 19) ^ (w[i - 2] >> 10));
+    }
+
+    memcpy (v, ctx->h, sizeof (v));
+
+    for (i = 0; i < 64; i++)
+    {
+        t1 = v[7] + (ROR (v[4], 6) ^ ROR (v[4], 11) ^ ROR (v[4], 25)) + ((v[4] & v[5]) ^ (~v[4] & v[6])) + sha256_k[i] + w[i];
+        t2 = (ROR (v[0], 2) ^ ROR (v[0], 13) ^ ROR (v[0], 22)) + ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+        memmove (v + 1, v, 7 * sizeof (uint32_t));
+        v[4] += t1;
+        v[0] = t1 + t2;
+    }
+
+    for (i = 0; i < 8; i++)
+    {
+        ctx->h[i] += v[i];
+    }
+}
+
+void
+br_sha256_init (br_sha256_context * ctx)
+{
+    static const uint32_t iv[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+
+    memcpy (ctx->h, iv, sizeof (iv));
+    ctx->count = 0;
+}
+
+void
+br_sha256_update (br_sha256_context * ctx, const void * data, size_t len)
+{
+    const uint8_t * p = (const uint8_t *) data;
+
+    while (len-- > 0)
+    {
+        ctx->block[ctx->count++ % 64] = *p++;
+
+        if (ctx->count % 64 == 0)
+        {
+            sha256_block (ctx);
+        }
+    }
+}
+
+void
+br_sha256_out (const br_sha256_context * ctx, void * out)
+{
+    br_sha256_context   c       = *ctx;
+    uint64_t            bits    = ctx->count * 8;
+    uint8_t             pad     = 0x80;
+    int                 i;
+
+    br_sha256_update (&c, &pad, 1);
+    pad = 0;
+
+    while (c.count % 64 != 56)
+    {
+        br_sha256_update (&c, &pad, 1);
+    }
+
+    for (i = 7; i >= 0; i--)
+    {
+        pad = bits >> (8 * i);
+        br_sha256_update (&c, &pad, 1);
+    }
+
+    for (i = 0; i < 32; i++)
+    {
+        ((uint8_t *) out)[i] = c.h[i / 4] >> (24 - 8 * (i % 4));
+    }
+}
@@ -0,0 +1,18 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * mock.h - control of the host mocks by the tests
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef MOCK_H
+#define MOCK_H
+
+#include <Arduino.h>
+
+#define MOCK_N_PINS                 17                                                  // GPIO0 - GPIO16
+
+extern uint8_t                      mock_pin_mode[MOCK_N_PINS];
+extern uint8_t                      mock_pin_level[MOCK_N_PINS];                        // level set by digitalWrite ()
+extern void                         (*mock_pin_changed) (uint8_t pin);                  // called after pinMode () and digitalWrite ()
+
+extern void                         mock_fs_reset (const char * dir);
+
+#endif // MOCK_H
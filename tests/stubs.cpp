@@ -0,0 +1,49 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * stubs.cpp - web server and metrics of the sketch for host tests of the flasher
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <Arduino.h>
+#include "http.h"
+#include "metrics.h"
+#include "stubs.h"
+
+String                              sResponse;
+std::string                         http_output;
+static HTTP_OUTPUT_FUNC             output_func;
+static void *                       output_ctx;
+
+void http_send (const char * s)     { sResponse += s; }
+void http_send_string (String s)    { sResponse += s; }
+
+void
+http_flush (void)
+{
+    if (output_func)
+    {
+        (*output_func) (output_ctx, (const uint8_t *) sResponse.c_str (), sResponse.length ());
+    }
+    else
+    {
+        http_output += sResponse.c_str ();
+    }
+    sResponse = "";
+}
+
+void
+http_redirect (HTTP_OUTPUT_FUNC func, void * ctx)
+{
+    sResponse   = "";
+    output_func = func;
+    output_ctx  = ctx;
+}
+
+void metrics_observe (uint8_t, unsigned long) { }
+void metrics_count (uint8_t, uint32_t) { }
+void console_drain (void) { }
+
+bool
+http_output_contains (const char * text)
+{
+    http_flush ();
+    return http_output.find (text) != std::string::npos;
+}
@@ -0,0 +1,14 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * stubs.h - web server and metrics of the sketch for host tests of the flasher: the HTML output is collected in http_output
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef STUBS_H
+#define STUBS_H
+
+#include <string>
+
+extern std::string                  http_output;                                        // flushed output of http_send ()
+
+extern bool                         http_output_contains (const char * text);
+
+#endif // STUBS_H
@@ -0,0 +1,199 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * test_farm.cpp - flash farm: emulated boards behind the UART mux and on software serial, sequential and interleaved
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "check.h"
+#include "mock.h"
+#include "stubs.h"
+#include "testboard.h"
+#include "eepromdata.h"
+#include "stm32flash.h"
+#include "stm32emu.h"
+#include "target.h"
+
+#define IMAGE_FNAME                 "/farm.hex"
+#define SEG1_ADDRESS                0x08000000
+#define SEG1_LEN                    3000
+#define SEG2_ADDRESS                0x08003000                                          // gap of several pages
+#define SEG2_LEN                    1000
+
+static std::string                  flash_expected;                                     // flash content after flashing the image
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * write the image in Intel HEX format, two segments
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+hex_record (File & f, uint8_t type, uint16_t address, const uint8_t * data, uint8_t len)
+{
+    char        buf[80];
+    uint8_t     sum = len + (address >> 8) + address + type;
+    int         pos;
+    int         i;
+
+    pos = sprintf (buf, ":%02X%04X%02X", len, address, type);
+
+    for (i = 0; i < len; i++)
+    {
+        pos += sprintf (buf + pos, "%02X", data[i]);
+        sum += data[i];
+    }
+
+    sprintf (buf + pos, "%02X\r\n", (uint8_t) -sum);
+    f.write ((const uint8_t *) buf, strlen (buf));
+}
+
+static void
+hex_segment (File & f, uint32_t address, uint32_t len, uint8_t seed)
+{
+    uint8_t     data[16];
+    uint8_t     upper[2] = { (uint8_t) (address >> 24), (uint8_t) (address >> 16) };
+    uint32_t    off;
+    uint8_t     n;
+    uint8_t     i;
+
+    hex_record (f, 0x04, 0, upper, 2);
+
+    for (off = 0; off < len; off += n)
+    {
+        n = len - off < 16 ? len - off : 16;
+
+        for (i = 0; i < n; i++)
+        {
+            data[i] = (uint8_t) ((off + i) * 7 + seed);
+            flash_expected[address - STM32EMU_FLASH_BASE + off + i] = data[i];
+        }
+
+        hex_record (f, 0x00, (address + off) & 0xFFFF, data, n);
+    }
+}
+
+static void
+write_image (void)
+{
+    File        f = LittleFS.open (IMAGE_FNAME, "w");
+
+    flash_expected.assign (STM32EMU_FLASH_SIZE, '\xFF');
+    hex_segment (f, SEG1_ADDRESS, SEG1_LEN, 3);
+    hex_segment (f, SEG2_ADDRESS, SEG2_LEN, 11);
+    hex_record (f, 0x01, 0, (const uint8_t *) 0, 0);
+    f.close ();
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * flash content of emulated device, missing bytes of a short file are erased
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static std::string
+flash_content (uint8_t idx)
+{
+    std::string content (STM32EMU_FLASH_SIZE, '\xFF');
+    File        f = LittleFS.open (stm32emu_flash_fname (idx), "r");
+
+    if (f)
+    {
+        f.read ((uint8_t *) &content[0], STM32EMU_FLASH_SIZE);
+    }
+    return content;
+}
+
+static void
+flash_clear (uint8_t idx)                                                               // programmed, must be erased before flashing
+{
+    std::string zero (STM32EMU_FLASH_SIZE, '\0');
+    File        f = LittleFS.open (stm32emu_flash_fname (idx), "w");
+
+    f.write ((const uint8_t *) zero.data (), zero.size ());
+}
+
+static void
+set_target (uint8_t idx, uint8_t kind, uint8_t rx_pin, uint8_t tx_pin, uint8_t reset_pin, uint8_t boot0_pin, uint8_t mux)
+{
+    eeprom_config.targets[idx] = { kind, rx_pin, tx_pin, reset_pin, boot0_pin, mux };
+}
+
+int
+main (void)
+{
+    static const TESTBOARD  mux_boards[] =
+    {   // mux  rx_pin              reset_pin   boot0_pin
+        {   1,  TESTBOARD_NO_PIN,   4,          5   },
+        {   2,  TESTBOARD_NO_PIN,   16,         2   },
+    };
+    static const TESTBOARD  soft_board[] =
+    {
+        {   0,  4,                  16,         2   },
+    };
+
+    mock_fs_reset ("fs_farm");
+    eeprom_read ();
+    write_image ();
+
+    // two boards behind the mux: each target is flashed through its channel, both are erased first and started afterwards
+
+    set_target (0, EEPROM_TARGET_UART, 0, 0, 4, 5, 1);
+    set_target (1, EEPROM_TARGET_UART, 0, 0, 16, 2, 2);
+    testboard_connect (mux_boards, 2);
+    stm32_flash_setup ();
+    CHECK (mock_pin_mode[TARGET_MUX_S0_PIN] == OUTPUT && mock_pin_mode[TARGET_MUX_S1_PIN] == OUTPUT);
+
+    flash_clear (0);
+    flash_clear (1);
+    stm32_farm_from_local (IMAGE_FNAME, SEG1_ADDRESS, 0x03, STM32_FARM_SEQUENTIAL);
+    CHECK (http_output_contains ("Target 0: UART, mux channel 0, RESET GPIO4, BOOT0 GPIO5: successful"));
+    CHECK (http_output_contains ("Target 1: UART, mux channel 1, RESET GPIO16, BOOT0 GPIO2: successful"));
+    CHECK (flash_content (0) == flash_expected);
+    CHECK (flash_content (1) == flash_expected);
+    CHECK (stm32emu_running (0) && stm32emu_running (1));
+
+    http_output.clear ();
+    flash_clear (0);
+    flash_clear (1);
+    stm32_farm_from_local (IMAGE_FNAME, SEG1_ADDRESS, 0x03, STM32_FARM_INTERLEAVED);
+    CHECK (http_output_contains ("Target 0: UART, mux channel 0, RESET GPIO4, BOOT0 GPIO5: successful"));
+    CHECK (http_output_contains ("Target 1: UART, mux channel 1, RESET GPIO16, BOOT0 GPIO2: successful"));
+    CHECK (flash_content (0) == flash_expected);
+    CHECK (flash_content (1) == flash_expected);
+    CHECK (stm32emu_running (0) && stm32emu_running (1));
+
+    // board on channel 1 missing: target 1 fails, target 0 is flashed anyway
+
+    http_output.clear ();
+    flash_clear (0);
+    flash_clear (1);
+    testboard_connect (mux_boards, 1);
+    stm32_farm_from_local (IMAGE_FNAME, SEG1_ADDRESS, 0x03, STM32_FARM_INTERLEAVED);
+    CHECK (http_output_contains ("Target 0: UART, mux channel 0, RESET GPIO4, BOOT0 GPIO5: successful"));
+    CHECK (http_output_contains ("Target 1: UART, mux channel 1, RESET GPIO16, BOOT0 GPIO2: failed"));
+    CHECK (flash_content (0) == flash_expected);
+    CHECK (flash_content (1) == std::string (STM32EMU_FLASH_SIZE, '\0'));
+
+    // target with a reserved GPIO is skipped and its pins are never driven
+
+    http_output.clear ();
+    set_target (1, EEPROM_TARGET_UART, 0, 0, 16, 0, 2);
+    memset (mock_pin_mode, INPUT, sizeof (mock_pin_mode));
+    testboard_connect (mux_boards, 2);
+    stm32_flash_setup ();
+    stm32_farm_from_local (IMAGE_FNAME, SEG1_ADDRESS, 0x03, STM32_FARM_SEQUENTIAL);
+    CHECK (http_output_contains ("Target 0: UART, mux channel 0, RESET GPIO4, BOOT0 GPIO5: successful"));
+    CHECK (! http_output_contains ("Target 1: UART"));
+    CHECK (mock_pin_mode[0] == INPUT);
+
+    // board on software serial: limited baud rate, flashed through its port, single target flash
+
+    http_output.clear ();
+    set_target (0, EEPROM_TARGET_SOFT, 4, 5, 16, 2, 0);
+    set_target (1, EEPROM_TARGET_NONE, 0, 0, 0, 0, 0);
+    testboard_connect (soft_board, 1);
+    stm32_flash_setup ();
+    flash_clear (0);
+    CHECK (stm32_flash_from_local (IMAGE_FNAME, SEG1_ADDRESS, 0) >= 0);
+    CHECK (testboard_soft_baud > 0 && testboard_soft_baud <= TARGET_SOFT_MAX_BAUD);
+    CHECK (flash_content (0) == flash_expected);
+    CHECK (! stm32emu_running (0));                                                     // stays in bootloader until reset or GO
+
+    return check_exit ("test_farm");
+}
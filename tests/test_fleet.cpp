@@ -0,0 +1,216 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * test_fleet.cpp - fleet update: background download across several fleet_loop () calls, hash check, flash when the UART is idle
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <ESP8266HTTPClient.h>
+#include <bearssl/bearssl_hash.h>
+#include "check.h"
+#include "mock.h"
+#include "stubs.h"
+#include "testboard.h"
+#include "eepromdata.h"
+#include "stm32flash.h"
+#include "stm32emu.h"
+#include "target.h"
+#include "arbiter.h"
+#include "fleet.h"
+
+#define MANIFEST_URL                "http://fleet.local/stm32/manifest.txt"
+#define IMAGE_URL                   "http://fleet.local/stm32/app.bin"
+#define IMAGE_LEN                   5000
+#define IMAGE_ADDRESS               0x08000000
+
+static std::string                  manifest;
+static std::shared_ptr<MockSocket>  image_sock;                                         // download of image, fed by the test
+static int                          image_size;                                         // Content-Length of image
+static int                          image_gets;
+
+static MockHttpResponse
+http_get (const std::string & url)
+{
+    std::shared_ptr<MockSocket> sock = std::make_shared<MockSocket> ();
+
+    if (url == MANIFEST_URL)
+    {
+        sock->to_server     = manifest;
+        sock->client_open   = false;
+        return { HTTP_CODE_OK, (int) manifest.size (), sock };
+    }
+
+    if (url == IMAGE_URL)
+    {
+        image_gets++;
+        image_sock = sock;
+        return { HTTP_CODE_OK, image_size, sock };
+    }
+
+    return { HTTP_CODE_NOT_FOUND, -1, sock };
+}
+
+static std::string
+make_manifest (const char * version, const std::string & image, uint32_t size)
+{
+    br_sha256_context   ctx;
+    uint8_t             sha256[32];
+    char                buf[256];
+    int                 pos;
+    int                 i;
+
+    br_sha256_init (&ctx);
+    br_sha256_update (&ctx, image.data (), image.size ());
+    br_sha256_out (&ctx, sha256);
+
+    pos = sprintf (buf, "image=app.bin\nversion=%s\nsize=%u\nbase=0x%08X\nsha256=", version, size, IMAGE_ADDRESS);
+
+    for (i = 0; i < 32; i++)
+    {
+        pos += sprintf (buf + pos, "%02x", sha256[i]);
+    }
+
+    strcpy (buf + pos, "\n");
+    return buf;
+}
+
+static std::string
+read_file (const String & fname)
+{
+    std::string content;
+    File        f = LittleFS.open (fname, "r");
+    int         ch;
+
+    while ((ch = f.read ()) >= 0)
+    {
+        content += (char) ch;
+    }
+    return content;
+}
+
+static bool
+status_contains (const char * text)
+{
+    return fleet_status ().indexOf (text) >= 0;
+}
+
+int
+main (void)
+{
+    static const TESTBOARD  board = { 0, TESTBOARD_NO_PIN, TARGET_DEFAULT_RESET_PIN, TARGET_DEFAULT_BOOT0_PIN };
+    std::string             image;
+    std::string             image2;
+    int                     calls;
+    int                     i;
+
+    mock_fs_reset ("fs_fleet");
+    eeprom_read ();                                                                     // target 0: built-in board on the UART
+    strcpy (eeprom_config.fleet_url, MANIFEST_URL);
+    testboard_connect (&board, 1);
+    stm32_flash_setup ();
+    mock_http_get = http_get;
+
+    for (i = 0; i < IMAGE_LEN; i++)
+    {
+        image += (char) (i * 31 + 7);
+    }
+
+    manifest    = make_manifest ("1.0", image, IMAGE_LEN);
+    image_size  = IMAGE_LEN;
+
+    // the download starts, loop () isn't blocked while no data arrives
+
+    fleet_request ();
+    fleet_loop ();
+    CHECK (image_gets == 1);
+    CHECK (status_contains ("Downloading version 1.0: 0 of 5000 bytes"));
+
+    for (i = 0; i < 10; i++)
+    {
+        fleet_loop ();
+    }
+
+    CHECK (status_contains ("0 of 5000 bytes"));
+
+    // each call stores only the data received meanwhile, max. HTTPCLIENT_POLL_BUFFERS chunks
+
+    image_sock->to_server += image.substr (0, 1500);
+    fleet_loop ();
+    CHECK (status_contains ("1500 of 5000 bytes"));
+    CHECK (read_file (stm32emu_flash_fname (0)).compare (0, IMAGE_LEN, image) != 0);
+
+    // complete image waits for idle UART
+
+    CHECK (arbiter_acquire (ARBITER_OWNER_REMOTE));
+    image_sock->to_server += image.substr (1500);
+
+    for (calls = 0; calls < 10 && status_contains (" bytes"); calls++)
+    {
+        fleet_loop ();
+    }
+
+    CHECK (calls == 2);
+    CHECK (status_contains ("Downloading version 1.0: downloaded, waiting for idle UART"));
+    CHECK (LittleFS.exists (FLEET_DIR "/app.bin"));
+
+    fleet_loop ();
+    CHECK (status_contains ("waiting for idle UART"));
+
+    arbiter_release (ARBITER_OWNER_REMOTE);
+    fleet_loop ();
+    CHECK (status_contains ("Updated to version 1.0"));
+    CHECK (read_file (stm32emu_flash_fname (0)).compare (0, IMAGE_LEN, image) == 0);
+    CHECK (stm32emu_running (0));
+    CHECK (! LittleFS.exists (FLEET_DIR "/app.bin"));                                   // flat image of last flash is kept instead
+    CHECK (read_file (FLEET_LOG_FNAME).find ("Updated to version 1.0") != std::string::npos);
+
+    // up to date: no download
+
+    fleet_request ();
+    fleet_loop ();
+    CHECK (status_contains ("Up to date, version 1.0"));
+    CHECK (image_gets == 1);
+
+    // new version with wrong hash is not flashed
+
+    image2          = image;
+    image2[100]    ^= 0x01;
+    manifest        = make_manifest ("2.0", image2, IMAGE_LEN);
+    fleet_request ();
+    fleet_loop ();
+    image_sock->to_server = image;
+
+    for (calls = 0; calls < 10 && status_contains (" bytes"); calls++)
+    {
+        fleet_loop ();
+    }
+
+    CHECK (status_contains ("Download failed: SHA-256 mismatch"));
+    CHECK (! LittleFS.exists (FLEET_TMP_FNAME));
+    CHECK (read_file (stm32emu_flash_fname (0)).compare (0, IMAGE_LEN, image) == 0);
+
+    // server closes connection early
+
+    manifest = make_manifest ("3.0", image2, IMAGE_LEN);
+    fleet_request ();
+    fleet_loop ();
+    image_sock->to_server   = image2.substr (0, 3000);
+    image_sock->client_open = false;
+
+    for (calls = 0; calls < 10 && status_contains (" bytes"); calls++)
+    {
+        fleet_loop ();
+    }
+
+    CHECK (status_contains ("Download failed: connection closed after 3000 of 5000 bytes"));
+
+    // image larger than free space isn't downloaded
+
+    manifest    = make_manifest ("4.0", image2, 4 * 1024 * 1024);
+    image_gets  = 0;
+    fleet_request ();
+    fleet_loop ();
+    CHECK (status_contains ("Download failed: not enough space in file system"));
+    CHECK (image_gets == 0);
+
+    return check_exit ("test_fleet");
+}
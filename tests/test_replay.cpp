@@ -0,0 +1,157 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * test_replay.cpp - session recording and replay: a session recorded with an emulated board is replayed without any board
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "check.h"
+#include "mock.h"
+#include "stubs.h"
+#include "testboard.h"
+#include "eepromdata.h"
+#include "stm32flash.h"
+#include "stm32emu.h"
+#include "target.h"
+#include "transport.h"
+
+#define IMAGE_FNAME                 "/app.bin"
+#define CHANGED_FNAME               "/changed.bin"
+#define CHANGED_REC_FNAME           "/changed.rec"
+#define IMAGE_ADDRESS               0x08000000
+#define IMAGE_LEN                   2500
+#define CHANGED_OFFSET              1500                                                // byte differing in changed image
+
+static void
+write_file (const char * fname, const std::string & content)
+{
+    File    f = LittleFS.open (fname, "w");
+
+    f.write ((const uint8_t *) content.data (), content.size ());
+}
+
+static std::string
+read_file (const String & fname)
+{
+    std::string content;
+    File        f = LittleFS.open (fname, "r");
+    int         ch;
+
+    while ((ch = f.read ()) >= 0)
+    {
+        content += (char) ch;
+    }
+    return content;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * bytes sent by the flasher in a recorded session
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static std::string
+session_tx (const char * fname)
+{
+    std::string         session = read_file (fname);
+    std::string         tx;
+    TRANSPORT_RECORD    hdr;
+    size_t              pos;
+
+    for (pos = 0; pos + sizeof (hdr) <= session.size (); pos += sizeof (hdr) + hdr.len)
+    {
+        memcpy (&hdr, session.data () + pos, sizeof (hdr));
+
+        if (hdr.dir == TRANSPORT_DIR_TX)
+        {
+            tx += session.substr (pos + sizeof (hdr), hdr.len);
+        }
+    }
+    return tx;
+}
+
+static int
+record (const char * image_fname)                                                       // flash with an erased board
+{
+    static const TESTBOARD  board = { 0, TESTBOARD_NO_PIN, TARGET_DEFAULT_RESET_PIN, TARGET_DEFAULT_BOOT0_PIN };
+    std::string             erased (STM32EMU_FLASH_SIZE, '\xFF');
+
+    write_file (stm32emu_flash_fname (0).c_str (), erased);
+    testboard_connect (&board, 1);
+    return stm32_flash_from_local (image_fname, IMAGE_ADDRESS, STM32_FLASH_FLAG_RECORD);
+}
+
+int
+main (void)
+{
+    std::string image;
+    std::string changed;
+    std::string flash;
+    std::string tx;
+    std::string changed_tx;
+    size_t      pos;
+    int         i;
+
+    mock_fs_reset ("fs_replay");
+    eeprom_read ();                                                                     // target 0: built-in board on the UART
+    stm32_flash_setup ();
+
+    for (i = 0; i < IMAGE_LEN; i++)
+    {
+        image += (char) (i * 13 + 5);
+    }
+
+    changed = image;
+    changed[CHANGED_OFFSET] ^= 0x5A;
+    write_file (IMAGE_FNAME, image);
+    write_file (CHANGED_FNAME, changed);
+
+    // record the session of the changed image for reference, then the one of the image
+
+    CHECK (record (CHANGED_FNAME) >= 0);
+    CHECK (LittleFS.rename (TRANSPORT_SESSION_FNAME, CHANGED_REC_FNAME));
+    http_output.clear ();
+    CHECK (record (IMAGE_FNAME) >= 0);
+    CHECK (http_output_contains ("Session recorded in " TRANSPORT_SESSION_FNAME));
+
+    tx          = session_tx (TRANSPORT_SESSION_FNAME);
+    changed_tx  = session_tx (CHANGED_REC_FNAME);
+    flash       = read_file (stm32emu_flash_fname (0));
+    CHECK (flash.compare (0, IMAGE_LEN, image) == 0);
+    CHECK (tx.size () > IMAGE_LEN && tx[0] == 0x7F);                                    // sync, commands, image data
+    CHECK (tx.size () == changed_tx.size () && tx != changed_tx);
+
+    // replay: no board is connected, the flash of the recorded board is left alone
+
+    write_file (stm32emu_flash_fname (0).c_str (), std::string (STM32EMU_FLASH_SIZE, '\0'));
+    testboard_connect ((const TESTBOARD *) 0, 0);
+
+    http_output.clear ();
+    stm32_replay_from_local (IMAGE_FNAME, IMAGE_ADDRESS, TRANSPORT_SESSION_FNAME, 0);
+    CHECK (http_output_contains ("mismatching: 0, beyond end of session: 0"));
+    CHECK (http_output_contains ("not replayed: 0"));
+    CHECK (http_output_contains ("Session replayed without divergence"));
+    CHECK (http_output_contains ((String ("Bytes sent: ") + (unsigned int) tx.size () + ",").c_str ()));
+
+    // the changed image diverges at the first byte which differs from the recorded session
+
+    for (pos = 0; pos < tx.size () && tx[pos] == changed_tx[pos]; pos++)
+    {
+    }
+
+    http_output.clear ();
+    stm32_replay_from_local (CHANGED_FNAME, IMAGE_ADDRESS, TRANSPORT_SESSION_FNAME, 0);
+    CHECK (http_output_contains ((String ("Session diverged at byte ") + (unsigned int) pos + " sent").c_str ()));
+    CHECK (read_file (stm32emu_flash_fname (0)) == std::string (STM32EMU_FLASH_SIZE, '\0'));
+
+    // replay of a session which ended early, and of a missing session
+
+    write_file ("/short.rec", read_file (TRANSPORT_SESSION_FNAME).substr (0, 200));
+    http_output.clear ();
+    stm32_replay_from_local (IMAGE_FNAME, IMAGE_ADDRESS, "/short.rec", 0);
+    CHECK (http_output_contains ("Session diverged at byte "));
+    CHECK (! http_output_contains ("without divergence"));
+
+    http_output.clear ();
+    stm32_replay_from_local (IMAGE_FNAME, IMAGE_ADDRESS, "/missing.rec", 0);
+    CHECK (http_output_contains ("Replay failed: cannot open /missing.rec"));
+
+    return check_exit ("test_replay");
+}
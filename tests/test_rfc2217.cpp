@@ -0,0 +1,152 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * test_rfc2217.cpp - RFC 2217 server: telnet option negotiation, COM-PORT-OPTION settings, IAC escaping in both directions
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include "check.h"
+#include "rfc2217.h"
+#include "arbiter.h"
+#include "eepromdata.h"
+
+#define IAC                         "\xFF"
+#define DONT                        "\xFE"
+#define DO                          "\xFD"
+#define WONT                        "\xFC"
+#define WILL                        "\xFB"
+#define SB                          "\xFA"
+#define SE                          "\xF0"
+#define COM_PORT                    "\x2C"
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * stubs of the flasher
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+EEPROM_CONFIG                       eeprom_config;
+static bool                         reset_active;
+static bool                         boot0_high;
+static int                          last_removed;
+
+void stm32_set_reset (bool active)  { reset_active = active; }
+void stm32_set_boot0 (bool high)    { boot0_high = high; }
+void image_last_remove (void)       { last_removed++; }
+void console_drain (void)           { }
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * send bytes of client, run server, return and clear its answer
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static std::string
+exchange (std::shared_ptr<MockSocket> sock, const std::string & out)
+{
+    std::string answer;
+    int         i;
+
+    sock->to_server += out;
+
+    for (i = 0; i < 4; i++)
+    {
+        rfc2217_loop ();
+    }
+
+    answer = sock->to_client;
+    sock->to_client.clear ();
+    return answer;
+}
+
+#define S(lit)                      std::string (lit, sizeof (lit) - 1)
+
+int
+main (void)
+{
+    std::shared_ptr<MockSocket> sock;
+    std::shared_ptr<MockSocket> second;
+
+    rfc2217_setup ();
+
+    // server proposes its options when a client connects
+
+    sock = WiFiServer::mock_connect (RFC2217_PORT);
+    CHECK_STR (exchange (sock, ""), S(IAC WILL "\x00" IAC DO "\x00" IAC WILL "\x03" IAC DO COM_PORT));
+    CHECK (arbiter_owner () == ARBITER_OWNER_REMOTE);
+    CHECK (last_removed == 1);
+
+    // negotiation: enabled options are not acknowledged again, unknown options are refused, the server doesn't offer COM-PORT
+
+    CHECK_STR (exchange (sock, S(IAC WILL COM_PORT IAC DO "\x00" IAC WILL "\x00" IAC DO "\x03")), "");
+    CHECK_STR (exchange (sock, S(IAC WILL "\x18")), S(IAC DONT "\x18"));
+    CHECK_STR (exchange (sock, S(IAC DO "\x01")), S(IAC WONT "\x01"));
+    CHECK_STR (exchange (sock, S(IAC DO COM_PORT)), S(IAC WONT COM_PORT));
+    CHECK_STR (exchange (sock, S(IAC WONT "\x03" IAC WILL "\x03")), S(IAC DO "\x03"));
+
+    // baud rate: set, request (value 0), value containing IAC
+
+    CHECK_STR (exchange (sock, S(IAC SB COM_PORT "\x01" "\x00\x00\xE1\x00" IAC SE)), S(IAC SB COM_PORT "\x65" "\x00\x00\xE1\x00" IAC SE));
+    CHECK (Serial.baud == 57600);
+    CHECK_STR (exchange (sock, S(IAC SB COM_PORT "\x01" "\x00\x00\x00\x00" IAC SE)), S(IAC SB COM_PORT "\x65" "\x00\x00\xE1\x00" IAC SE));
+    CHECK (Serial.baud == 57600);
+    CHECK_STR (exchange (sock, S(IAC SB COM_PORT "\x01" "\x00\x00" IAC IAC IAC IAC IAC SE)),
+               S(IAC SB COM_PORT "\x65" "\x00\x00" IAC IAC IAC IAC IAC SE));
+    CHECK (Serial.baud == 0xFFFF);
+
+    // data size, parity, stop size
+
+    CHECK_STR (exchange (sock, S(IAC SB COM_PORT "\x03" "\x01" IAC SE)), S(IAC SB COM_PORT "\x67" "\x01" IAC SE));
+    CHECK (Serial.config == (UART_NB_BIT_8 | UART_PARITY_NONE | UART_NB_STOP_BIT_1));
+    CHECK_STR (exchange (sock, S(IAC SB COM_PORT "\x03" "\x02" IAC SE)), S(IAC SB COM_PORT "\x67" "\x02" IAC SE));
+    CHECK (Serial.config == (UART_NB_BIT_8 | UART_PARITY_ODD | UART_NB_STOP_BIT_1));
+    CHECK_STR (exchange (sock, S(IAC SB COM_PORT "\x03" "\x04" IAC SE)), S(IAC SB COM_PORT "\x67" "\x02" IAC SE));  // mark: refused
+    CHECK_STR (exchange (sock, S(IAC SB COM_PORT "\x02" "\x07" IAC SE IAC SB COM_PORT "\x04" "\x02" IAC SE)),
+               S(IAC SB COM_PORT "\x66" "\x07" IAC SE IAC SB COM_PORT "\x68" "\x02" IAC SE));
+    CHECK (Serial.config == (UART_NB_BIT_7 | UART_PARITY_ODD | UART_NB_STOP_BIT_2));
+    CHECK (Serial.baud == 0xFFFF);
+
+    // DTR drives RESET, RTS drives BOOT0
+
+    CHECK_STR (exchange (sock, S(IAC SB COM_PORT "\x05" "\x08" IAC SE IAC SB COM_PORT "\x05" "\x0B" IAC SE)),
+               S(IAC SB COM_PORT "\x69" "\x08" IAC SE IAC SB COM_PORT "\x69" "\x0B" IAC SE));
+    CHECK (reset_active && boot0_high);
+    CHECK_STR (exchange (sock, S(IAC SB COM_PORT "\x05" "\x09" IAC SE IAC SB COM_PORT "\x05" "\x07" IAC SE)),
+               S(IAC SB COM_PORT "\x69" "\x09" IAC SE IAC SB COM_PORT "\x69" "\x09" IAC SE));
+    CHECK (! reset_active && boot0_high);
+
+    // data: IAC is escaped in both directions, commands between data bytes are removed
+
+    Serial.tx.clear ();
+    CHECK_STR (exchange (sock, S("a" IAC IAC "b" IAC "\xF1" "c")), "");                                         // IAC NOP
+    CHECK_STR (Serial.tx, S("a\xFF" "bc"));
+    Serial.rx = S("x\xFFy\xFF");
+    CHECK_STR (exchange (sock, ""), S("x" IAC IAC "y" IAC IAC));
+
+    // FLOWCONTROL-SUSPEND stops output to the client until FLOWCONTROL-RESUME
+
+    CHECK_STR (exchange (sock, S(IAC SB COM_PORT "\x08" IAC SE)), S(IAC SB COM_PORT "\x6C" IAC SE));
+    Serial.rx = "z";
+    CHECK_STR (exchange (sock, ""), "");
+    CHECK_STR (exchange (sock, S(IAC SB COM_PORT "\x09" IAC SE)), S(IAC SB COM_PORT "\x6D" IAC SE "z"));
+
+    // a second client is refused while the first one is connected
+
+    second = WiFiServer::mock_connect (RFC2217_PORT);
+    exchange (sock, "");
+    CHECK (! second->server_open);
+
+    // disconnect: RESET and BOOT0 are released, UART settings are restored
+
+    sock->client_open = false;
+    exchange (sock, "");
+    CHECK (! sock->server_open);
+    CHECK (! reset_active && ! boot0_high);
+    CHECK (Serial.baud == ARBITER_DEFAULT_BAUD && Serial.config == ARBITER_DEFAULT_CONFIG && Serial.swapped);
+    CHECK (arbiter_owner () == ARBITER_OWNER_CONSOLE);
+
+    // a client is refused while the flasher owns the UART
+
+    arbiter_acquire (ARBITER_OWNER_FLASHER);
+    second = WiFiServer::mock_connect (RFC2217_PORT);
+    CHECK_STR (exchange (second, ""), "UART in use by flasher\r\n");
+    CHECK (! second->server_open);
+    CHECK (last_removed == 1);
+
+    return check_exit ("test_rfc2217");
+}
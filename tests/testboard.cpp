@@ -0,0 +1,161 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * testboard.cpp - emulated STM32 boards wired to the flasher
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#include <Arduino.h>
+#include <SoftwareSerial.h>
+#include "mock.h"
+#include "testboard.h"
+#include "stm32emu.h"
+#include "target.h"
+
+static TESTBOARD                    boards[TESTBOARD_MAX];
+static uint8_t                      n_boards;
+static bool                         reset_active[TESTBOARD_MAX];
+static int                          emu_selected = -1;                                  // device selected by the boards
+
+uint32_t                            testboard_soft_baud;
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * port of a board: selects its emulated device when the flasher talks to another board than before
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+class BoardPort : public Stream
+{
+    public:
+        int                         idx;                                                // board, -1: nothing connected
+
+        BoardPort () : idx (-1) {}
+
+        void select ()
+        {
+            if (idx != emu_selected)
+            {
+                stm32emu_select (idx);                                                  // only between commands, see stm32emu.h
+                emu_selected = idx;
+            }
+        }
+
+        int available () override                                   { return idx < 0 || idx != emu_selected ? 0 : transport_stm32emu.available (); }
+        int read () override                                        { return available () ? transport_stm32emu.read () : -1; }
+        int peek () override                                        { return -1; }
+        size_t write (uint8_t ch) override                          { return write (&ch, 1); }
+        size_t write (const uint8_t * buf, size_t len) override
+        {
+            if (idx >= 0)
+            {
+                select ();
+                transport_stm32emu.write (buf, len);
+            }
+            return len;
+        }
+        using Print::write;
+};
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * UART: routed to the board on the selected mux channel
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+class UartBus : public Stream
+{
+    public:
+        BoardPort                   port;
+
+        Stream * route ()
+        {
+            uint8_t channel = (mock_pin_level[TARGET_MUX_S0_PIN] ? 1 : 0) | (mock_pin_level[TARGET_MUX_S1_PIN] ? 2 : 0);
+            uint8_t idx;
+
+            port.idx = -1;
+
+            for (idx = 0; idx < n_boards; idx++)
+            {
+                if (boards[idx].rx_pin == TESTBOARD_NO_PIN && (boards[idx].mux == 0 || boards[idx].mux == channel + 1))
+                {
+                    port.idx = idx;
+                    break;
+                }
+            }
+            return &port;
+        }
+
+        int available () override                                   { return route ()->available (); }
+        int read () override                                        { return route ()->read (); }
+        int peek () override                                        { return -1; }
+        size_t write (uint8_t ch) override                          { return write (&ch, 1); }
+        size_t write (const uint8_t * buf, size_t len) override     { return route ()->write (buf, len); }
+        using Print::write;
+};
+
+static UartBus                      uart_bus;
+static BoardPort                    soft_ports[TESTBOARD_MAX];
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * SoftwareSerial begin (): port of the board on rx_pin
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static Stream *
+soft_serial_connect (int8_t rx_pin, int8_t, uint32_t baud)
+{
+    uint8_t idx;
+
+    testboard_soft_baud = baud;
+
+    for (idx = 0; idx < n_boards; idx++)
+    {
+        if (boards[idx].rx_pin == (uint8_t) rx_pin)
+        {
+            soft_ports[idx].idx = idx;
+            return &soft_ports[idx];
+        }
+    }
+    return (Stream *) 0;
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * GPIO changed: restart devices whose RESET is released
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+static void
+pin_changed (uint8_t)
+{
+    uint8_t idx;
+    bool    active;
+    bool    boot0;
+
+    for (idx = 0; idx < n_boards; idx++)
+    {
+        active = mock_pin_mode[boards[idx].reset_pin] == OUTPUT && mock_pin_level[boards[idx].reset_pin] == LOW;
+
+        if (reset_active[idx] && ! active)
+        {
+            boot0 = mock_pin_mode[boards[idx].boot0_pin] == OUTPUT && mock_pin_level[boards[idx].boot0_pin] == HIGH;
+            stm32emu_reset (idx, boot0);
+        }
+        reset_active[idx] = active;
+    }
+}
+
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * testboard_connect () - wire boards to the flasher, replaces the previous boards
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+void
+testboard_connect (const TESTBOARD * b, uint8_t n)
+{
+    uint8_t idx;
+
+    n_boards = n < TESTBOARD_MAX ? n : TESTBOARD_MAX;
+
+    for (idx = 0; idx < n_boards; idx++)
+    {
+        boards[idx]         = b[idx];
+        reset_active[idx]   = false;
+        stm32emu_reset (idx, false);
+    }
+
+    emu_selected        = -1;
+    Serial.peer         = &uart_bus;
+    mock_pin_changed    = pin_changed;
+    mock_soft_serial_connect = soft_serial_connect;
+}
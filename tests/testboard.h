@@ -0,0 +1,30 @@
+/*----------------------------------------------------------------------------------------------------------------------------------------
+ * testboard.h - emulated STM32 boards wired to the flasher: board n is emulated device n, see stm32emu.h
+ *
+ * A board is reached through the swapped UART if the mux select pins GPIO12/GPIO14 select its channel (mux = channel + 1),
+ * a board without mux and without rx_pin is wired directly to the UART. A board with rx_pin is reached through the
+ * SoftwareSerial port on this pin. Releasing RESET restarts the device, it starts the bootloader if BOOT0 is driven high.
+ * Targets of kind EEPROM_TARGET_EMULATED select the emulator without the boards, don't mix them with boards.
+ *----------------------------------------------------------------------------------------------------------------------------------------
+ */
+#ifndef TESTBOARD_H
+#define TESTBOARD_H
+
+#include <Arduino.h>
+
+#define TESTBOARD_MAX               4                                                   // STM32EMU_MAX
+#define TESTBOARD_NO_PIN            0xFF
+
+typedef struct
+{
+    uint8_t                         mux;                                                // 0: no mux, else mux channel + 1
+    uint8_t                         rx_pin;                                             // software serial: RX GPIO of flasher
+    uint8_t                         reset_pin;
+    uint8_t                         boot0_pin;
+} TESTBOARD;
+
+extern uint32_t                     testboard_soft_baud;                                // baud rate of last SoftwareSerial begin ()
+
+extern void                         testboard_connect (const TESTBOARD * boards, uint8_t n);
+
+#endif // TESTBOARD_H
@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+#----------------------------------------------------------------------------------------------------------------------------------------
+# fleetserver.py - serve an image and its manifest for the fleet update of STM32 OTA Flasher
+#
+# usage: fleetserver.py image version [port] [base_address]
+#
+# Writes manifest.txt (image, version, sha256, size, base) into the directory of the image and serves this directory by HTTP,
+# default port 8000. Set the manifest URL of the flashers to http://<host>:<port>/manifest.txt. Run the script again with a new
+# image or version to roll out an update, the flashers pick it up at their next check.
+#----------------------------------------------------------------------------------------------------------------------------------------
+# MIT License
+#
+# Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+#----------------------------------------------------------------------------------------------------------------------------------------
+import functools
+import hashlib
+import http.server
+import os
+import sys
+
+def write_manifest (image, version, base_address):
+    data = open (image, 'rb').read ()
+    path = os.path.join (os.path.dirname (os.path.abspath (image)), 'manifest.txt')
+
+    with open (path, 'w') as f:
+        f.write ('image=%s\n' % os.path.basename (image))
+        f.write ('version=%s\n' % version)
+        f.write ('sha256=%s\n' % hashlib.sha256 (data).hexdigest ())
+        f.write ('size=%d\n' % len (data))
+        f.write ('base=0x%08X\n' % base_address)
+
+    print ('%s: %s version %s, %d bytes' % (path, os.path.basename (image), version, len (data)))
+    return os.path.dirname (path)
+
+if __name__ == '__main__':
+    if len (sys.argv) < 3:
+        sys.exit ('usage: fleetserver.py image version [port] [base_address]')
+
+    port    = int (sys.argv[3]) if len (sys.argv) > 3 else 8000
+    base    = int (sys.argv[4], 0) if len (sys.argv) > 4 else 0x08000000
+    root    = write_manifest (sys.argv[1], sys.argv[2], base)
+    handler = functools.partial (http.server.SimpleHTTPRequestHandler, directory = root)
+
+    http.server.ThreadingHTTPServer (('', port), handler).serve_forever ()
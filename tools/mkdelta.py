@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+#----------------------------------------------------------------------------------------------------------------------------------------
+# mkdelta.py - create delta patch (.dlt) for STM32 OTA Flasher
+#
+# usage: mkdelta.py old.bin new.bin patch.dlt [base_address]
+#
+# old.bin must be the flat binary of the last flashed image, e.g. "objcopy -O binary firmware.elf old.bin".
+# The patch can only be flashed if the flasher's last flashed image has the same SHA-256 as old.bin.
+#----------------------------------------------------------------------------------------------------------------------------------------
+# MIT License
+#
+# Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+#----------------------------------------------------------------------------------------------------------------------------------------
+import hashlib
+import struct
+import sys
+
+BLOCK       = 32                                    # min. length of a COPY op
+OP_END      = 0x00
+OP_COPY     = 0x01
+OP_DATA     = 0x02
+
+def make_delta (old, new, base_address):
+    index = {}
+
+    for pos in range (0, len (old) - BLOCK + 1, BLOCK):
+        index.setdefault (old[pos:pos + BLOCK], pos)
+
+    ops     = bytearray ()
+    literal = bytearray ()
+    i       = 0
+
+    def flush_literal ():
+        if literal:
+            ops.extend (struct.pack ('<BI', OP_DATA, len (literal)) + literal)
+            literal.clear ()
+
+    while i < len (new):
+        block = new[i:i + BLOCK]
+        src   = -1
+
+        if len (block) == BLOCK:
+            if old[i:i + BLOCK] == block:           # unchanged code stays at the same offset most of the time
+                src = i
+            else:
+                src = index.get (block, -1)
+
+        if src < 0:
+            literal.append (new[i])
+            i += 1
+            continue
+
+        n = BLOCK
+
+        while i + n < len (new) and src + n < len (old) and new[i + n] == old[src + n]:
+            n += 1
+
+        flush_literal ()
+        ops.extend (struct.pack ('<BII', OP_COPY, src, n))
+        i += n
+
+    flush_literal ()
+    ops.append (OP_END)
+
+    header = b'STMD' + bytes ([1, 0, 0, 0]) + hashlib.sha256 (old).digest () + \
+             struct.pack ('<II', base_address, len (new)) + hashlib.sha256 (new).digest ()
+    return header + bytes (ops)
+
+if __name__ == '__main__':
+    if len (sys.argv) < 4:
+        sys.exit ('usage: mkdelta.py old.bin new.bin patch.dlt [base_address]')
+
+    old  = open (sys.argv[1], 'rb').read ()
+    new  = open (sys.argv[2], 'rb').read ()
+    base = int (sys.argv[4], 0) if len (sys.argv) > 4 else 0x08000000
+
+    patch = make_delta (old, new, base)
+    open (sys.argv[3], 'wb').write (patch)
+    print ('%s: %d bytes (new image: %d bytes)' % (sys.argv[3], len (patch), len (new)))
@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+#----------------------------------------------------------------------------------------------------------------------------------------
+# stm32trace.py - decode bootloader trace (trace.bin) downloaded from STM32 OTA Flasher
+#
+# usage: stm32trace.py trace.bin [slow_usec]
+#
+# Prints one line per bootloader response and a summary per command. Responses other than ACK and responses slower than
+# slow_usec (default 100000) are marked with '!'. The latency includes the transmission of the request at 115200 Bd.
+#----------------------------------------------------------------------------------------------------------------------------------------
+# MIT License
+#
+# Copyright (c) 2022 Frank Meyer (frank@uclock.de)
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+#----------------------------------------------------------------------------------------------------------------------------------------
+import struct
+import sys
+
+HEADER      = struct.Struct ('<IBBHIII')
+RECORD      = struct.Struct ('<IIIIHBB')
+MAGIC       = 0x43525453                            # "STRC"
+TIMEOUT     = 0xFFFF
+ACK         = 0x79
+NACK        = 0x1F
+
+COMMANDS    = {
+    0x00: 'GET',            0x01: 'GET VERSION',    0x02: 'GET ID',         0x11: 'READ MEMORY',
+    0x21: 'GO',             0x31: 'WRITE MEMORY',   0x43: 'ERASE',          0x44: 'EXT ERASE',
+    0x63: 'WRITE PROTECT',  0x73: 'WRITE UNPROT',   0x82: 'READOUT PROT',   0x92: 'READOUT UNPROT',
+    0xA1: 'GET CHECKSUM',   0x7F: 'SYNC',
+}
+
+def response_name (response):
+    if response == TIMEOUT:
+        return 'TIMEOUT'
+    if response == ACK:
+        return 'ACK'
+    if response == NACK:
+        return 'NACK'
+    return '0x%02X' % response
+
+def decode (data, slow_usec):
+    if len (data) < HEADER.size:
+        sys.exit ('file too short')
+
+    magic, version, record_size, _, n_records, n_lost, _ = HEADER.unpack_from (data, 0)
+
+    if magic != MAGIC or version != 1 or record_size != RECORD.size:
+        sys.exit ('no trace file or unsupported version')
+
+    if len (data) < HEADER.size + n_records * RECORD.size:
+        sys.exit ('file truncated')
+
+    print ('%d records, %d older records lost' % (n_records, n_lost))
+    print ('%12s %-14s %5s %10s %8s %-8s %10s' % ('time [ms]', 'command', 'stage', 'address', 'len', 'response', 'latency'))
+
+    stats = {}
+    t0    = None
+
+    for i in range (n_records):
+        time, latency, address, length, response, cmd, stage = RECORD.unpack_from (data, HEADER.size + i * RECORD.size)
+
+        if t0 is None:
+            t0 = time
+
+        name = COMMANDS.get (cmd, '0x%02X' % cmd)
+        bad  = response != ACK or latency > slow_usec
+
+        print ('%12.3f %-14s %5d %10s %8s %-8s %10d%s' % (((time - t0) & 0xFFFFFFFF) / 1000.0, name, stage,
+               '0x%08X' % address if address else '', length if length else '', response_name (response), latency, ' !' if bad else ''))
+
+        s = stats.setdefault (name, [0, 0, 0, 0, 0xFFFFFFFF, 0])   # count, nacks, timeouts, sum, min, max
+        s[0] += 1
+        s[1] += response == NACK
+        s[2] += response == TIMEOUT
+        s[3] += latency
+        s[4]  = min (s[4], latency)
+        s[5]  = max (s[5], latency)
+
+    print ()
+    print ('%-14s %8s %6s %8s %10s %10s %10s' % ('command', 'count', 'NACKs', 'timeouts', 'min [us]', 'avg [us]', 'max [us]'))
+
+    for name, s in sorted (stats.items ()):
+        print ('%-14s %8d %6d %8d %10d %10d %10d' % (name, s[0], s[1], s[2], s[4], s[3] // s[0], s[5]))
+
+if __name__ == '__main__':
+    if len (sys.argv) < 2:
+        sys.exit ('usage: stm32trace.py trace.bin [slow_usec]')
+
+    decode (open (sys.argv[1], 'rb').read (), int (sys.argv[2]) if len (sys.argv) > 2 else 100000)